@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/AST/Cancellation.h"
+
+#include <algorithm>
+
+namespace rellic {
+
+constexpr int64_t CancellationToken::kNoDeadline;
+
+void CancellationToken::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex);
+  cancelled = true;
+  for (auto ctx : contexts) {
+    ctx->interrupt();
+  }
+}
+
+void CancellationToken::SetTimeout(unsigned ms) {
+  if (!ms) {
+    deadline = kNoDeadline;
+    return;
+  }
+  auto time{Clock::now() + std::chrono::milliseconds(ms)};
+  deadline = time.time_since_epoch().count();
+}
+
+void CancellationToken::Reset() {
+  cancelled = false;
+  deadline = kNoDeadline;
+}
+
+bool CancellationToken::IsCancelled() const {
+  if (cancelled) {
+    return true;
+  }
+  auto time{deadline.load()};
+  return time != kNoDeadline && Clock::now().time_since_epoch().count() >= time;
+}
+
+unsigned CancellationToken::GetTimeLeft() const {
+  auto time{deadline.load()};
+  if (time == kNoDeadline) {
+    return 0;
+  }
+  auto left{Clock::duration(time) - Clock::now().time_since_epoch()};
+  auto ms{std::chrono::duration_cast<std::chrono::milliseconds>(left).count()};
+  return static_cast<unsigned>(
+      std::min<int64_t>(std::max<int64_t>(ms, 1), UINT32_MAX));
+}
+
+CancellationToken::Guard::Guard(CancellationToken *token, z3::context &ctx)
+    : token(token), ctx(ctx) {
+  if (!token) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(token->mutex);
+  token->contexts.push_back(&ctx);
+}
+
+CancellationToken::Guard::~Guard() {
+  if (!token) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(token->mutex);
+  auto &contexts{token->contexts};
+  contexts.erase(std::find(contexts.begin(), contexts.end(), &ctx));
+}
+
+}  // namespace rellic
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <z3++.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace rellic {
+
+// Lets decompilations be stopped from another thread, or once a deadline
+// passes. Work is stopped cooperatively: pipelines check the token
+// between passes, stages and functions, and hand out what they refined
+// so far. Z3 queries end by the deadline, and queries that are running
+// when the token is cancelled are interrupted.
+class CancellationToken {
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::atomic<bool> cancelled{false};
+  // Deadline in ticks of `Clock`, or `kNoDeadline`
+  std::atomic<int64_t> deadline;
+  static constexpr int64_t kNoDeadline{INT64_MAX};
+
+  // Contexts that are running queries
+  std::mutex mutex;
+  std::vector<z3::context *> contexts;
+
+ public:
+  CancellationToken() : deadline(kNoDeadline) {}
+
+  // Cancels the token and interrupts the queries that are running
+  void Cancel();
+  // Sets a deadline `ms` milliseconds from now, or removes it if `ms` is 0
+  void SetTimeout(unsigned ms);
+  // Makes the token usable for another decompilation
+  void Reset();
+
+  // Returns `true` if the token was cancelled or its deadline passed
+  bool IsCancelled() const;
+  // Milliseconds left until the deadline, at least 1, or 0 if there is
+  // no deadline
+  unsigned GetTimeLeft() const;
+
+  // Interrupts the queries in `ctx` if `token`, which may be `nullptr`, is
+  // cancelled while the guard exists. Z3 only interrupts queries that are
+  // running, so `IsCancelled` has to be checked after the guard is created
+  // and before a query starts.
+  class Guard {
+   private:
+    CancellationToken *token;
+    z3::context &ctx;
+
+   public:
+    Guard(CancellationToken *token, z3::context &ctx);
+    ~Guard();
+  };
+};
+
+}  // namespace rellic
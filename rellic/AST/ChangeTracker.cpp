@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/ChangeTracker.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "rellic/AST/StmtHash.h"
+
+namespace rellic {
+
+namespace {
+
+static thread_local ChangeTracker *current_tracker{nullptr};
+
+static uint64_t HashBody(clang::FunctionDecl *fdecl) {
+  StmtHasher hasher;
+  return hasher.Hash(fdecl->getBody());
+}
+
+// Orders reports by function name, independently of allocation order
+static ChangeTracker::FunctionChanges Sorted(
+    ChangeTracker::FunctionChanges changes) {
+  std::sort(changes.begin(), changes.end(), [](auto &lhs, auto &rhs) {
+    return lhs.first->getName() < rhs.first->getName();
+  });
+  return changes;
+}
+
+}  // namespace
+
+ChangeTracker::ChangeTracker(clang::ASTContext &ctx)
+    : ast_ctx(ctx), prev(current_tracker), first_round(true) {
+  current_tracker = this;
+}
+
+ChangeTracker::ChangeTracker(clang::ASTContext &ctx,
+                             const std::vector<clang::FunctionDecl *> &fdecls)
+    : ChangeTracker(ctx) {
+  first_round = false;
+  for (auto fdecl : fdecls) {
+    dirty[fdecl];
+  }
+}
+
+ChangeTracker::~ChangeTracker() {
+  CHECK_EQ(current_tracker, this) << "Trackers must be destroyed in order";
+  current_tracker = prev;
+}
+
+ChangeTracker *ChangeTracker::Get(clang::ASTContext &ctx) {
+  for (auto tracker = current_tracker; tracker; tracker = tracker->prev) {
+    if (&tracker->ast_ctx == &ctx) {
+      return tracker;
+    }
+  }
+  return nullptr;
+}
+
+ChangeTracker::FunctionChanges ChangeTracker::NextRound() {
+  FunctionChanges oscillating;
+  for (auto iter = changed.begin(); iter != changed.end();) {
+    // A body that was seen before will keep on repeating. Hash collisions
+    // only stop the refinement of a function early.
+    if (!history[iter->first].insert(HashBody(iter->first)).second) {
+      oscillating.emplace_back(iter->first, std::move(iter->second));
+      iter = changed.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  first_round = false;
+  dirty.swap(changed);
+  changed.clear();
+  DLOG(INFO) << dirty.size() << " functions are dirty";
+  return Sorted(std::move(oscillating));
+}
+
+ChangeTracker::FunctionChanges ChangeTracker::GetDirty() const {
+  return Sorted(FunctionChanges(dirty.begin(), dirty.end()));
+}
+
+}  // namespace rellic
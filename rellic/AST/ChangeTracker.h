@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace rellic {
+
+// Records which function definitions the passes of a fixpoint stage
+// changed, so that later rounds only visit functions that may still
+// change. A function that no pass changed during a round is converged.
+//
+// While a tracker exists, `TransformVisitor` passes on the same thread
+// and context skip functions that are not dirty. Every function is dirty
+// during the first round.
+//
+// A function whose body returns to a state it had after an earlier round
+// is oscillating between rewrites that undo each other. It is not dirty
+// anymore, so that the stage can still converge.
+class ChangeTracker {
+ public:
+  // Names of the passes that changed a function
+  using PassNames = std::set<std::string>;
+  using FunctionChanges =
+      std::vector<std::pair<clang::FunctionDecl *, PassNames>>;
+
+ private:
+  clang::ASTContext &ast_ctx;
+  // Enclosing tracker of the current thread
+  ChangeTracker *prev;
+
+  bool first_round;
+  std::string current_pass;
+  std::unordered_map<clang::FunctionDecl *, PassNames> dirty;
+  std::unordered_map<clang::FunctionDecl *, PassNames> changed;
+  // Hashes of the bodies that functions had after earlier rounds
+  std::unordered_map<clang::FunctionDecl *, std::unordered_set<uint64_t>>
+      history;
+
+ public:
+  ChangeTracker(clang::ASTContext &ctx);
+  // Tracker whose first round only visits `fdecls`
+  ChangeTracker(clang::ASTContext &ctx,
+                const std::vector<clang::FunctionDecl *> &fdecls);
+  ~ChangeTracker();
+
+  // Returns the innermost tracker of `ctx` on the current thread
+  static ChangeTracker *Get(clang::ASTContext &ctx);
+
+  bool IsDirty(clang::FunctionDecl *fdecl) const {
+    return first_round || dirty.count(fdecl);
+  }
+
+  // Sets the name of the pass that subsequent changes are attributed to
+  void SetPass(llvm::StringRef pass) { current_pass = pass.str(); }
+
+  void MarkChanged(clang::FunctionDecl *fdecl) {
+    changed[fdecl].insert(current_pass);
+  }
+
+  // Starts a new round in which only the functions changed during the
+  // current round are dirty. Returns the functions that started to
+  // oscillate, and the passes that changed them.
+  FunctionChanges NextRound();
+
+  bool HasDirty() const { return first_round || !dirty.empty(); }
+
+  // Returns the dirty functions, and the passes that changed them during
+  // the previous round
+  FunctionChanges GetDirty() const;
+};
+
+}  // namespace rellic
@@ -0,0 +1,989 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Checkpoint.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringMap.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/Compat/ASTContext.h"
+#include "rellic/AST/Compat/Expr.h"
+#include "rellic/AST/Compat/Stmt.h"
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static const char kMagic[] = {'R', 'L', 'C', 'K'};
+static constexpr unsigned kVersion = 1;
+
+// One past the last `clang::CastKind`
+static constexpr unsigned kNumCastKinds = 0
+#define CAST_OPERATION(Name) +1
+#include <clang/AST/OperationKinds.def>
+    ;
+
+enum TypeTag : unsigned {
+  kBuiltinType,
+  kPointerType,
+  kConstantArrayType,
+  kIncompleteArrayType,
+  kRecordType,
+  kFunctionProtoType,
+  kFunctionNoProtoType,
+  kQualifiedType,
+};
+
+enum NodeTag : unsigned {
+  kCompoundStmt,
+  kIfStmt,
+  kWhileStmt,
+  kDoStmt,
+  kBreakStmt,
+  kReturnStmt,
+  kDeclStmt,
+  kDeclRefExpr,
+  kIntegerLiteral,
+  kCharacterLiteral,
+  kFloatingLiteral,
+  kStringLiteral,
+  kParenExpr,
+  kUnaryOperator,
+  kBinaryOperator,
+  kImplicitCastExpr,
+  kCStyleCastExpr,
+  kCallExpr,
+  kMemberExpr,
+  kArraySubscriptExpr,
+  kConditionalOperator,
+  kInitListExpr,
+  // Marks a missing optional child
+  kNone,
+};
+
+// How a DeclRefExpr refers to its declaration
+enum DeclTag : unsigned {
+  kParamDecl,
+  kLocalDecl,
+  kGlobalDecl,
+};
+
+// Builtin types by their position in this list. Unlike builtin type
+// kinds, positions don't change between clang versions.
+static std::vector<clang::QualType> GetBuiltinTypes(clang::ASTContext &ctx) {
+  return {ctx.VoidTy, ctx.BoolTy, ctx.CharTy, ctx.SignedCharTy,
+          ctx.UnsignedCharTy, ctx.ShortTy, ctx.UnsignedShortTy, ctx.IntTy,
+          ctx.UnsignedIntTy, ctx.LongTy, ctx.UnsignedLongTy, ctx.LongLongTy,
+          ctx.UnsignedLongLongTy, ctx.Int128Ty, ctx.UnsignedInt128Ty,
+          ctx.HalfTy, ctx.FloatTy, ctx.DoubleTy, ctx.LongDoubleTy, ctx.WCharTy};
+}
+
+// Structures, globals and functions of the translation unit by name
+struct DeclIndex {
+  llvm::StringMap<clang::RecordDecl *> records;
+  llvm::StringMap<clang::ValueDecl *> values;
+
+  explicit DeclIndex(clang::ASTContext &ctx) {
+    for (auto decl : ctx.getTranslationUnitDecl()->decls()) {
+      auto named{clang::dyn_cast<clang::NamedDecl>(decl)};
+      if (!named || named->getName().empty()) {
+        continue;
+      }
+      if (auto record = clang::dyn_cast<clang::RecordDecl>(decl)) {
+        records.try_emplace(record->getName(), record);
+      } else if (clang::isa<clang::FunctionDecl>(decl) ||
+                 clang::isa<clang::VarDecl>(decl)) {
+        values.try_emplace(named->getName(),
+                           clang::cast<clang::ValueDecl>(decl));
+      }
+    }
+  }
+};
+
+static void WriteVarint(std::string &out, uint64_t val) {
+  while (val >= 0x80) {
+    out.push_back(static_cast<char>(val | 0x80));
+    val >>= 7;
+  }
+  out.push_back(static_cast<char>(val));
+}
+
+static void WriteAPInt(std::string &out, const llvm::APInt &val) {
+  WriteVarint(out, val.getBitWidth());
+  for (auto i = 0U; i < val.getNumWords(); ++i) {
+    WriteVarint(out, val.getRawData()[i]);
+  }
+}
+
+class CheckpointWriter {
+ private:
+  clang::ASTContext &ctx;
+  DeclIndex index;
+  std::vector<clang::QualType> builtins;
+
+  std::unordered_map<const clang::Decl *, unsigned> params;
+  std::unordered_map<const clang::Decl *, unsigned> locals;
+
+  std::string strings;
+  unsigned num_strings = 0;
+  llvm::StringMap<unsigned> string_ids;
+
+  std::string types;
+  unsigned num_types = 0;
+  std::unordered_map<void *, unsigned> type_ids;
+
+  std::string body;
+
+  bool Fail(const char *what) {
+    DLOG(INFO) << "Can't checkpoint " << what;
+    return false;
+  }
+
+  unsigned GetString(llvm::StringRef str) {
+    auto ins{string_ids.try_emplace(str, num_strings)};
+    if (ins.second) {
+      WriteVarint(strings, str.size());
+      strings += str.str();
+      ++num_strings;
+    }
+    return ins.first->second;
+  }
+
+  // Adds `type` and the types it refers to to the type table
+  bool GetType(clang::QualType type, unsigned &id) {
+    auto iter{type_ids.find(type.getAsOpaquePtr())};
+    if (iter != type_ids.end()) {
+      id = iter->second;
+      return true;
+    }
+
+    std::string entry;
+    unsigned sub;
+    if (type.hasLocalQualifiers()) {
+      if (type.hasLocalNonFastQualifiers()) {
+        return Fail("extended qualifiers");
+      }
+      if (!GetType(type.getLocalUnqualifiedType(), sub)) {
+        return false;
+      }
+      WriteVarint(entry, kQualifiedType);
+      WriteVarint(entry, sub);
+      WriteVarint(entry, type.getLocalFastQualifiers());
+    } else if (auto ptr =
+                   clang::dyn_cast<clang::PointerType>(type.getTypePtr())) {
+      if (!GetType(ptr->getPointeeType(), sub)) {
+        return false;
+      }
+      WriteVarint(entry, kPointerType);
+      WriteVarint(entry, sub);
+    } else if (auto arr = clang::dyn_cast<clang::ConstantArrayType>(
+                   type.getTypePtr())) {
+      if (!GetType(arr->getElementType(), sub)) {
+        return false;
+      }
+      WriteVarint(entry, kConstantArrayType);
+      WriteVarint(entry, sub);
+      WriteVarint(entry, arr->getSize().getZExtValue());
+    } else if (auto arr = clang::dyn_cast<clang::IncompleteArrayType>(
+                   type.getTypePtr())) {
+      if (!GetType(arr->getElementType(), sub)) {
+        return false;
+      }
+      WriteVarint(entry, kIncompleteArrayType);
+      WriteVarint(entry, sub);
+    } else if (auto record =
+                   clang::dyn_cast<clang::RecordType>(type.getTypePtr())) {
+      auto decl{record->getDecl()};
+      auto found{index.records.lookup(decl->getName())};
+      if (!found || found->getCanonicalDecl() != decl->getCanonicalDecl()) {
+        return Fail("a structure that can't be found by name");
+      }
+      WriteVarint(entry, kRecordType);
+      WriteVarint(entry, GetString(decl->getName()));
+    } else if (auto proto = clang::dyn_cast<clang::FunctionProtoType>(
+                   type.getTypePtr())) {
+      std::vector<unsigned> subs(proto->getNumParams() + 1);
+      if (!GetType(proto->getReturnType(), subs[0])) {
+        return false;
+      }
+      for (auto i = 0U; i < proto->getNumParams(); ++i) {
+        if (!GetType(proto->getParamType(i), subs[i + 1])) {
+          return false;
+        }
+      }
+      WriteVarint(entry, kFunctionProtoType);
+      WriteVarint(entry, proto->getNumParams());
+      for (auto sub : subs) {
+        WriteVarint(entry, sub);
+      }
+      WriteVarint(entry, proto->isVariadic());
+    } else if (auto noproto = clang::dyn_cast<clang::FunctionNoProtoType>(
+                   type.getTypePtr())) {
+      if (!GetType(noproto->getReturnType(), sub)) {
+        return false;
+      }
+      WriteVarint(entry, kFunctionNoProtoType);
+      WriteVarint(entry, sub);
+    } else {
+      auto pos{std::find(builtins.begin(), builtins.end(), type)};
+      if (pos == builtins.end()) {
+        return Fail("a type");
+      }
+      WriteVarint(entry, kBuiltinType);
+      WriteVarint(entry, pos - builtins.begin());
+    }
+
+    types += entry;
+    id = num_types++;
+    type_ids[type.getAsOpaquePtr()] = id;
+    return true;
+  }
+
+  bool WriteType(clang::QualType type) {
+    unsigned id;
+    if (!GetType(type, id)) {
+      return false;
+    }
+    WriteVarint(body, id);
+    return true;
+  }
+
+  bool WriteDeclRef(clang::ValueDecl *decl) {
+    auto param{params.find(decl)};
+    if (param != params.end()) {
+      WriteVarint(body, kParamDecl);
+      WriteVarint(body, param->second);
+      return true;
+    }
+    auto local{locals.find(decl)};
+    if (local != locals.end()) {
+      WriteVarint(body, kLocalDecl);
+      WriteVarint(body, local->second);
+      return true;
+    }
+    auto found{index.values.lookup(decl->getName())};
+    if (!found || found->getCanonicalDecl() != decl->getCanonicalDecl()) {
+      return Fail("a declaration that can't be found by name");
+    }
+    WriteVarint(body, kGlobalDecl);
+    WriteVarint(body, GetString(decl->getName()));
+    return true;
+  }
+
+  bool WriteExprs(llvm::ArrayRef<clang::Expr *> exprs) {
+    WriteVarint(body, exprs.size());
+    for (auto expr : exprs) {
+      if (!WriteStmt(expr)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool WriteOptional(clang::Stmt *stmt) {
+    if (!stmt) {
+      WriteVarint(body, kNone);
+      return true;
+    }
+    return WriteStmt(stmt);
+  }
+
+ public:
+  CheckpointWriter(clang::ASTContext &ctx)
+      : ctx(ctx), index(ctx), builtins(GetBuiltinTypes(ctx)) {}
+
+  bool WriteStmt(clang::Stmt *stmt) {
+    if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+      WriteVarint(body, kCompoundStmt);
+      WriteVarint(body, compound->size());
+      for (auto child : compound->body()) {
+        if (!WriteStmt(child)) {
+          return false;
+        }
+      }
+      return true;
+    } else if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+      if (ifstmt->getInit() || ifstmt->getConditionVariable()) {
+        return Fail("an if statement with declarations");
+      }
+      WriteVarint(body, kIfStmt);
+      return WriteStmt(ifstmt->getCond()) && WriteStmt(ifstmt->getThen()) &&
+             WriteOptional(ifstmt->getElse());
+    } else if (auto loop = clang::dyn_cast<clang::WhileStmt>(stmt)) {
+      if (loop->getConditionVariable()) {
+        return Fail("a while statement with declarations");
+      }
+      WriteVarint(body, kWhileStmt);
+      return WriteStmt(loop->getCond()) && WriteStmt(loop->getBody());
+    } else if (auto loop = clang::dyn_cast<clang::DoStmt>(stmt)) {
+      WriteVarint(body, kDoStmt);
+      return WriteStmt(loop->getCond()) && WriteStmt(loop->getBody());
+    } else if (clang::isa<clang::BreakStmt>(stmt)) {
+      WriteVarint(body, kBreakStmt);
+      return true;
+    } else if (auto ret = clang::dyn_cast<clang::ReturnStmt>(stmt)) {
+      WriteVarint(body, kReturnStmt);
+      return WriteOptional(ret->getRetValue());
+    } else if (auto decl = clang::dyn_cast<clang::DeclStmt>(stmt)) {
+      auto local{decl->isSingleDecl() ? locals.find(decl->getSingleDecl())
+                                      : locals.end()};
+      if (local == locals.end()) {
+        return Fail("a declaration statement");
+      }
+      WriteVarint(body, kDeclStmt);
+      WriteVarint(body, local->second);
+      return true;
+    } else if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(stmt)) {
+      WriteVarint(body, kDeclRefExpr);
+      return WriteDeclRef(ref->getDecl());
+    } else if (auto lit = clang::dyn_cast<clang::IntegerLiteral>(stmt)) {
+      WriteVarint(body, kIntegerLiteral);
+      if (!WriteType(lit->getType())) {
+        return false;
+      }
+      WriteAPInt(body, lit->getValue());
+      return true;
+    } else if (auto lit = clang::dyn_cast<clang::CharacterLiteral>(stmt)) {
+      if (lit->getKind() != clang::CharacterLiteral::CharacterKind::Ascii) {
+        return Fail("a wide character literal");
+      }
+      WriteVarint(body, kCharacterLiteral);
+      if (!WriteType(lit->getType())) {
+        return false;
+      }
+      WriteVarint(body, lit->getValue());
+      return true;
+    } else if (auto lit = clang::dyn_cast<clang::FloatingLiteral>(stmt)) {
+      WriteVarint(body, kFloatingLiteral);
+      if (!WriteType(lit->getType())) {
+        return false;
+      }
+      WriteAPInt(body, lit->getValue().bitcastToAPInt());
+      return true;
+    } else if (auto lit = clang::dyn_cast<clang::StringLiteral>(stmt)) {
+      if (!lit->isAscii()) {
+        return Fail("a wide string literal");
+      }
+      WriteVarint(body, kStringLiteral);
+      if (!WriteType(lit->getType())) {
+        return false;
+      }
+      WriteVarint(body, GetString(lit->getString()));
+      return true;
+    } else if (auto paren = clang::dyn_cast<clang::ParenExpr>(stmt)) {
+      WriteVarint(body, kParenExpr);
+      return WriteStmt(paren->getSubExpr());
+    } else if (auto unop = clang::dyn_cast<clang::UnaryOperator>(stmt)) {
+      WriteVarint(body, kUnaryOperator);
+      WriteVarint(body, unop->getOpcode());
+      return WriteType(unop->getType()) && WriteStmt(unop->getSubExpr());
+    } else if (auto binop = clang::dyn_cast<clang::BinaryOperator>(stmt)) {
+      if (clang::isa<clang::CompoundAssignOperator>(binop)) {
+        return Fail("a compound assignment");
+      }
+      WriteVarint(body, kBinaryOperator);
+      WriteVarint(body, binop->getOpcode());
+      return WriteType(binop->getType()) && WriteStmt(binop->getLHS()) &&
+             WriteStmt(binop->getRHS());
+    } else if (auto cast = clang::dyn_cast<clang::ImplicitCastExpr>(stmt)) {
+      WriteVarint(body, kImplicitCastExpr);
+      WriteVarint(body, cast->getCastKind());
+      return WriteType(cast->getType()) && WriteStmt(cast->getSubExpr());
+    } else if (auto cast = clang::dyn_cast<clang::CStyleCastExpr>(stmt)) {
+      WriteVarint(body, kCStyleCastExpr);
+      WriteVarint(body, cast->getCastKind());
+      return WriteType(cast->getType()) && WriteStmt(cast->getSubExpr());
+    } else if (auto call = clang::dyn_cast<clang::CallExpr>(stmt)) {
+      WriteVarint(body, kCallExpr);
+      return WriteType(call->getType()) && WriteStmt(call->getCallee()) &&
+             WriteExprs(
+                 llvm::makeArrayRef(call->getArgs(), call->getNumArgs()));
+    } else if (auto member = clang::dyn_cast<clang::MemberExpr>(stmt)) {
+      auto field{clang::dyn_cast<clang::FieldDecl>(member->getMemberDecl())};
+      if (!field) {
+        return Fail("a member expression");
+      }
+      WriteVarint(body, kMemberExpr);
+      WriteVarint(body, member->isArrow());
+      WriteVarint(body, field->getFieldIndex());
+      return WriteType(ctx.getRecordType(field->getParent())) &&
+             WriteType(member->getType()) && WriteStmt(member->getBase());
+    } else if (auto sub = clang::dyn_cast<clang::ArraySubscriptExpr>(stmt)) {
+      WriteVarint(body, kArraySubscriptExpr);
+      return WriteType(sub->getType()) && WriteStmt(sub->getBase()) &&
+             WriteStmt(sub->getIdx());
+    } else if (auto cond = clang::dyn_cast<clang::ConditionalOperator>(stmt)) {
+      WriteVarint(body, kConditionalOperator);
+      return WriteType(cond->getType()) && WriteStmt(cond->getCond()) &&
+             WriteStmt(cond->getLHS()) && WriteStmt(cond->getRHS());
+    } else if (auto init = clang::dyn_cast<clang::InitListExpr>(stmt)) {
+      WriteVarint(body, kInitListExpr);
+      return WriteType(init->getType()) &&
+             WriteExprs(
+                 llvm::makeArrayRef(init->getInits(), init->getNumInits()));
+    }
+    return Fail(stmt->getStmtClassName());
+  }
+
+  bool Write(clang::FunctionDecl *fdecl, clang::FunctionDecl *fdefn,
+             std::string &data) {
+    for (auto i = 0U; i < fdefn->getNumParams(); ++i) {
+      params[fdefn->getParamDecl(i)] = i;
+    }
+    // Locals are declared in the context of the prototype
+    std::vector<clang::VarDecl *> vars;
+    for (auto decl : fdecl->decls()) {
+      auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+      if (!var || clang::isa<clang::ParmVarDecl>(var)) {
+        continue;
+      }
+      if (var->getStorageClass() != clang::SC_None) {
+        return Fail("a local with a storage class");
+      }
+      locals[var] = vars.size();
+      vars.push_back(var);
+    }
+
+    // Initializers may refer to any local, so they follow the list
+    std::vector<unsigned> var_types(vars.size());
+    for (auto i = 0U; i < vars.size(); ++i) {
+      if (!GetType(vars[i]->getType(), var_types[i]) ||
+          !WriteOptional(vars[i]->getInit())) {
+        return false;
+      }
+    }
+    if (!WriteStmt(fdefn->getBody())) {
+      return false;
+    }
+
+    data.assign(kMagic, sizeof(kMagic));
+    WriteVarint(data, kVersion);
+    // The names of locals are needed before the statements
+    std::string var_table;
+    WriteVarint(var_table, vars.size());
+    for (auto i = 0U; i < vars.size(); ++i) {
+      WriteVarint(var_table, GetString(vars[i]->getName()));
+      WriteVarint(var_table, var_types[i]);
+    }
+    WriteVarint(data, num_strings);
+    data += strings;
+    WriteVarint(data, num_types);
+    data += types;
+    data += var_table;
+    data += body;
+    return true;
+  }
+};
+
+class CheckpointReader {
+ private:
+  clang::ASTContext &ctx;
+  DeclIndex index;
+  std::vector<clang::QualType> builtins;
+
+  const char *pos;
+  const char *end;
+  bool ok = true;
+
+  std::vector<llvm::StringRef> strings;
+  std::vector<clang::QualType> types;
+  clang::FunctionDecl *fdecl;
+  std::vector<clang::VarDecl *> locals;
+
+  std::nullptr_t Fail() {
+    ok = false;
+    return nullptr;
+  }
+
+  uint64_t ReadVarint() {
+    uint64_t val{0};
+    for (unsigned shift{0}; ok; shift += 7) {
+      if (pos == end || shift > 63) {
+        Fail();
+        break;
+      }
+      auto byte{static_cast<uint8_t>(*pos++)};
+      val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    return val;
+  }
+
+  // Reads an index into a table of `size` entries
+  unsigned ReadIndex(size_t size) {
+    auto idx{ReadVarint()};
+    if (idx >= size) {
+      Fail();
+      return 0;
+    }
+    return static_cast<unsigned>(idx);
+  }
+
+  llvm::StringRef ReadString() {
+    auto idx{ReadIndex(strings.size())};
+    return ok ? strings[idx] : llvm::StringRef();
+  }
+
+  clang::QualType ReadType() {
+    auto idx{ReadIndex(types.size())};
+    return ok ? types[idx] : clang::QualType();
+  }
+
+  llvm::APInt ReadAPInt() {
+    auto width{ReadVarint()};
+    if (!ok || !width || width > (1U << 16)) {
+      Fail();
+      return llvm::APInt();
+    }
+    std::vector<uint64_t> words((width + 63) / 64);
+    for (auto &word : words) {
+      word = ReadVarint();
+    }
+    return llvm::APInt(static_cast<unsigned>(width), words);
+  }
+
+  bool ReadTypes() {
+    auto num_types{ReadVarint()};
+    for (uint64_t i{0}; ok && i < num_types; ++i) {
+      clang::QualType type;
+      switch (ReadVarint()) {
+        case kBuiltinType:
+          type = builtins[ReadIndex(builtins.size())];
+          break;
+        case kPointerType: {
+          auto pointee{ReadType()};
+          if (ok) {
+            type = ctx.getPointerType(pointee);
+          }
+        } break;
+        case kConstantArrayType: {
+          auto elm{ReadType()};
+          auto size{ReadVarint()};
+          if (ok) {
+            type = GetConstantArrayType(ctx, elm, size);
+          }
+        } break;
+        case kIncompleteArrayType: {
+          auto elm{ReadType()};
+          if (ok) {
+            type = ctx.getIncompleteArrayType(elm, clang::ArrayType::Normal, 0);
+          }
+        } break;
+        case kRecordType: {
+          auto record{index.records.lookup(ReadString())};
+          if (ok && record) {
+            type = ctx.getRecordType(record);
+          }
+        } break;
+        case kFunctionProtoType: {
+          auto num_params{ReadVarint()};
+          if (!ok || num_params > static_cast<uint64_t>(end - pos)) {
+            Fail();
+            break;
+          }
+          auto ret{ReadType()};
+          std::vector<clang::QualType> params;
+          for (uint64_t j{0}; ok && j < num_params; ++j) {
+            params.push_back(ReadType());
+          }
+          clang::FunctionProtoType::ExtProtoInfo epi;
+          epi.Variadic = ReadVarint() != 0;
+          if (ok) {
+            type = ctx.getFunctionType(ret, params, epi);
+          }
+        } break;
+        case kFunctionNoProtoType: {
+          auto ret{ReadType()};
+          if (ok) {
+            type = ctx.getFunctionNoProtoType(ret);
+          }
+        } break;
+        case kQualifiedType: {
+          auto base{ReadType()};
+          auto quals{ReadVarint()};
+          if (ok && quals <= clang::Qualifiers::FastMask) {
+            type = ctx.getQualifiedType(
+                base, clang::Qualifiers::fromFastMask(quals));
+          }
+        } break;
+        default:
+          break;
+      }
+      if (type.isNull()) {
+        return Fail();
+      }
+      types.push_back(type);
+    }
+    return ok;
+  }
+
+  clang::ValueDecl *ReadDeclRef() {
+    switch (ReadVarint()) {
+      case kParamDecl: {
+        auto idx{ReadIndex(fdecl->getNumParams())};
+        return ok ? fdecl->getParamDecl(idx) : nullptr;
+      }
+      case kLocalDecl: {
+        auto idx{ReadIndex(locals.size())};
+        return ok ? locals[idx] : nullptr;
+      }
+      case kGlobalDecl: {
+        auto name{ReadString()};
+        return ok ? index.values.lookup(name) : nullptr;
+      }
+      default:
+        return Fail();
+    }
+  }
+
+  bool ReadExprs(std::vector<clang::Expr *> &exprs) {
+    auto num{ReadVarint()};
+    // Every expression takes at least one byte
+    if (!ok || num > static_cast<uint64_t>(end - pos)) {
+      return Fail();
+    }
+    for (uint64_t i{0}; ok && i < num; ++i) {
+      exprs.push_back(ReadExpr());
+    }
+    return ok;
+  }
+
+  clang::Expr *ReadExpr() {
+    return clang::dyn_cast_or_null<clang::Expr>(ReadStmt(/*is_expr=*/true));
+  }
+
+ public:
+  CheckpointReader(clang::ASTContext &ctx, llvm::StringRef data,
+                   clang::FunctionDecl *fdecl)
+      : ctx(ctx),
+        index(ctx),
+        builtins(GetBuiltinTypes(ctx)),
+        pos(data.begin()),
+        end(data.end()),
+        fdecl(fdecl) {}
+
+  // Reads a statement, or nothing if `kNone` is found
+  clang::Stmt *ReadStmt(bool is_expr = false) {
+    auto tag{ReadVarint()};
+    if (!ok) {
+      return nullptr;
+    }
+    // Only expressions may appear where `is_expr` is set
+    if (is_expr && tag < kDeclRefExpr) {
+      return Fail();
+    }
+    switch (tag) {
+      case kCompoundStmt: {
+        auto size{ReadVarint()};
+        if (!ok || size > static_cast<uint64_t>(end - pos)) {
+          return Fail();
+        }
+        std::vector<clang::Stmt *> stmts;
+        for (uint64_t i{0}; ok && i < size; ++i) {
+          stmts.push_back(ReadRequired());
+        }
+        return ok ? CreateCompoundStmt(ctx, stmts) : nullptr;
+      }
+      case kIfStmt: {
+        auto cond{ReadExpr()};
+        auto then{ReadRequired()};
+        auto other{ReadStmt()};
+        if (!ok || !cond) {
+          return Fail();
+        }
+        auto ifstmt{CreateIfStmt(ctx, cond, then)};
+        ifstmt->setElse(other);
+        return ifstmt;
+      }
+      case kWhileStmt:
+      case kDoStmt: {
+        auto cond{ReadExpr()};
+        auto body{ReadRequired()};
+        if (!ok || !cond) {
+          return Fail();
+        }
+        if (tag == kWhileStmt) {
+          return CreateWhileStmt(ctx, cond, body);
+        }
+        return CreateDoStmt(ctx, cond, body);
+      }
+      case kBreakStmt:
+        return CreateBreakStmt(ctx);
+      case kReturnStmt: {
+        auto value{ReadStmt()};
+        if (!ok || (value && !clang::isa<clang::Expr>(value))) {
+          return Fail();
+        }
+        return CreateReturnStmt(ctx, clang::cast_or_null<clang::Expr>(value));
+      }
+      case kDeclStmt: {
+        auto idx{ReadIndex(locals.size())};
+        return ok ? CreateDeclStmt(ctx, locals[idx]) : nullptr;
+      }
+      case kDeclRefExpr: {
+        auto decl{ReadDeclRef()};
+        return ok && decl ? CreateDeclRefExpr(ctx, decl) : Fail();
+      }
+      case kIntegerLiteral: {
+        auto type{ReadType()};
+        auto val{ReadAPInt()};
+        if (!ok || !type->isIntegerType() ||
+            val.getBitWidth() != ctx.getIntWidth(type)) {
+          return Fail();
+        }
+        return CreateIntegerLiteral(ctx, val, type);
+      }
+      case kCharacterLiteral: {
+        auto type{ReadType()};
+        auto val{ReadVarint()};
+        if (!ok || !type->isIntegerType()) {
+          return Fail();
+        }
+        return CreateCharacterLiteral(ctx, llvm::APInt(64, val), type);
+      }
+      case kFloatingLiteral: {
+        auto type{ReadType()};
+        auto bits{ReadAPInt()};
+        if (!ok || !type->isRealFloatingType()) {
+          return Fail();
+        }
+        auto &sem{ctx.getFloatTypeSemantics(type)};
+        if (bits.getBitWidth() != llvm::APFloat::getSizeInBits(sem)) {
+          return Fail();
+        }
+        return CreateFloatingLiteral(ctx, llvm::APFloat(sem, bits), type);
+      }
+      case kStringLiteral: {
+        auto type{ReadType()};
+        auto str{ReadString()};
+        return ok ? CreateStringLiteral(ctx, str.str(), type) : nullptr;
+      }
+      case kParenExpr: {
+        auto sub{ReadExpr()};
+        return ok && sub ? CreateParenExpr(ctx, sub) : Fail();
+      }
+      case kUnaryOperator: {
+        auto opc{ReadVarint()};
+        auto type{ReadType()};
+        auto sub{ReadExpr()};
+        if (!ok || !sub || opc > clang::UO_Coawait) {
+          return Fail();
+        }
+        return CreateUnaryOperator(
+            ctx, static_cast<clang::UnaryOperatorKind>(opc), sub, type);
+      }
+      case kBinaryOperator: {
+        auto opc{ReadVarint()};
+        auto type{ReadType()};
+        auto lhs{ReadExpr()};
+        auto rhs{ReadExpr()};
+        if (!ok || !lhs || !rhs || opc > clang::BO_Comma ||
+            (opc >= clang::BO_MulAssign && opc <= clang::BO_OrAssign)) {
+          return Fail();
+        }
+        return CreateBinaryOperator(
+            ctx, static_cast<clang::BinaryOperatorKind>(opc), lhs, rhs, type);
+      }
+      case kImplicitCastExpr:
+      case kCStyleCastExpr: {
+        auto kind{ReadVarint()};
+        auto type{ReadType()};
+        auto sub{ReadExpr()};
+        if (!ok || !sub || kind >= kNumCastKinds) {
+          return Fail();
+        }
+        auto cast_kind{static_cast<clang::CastKind>(kind)};
+        if (tag == kImplicitCastExpr) {
+          return CreateImplicitCastExpr(ctx, type, cast_kind, sub);
+        }
+        return CreateCStyleCastExpr(ctx, type, cast_kind, sub);
+      }
+      case kCallExpr: {
+        auto type{ReadType()};
+        auto callee{ReadExpr()};
+        std::vector<clang::Expr *> args;
+        if (!ReadExprs(args) || !callee) {
+          return Fail();
+        }
+        return CreateCallExpr(ctx, callee, args, type);
+      }
+      case kMemberExpr: {
+        auto is_arrow{ReadVarint() != 0};
+        auto idx{ReadVarint()};
+        auto parent{ReadType()};
+        auto type{ReadType()};
+        auto base{ReadExpr()};
+        auto record{ok ? parent->getAsRecordDecl() : nullptr};
+        if (!ok || !base || !record) {
+          return Fail();
+        }
+        for (auto field : record->fields()) {
+          if (field->getFieldIndex() == idx) {
+            return CreateMemberExpr(ctx, base, field, type, is_arrow);
+          }
+        }
+        return Fail();
+      }
+      case kArraySubscriptExpr: {
+        auto type{ReadType()};
+        auto base{ReadExpr()};
+        auto idx{ReadExpr()};
+        if (!ok || !base || !idx) {
+          return Fail();
+        }
+        return CreateArraySubscriptExpr(ctx, base, idx, type);
+      }
+      case kConditionalOperator: {
+        auto type{ReadType()};
+        auto cond{ReadExpr()};
+        auto lhs{ReadExpr()};
+        auto rhs{ReadExpr()};
+        if (!ok || !cond || !lhs || !rhs) {
+          return Fail();
+        }
+        return CreateConditionalOperatorExpr(ctx, cond, lhs, rhs, type);
+      }
+      case kInitListExpr: {
+        auto type{ReadType()};
+        std::vector<clang::Expr *> inits;
+        if (!ReadExprs(inits)) {
+          return nullptr;
+        }
+        return CreateInitListExpr(ctx, inits, type);
+      }
+      case kNone:
+        return nullptr;
+      default:
+        return Fail();
+    }
+  }
+
+  clang::Stmt *ReadRequired() {
+    auto stmt{ReadStmt()};
+    return stmt ? stmt : Fail();
+  }
+
+  bool Read(clang::Stmt *&body) {
+    if (end - pos < static_cast<ptrdiff_t>(sizeof(kMagic)) ||
+        !std::equal(kMagic, kMagic + sizeof(kMagic), pos)) {
+      return false;
+    }
+    pos += sizeof(kMagic);
+    if (ReadVarint() != kVersion) {
+      return false;
+    }
+
+    auto num_strings{ReadVarint()};
+    for (uint64_t i{0}; ok && i < num_strings; ++i) {
+      auto size{ReadVarint()};
+      if (!ok || size > static_cast<uint64_t>(end - pos)) {
+        return Fail();
+      }
+      strings.emplace_back(pos, size);
+      pos += size;
+    }
+
+    if (!ReadTypes()) {
+      return false;
+    }
+
+    auto num_locals{ReadVarint()};
+    if (!ok || num_locals > static_cast<uint64_t>(end - pos)) {
+      return Fail();
+    }
+    for (uint64_t i{0}; ok && i < num_locals; ++i) {
+      auto name{ReadString()};
+      auto type{ReadType()};
+      if (!ok) {
+        break;
+      }
+      auto var{CreateVarDecl(ctx, fdecl, CreateIdentifier(ctx, name.str()),
+                             type)};
+      fdecl->addDecl(var);
+      locals.push_back(var);
+    }
+    for (auto i = 0U; ok && i < locals.size(); ++i) {
+      auto init{ReadStmt()};
+      if (init) {
+        if (!clang::isa<clang::Expr>(init)) {
+          Fail();
+          break;
+        }
+        locals[i]->setInit(clang::cast<clang::Expr>(init));
+      }
+    }
+    body = ok ? ReadRequired() : nullptr;
+    if (ok && (pos != end || !clang::isa<clang::CompoundStmt>(body))) {
+      Fail();
+    }
+
+    if (!ok) {
+      for (auto var : locals) {
+        fdecl->removeDecl(var);
+      }
+    }
+    return ok;
+  }
+};
+
+}  // namespace
+
+bool SaveCheckpoint(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                    llvm::Function &func, std::string &data) {
+  auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(&func))};
+  auto fdefn{fdecl->getDefinition()};
+  if (!fdefn || !fdefn->hasBody()) {
+    return false;
+  }
+  CheckpointWriter writer(ctx);
+  return writer.Write(fdecl, fdefn, data);
+}
+
+bool LoadCheckpoint(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                    llvm::Function &func, llvm::StringRef data) {
+  auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(&func))};
+  if (fdecl->getDefinition()) {
+    return false;
+  }
+  CheckpointReader reader(ctx, data, fdecl);
+  clang::Stmt *body;
+  if (!reader.Read(body)) {
+    LOG(WARNING) << "Ignoring malformed checkpoint of " << func.getName().str();
+    return false;
+  }
+  // Create a definition the same way GenerateAST does
+  auto tudecl{ctx.getTranslationUnitDecl()};
+  auto fdefn{CreateFunctionDecl(ctx, tudecl, fdecl->getIdentifier(),
+                                fdecl->getType())};
+  fdefn->setPreviousDecl(fdecl);
+  tudecl->addDecl(fdefn);
+  fdefn->setParams(fdecl->parameters());
+  fdefn->setBody(body);
+  return true;
+}
+
+}  // namespace rellic
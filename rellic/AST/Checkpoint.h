@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+
+#include <string>
+
+#include "rellic/AST/IRToASTVisitor.h"
+
+namespace rellic {
+
+// Checkpoints hold the definition of a function in a compact binary form
+// of the C subset that rellic generates. Types and names are stored once
+// in tables, declarations outside the function are referred to by name,
+// and the data is decoded in place, so checkpoints can be read straight
+// from a mapped file.
+
+// Encodes the definition of `func` into `data`. Returns `false` if the
+// definition uses constructs the format does not cover, or declarations
+// that can't be found by name again.
+bool SaveCheckpoint(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                    llvm::Function &func, std::string &data);
+
+// Recreates the definition of `func` from `data`, which must have been
+// saved in a context holding the same declarations. Returns `false` and
+// leaves `func` without a definition if `data` is malformed.
+bool LoadCheckpoint(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                    llvm::Function &func, llvm::StringRef data);
+
+}  // namespace rellic
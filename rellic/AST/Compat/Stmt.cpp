@@ -16,6 +16,7 @@
 
 #include "rellic/AST/Compat/Stmt.h"
 
+#include "rellic/AST/StmtRecycler.h"
 #include "rellic/BC/Version.h"
 
 namespace rellic {
@@ -62,13 +63,23 @@ clang::ReturnStmt *CreateReturnStmt(clang::ASTContext &ctx, clang::Expr *expr) {
 
 clang::CompoundStmt *CreateCompoundStmt(clang::ASTContext &ctx,
                                         std::vector<clang::Stmt *> &stmts) {
+  auto recycler = StmtRecycler::Get(ctx);
+  if (recycler) {
+    if (auto compound = recycler->Reuse(stmts)) {
+      return compound;
+    }
+  }
 #if LLVM_VERSION_NUMBER >= LLVM_VERSION(6, 0)
-  return clang::CompoundStmt::Create(ctx, stmts, clang::SourceLocation(),
-                                     clang::SourceLocation());
+  auto compound = clang::CompoundStmt::Create(
+      ctx, stmts, clang::SourceLocation(), clang::SourceLocation());
 #else
-  return new (ctx) clang::CompoundStmt(ctx, stmts, clang::SourceLocation(),
-                                       clang::SourceLocation());
+  auto compound = new (ctx) clang::CompoundStmt(
+      ctx, stmts, clang::SourceLocation(), clang::SourceLocation());
 #endif
+  if (recycler) {
+    recycler->Track(compound);
+  }
+  return compound;
 }
 
 }  // namespace rellic
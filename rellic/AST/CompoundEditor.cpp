@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/CompoundEditor.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace rellic {
+
+CompoundEditor::CompoundEditor(clang::ASTContext &ctx,
+                               clang::CompoundStmt *compound)
+    : ast_ctx(ctx), compound(compound) {}
+
+void CompoundEditor::Resize() {
+  if (!resized) {
+    body.assign(compound->body_begin(), compound->body_end());
+    resized = true;
+  }
+}
+
+size_t CompoundEditor::size() const {
+  return resized ? body.size() : compound->size();
+}
+
+clang::Stmt *CompoundEditor::Get(size_t idx) const {
+  CHECK_LT(idx, size());
+  return resized ? body[idx] : compound->body_begin()[idx];
+}
+
+void CompoundEditor::Replace(size_t idx, clang::Stmt *stmt) {
+  CHECK_LT(idx, size());
+  CHECK(stmt) << "Use `Erase` to remove children";
+  if (Get(idx) == stmt) {
+    return;
+  }
+  if (resized) {
+    body[idx] = stmt;
+  } else {
+    compound->body_begin()[idx] = stmt;
+  }
+  changed = true;
+}
+
+void CompoundEditor::Replace(size_t begin, size_t end,
+                             llvm::ArrayRef<clang::Stmt *> stmts) {
+  CHECK_LE(begin, end);
+  CHECK_LE(end, size());
+  if (end - begin == stmts.size()) {
+    for (auto i = 0U; i < stmts.size(); ++i) {
+      Replace(begin + i, stmts[i]);
+    }
+    return;
+  }
+  Resize();
+  auto it{body.erase(body.begin() + begin, body.begin() + end)};
+  body.insert(it, stmts.begin(), stmts.end());
+  changed = true;
+}
+
+void CompoundEditor::Erase(size_t begin, size_t end) {
+  Replace(begin, end, {});
+}
+
+void CompoundEditor::Splice(size_t idx, llvm::ArrayRef<clang::Stmt *> stmts) {
+  Replace(idx, idx, stmts);
+}
+
+bool CompoundEditor::Substitute(const StmtMap &substitutions) {
+  if (substitutions.empty()) {
+    return false;
+  }
+  auto result{false};
+  // Children are replaced in place until the first one is removed. From
+  // there on, the children that are kept are moved up in the same pass,
+  // instead of erasing every removed child on its own.
+  auto num{size()};
+  size_t kept{0};
+  for (size_t i{0}; i < num; ++i) {
+    auto child{Get(i)};
+    auto iter{substitutions.find(child)};
+    if (iter != substitutions.end()) {
+      child = iter->second;
+      result = true;
+    }
+    if (!child) {
+      Resize();
+      continue;
+    }
+    if (kept == i) {
+      Replace(i, child);
+    } else {
+      body[kept] = child;
+    }
+    ++kept;
+  }
+  if (kept != num) {
+    body.resize(kept);
+    changed = true;
+  }
+  return result;
+}
+
+clang::CompoundStmt *CompoundEditor::Commit() {
+  if (!resized) {
+    return compound;
+  }
+  if (body.size() == compound->size()) {
+    std::copy(body.begin(), body.end(), compound->body_begin());
+  } else {
+    compound = CreateCompoundStmt(ast_ctx, body);
+  }
+  body.clear();
+  resized = false;
+  return compound;
+}
+
+}  // namespace rellic
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/ADT/ArrayRef.h>
+
+#include <vector>
+
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+// Edits the children of a `clang::CompoundStmt`. Replacements that keep
+// the number of children are written into the compound right away. Edits
+// that add or remove children are collected, and only `Commit` creates a
+// compound for them, through `CreateCompoundStmt` so that recycled
+// compounds are used when there are any.
+class CompoundEditor {
+ private:
+  clang::ASTContext &ast_ctx;
+  clang::CompoundStmt *compound;
+  // Children after edits that changed their number, empty until then
+  std::vector<clang::Stmt *> body;
+  bool resized = false;
+  bool changed = false;
+
+  void Resize();
+
+ public:
+  CompoundEditor(clang::ASTContext &ctx, clang::CompoundStmt *compound);
+
+  size_t size() const;
+  clang::Stmt *Get(size_t idx) const;
+
+  // Replaces child `idx` with `stmt`
+  void Replace(size_t idx, clang::Stmt *stmt);
+  // Replaces children `begin` up to `end` with `stmts`
+  void Replace(size_t begin, size_t end, llvm::ArrayRef<clang::Stmt *> stmts);
+  // Removes children `begin` up to `end`
+  void Erase(size_t begin, size_t end);
+  // Inserts `stmts` before child `idx`
+  void Splice(size_t idx, llvm::ArrayRef<clang::Stmt *> stmts);
+
+  // Applies `substitutions` to the children, removing the children that
+  // are substituted by `nullptr`. Returns `true` if any child changed.
+  bool Substitute(const StmtMap &substitutions);
+
+  bool IsChanged() const { return changed; }
+
+  // Returns the edited compound, which is the original one unless the
+  // number of children changed
+  clang::CompoundStmt *Commit();
+};
+
+}  // namespace rellic
@@ -17,141 +17,296 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "rellic/AST/CompoundEditor.h"
 #include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/Stats.h"
 #include "rellic/AST/Util.h"
+#include "rellic/AST/Z3Prefilter.h"
 
 namespace rellic {
 
 namespace {
 
-using IfStmtVec = std::vector<clang::IfStmt *>;
+// A later condition `j` that can possibly be equivalent with (`same`) or
+// complementary to (`diff`) some condition
+struct Candidate {
+  unsigned j;
+  bool same;
+  bool diff;
+};
+
+using CandidateVec = std::vector<Candidate>;
+
+// Finds the candidates of every condition of `ifs`, in work list order
+static std::vector<CandidateVec> GetCandidates(IfConds &ifs) {
+  // Bucket conditions by their simulation signature, normalized so that
+  // a condition and its negation land in the same bucket with opposite
+  // polarities. Only conditions within a bucket can be equivalent or
+  // complementary, so the solver is only asked about those.
+  auto &conds{ifs.conds};
+  auto &sigs{ifs.sigs};
+  auto &known{ifs.known};
+
+  auto Polarity = [&sigs](unsigned i) { return (sigs[i] & 1U) != 0; };
+  auto Key = [&sigs, &Polarity](unsigned i) {
+    return Polarity(i) ? ~sigs[i] : sigs[i];
+  };
+
+  std::unordered_map<uint64_t, std::vector<unsigned>> buckets;
+  std::vector<unsigned> unknowns;
+  for (auto i = 0U; i < conds.size(); ++i) {
+    if (known[i]) {
+      buckets[Key(i)].push_back(i);
+    } else {
+      unknowns.push_back(i);
+    }
+  }
+
+  std::vector<std::vector<unsigned>> supports;
+  for (auto i = 0U; i < conds.size(); ++i) {
+    supports.push_back(GetSupport(conds[i]));
+  }
 
-static IfStmtVec GetIfStmts(clang::CompoundStmt *compound) {
-  IfStmtVec result;
-  for (auto stmt : compound->body()) {
-    if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
-      result.push_back(ifstmt);
+  std::vector<CandidateVec> result(conds.size());
+  for (auto i = 0U; i < conds.size(); ++i) {
+    std::vector<unsigned> candidates(unknowns);
+    if (known[i]) {
+      auto &bucket = buckets[Key(i)];
+      candidates.insert(candidates.end(), bucket.begin(), bucket.end());
+    } else {
+      for (auto j = 0U; j < conds.size(); ++j) {
+        candidates.push_back(j);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+    for (auto j : candidates) {
+      if (j <= i) {
+        continue;
+      }
+      // Conditions over unrelated variables aren't worth a proof
+      if (!supports[i].empty() && !supports[j].empty() &&
+          !SharesSupport(supports[i], supports[j])) {
+        if (Stats::IsEnabled()) {
+          Stats::Get().AddZ3Prefiltered("prove");
+        }
+        continue;
+      }
+      // Signatures of known conditions already tell which test can hold
+      auto same = !known[i] || !known[j] || Polarity(i) == Polarity(j);
+      auto diff = !known[i] || !known[j] || Polarity(i) != Polarity(j);
+      result[i].push_back({j, same, diff});
     }
   }
   return result;
 }
 
+static bool IsEquivalent(Z3Solver &solver, const ProofMap &proven,
+                         clang::IfStmt *lhs, clang::IfStmt *rhs,
+                         z3::expr lcond, z3::expr rcond, bool negated) {
+  if (IsSyntacticallyEquivalent(lcond, rcond, negated)) {
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddZ3Prefiltered("prove");
+    }
+    return true;
+  }
+  auto iter{proven.find(std::make_tuple(lhs->getCond(), rhs->getCond(),
+                                        negated))};
+  if (iter != proven.end()) {
+    return iter->second;
+  }
+  solver.SetStatement(lhs);
+  return solver.Prove(negated ? lcond == !rcond : lcond == rcond);
+}
+
 }  // namespace
 
 char CondBasedRefine::ID = 0;
 
 CondBasedRefine::CondBasedRefine(clang::ASTContext &ctx,
-                                 rellic::IRToASTVisitor &ast_gen)
+                                 rellic::IRToASTVisitor &ast_gen,
+                                 rellic::Z3Solver &solver)
     : ModulePass(CondBasedRefine::ID),
       ast_ctx(&ctx),
       ast_gen(&ast_gen),
-      z3_ctx(new z3::context()),
-      z3_gen(new rellic::Z3ConvVisitor(ast_ctx, z3_ctx.get())),
-      z3_solver(*z3_ctx, "sat") {}
-
-bool CondBasedRefine::Prove(z3::expr expr) {
-  z3::goal goal(*z3_ctx);
-  goal.add((!expr).simplify());
-  auto app = z3_solver(goal);
-  CHECK(app.size() == 1) << "Unexpected multiple goals in application!";
-  return app[0].is_decided_unsat();
-}
+      solver(&solver),
+      z3_ctx(&solver.GetZ3Context()),
+      z3_gen(&solver.GetZ3ConvVisitor()) {}
 
-z3::expr CondBasedRefine::GetZ3Cond(clang::IfStmt *ifstmt) {
-  auto cond = ifstmt->getCond();
-  auto expr = z3_gen->Z3BoolCast(z3_gen->GetOrCreateZ3Expr(cond));
-  return expr.simplify();
-}
-
-void CondBasedRefine::CreateIfThenElseStmts(IfStmtVec worklist) {
-  auto RemoveFromWorkList = [&worklist](clang::Stmt *stmt) {
-    auto it = std::find(worklist.begin(), worklist.end(), stmt);
-    if (it != worklist.end()) {
-      worklist.erase(it);
+void ProveIfThenElseAhead(clang::Stmt *body, Z3Solver &solver,
+                          ProofMap &proven, IfCondCache *cache) {
+  auto &z3_ctx{solver.GetZ3Context()};
+  // Gather the compounds of the function
+  std::vector<clang::CompoundStmt *> compounds;
+  std::function<void(clang::Stmt *)> Collect = [&](clang::Stmt *stmt) {
+    if (!stmt || clang::isa<clang::Expr>(stmt)) {
+      return;
+    }
+    if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+      compounds.push_back(compound);
+    }
+    for (auto child : stmt->children()) {
+      Collect(child);
     }
   };
+  Collect(body);
+  // Ask every query that the compounds may need at once
+  using Key = std::tuple<clang::Expr *, clang::Expr *, bool>;
+  std::vector<Key> keys;
+  std::vector<clang::Stmt *> stmts;
+  z3::expr_vector queries(z3_ctx);
+  for (auto compound : compounds) {
+    IfConds ifs(z3_ctx);
+    GetIfConds(compound, solver.GetZ3ConvVisitor(), ifs, cache);
+    auto &worklist{ifs.stmts};
+    auto &conds{ifs.conds};
+    auto candidates{GetCandidates(ifs)};
+    for (auto i = 0U; i < worklist.size(); ++i) {
+      for (auto &cand : candidates[i]) {
+        auto lhs{worklist[i]->getCond()};
+        auto rhs{worklist[cand.j]->getCond()};
+        if (cand.same &&
+            !IsSyntacticallyEquivalent(conds[i], conds[cand.j], false)) {
+          keys.emplace_back(lhs, rhs, false);
+          stmts.push_back(worklist[i]);
+          queries.push_back(conds[i] == conds[cand.j]);
+        }
+        if (cand.diff &&
+            !IsSyntacticallyEquivalent(conds[i], conds[cand.j], true)) {
+          keys.emplace_back(lhs, rhs, true);
+          stmts.push_back(worklist[i]);
+          queries.push_back(conds[i] == !conds[cand.j]);
+        }
+      }
+    }
+  }
+  auto results{solver.ProveAll(queries, stmts)};
+  for (auto i = 0U; i < keys.size(); ++i) {
+    proven[keys[i]] = results[i];
+  }
+}
 
-  auto ThenTest = [this](z3::expr lhs, z3::expr rhs) {
-    return Prove(lhs == rhs);
-  };
-
-  auto ElseTest = [this](z3::expr lhs, z3::expr rhs) {
-    return Prove(lhs == !rhs);
-  };
+void CreateIfThenElseStmts(clang::ASTContext &ctx, Z3Solver &solver,
+                           const ProofMap &proven, IfConds &ifs,
+                           const SubstituteFn &Substitute) {
+  auto &worklist{ifs.stmts};
+  auto &conds{ifs.conds};
+  auto candidates{GetCandidates(ifs)};
 
-  while (!worklist.empty()) {
-    auto lhs = *worklist.begin();
-    RemoveFromWorkList(lhs);
+  std::vector<bool> removed(worklist.size(), false);
+  for (auto i = 0U; i < worklist.size(); ++i) {
+    if (removed[i]) {
+      continue;
+    }
+    removed[i] = true;
+    auto lhs = worklist[i];
     // Prepare conditions according to which we're going to
     // cluster statements according to the whole `lhs`
     // condition.
-    auto lcond = GetZ3Cond(lhs);
+    auto lcond = conds[i];
     // Get branch candidates wrt `clause`
-    std::vector<clang::Stmt *> thens({lhs}), elses;
-    for (auto rhs : worklist) {
-      auto rcond = GetZ3Cond(rhs);
-      if (ThenTest(lcond, rcond)) {
-        thens.push_back(rhs);
-      } else if (ElseTest(lcond, rcond)) {
-        elses.push_back(rhs);
+    std::vector<unsigned> then_idxs, else_idxs;
+    for (auto &cand : candidates[i]) {
+      auto j{cand.j};
+      if (removed[j]) {
+        continue;
+      }
+      auto rhs = worklist[j];
+      auto rcond = conds[j];
+      if (cand.same &&
+          IsEquivalent(solver, proven, lhs, rhs, lcond, rcond, false)) {
+        then_idxs.push_back(j);
+      } else if (cand.diff && IsEquivalent(solver, proven, lhs, rhs, lcond,
+                                           rcond, true)) {
+        else_idxs.push_back(j);
       }
     }
 
     // Check if we have enough statements to work with
-    if (thens.size() + elses.size() < 2) {
+    if (then_idxs.empty() && else_idxs.empty()) {
       continue;
     }
 
     // Erase then statements from the AST and `worklist`
-    for (auto stmt : thens) {
-      RemoveFromWorkList(stmt);
-      substitutions[stmt] = nullptr;
+    std::vector<clang::Stmt *> thens({lhs});
+    for (auto j : then_idxs) {
+      removed[j] = true;
+      thens.push_back(worklist[j]);
+      Substitute(worklist[j], nullptr);
     }
     // Create our new if-then
-    auto sub = CreateIfStmt(*ast_ctx, lhs->getCond(),
-                            CreateCompoundStmt(*ast_ctx, thens));
+    auto sub =
+        CreateIfStmt(ctx, lhs->getCond(), CreateCompoundStmt(ctx, thens));
     // Create an else branch if possible
-    if (!elses.empty()) {
+    if (!else_idxs.empty()) {
       // Erase else statements from the AST and `worklist`
-      for (auto stmt : elses) {
-        RemoveFromWorkList(stmt);
-        substitutions[stmt] = nullptr;
+      std::vector<clang::Stmt *> elses;
+      for (auto j : else_idxs) {
+        removed[j] = true;
+        elses.push_back(worklist[j]);
+        Substitute(worklist[j], nullptr);
       }
       // Add the else branch
-      sub->setElse(CreateCompoundStmt(*ast_ctx, elses));
+      sub->setElse(CreateCompoundStmt(ctx, elses));
     }
     // Replace `lhs` with the new `sub`
-    substitutions[lhs] = sub;
+    Substitute(lhs, sub);
   }
 }
 
 bool CondBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
   // DLOG(INFO) << "VisitCompoundStmt";
   // Create if-then-else substitutions for IfStmts in `compound`
-  CreateIfThenElseStmts(GetIfStmts(compound));
-  // Apply created if-then-else substitutions and
-  // create a replacement for `compound`
-  if (ReplaceChildren(compound, substitutions)) {
-    std::vector<clang::Stmt *> new_body;
-    for (auto stmt : compound->body()) {
-      if (stmt) {
-        new_body.push_back(stmt);
-      }
+  IfConds ifs(*z3_ctx);
+  GetIfConds(compound, *z3_gen, ifs);
+  CreateIfThenElseStmts(
+      *ast_ctx, *solver, proven, ifs,
+      [this](clang::Stmt *stmt, clang::Stmt *sub) { Substitute(stmt, sub); });
+  // Apply created if-then-else substitutions in place. `compound` is
+  // only replaced if statements were removed from it.
+  CompoundEditor editor(*ast_ctx, compound);
+  if (editor.Substitute(substitutions)) {
+    auto sub{editor.Commit()};
+    if (sub != compound) {
+      Substitute(compound, sub);
     }
-    substitutions[compound] = CreateCompoundStmt(*ast_ctx, new_body);
+    changed = true;
   }
   return true;
 }
 
+bool CondBasedRefine::TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+  // Charge Z3 queries to the budget of `fdecl`
+  solver->SetFunction(fdecl);
+  proven.clear();
+  // Prove the queries of all compounds concurrently, unless the function
+  // converged during an earlier round and won't be visited
+  auto tracker{ChangeTracker::Get(*ast_ctx)};
+  if (solver->GetNumThreads() > 1 && fdecl->hasBody() &&
+      (!tracker || tracker->IsDirty(fdecl))) {
+    ProveIfThenElseAhead(fdecl->getBody(), *solver, proven);
+  }
+  return TransformVisitor<CondBasedRefine>::TraverseFunctionDecl(fdecl);
+}
+
 bool CondBasedRefine::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Condition-based refinement";
+  PassStats stats("CondBasedRefine", *ast_ctx);
   Initialize();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.SetMapBytes(z3_gen->GetMemoryUsage());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
 llvm::ModulePass *createCondBasedRefinePass(clang::ASTContext &ctx,
-                                            rellic::IRToASTVisitor &gen) {
-  return new CondBasedRefine(ctx, gen);
+                                            rellic::IRToASTVisitor &gen,
+                                            rellic::Z3Solver &solver) {
+  return new CondBasedRefine(ctx, gen, solver);
 }
 }  // namespace rellic
\ No newline at end of file
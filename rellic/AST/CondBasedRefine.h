@@ -20,8 +20,10 @@
 #include <llvm/Pass.h>
 
 #include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/IfConds.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Z3ConvVisitor.h"
+#include "rellic/AST/Z3Solver.h"
 
 namespace rellic {
 
@@ -30,31 +32,38 @@ class CondBasedRefine : public llvm::ModulePass,
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
-  std::unique_ptr<z3::context> z3_ctx;
-  std::unique_ptr<rellic::Z3ConvVisitor> z3_gen;
+  rellic::Z3Solver *solver;
+  z3::context *z3_ctx;
+  rellic::Z3ConvVisitor *z3_gen;
 
-  z3::tactic z3_solver;
-
-  z3::expr GetZ3Cond(clang::IfStmt *ifstmt);
-
-  bool Prove(z3::expr expr);
-
-  using IfStmtVec = std::vector<clang::IfStmt *>;
-
-  void CreateIfThenElseStmts(IfStmtVec stmts);
+  ProofMap proven;
 
  public:
   static char ID;
 
-  CondBasedRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+  CondBasedRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen,
+                  rellic::Z3Solver &solver);
 
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl);
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Proves the queries of every compound in `body` with `ProveAll`
+void ProveIfThenElseAhead(clang::Stmt *body, Z3Solver &solver,
+                          ProofMap &proven, IfCondCache *cache = nullptr);
+
+// Merges if statements of `ifs` with equivalent or complementary
+// conditions into if-then-else statements, using the proofs of
+// `ProveIfThenElseAhead` where available
+void CreateIfThenElseStmts(clang::ASTContext &ctx, Z3Solver &solver,
+                           const ProofMap &proven, IfConds &ifs,
+                           const SubstituteFn &Substitute);
+
 llvm::ModulePass *createCondBasedRefinePass(clang::ASTContext &ctx,
-                                            rellic::IRToASTVisitor &ast_gen);
+                                            rellic::IRToASTVisitor &ast_gen,
+                                            rellic::Z3Solver &solver);
 }  // namespace rellic
 
 namespace llvm {
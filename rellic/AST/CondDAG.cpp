@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/CondDAG.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/Hashing.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// Rows of a truth table on which the atom of the same index is true
+static constexpr uint64_t kAtomRows[]{
+    0xaaaaaaaaaaaaaaaaULL, 0xccccccccccccccccULL, 0xf0f0f0f0f0f0f0f0ULL,
+    0xff00ff00ff00ff00ULL, 0xffff0000ffff0000ULL, 0xffffffff00000000ULL};
+
+static constexpr uint64_t kAllRows{~uint64_t(0)};
+
+static uint64_t AddSizes(uint64_t lhs, uint64_t rhs) {
+  auto max{std::numeric_limits<uint64_t>::max()};
+  return lhs > max - rhs ? max : lhs + rhs;
+}
+
+}  // namespace
+
+constexpr unsigned CondDAG::kMaxTableAtoms;
+constexpr CondDAG::Node CondDAG::kNoNode;
+
+size_t CondDAG::NodeHash::operator()(const NodeData &node) const {
+  return llvm::hash_combine(static_cast<unsigned>(node.kind), node.lhs,
+                            node.rhs, node.atom);
+}
+
+CondDAG::CondDAG(clang::ASTContext &ctx) : ast_ctx(ctx) { Clear(); }
+
+void CondDAG::Clear() {
+  nodes.clear();
+  unique.clear();
+  exprs.clear();
+  sizes.clear();
+  simplified.clear();
+  // Constants always occupy the first two nodes
+  GetOrCreateNode(Kind::True, 0, 0, nullptr);
+  GetOrCreateNode(Kind::False, 0, 0, nullptr);
+}
+
+CondDAG::Node CondDAG::GetOrCreateNode(Kind kind, Node lhs, Node rhs,
+                                       clang::Expr *atom) {
+  NodeData data{kind, lhs, rhs, atom};
+  auto iter{unique.find(data)};
+  if (iter != unique.end()) {
+    return iter->second;
+  }
+  Node node = nodes.size();
+  nodes.push_back(data);
+  exprs.push_back(nullptr);
+  uint64_t size{1};
+  if (kind == Kind::Not) {
+    size = AddSizes(size, sizes[lhs]);
+  } else if (kind == Kind::And || kind == Kind::Or) {
+    size = AddSizes(AddSizes(size, sizes[lhs]), sizes[rhs]);
+  }
+  sizes.push_back(size);
+  unique[data] = node;
+  return node;
+}
+
+bool CondDAG::IsNegation(Node lhs, Node rhs) {
+  auto IsNotOf{[this](Node op, Node sub) {
+    return nodes[op].kind == Kind::Not && nodes[op].lhs == sub;
+  }};
+  return IsNotOf(lhs, rhs) || IsNotOf(rhs, lhs);
+}
+
+CondDAG::Node CondDAG::CreateTrue() { return 0; }
+
+CondDAG::Node CondDAG::CreateFalse() { return 1; }
+
+CondDAG::Node CondDAG::CreateAtom(clang::Expr *expr) {
+  CHECK(expr) << "Creating a condition atom without an expression";
+  return GetOrCreateNode(Kind::Atom, 0, 0, expr);
+}
+
+CondDAG::Node CondDAG::CreateNot(Node op) {
+  switch (nodes[op].kind) {
+    case Kind::True:
+      return CreateFalse();
+    case Kind::False:
+      return CreateTrue();
+    case Kind::Not:
+      return nodes[op].lhs;
+    default:
+      return GetOrCreateNode(Kind::Not, op, 0, nullptr);
+  }
+}
+
+CondDAG::Node CondDAG::CreateAnd(Node lhs, Node rhs) {
+  // Identity, annihilation and idempotence
+  if (nodes[lhs].kind == Kind::True || nodes[rhs].kind == Kind::False ||
+      lhs == rhs) {
+    return rhs;
+  }
+  if (nodes[rhs].kind == Kind::True || nodes[lhs].kind == Kind::False) {
+    return lhs;
+  }
+  // Complementation
+  if (IsNegation(lhs, rhs)) {
+    return CreateFalse();
+  }
+  // Absorption: `a && (a || b)` is `a`
+  auto Absorbs{[this](Node op, Node other) {
+    auto &data{nodes[other]};
+    return data.kind == Kind::Or && (data.lhs == op || data.rhs == op);
+  }};
+  if (Absorbs(lhs, rhs)) {
+    return lhs;
+  }
+  if (Absorbs(rhs, lhs)) {
+    return rhs;
+  }
+  // Commutativity
+  if (lhs > rhs) {
+    std::swap(lhs, rhs);
+  }
+  return GetOrCreateNode(Kind::And, lhs, rhs, nullptr);
+}
+
+CondDAG::Node CondDAG::CreateOr(Node lhs, Node rhs) {
+  // Identity, annihilation and idempotence
+  if (nodes[lhs].kind == Kind::False || nodes[rhs].kind == Kind::True ||
+      lhs == rhs) {
+    return rhs;
+  }
+  if (nodes[rhs].kind == Kind::False || nodes[lhs].kind == Kind::True) {
+    return lhs;
+  }
+  // Complementation
+  if (IsNegation(lhs, rhs)) {
+    return CreateTrue();
+  }
+  // Absorption: `a || (a && b)` is `a`
+  auto Absorbs{[this](Node op, Node other) {
+    auto &data{nodes[other]};
+    return data.kind == Kind::And && (data.lhs == op || data.rhs == op);
+  }};
+  if (Absorbs(lhs, rhs)) {
+    return lhs;
+  }
+  if (Absorbs(rhs, lhs)) {
+    return rhs;
+  }
+  // Factoring: `(a && b) || (a && !b)` is `a`. This is what joins the
+  // reaching conditions of the two sides of a diamond.
+  auto &l{nodes[lhs]};
+  auto &r{nodes[rhs]};
+  if (l.kind == Kind::And && r.kind == Kind::And) {
+    Node lops[]{l.lhs, l.rhs};
+    Node rops[]{r.lhs, r.rhs};
+    for (auto i = 0U; i < 2U; ++i) {
+      for (auto j = 0U; j < 2U; ++j) {
+        if (lops[i] == rops[j] && IsNegation(lops[1U - i], rops[1U - j])) {
+          return lops[i];
+        }
+      }
+    }
+  }
+  // Commutativity
+  if (lhs > rhs) {
+    std::swap(lhs, rhs);
+  }
+  return GetOrCreateNode(Kind::Or, lhs, rhs, nullptr);
+}
+
+const CondDAG::AtomSet &CondDAG::GetAtoms(Node node, AtomMap &atoms) {
+  auto iter{atoms.find(node)};
+  if (iter != atoms.end()) {
+    return iter->second;
+  }
+  AtomSet result;
+  auto data{nodes[node]};
+  switch (data.kind) {
+    case Kind::True:
+    case Kind::False:
+      break;
+
+    case Kind::Atom:
+      result.push_back(node);
+      break;
+
+    case Kind::Not:
+      result = GetAtoms(data.lhs, atoms);
+      break;
+
+    case Kind::And:
+    case Kind::Or: {
+      auto &lhs{GetAtoms(data.lhs, atoms)};
+      auto &rhs{GetAtoms(data.rhs, atoms)};
+      std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                     std::back_inserter(result));
+      if (result.size() > kMaxTableAtoms) {
+        result.resize(kMaxTableAtoms + 1);
+      }
+    } break;
+  }
+  return atoms[node] = std::move(result);
+}
+
+uint64_t CondDAG::GetTable(Node node, const AtomSet &atoms,
+                           std::unordered_map<Node, uint64_t> &tables) {
+  auto iter{tables.find(node)};
+  if (iter != tables.end()) {
+    return iter->second;
+  }
+  uint64_t result{0};
+  auto data{nodes[node]};
+  switch (data.kind) {
+    case Kind::True:
+      result = kAllRows;
+      break;
+
+    case Kind::False:
+      break;
+
+    case Kind::Atom: {
+      auto idx{std::lower_bound(atoms.begin(), atoms.end(), node) -
+               atoms.begin()};
+      result = kAtomRows[idx];
+    } break;
+
+    case Kind::Not:
+      result = ~GetTable(data.lhs, atoms, tables);
+      break;
+
+    case Kind::And:
+      result =
+          GetTable(data.lhs, atoms, tables) & GetTable(data.rhs, atoms, tables);
+      break;
+
+    case Kind::Or:
+      result =
+          GetTable(data.lhs, atoms, tables) | GetTable(data.rhs, atoms, tables);
+      break;
+  }
+  tables[node] = result;
+  return result;
+}
+
+// Shannon expansion of `table` over its atoms in order
+CondDAG::Node CondDAG::CreateFromTable(
+    uint64_t table, const AtomSet &atoms,
+    std::unordered_map<uint64_t, Node> &built) {
+  if (table == kAllRows) {
+    return CreateTrue();
+  }
+  if (!table) {
+    return CreateFalse();
+  }
+  auto iter{built.find(table)};
+  if (iter != built.end()) {
+    return iter->second;
+  }
+  for (auto i = 0U; i < atoms.size(); ++i) {
+    // Cofactors of `table` for the atom being false and true
+    auto shift{1U << i};
+    auto lo{table & ~kAtomRows[i]};
+    auto hi{table & kAtomRows[i]};
+    auto table0{lo | (lo << shift)};
+    auto table1{hi | (hi >> shift)};
+    if (table0 == table1) {
+      continue;
+    }
+    auto atom{atoms[i]};
+    auto cond0{CreateFromTable(table0, atoms, built)};
+    auto cond1{CreateFromTable(table1, atoms, built)};
+    Node result;
+    if (cond1 == CreateTrue()) {
+      result = CreateOr(atom, cond0);
+    } else if (cond0 == CreateFalse()) {
+      result = CreateAnd(atom, cond1);
+    } else if (cond1 == CreateFalse()) {
+      result = CreateAnd(CreateNot(atom), cond0);
+    } else if (cond0 == CreateTrue()) {
+      result = CreateOr(CreateNot(atom), cond1);
+    } else {
+      result = CreateOr(CreateAnd(atom, cond1),
+                        CreateAnd(CreateNot(atom), cond0));
+    }
+    built[table] = result;
+    return result;
+  }
+  LOG(FATAL) << "Truth table does not depend on any atom";
+  return CreateFalse();
+}
+
+CondDAG::Node CondDAG::Simplify(Node node) {
+  AtomMap atoms;
+  return Simplify(node, atoms);
+}
+
+CondDAG::Node CondDAG::Simplify(Node node, AtomMap &atoms) {
+  auto iter{simplified.find(node)};
+  if (iter != simplified.end()) {
+    return iter->second;
+  }
+  Node result;
+  auto &node_atoms{GetAtoms(node, atoms)};
+  if (node_atoms.size() <= kMaxTableAtoms) {
+    std::unordered_map<Node, uint64_t> tables;
+    std::unordered_map<uint64_t, Node> built;
+    result = CreateFromTable(GetTable(node, node_atoms, tables), node_atoms,
+                             built);
+  } else {
+    // Too many atoms for a table, so only the operands are simplified
+    auto data{nodes[node]};
+    switch (data.kind) {
+      case Kind::Not:
+        result = CreateNot(Simplify(data.lhs, atoms));
+        break;
+
+      case Kind::And:
+        result =
+            CreateAnd(Simplify(data.lhs, atoms), Simplify(data.rhs, atoms));
+        break;
+
+      case Kind::Or:
+        result =
+            CreateOr(Simplify(data.lhs, atoms), Simplify(data.rhs, atoms));
+        break;
+
+      default:
+        result = node;
+        break;
+    }
+  }
+  if (sizes[result] > sizes[node]) {
+    result = node;
+  }
+  simplified[node] = result;
+  simplified.emplace(result, result);
+  return result;
+}
+
+bool CondDAG::GetTables(Node lhs, Node rhs, uint64_t &ltable,
+                        uint64_t &rtable) {
+  AtomMap atoms;
+  auto &latoms{GetAtoms(lhs, atoms)};
+  auto &ratoms{GetAtoms(rhs, atoms)};
+  AtomSet both;
+  std::set_union(latoms.begin(), latoms.end(), ratoms.begin(), ratoms.end(),
+                 std::back_inserter(both));
+  if (both.size() > kMaxTableAtoms) {
+    return false;
+  }
+  std::unordered_map<Node, uint64_t> tables;
+  ltable = GetTable(lhs, both, tables);
+  rtable = GetTable(rhs, both, tables);
+  return true;
+}
+
+bool CondDAG::IsEquivalent(Node lhs, Node rhs) {
+  uint64_t ltable, rtable;
+  return lhs == rhs ||
+         (GetTables(lhs, rhs, ltable, rtable) && ltable == rtable);
+}
+
+bool CondDAG::IsDisjoint(Node lhs, Node rhs) {
+  uint64_t ltable, rtable;
+  return IsNegation(lhs, rhs) ||
+         (GetTables(lhs, rhs, ltable, rtable) && !(ltable & rtable));
+}
+
+clang::Expr *CondDAG::GetOrCreateExpr(Node node) {
+  if (exprs[node]) {
+    return exprs[node];
+  }
+  // Parenthesize nested binary operands, so that the printed
+  // condition preserves the structure of the DAG.
+  auto GetOperandExpr{[this](Node op) {
+    auto expr{GetOrCreateExpr(op)};
+    auto kind{nodes[op].kind};
+    if (kind == Kind::And || kind == Kind::Or) {
+      expr = CreateParenExpr(ast_ctx, expr);
+    }
+    return expr;
+  }};
+
+  clang::Expr *result{nullptr};
+  auto &data{nodes[node]};
+  switch (data.kind) {
+    case Kind::True:
+      result = CreateTrueExpr(ast_ctx);
+      break;
+
+    case Kind::False:
+      result = CreateFalseExpr(ast_ctx);
+      break;
+
+    case Kind::Atom:
+      result = data.atom;
+      break;
+
+    case Kind::Not:
+      result = CreateNotExpr(ast_ctx, GetOrCreateExpr(data.lhs));
+      break;
+
+    case Kind::And:
+      result = CreateAndExpr(ast_ctx, GetOperandExpr(data.lhs),
+                             GetOperandExpr(data.rhs));
+      break;
+
+    case Kind::Or:
+      result = CreateOrExpr(ast_ctx, GetOperandExpr(data.lhs),
+                            GetOperandExpr(data.rhs));
+      break;
+  }
+
+  exprs[node] = result;
+  return result;
+}
+
+}  // namespace rellic
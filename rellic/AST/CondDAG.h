@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Expr.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace rellic {
+
+// A hash-consed DAG of boolean conditions over opaque `clang::Expr` atoms.
+// Structurally equal conditions are represented by the same node, and a
+// few cheap boolean identities are applied while nodes are created. Nodes
+// are turned into `clang::Expr`s only when requested by `GetOrCreateExpr`.
+class CondDAG {
+ public:
+  using Node = unsigned;
+
+  // Never a node of the DAG, for per-block tables of nodes to mark the
+  // blocks that have none yet
+  static constexpr Node kNoNode{std::numeric_limits<Node>::max()};
+
+  enum class Kind : unsigned { True, False, Atom, Not, And, Or };
+
+ private:
+  struct NodeData {
+    Kind kind;
+    Node lhs;
+    Node rhs;
+    clang::Expr *atom;
+
+    bool operator==(const NodeData &that) const {
+      return kind == that.kind && lhs == that.lhs && rhs == that.rhs &&
+             atom == that.atom;
+    }
+  };
+
+  struct NodeHash {
+    size_t operator()(const NodeData &node) const;
+  };
+
+  clang::ASTContext &ast_ctx;
+
+  std::vector<NodeData> nodes;
+  std::unordered_map<NodeData, Node, NodeHash> unique;
+  std::vector<clang::Expr *> exprs;
+  // Sizes of the trees that nodes print as, saturated
+  std::vector<uint64_t> sizes;
+  std::unordered_map<Node, Node> simplified;
+
+  Node GetOrCreateNode(Kind kind, Node lhs, Node rhs, clang::Expr *atom);
+
+  bool IsNegation(Node lhs, Node rhs);
+
+  // Conditions over at most this many atoms are simplified through their
+  // truth tables, which fit in 64 bits
+  static constexpr unsigned kMaxTableAtoms{6};
+  // Atoms of a node in node order. Sets that would exceed
+  // `kMaxTableAtoms` stop growing one past it.
+  using AtomSet = llvm::SmallVector<Node, kMaxTableAtoms + 1>;
+  using AtomMap = std::unordered_map<Node, AtomSet>;
+
+  const AtomSet &GetAtoms(Node node, AtomMap &atoms);
+  uint64_t GetTable(Node node, const AtomSet &atoms,
+                    std::unordered_map<Node, uint64_t> &tables);
+  Node CreateFromTable(uint64_t table, const AtomSet &atoms,
+                       std::unordered_map<uint64_t, Node> &built);
+  Node Simplify(Node node, AtomMap &atoms);
+  // Truth tables of `lhs` and `rhs` over the atoms of both. Returns
+  // `false` if there are too many atoms.
+  bool GetTables(Node lhs, Node rhs, uint64_t &ltable, uint64_t &rtable);
+
+ public:
+  CondDAG(clang::ASTContext &ctx);
+
+  Kind GetKind(Node node) { return nodes[node].kind; }
+  Node GetLHS(Node node) { return nodes[node].lhs; }
+  Node GetRHS(Node node) { return nodes[node].rhs; }
+  clang::Expr *GetAtom(Node node) { return nodes[node].atom; }
+
+  size_t Size() { return nodes.size(); }
+  // Number of nodes that `node` would have as a tree
+  uint64_t GetSize(Node node) { return sizes[node]; }
+
+  Node CreateTrue();
+  Node CreateFalse();
+  Node CreateAtom(clang::Expr *expr);
+  Node CreateNot(Node op);
+  Node CreateAnd(Node lhs, Node rhs);
+  Node CreateOr(Node lhs, Node rhs);
+
+  // Returns an equivalent node that is no larger than `node`. Parts over
+  // few atoms are rebuilt from their truth tables, which catches the
+  // redundancy that the identities of `CreateAnd` and `CreateOr` miss.
+  // Only boolean structure is considered; atoms stay opaque.
+  Node Simplify(Node node);
+
+  // Returns `true` if `lhs` and `rhs` are known to be equivalent, or known
+  // to never hold together. Both only consider boolean structure, and
+  // give up on conditions over more than `kMaxTableAtoms` atoms.
+  bool IsEquivalent(Node lhs, Node rhs);
+  bool IsDisjoint(Node lhs, Node rhs);
+
+  // Returns a `clang::Expr` equivalent of `node`. Expressions are
+  // memoized, so equal nodes share the same `clang::Expr`.
+  clang::Expr *GetOrCreateExpr(Node node);
+
+  // Drops all nodes and memoized expressions
+  void Clear();
+};
+
+}  // namespace rellic
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/CondEngine.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace rellic {
+
+namespace {
+
+// Terminals sort after all variables
+static constexpr unsigned kNoVar = std::numeric_limits<unsigned>::max();
+
+}  // namespace
+
+constexpr BDD::Node BDD::kFalse;
+constexpr BDD::Node BDD::kTrue;
+
+BDD::BDD(size_t max_nodes) : max_nodes(max_nodes) { Clear(); }
+
+void BDD::Clear() {
+  overflow = false;
+  nodes.clear();
+  unique.clear();
+  ite_cache.clear();
+  nodes.push_back({kNoVar, kFalse, kFalse});
+  nodes.push_back({kNoVar, kTrue, kTrue});
+}
+
+BDD::Node BDD::GetCofactor(Node node, unsigned var, bool value) const {
+  if (GetVar(node) != var) {
+    return node;
+  }
+  return value ? nodes[node].high : nodes[node].low;
+}
+
+BDD::Node BDD::MakeNode(unsigned var, Node low, Node high) {
+  if (low == high) {
+    return low;
+  }
+  Triple key{var, low, high};
+  auto iter{unique.find(key)};
+  if (iter != unique.end()) {
+    return iter->second;
+  }
+  if (nodes.size() >= max_nodes) {
+    overflow = true;
+    return kFalse;
+  }
+  Node node{static_cast<Node>(nodes.size())};
+  nodes.push_back({var, low, high});
+  unique[key] = node;
+  return node;
+}
+
+BDD::Node BDD::Var(unsigned var) {
+  CHECK_NE(var, kNoVar);
+  return MakeNode(var, kFalse, kTrue);
+}
+
+BDD::Node BDD::Ite(Node cond, Node then, Node other) {
+  if (overflow) {
+    return kFalse;
+  }
+  if (cond == kTrue || then == other) {
+    return then;
+  }
+  if (cond == kFalse) {
+    return other;
+  }
+  if (then == kTrue && other == kFalse) {
+    return cond;
+  }
+  Triple key{cond, then, other};
+  auto iter{ite_cache.find(key)};
+  if (iter != ite_cache.end()) {
+    return iter->second;
+  }
+  auto var{std::min({GetVar(cond), GetVar(then), GetVar(other)})};
+  auto high{Ite(GetCofactor(cond, var, true), GetCofactor(then, var, true),
+                GetCofactor(other, var, true))};
+  auto low{Ite(GetCofactor(cond, var, false), GetCofactor(then, var, false),
+               GetCofactor(other, var, false))};
+  auto result{MakeNode(var, low, high)};
+  if (!overflow) {
+    ite_cache[key] = result;
+  }
+  return result;
+}
+
+BDD::Node CondEngine::Convert(z3::expr expr, bool &pure) {
+  auto id{Z3_get_ast_id(expr.ctx(), expr)};
+  auto iter{conds.find(id)};
+  if (iter != conds.end()) {
+    pure = propositional[id];
+    return iter->second.second;
+  }
+
+  auto result{BDD::kFalse};
+  auto is_connective{expr.is_app()};
+  pure = true;
+  if (expr.is_true()) {
+    result = BDD::kTrue;
+  } else if (expr.is_false()) {
+    result = BDD::kFalse;
+  } else if (is_connective) {
+    auto num_args{expr.num_args()};
+    std::vector<BDD::Node> args;
+    auto BoolArgs = [&] {
+      for (auto i = 0U; i < num_args; ++i) {
+        if (!expr.arg(i).is_bool()) {
+          return false;
+        }
+      }
+      return true;
+    };
+    auto ConvertArgs = [&] {
+      for (auto i = 0U; i < num_args; ++i) {
+        bool arg_pure;
+        args.push_back(Convert(expr.arg(i), arg_pure));
+        pure = pure && arg_pure;
+      }
+    };
+    switch (expr.decl().decl_kind()) {
+      case Z3_OP_NOT:
+        ConvertArgs();
+        result = bdd.Not(args[0]);
+        break;
+      case Z3_OP_AND:
+        ConvertArgs();
+        result = BDD::kTrue;
+        for (auto arg : args) {
+          result = bdd.And(result, arg);
+        }
+        break;
+      case Z3_OP_OR:
+        ConvertArgs();
+        for (auto arg : args) {
+          result = bdd.Or(result, arg);
+        }
+        break;
+      case Z3_OP_XOR:
+        ConvertArgs();
+        for (auto arg : args) {
+          result = bdd.Xor(result, arg);
+        }
+        break;
+      case Z3_OP_IMPLIES:
+        ConvertArgs();
+        result = bdd.Or(bdd.Not(args[0]), args[1]);
+        break;
+      case Z3_OP_IFF:
+        ConvertArgs();
+        result = bdd.Not(bdd.Xor(args[0], args[1]));
+        break;
+      case Z3_OP_EQ:
+      case Z3_OP_DISTINCT:
+        is_connective = num_args == 2 && BoolArgs();
+        if (is_connective) {
+          ConvertArgs();
+          result = bdd.Xor(args[0], args[1]);
+          if (expr.decl().decl_kind() == Z3_OP_EQ) {
+            result = bdd.Not(result);
+          }
+        }
+        break;
+      case Z3_OP_ITE:
+        is_connective = BoolArgs();
+        if (is_connective) {
+          ConvertArgs();
+          result = bdd.Ite(args[0], args[1], args[2]);
+        }
+        break;
+      default:
+        is_connective = false;
+        break;
+    }
+  }
+  if (!is_connective && !expr.is_true() && !expr.is_false()) {
+    // Structurally equal atoms have the same ID, and share a variable
+    auto atom{atoms.emplace(id, static_cast<unsigned>(atoms.size()))};
+    result = bdd.Var(atom.first->second);
+    pure = expr.is_const() &&
+           expr.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+  }
+  conds.emplace(id, std::make_pair(expr, result));
+  propositional[id] = pure;
+  return result;
+}
+
+bool CondEngine::GetOrCreate(z3::expr expr, BDD::Node &node, bool &pure) {
+  if (!expr.is_bool()) {
+    return false;
+  }
+  node = Convert(expr, pure);
+  if (bdd.HasOverflowed()) {
+    // Conditions converted since the overflow are meaningless
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+bool CondEngine::DecideValid(z3::expr expr, bool &valid) {
+  BDD::Node node;
+  bool pure;
+  if (!GetOrCreate(expr, node, pure)) {
+    return false;
+  }
+  valid = node == BDD::kTrue;
+  return valid || node == BDD::kFalse || pure;
+}
+
+bool CondEngine::DecideSat(z3::expr expr, bool &sat) {
+  BDD::Node node;
+  bool pure;
+  if (!GetOrCreate(expr, node, pure)) {
+    return false;
+  }
+  sat = node != BDD::kFalse;
+  return !sat || node == BDD::kTrue || pure;
+}
+
+void CondEngine::Clear() {
+  bdd.Clear();
+  conds.clear();
+  atoms.clear();
+  propositional.clear();
+}
+
+size_t CondEngine::GetMemoryUsage() const {
+  return bdd.GetNumNodes() * 3 * sizeof(unsigned) +
+         conds.size() * (sizeof(unsigned) + sizeof(z3::expr) +
+                         sizeof(BDD::Node)) +
+         atoms.size() * 2 * sizeof(unsigned) +
+         propositional.size() * (sizeof(unsigned) + sizeof(bool));
+}
+
+}  // namespace rellic
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <z3++.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rellic {
+
+// Reduced ordered binary decision diagrams. Equivalent functions over the
+// same variables are the same node, so equivalence is a comparison.
+// Variables are ordered by their number.
+class BDD {
+ public:
+  using Node = unsigned;
+
+  static constexpr Node kFalse = 0;
+  static constexpr Node kTrue = 1;
+
+ private:
+  struct NodeData {
+    unsigned var;
+    Node low;
+    Node high;
+  };
+
+  struct TripleHash {
+    size_t operator()(
+        const std::tuple<unsigned, unsigned, unsigned> &key) const {
+      auto a{static_cast<uint64_t>(std::get<0>(key))};
+      auto b{static_cast<uint64_t>(std::get<1>(key))};
+      auto c{static_cast<uint64_t>(std::get<2>(key))};
+      return static_cast<size_t>((a * 0x9e3779b97f4a7c15ULL) ^
+                                 (b * 0xc2b2ae3d27d4eb4fULL) ^ c);
+    }
+  };
+
+  using Triple = std::tuple<unsigned, unsigned, unsigned>;
+
+  size_t max_nodes;
+  bool overflow = false;
+  std::vector<NodeData> nodes;
+  std::unordered_map<Triple, Node, TripleHash> unique;
+  std::unordered_map<Triple, Node, TripleHash> ite_cache;
+
+  unsigned GetVar(Node node) const { return nodes[node].var; }
+  Node GetCofactor(Node node, unsigned var, bool value) const;
+  Node MakeNode(unsigned var, Node low, Node high);
+
+ public:
+  // Creates a manager that overflows once it holds `max_nodes` nodes
+  BDD(size_t max_nodes = 1U << 20);
+
+  Node Var(unsigned var);
+  Node Ite(Node cond, Node then, Node other);
+  Node Not(Node node) { return Ite(node, kFalse, kTrue); }
+  Node And(Node lhs, Node rhs) { return Ite(lhs, rhs, kFalse); }
+  Node Or(Node lhs, Node rhs) { return Ite(lhs, kTrue, rhs); }
+  Node Xor(Node lhs, Node rhs) { return Ite(lhs, Not(rhs), rhs); }
+
+  // Returns `true` if the manager ran out of nodes. Results of operations
+  // are meaningless then, until `Clear` is called.
+  bool HasOverflowed() const { return overflow; }
+  size_t GetNumNodes() const { return nodes.size(); }
+  void Clear();
+};
+
+// Decides queries about conditions from their boolean structure alone.
+// Maximal subterms that aren't boolean connectives, like comparisons of
+// bit-vectors, become opaque atoms: BDD variables numbered by their first
+// occurrence. Conditions are converted once per `z3::expr`.
+//
+// A condition whose BDD is constant is decided, with whatever meaning its
+// atoms have. Otherwise it is only decided if all its atoms are boolean
+// constants, since other atoms may constrain each other. Queries that
+// aren't decided need a solver.
+class CondEngine {
+ private:
+  BDD bdd;
+  // Atom number and BDD of every converted expression, keyed by its ID.
+  // Expressions are kept alongside so that their IDs stay taken.
+  std::unordered_map<unsigned, std::pair<z3::expr, BDD::Node>> conds;
+  std::unordered_map<unsigned, unsigned> atoms;
+  // Expressions whose atoms are all boolean constants
+  std::unordered_map<unsigned, bool> propositional;
+
+  BDD::Node Convert(z3::expr expr, bool &pure);
+
+ public:
+  // Returns the BDD of `expr`, and whether all its atoms are boolean
+  // constants in `pure`. Returns `false` if the BDD got too big.
+  bool GetOrCreate(z3::expr expr, BDD::Node &node, bool &pure);
+
+  BDD &GetBDD() { return bdd; }
+
+  // Returns `true` if the validity of `expr` is decided, and the answer
+  // in `valid`
+  bool DecideValid(z3::expr expr, bool &valid);
+  // Returns `true` if the satisfiability of `expr` is decided, and the
+  // answer in `sat`
+  bool DecideSat(z3::expr expr, bool &sat);
+
+  // Drops all conditions, to free memory
+  void Clear();
+  size_t GetMemoryUsage() const;
+};
+
+}  // namespace rellic
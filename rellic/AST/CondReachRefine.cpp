@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/AST/CondReachRefine.h"
+
+#include <glog/logging.h>
+
+#include "rellic/AST/CompoundEditor.h"
+#include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/Stats.h"
+
+namespace rellic {
+
+char CondReachRefine::ID = 0;
+
+CondReachRefine::CondReachRefine(clang::ASTContext &ctx,
+                                 rellic::IRToASTVisitor &ast_gen,
+                                 rellic::Z3Solver &solver)
+    : ModulePass(CondReachRefine::ID),
+      ast_ctx(&ctx),
+      ast_gen(&ast_gen),
+      solver(&solver),
+      z3_ctx(&solver.GetZ3Context()),
+      z3_gen(&solver.GetZ3ConvVisitor()) {}
+
+clang::CompoundStmt *CondReachRefine::ApplySubstitutions(
+    clang::CompoundStmt *compound) {
+  CompoundEditor editor(*ast_ctx, compound);
+  if (!editor.Substitute(substitutions)) {
+    return compound;
+  }
+  changed = true;
+  return editor.Commit();
+}
+
+bool CondReachRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
+  auto Substitute = [this](clang::Stmt *stmt, clang::Stmt *sub) {
+    TransformVisitor<CondReachRefine>::Substitute(stmt, sub);
+  };
+  // Create if-then-else statements first, like `cbr`
+  IfConds ifs(*z3_ctx);
+  GetIfConds(compound, *z3_gen, ifs, &cache);
+  auto num_before{num_substituted};
+  CreateIfThenElseStmts(*ast_ctx, *solver, proven, ifs, Substitute);
+  auto edited{ApplySubstitutions(compound)};
+  // Then create else-if cascades from the if statements that are left,
+  // like `rbr`. Merged if statements keep the condition of their first
+  // statement, so their conditions are found in `cache`.
+  IfConds rest(*z3_ctx);
+  auto elifs{&ifs};
+  if (num_substituted != num_before) {
+    GetIfConds(edited, *z3_gen, rest, &cache);
+    elifs = &rest;
+  }
+  CreateIfElseStmts(*ast_ctx, *solver, *elifs, Substitute);
+  edited = ApplySubstitutions(edited);
+  if (edited != compound) {
+    Substitute(compound, edited);
+  }
+  return true;
+}
+
+bool CondReachRefine::TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+  // Charge Z3 queries to the budget of `fdecl`
+  solver->SetFunction(fdecl);
+  proven.clear();
+  cache.clear();
+  // Prove the if-then-else queries of all compounds concurrently, unless
+  // the function converged during an earlier round and won't be visited
+  auto tracker{ChangeTracker::Get(*ast_ctx)};
+  if (solver->GetNumThreads() > 1 && fdecl->hasBody() &&
+      (!tracker || tracker->IsDirty(fdecl))) {
+    ProveIfThenElseAhead(fdecl->getBody(), *solver, proven, &cache);
+  }
+  return TransformVisitor<CondReachRefine>::TraverseFunctionDecl(fdecl);
+}
+
+bool CondReachRefine::runOnModule(llvm::Module &module) {
+  LOG(INFO) << "Condition- and reachability-based refinement";
+  PassStats stats("CondReachRefine", *ast_ctx);
+  Initialize();
+  TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.SetMapBytes(z3_gen->GetMemoryUsage());
+  stats.Finish(substitutions.size(), changed);
+  return changed;
+}
+
+llvm::ModulePass *createCondReachRefinePass(clang::ASTContext &ctx,
+                                            rellic::IRToASTVisitor &gen,
+                                            rellic::Z3Solver &solver) {
+  return new CondReachRefine(ctx, gen, solver);
+}
+
+}  // namespace rellic
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/IfConds.h"
+#include "rellic/AST/TransformVisitor.h"
+#include "rellic/AST/Z3ConvVisitor.h"
+#include "rellic/AST/Z3Solver.h"
+
+namespace rellic {
+
+// Condition-based refinement immediately followed by reachability-based
+// refinement of every compound, as `cbr` and `rbr` would do in sequence.
+// Conditions are converted to Z3, simplified and simulated once for both.
+class CondReachRefine : public llvm::ModulePass,
+                        public TransformVisitor<CondReachRefine> {
+ private:
+  clang::ASTContext *ast_ctx;
+  rellic::IRToASTVisitor *ast_gen;
+  rellic::Z3Solver *solver;
+  z3::context *z3_ctx;
+  rellic::Z3ConvVisitor *z3_gen;
+
+  ProofMap proven;
+  IfCondCache cache;
+
+  // Applies `substitutions` to `compound` and returns the edited compound
+  clang::CompoundStmt *ApplySubstitutions(clang::CompoundStmt *compound);
+
+ public:
+  static char ID;
+
+  CondReachRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen,
+                  rellic::Z3Solver &solver);
+
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl);
+  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+
+  bool runOnModule(llvm::Module &module) override;
+};
+
+llvm::ModulePass *createCondReachRefinePass(clang::ASTContext &ctx,
+                                            rellic::IRToASTVisitor &ast_gen,
+                                            rellic::Z3Solver &solver);
+}  // namespace rellic
+
+namespace llvm {
+void initializeCondReachRefinePass(PassRegistry &);
+}
@@ -17,11 +17,195 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/ChangeTracker.h"
 #include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/Stats.h"
 #include "rellic/AST/Util.h"
 
 namespace rellic {
 
+namespace {
+
+// Removes local variables that are never read, along with their
+// declarations and the statements that assign them. Def-use chains are
+// built in one walk over the body: every declaration and `var = ...`
+// statement in a compound is a definition, and every other reference to
+// a variable is a read. Removing a definition releases the reads of its
+// value, so chains of dead variables are removed from a worklist without
+// walking the body again. Definitions are edited in place; values with
+// side effects stay behind as statements, and the rest leave `nullptr`
+// children for `EliminateDeadStmt` to drop.
+class DeadVarElim {
+ private:
+  clang::ASTContext &ctx;
+
+  struct Def {
+    // Child of a compound that holds the definition
+    clang::Stmt **slot;
+    clang::VarDecl *var;
+    clang::Expr *value;
+    bool pure;
+    std::vector<clang::VarDecl *> reads;
+  };
+
+  struct VarInfo {
+    unsigned reads = 0;
+    bool declared = false;
+    std::vector<unsigned> defs;
+  };
+
+  std::vector<Def> defs;
+  std::unordered_map<clang::VarDecl *, VarInfo> vars;
+  static constexpr size_t kNone = ~size_t(0);
+  // Index of the definition whose value is being walked, if any
+  size_t current = kNone;
+
+  clang::VarDecl *GetLocal(clang::Decl *decl) {
+    auto var{clang::dyn_cast_or_null<clang::VarDecl>(decl)};
+    return var && var->isLocalVarDecl() ? var : nullptr;
+  }
+
+  void Walk(clang::Stmt *stmt) {
+    if (!stmt) {
+      return;
+    }
+    if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(stmt)) {
+      if (auto var = GetLocal(ref->getDecl())) {
+        if (current == kNone) {
+          ++vars[var].reads;
+        } else if (var != defs[current].var || !defs[current].pure) {
+          // Pure values that read their own variable, as in `x = x + 1`,
+          // don't keep it alive
+          ++vars[var].reads;
+          defs[current].reads.push_back(var);
+        }
+      }
+    } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+      for (auto it = compound->body_begin(); it != compound->body_end();
+           ++it) {
+        WalkChild(it);
+      }
+      return;
+    }
+    for (auto child : stmt->children()) {
+      Walk(child);
+    }
+  }
+
+  // Walks the child of a compound held by `slot`
+  void WalkChild(clang::Stmt **slot) {
+    clang::VarDecl *var{nullptr};
+    clang::Expr *value{nullptr};
+    auto stmt{*slot};
+    if (auto decl = clang::dyn_cast_or_null<clang::DeclStmt>(stmt)) {
+      if (decl->isSingleDecl()) {
+        var = GetLocal(decl->getSingleDecl());
+        value = var ? var->getInit() : nullptr;
+      }
+    } else if (auto binop = clang::dyn_cast_or_null<clang::BinaryOperator>(
+                   stmt)) {
+      auto ref{clang::dyn_cast<clang::DeclRefExpr>(binop->getLHS())};
+      if (binop->getOpcode() == clang::BO_Assign && ref) {
+        var = GetLocal(ref->getDecl());
+        value = binop->getRHS();
+      }
+    }
+    if (!var) {
+      Walk(stmt);
+      return;
+    }
+
+    auto &info{vars[var]};
+    info.declared |= clang::isa<clang::DeclStmt>(stmt);
+    // Stores to volatile variables are observable
+    if (var->getType().isVolatileQualified()) {
+      ++info.reads;
+    }
+    info.defs.push_back(defs.size());
+    auto pure{!value || !value->HasSideEffects(ctx)};
+    defs.push_back({slot, var, value, pure, {}});
+    current = defs.size() - 1;
+    Walk(value);
+    current = kNone;
+  }
+
+ public:
+  DeadVarElim(clang::ASTContext &ctx) : ctx(ctx) {}
+
+  // Returns the number of variables removed from `fdefn`
+  unsigned Run(clang::FunctionDecl *fdefn) {
+    Walk(fdefn->getBody());
+
+    std::vector<clang::VarDecl *> worklist;
+    for (auto &var : vars) {
+      if (var.second.declared && !var.second.reads) {
+        worklist.push_back(var.first);
+      }
+    }
+
+    auto num_removed{0U};
+    while (!worklist.empty()) {
+      auto var{worklist.back()};
+      worklist.pop_back();
+      for (auto idx : vars[var].defs) {
+        auto &def{defs[idx]};
+        if (!def.pure) {
+          *def.slot = def.value;
+          continue;
+        }
+        *def.slot = nullptr;
+        for (auto read : def.reads) {
+          auto &info{vars[read]};
+          if (!--info.reads && info.declared) {
+            worklist.push_back(read);
+          }
+        }
+      }
+      var->getDeclContext()->removeDecl(var);
+      ++num_removed;
+    }
+    return num_removed;
+  }
+};
+
+}  // namespace
+
+clang::Stmt *EliminateDeadStmt(clang::ASTContext &ctx, clang::Stmt *stmt) {
+  if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+    llvm::APSInt val;
+    bool is_const = ifstmt->getCond()->isIntegerConstantExpr(val, ctx);
+    auto compound = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getThen());
+    bool is_empty = compound ? compound->body_empty() : false;
+    if ((is_const && !val.getBoolValue()) || is_empty) {
+      return nullptr;
+    }
+  } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    std::vector<clang::Stmt *> new_body;
+    for (auto stmt : compound->body()) {
+      // Filter out nullptr statements
+      if (!stmt) {
+        continue;
+      }
+      // Add only necessary statements
+      if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+        if (expr->HasSideEffects(ctx)) {
+          new_body.push_back(stmt);
+        }
+      } else {
+        new_body.push_back(stmt);
+      }
+    }
+    // Create the a new compound
+    if (new_body.size() < compound->size()) {
+      return CreateCompoundStmt(ctx, new_body);
+    }
+  }
+  return stmt;
+}
+
 char DeadStmtElim::ID = 0;
 
 DeadStmtElim::DeadStmtElim(clang::ASTContext &ctx,
@@ -32,44 +216,44 @@ DeadStmtElim::DeadStmtElim(clang::ASTContext &ctx,
 
 bool DeadStmtElim::VisitIfStmt(clang::IfStmt *ifstmt) {
   // DLOG(INFO) << "VisitIfStmt";
-  llvm::APSInt val;
-  bool is_const = ifstmt->getCond()->isIntegerConstantExpr(val, *ast_ctx);
-  auto compound = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getThen());
-  bool is_empty = compound ? compound->body_empty() : false;
-  if ((is_const && !val.getBoolValue()) || is_empty) {
-    substitutions[ifstmt] = nullptr;
+  auto sub = EliminateDeadStmt(*ast_ctx, ifstmt);
+  if (sub != ifstmt) {
+    Substitute(ifstmt, sub);
   }
   return true;
 }
 
 bool DeadStmtElim::VisitCompoundStmt(clang::CompoundStmt *compound) {
   // DLOG(INFO) << "VisitCompoundStmt";
-  std::vector<clang::Stmt *> new_body;
-  for (auto stmt : compound->body()) {
-    // Filter out nullptr statements
-    if (!stmt) {
-      continue;
-    }
-    // Add only necessary statements
-    if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
-      if (expr->HasSideEffects(*ast_ctx)) {
-        new_body.push_back(stmt);
+  auto sub = EliminateDeadStmt(*ast_ctx, compound);
+  if (sub != compound) {
+    Substitute(compound, sub);
+  }
+  return true;
+}
+
+bool DeadStmtElim::TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+  auto tracker{ChangeTracker::Get(*ast_ctx)};
+  if (fdecl->doesThisDeclarationHaveABody() &&
+      (!tracker || tracker->IsDirty(fdecl))) {
+    if (auto num_removed = DeadVarElim(*ast_ctx).Run(fdecl)) {
+      num_dead_vars += num_removed;
+      changed = true;
+      if (tracker) {
+        tracker->MarkChanged(fdecl);
       }
-    } else {
-      new_body.push_back(stmt);
     }
   }
-  // Create the a new compound
-  if (changed || new_body.size() < compound->size()) {
-    substitutions[compound] = CreateCompoundStmt(*ast_ctx, new_body);
-  }
-  return true;
+  return TransformVisitor<DeadStmtElim>::TraverseFunctionDecl(fdecl);
 }
 
 bool DeadStmtElim::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Eliminating dead statements";
+  PassStats stats("DeadStmtElim", *ast_ctx);
   Initialize();
+  num_dead_vars = 0;
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size() + num_dead_vars, changed);
   return changed;
 }
 
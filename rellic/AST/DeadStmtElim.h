@@ -30,18 +30,28 @@ class DeadStmtElim : public llvm::ModulePass,
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
+  size_t num_dead_vars;
 
  public:
   static char ID;
 
   DeadStmtElim(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
 
+  // Removes local variables that are never read before the body of
+  // `fdecl` is traversed
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl);
+
   bool VisitIfStmt(clang::IfStmt *ifstmt);
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Returns `nullptr` if `stmt` is an `if` that never executes anything, a
+// copy of a compound `stmt` without its null and side-effect free children,
+// or `stmt` itself if it is not dead.
+clang::Stmt *EliminateDeadStmt(clang::ASTContext &ctx, clang::Stmt *stmt);
+
 llvm::ModulePass *createDeadStmtElimPass(clang::ASTContext &ctx,
                                          rellic::IRToASTVisitor &ast_gen);
 }  // namespace rellic
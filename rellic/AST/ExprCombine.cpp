@@ -18,38 +18,33 @@
 #include <glog/logging.h>
 
 #include "rellic/AST/ExprCombine.h"
-#include "rellic/AST/InferenceRule.h"
+#include "rellic/AST/Stats.h"
 #include "rellic/AST/Util.h"
 
 namespace rellic {
 
 namespace {
 
-using namespace clang::ast_matchers;
+using namespace rellic::matchers;
 
-static const auto zero_int_lit = integerLiteral(equals(0));
+static const auto zero_int_lit = Is<clang::IntegerLiteral>(Equals(0));
+
+static const auto addr_of_op =
+    Is<clang::UnaryOperator>(HasOpcode(clang::UO_AddrOf));
 
 // Matches `(&base)[0]` and subs it for `base`
 class ArraySubscriptAddrOfRule : public InferenceRule {
  public:
-  ArraySubscriptAddrOfRule()
-      : InferenceRule(arraySubscriptExpr(
-            stmt().bind("sub"),
-            hasBase(parenExpr(has(unaryOperator(stmt().bind("base"))))),
-            hasIndex(zero_int_lit))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto op = result.Nodes.getNodeAs<clang::UnaryOperator>("base");
-    if (op->getOpcode() == clang::UO_AddrOf) {
-      match = result.Nodes.getNodeAs<clang::ArraySubscriptExpr>("sub");
-    }
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::ArraySubscriptExpr>(
+        Base(Is<clang::ParenExpr>(SubExpr(addr_of_op))),
+        Index(zero_int_lit));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto sub = clang::cast<clang::ArraySubscriptExpr>(stmt);
-    CHECK(sub == match) << "Substituted ArraySubscriptExpr is not the matched "
-                           "ArraySubscriptExpr!";
     auto paren = clang::cast<clang::ParenExpr>(sub->getBase());
     auto addr_of = clang::cast<clang::UnaryOperator>(paren->getSubExpr());
     return addr_of->getSubExpr();
@@ -59,22 +54,18 @@ class ArraySubscriptAddrOfRule : public InferenceRule {
 // Matches `&base[0]` and subs it for `base`
 class AddrOfArraySubscriptRule : public InferenceRule {
  public:
-  AddrOfArraySubscriptRule()
-      : InferenceRule(
-            unaryOperator(stmt().bind("addr_of"), hasOperatorName("&"),
-                          has(ignoringParenImpCasts(
-                              arraySubscriptExpr(hasIndex(zero_int_lit)))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    match = result.Nodes.getNodeAs<clang::UnaryOperator>("addr_of");
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::UnaryOperator>(
+        HasOpcode(clang::UO_AddrOf),
+        SubExpr(IgnoringParenImpCasts(
+            Is<clang::ArraySubscriptExpr>(Index(zero_int_lit)))));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto addr_of = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(addr_of == match)
-        << "Substituted UnaryOperator is not the matched UnaryOperator!";
-    auto subexpr = addr_of->getSubExpr()->IgnoreParenCasts();
+    auto subexpr = addr_of->getSubExpr()->IgnoreParenImpCasts();
     auto sub = clang::cast<clang::ArraySubscriptExpr>(subexpr);
     return sub->getBase();
   }
@@ -83,21 +74,17 @@ class AddrOfArraySubscriptRule : public InferenceRule {
 // Matches `*&expr` and subs it for `expr`
 class DerefAddrOfRule : public InferenceRule {
  public:
-  DerefAddrOfRule()
-      : InferenceRule(unaryOperator(
-            stmt().bind("deref"), hasOperatorName("*"),
-            has(ignoringParenImpCasts(unaryOperator(hasOperatorName("&")))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    match = result.Nodes.getNodeAs<clang::UnaryOperator>("deref");
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::UnaryOperator>(
+        HasOpcode(clang::UO_Deref),
+        SubExpr(IgnoringParenImpCasts(addr_of_op)));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto deref = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(deref == match)
-        << "Substituted UnaryOperator is not the matched UnaryOperator!";
-    auto subexpr = deref->getSubExpr()->IgnoreParenCasts();
+    auto subexpr = deref->getSubExpr()->IgnoreParenImpCasts();
     auto addr_of = clang::cast<clang::UnaryOperator>(subexpr);
     return addr_of->getSubExpr();
   }
@@ -106,25 +93,18 @@ class DerefAddrOfRule : public InferenceRule {
 // Matches `!(comp)` and subs it for `negcomp`
 class NegComparisonRule : public InferenceRule {
  public:
-  NegComparisonRule()
-      : InferenceRule(unaryOperator(
-            stmt().bind("not"), hasOperatorName("!"),
-            has(ignoringParenImpCasts(binaryOperator(stmt().bind("binop")))))) {
-  }
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto binop = result.Nodes.getNodeAs<clang::BinaryOperator>("binop");
-    if (binop->isComparisonOp()) {
-      match = result.Nodes.getNodeAs<clang::UnaryOperator>("not");
-    }
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::UnaryOperator>(
+        HasOpcode(clang::UO_LNot),
+        SubExpr(IgnoringParenImpCasts(
+            Is<clang::BinaryOperator>(IsComparison()))));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto op = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(op == match)
-        << "Substituted UnaryOperator is not the matched UnaryOperator!";
-    auto subexpr = op->getSubExpr()->IgnoreParenCasts();
+    auto subexpr = op->getSubExpr()->IgnoreParenImpCasts();
     auto binop = clang::cast<clang::BinaryOperator>(subexpr);
     auto opc = clang::BinaryOperator::negateComparisonOp(binop->getOpcode());
     return CreateBinaryOperator(ctx, opc, binop->getLHS(), binop->getRHS(),
@@ -135,20 +115,15 @@ class NegComparisonRule : public InferenceRule {
 // Matches `(a)` and subs it for `a`
 class ParenDeclRefExprStripRule : public InferenceRule {
  public:
-  ParenDeclRefExprStripRule()
-      : InferenceRule(
-            parenExpr(stmt().bind("paren"),
-                      has(ignoringImpCasts(declRefExpr(to(varDecl())))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    match = result.Nodes.getNodeAs<clang::ParenExpr>("paren");
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::ParenExpr>(SubExpr(
+        IgnoringImpCasts(Is<clang::DeclRefExpr>(To<clang::VarDecl>()))));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto paren = clang::cast<clang::ParenExpr>(stmt);
-    CHECK(paren == match)
-        << "Substituted ParenExpr is not the matched ParenExpr!";
     return paren->getSubExpr();
   }
 };
@@ -156,25 +131,16 @@ class ParenDeclRefExprStripRule : public InferenceRule {
 // Matches `(&expr)->field` and subs it for `expr.field`
 class MemberExprAddrOfRule : public InferenceRule {
  public:
-  MemberExprAddrOfRule()
-      : InferenceRule(memberExpr(
-            stmt().bind("arrow"), isArrow(),
-            has(expr(stmt().bind("base"), ignoringParenImpCasts(unaryOperator(
-                                              hasOperatorName("&"))))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto arrow = result.Nodes.getNodeAs<clang::MemberExpr>("arrow");
-    if (result.Nodes.getNodeAs<clang::Expr>("base") == arrow->getBase()) {
-      match = arrow;
-    }
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::MemberExpr>(
+        IsArrow(), Base(IgnoringParenImpCasts(addr_of_op)));
+    return pattern(stmt);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
+                                       clang::Stmt *stmt) override {
     auto arrow = clang::cast<clang::MemberExpr>(stmt);
-    CHECK(arrow == match)
-        << "Substituted MemberExpr is not the matched MemberExpr!";
-    auto base = arrow->getBase()->IgnoreParenCasts();
+    auto base = arrow->getBase()->IgnoreParenImpCasts();
     auto addr_of = clang::cast<clang::UnaryOperator>(base);
     return CreateMemberExpr(ctx, addr_of->getSubExpr(), arrow->getMemberDecl(),
                             arrow->getType());
@@ -183,76 +149,48 @@ class MemberExprAddrOfRule : public InferenceRule {
 
 }  // namespace
 
+std::unique_ptr<RuleSet> CreateExprCombineRules() {
+  std::unique_ptr<RuleSet> rules(new RuleSet);
+  rules->AddRule(std::make_unique<ParenDeclRefExprStripRule>(),
+                 clang::Stmt::ParenExprClass);
+  rules->AddRule(std::make_unique<ArraySubscriptAddrOfRule>(),
+                 clang::Stmt::ArraySubscriptExprClass);
+  rules->AddRule(std::make_unique<NegComparisonRule>(),
+                 clang::Stmt::UnaryOperatorClass);
+  rules->AddRule(std::make_unique<DerefAddrOfRule>(),
+                 clang::Stmt::UnaryOperatorClass);
+  rules->AddRule(std::make_unique<AddrOfArraySubscriptRule>(),
+                 clang::Stmt::UnaryOperatorClass);
+  rules->AddRule(std::make_unique<MemberExprAddrOfRule>(),
+                 clang::Stmt::MemberExprClass);
+  return rules;
+}
+
 char ExprCombine::ID = 0;
 
 ExprCombine::ExprCombine(clang::ASTContext &ctx,
                          rellic::IRToASTVisitor &ast_gen)
-    : ModulePass(ExprCombine::ID), ast_ctx(&ctx), ast_gen(&ast_gen) {}
-
-bool ExprCombine::VisitParenExpr(clang::ParenExpr *paren) {
-  // DLOG(INFO) << "VisitParenExpr";
-  std::vector<InferenceRule *> rules({new ParenDeclRefExprStripRule});
-  auto sub = ApplyFirstMatchingRule(*ast_ctx, paren, rules);
-  if (sub != paren) {
-    substitutions[paren] = sub;
-  }
-
-  delete rules.back();
-
-  return true;
-}
-
-bool ExprCombine::VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr) {
-  // DLOG(INFO) << "VisitArraySubscriptExpr";
-  std::vector<InferenceRule *> rules({new ArraySubscriptAddrOfRule});
-  auto sub = ApplyFirstMatchingRule(*ast_ctx, expr, rules);
+    : ModulePass(ExprCombine::ID),
+      ast_ctx(&ctx),
+      ast_gen(&ast_gen),
+      rules(CreateExprCombineRules()) {}
+
+bool ExprCombine::VisitExpr(clang::Expr *expr) {
+  // DLOG(INFO) << "VisitExpr";
+  auto sub = rules->ApplyFirstMatchingRule(*ast_ctx, expr);
   if (sub != expr) {
-    substitutions[expr] = sub;
+    Substitute(expr, sub);
   }
-
-  delete rules.back();
-
-  return true;
-}
-
-bool ExprCombine::VisitUnaryOperator(clang::UnaryOperator *op) {
-  // DLOG(INFO) << "VisitUnaryOperator";
-  std::vector<InferenceRule *> rules;
-
-  rules.push_back(new NegComparisonRule);
-  rules.push_back(new DerefAddrOfRule);
-  rules.push_back(new AddrOfArraySubscriptRule);
-
-  auto sub = ApplyFirstMatchingRule(*ast_ctx, op, rules);
-  if (sub != op) {
-    substitutions[op] = sub;
-  }
-
-  for (auto rule : rules) {
-    delete rule;
-  }
-
-  return true;
-}
-
-bool ExprCombine::VisitMemberExpr(clang::MemberExpr *expr) {
-  // DLOG(INFO) << "VisitArraySubscriptExpr";
-  std::vector<InferenceRule *> rules({new MemberExprAddrOfRule});
-  auto sub = ApplyFirstMatchingRule(*ast_ctx, expr, rules);
-  if (sub != expr) {
-    substitutions[expr] = sub;
-  }
-
-  delete rules.back();
-
   return true;
 }
 
 bool ExprCombine::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Rule-based statement simplification";
+  PassStats stats("ExprCombine", *ast_ctx);
   Initialize();
 
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
@@ -20,6 +20,7 @@
 #include <llvm/Pass.h>
 
 #include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Util.h"
 
@@ -31,19 +32,22 @@ class ExprCombine : public llvm::ModulePass,
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
 
+  std::unique_ptr<RuleSet> rules;
+
  public:
   static char ID;
 
   ExprCombine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
 
-  bool VisitUnaryOperator(clang::UnaryOperator *op);
-  bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr);
-  bool VisitMemberExpr(clang::MemberExpr *expr);
-  bool VisitParenExpr(clang::ParenExpr *paren);
+  bool VisitExpr(clang::Expr *expr);
 
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Rules that combine pointer arithmetic, member accesses, negated
+// comparisons and parentheses into simpler expressions
+std::unique_ptr<RuleSet> CreateExprCombineRules();
+
 llvm::ModulePass *createExprCombinePass(clang::ASTContext &ctx,
                                         rellic::IRToASTVisitor &ast_gen);
 }  // namespace rellic
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/FunctionCache.h"
+
+#include <clang/AST/Decl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <set>
+#include <unordered_set>
+
+#include "rellic/BC/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static std::string GetDigest(llvm::MD5 &md5) {
+  llvm::MD5::MD5Result result;
+  md5.final(result);
+  return result.digest().str().str();
+}
+
+// Collects global values used by `val`, looking through constants
+static void GetGlobalUses(llvm::Value *val, std::set<llvm::GlobalValue *> &gvs,
+                          std::unordered_set<llvm::Constant *> &seen) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+    gvs.insert(gv);
+  } else if (auto constant = llvm::dyn_cast<llvm::Constant>(val)) {
+    if (seen.insert(constant).second) {
+      for (auto &op : constant->operands()) {
+        GetGlobalUses(op.get(), gvs, seen);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+FunctionCache::FunctionCache(std::string dir, std::string salt)
+    : dir(dir), salt(salt) {
+  auto ec{llvm::sys::fs::create_directories(dir)};
+  LOG_IF(ERROR, ec) << "Failed to create function cache directory " << dir
+                    << ": " << ec.message();
+}
+
+std::string FunctionCache::GetPath(const std::string &key) {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key + ".c");
+  return path.str().str();
+}
+
+std::string FunctionCache::GetCheckpointPath(const std::string &key,
+                                             const std::string &stage) {
+  llvm::MD5 md5;
+  md5.update(stage);
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key + "-" + GetDigest(md5) + ".ast");
+  return path.str().str();
+}
+
+std::string FunctionCache::GetKey(llvm::Function &func, clang::ASTContext &ctx,
+                                  rellic::IRToASTVisitor &gen) {
+  // Names of anonymous structures depend on the whole module,
+  // so every function depends on all structure declarations.
+  if (types_digest.empty()) {
+    llvm::MD5 md5;
+    for (auto decl : ctx.getTranslationUnitDecl()->decls()) {
+      if (clang::isa<clang::RecordDecl>(decl)) {
+        std::string str;
+        llvm::raw_string_ostream os(str);
+        decl->print(os);
+        md5.update(os.str());
+      }
+    }
+    types_digest = GetDigest(md5);
+  }
+
+  llvm::MD5 md5;
+  md5.update(salt);
+  md5.update(types_digest);
+
+  std::string ir;
+  llvm::raw_string_ostream ir_os(ir);
+  func.print(ir_os);
+  md5.update(ir_os.str());
+
+  std::set<llvm::GlobalValue *> gvs;
+  std::unordered_set<llvm::Constant *> seen;
+  for (auto &inst : llvm::instructions(func)) {
+    for (auto &op : inst.operands()) {
+      GetGlobalUses(op.get(), gvs, seen);
+    }
+  }
+
+  // Hash referenced globals in a stable order
+  std::vector<std::string> uses;
+  for (auto gv : gvs) {
+    std::string str;
+    llvm::raw_string_ostream os(str);
+    clang::Decl *decl = nullptr;
+    if (llvm::isa<llvm::Function>(gv) || llvm::isa<llvm::GlobalVariable>(gv)) {
+      decl = gen.GetOrCreateDecl(gv);
+    }
+    if (decl) {
+      decl->print(os);
+    } else {
+      os << gv->getName() << ' ' << LLVMThingToString(gv->getType());
+    }
+    uses.push_back(os.str());
+  }
+  std::sort(uses.begin(), uses.end());
+  for (auto &use : uses) {
+    md5.update(use);
+  }
+
+  return GetDigest(md5);
+}
+
+bool FunctionCache::Lookup(const std::string &key, std::string &defn) {
+  auto buf{llvm::MemoryBuffer::getFile(GetPath(key))};
+  if (!buf) {
+    return false;
+  }
+  defn = (*buf)->getBuffer().str();
+  return true;
+}
+
+void FunctionCache::Insert(const std::string &key, const std::string &defn) {
+  Write(GetPath(key), defn);
+}
+
+bool FunctionCache::LookupCheckpoint(const std::string &key,
+                                     const std::string &stage,
+                                     std::unique_ptr<llvm::MemoryBuffer> &buf) {
+  auto file{llvm::MemoryBuffer::getFile(GetCheckpointPath(key, stage))};
+  if (!file) {
+    return false;
+  }
+  buf = std::move(*file);
+  return true;
+}
+
+void FunctionCache::InsertCheckpoint(const std::string &key,
+                                     const std::string &stage,
+                                     llvm::StringRef data) {
+  Write(GetCheckpointPath(key, stage), data);
+}
+
+void FunctionCache::Write(const std::string &path, llvm::StringRef data) {
+  // Write to a temporary file first, so that concurrent
+  // runs never see partially written entries.
+  int fd;
+  llvm::SmallString<128> tmp;
+  if (auto ec = llvm::sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, tmp)) {
+    LOG(ERROR) << "Failed to create function cache entry for " << path << ": "
+               << ec.message();
+    return;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+  }
+  auto ec{llvm::sys::fs::rename(tmp, path)};
+  LOG_IF(ERROR, ec) << "Failed to add function cache entry " << path << ": "
+                    << ec.message();
+}
+
+}  // namespace rellic
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+
+#include "rellic/AST/IRToASTVisitor.h"
+
+namespace rellic {
+
+// Content-addressed on-disk cache of decompiled function definitions.
+// Every entry is a file in `dir` named after the key of the function.
+class FunctionCache {
+ private:
+  std::string dir;
+  std::string salt;
+  std::string types_digest;
+
+  std::string GetPath(const std::string &key);
+  std::string GetCheckpointPath(const std::string &key,
+                                const std::string &stage);
+  void Write(const std::string &path, llvm::StringRef data);
+
+ public:
+  // `salt` should identify everything besides the input that the
+  // output depends on, e.g. the rellic version and pipeline options.
+  FunctionCache(std::string dir, std::string salt);
+
+  // Computes the key of `func`. It covers the IR of `func`, the C
+  // declarations of the globals and functions it refers to, and all
+  // structure declarations. `gen` and `ctx` must hold the declarations
+  // of the whole module of `func`.
+  std::string GetKey(llvm::Function &func, clang::ASTContext &ctx,
+                     rellic::IRToASTVisitor &gen);
+
+  bool Lookup(const std::string &key, std::string &defn);
+  void Insert(const std::string &key, const std::string &defn);
+
+  // Checkpoints hold the AST of a function after some pipeline stage.
+  // `stage` should describe all stages up to and including that stage.
+  // Checkpoints are mapped rather than read into memory.
+  bool LookupCheckpoint(const std::string &key, const std::string &stage,
+                        std::unique_ptr<llvm::MemoryBuffer> &buf);
+  void InsertCheckpoint(const std::string &key, const std::string &stage,
+                        llvm::StringRef data);
+};
+
+}  // namespace rellic
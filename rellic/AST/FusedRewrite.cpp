@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/FusedRewrite.h"
+
+#include <glog/logging.h>
+
+#include <utility>
+
+#include "rellic/AST/ChangeTracker.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// Upper bound on rewrites applied to a single statement, in case some
+// rewrites undo each other
+static constexpr unsigned kMaxLocalRewrites{64};
+
+}  // namespace
+
+char FusedRewrite::ID = 0;
+
+FusedRewrite::FusedRewrite(clang::ASTContext &ctx,
+                           rellic::IRToASTVisitor &ast_gen)
+    : ModulePass(FusedRewrite::ID),
+      ast_ctx(&ctx),
+      ast_gen(&ast_gen),
+      num_rewritten(0) {}
+
+void FusedRewrite::AddRewrite(LocalRewrite rewrite) {
+  rewrites.push_back(std::move(rewrite));
+}
+
+void FusedRewrite::AddRules(std::unique_ptr<RuleSet> rules) {
+  auto rule_set{rules.get()};
+  rule_sets.push_back(std::move(rules));
+  AddRewrite([rule_set](clang::ASTContext &ctx, clang::Stmt *stmt) {
+    return rule_set->ApplyFirstMatchingRule(ctx, stmt);
+  });
+}
+
+void FusedRewrite::Enqueue(clang::Stmt *stmt) {
+  if (queued.insert(stmt).second) {
+    worklist.push_back(stmt);
+  }
+}
+
+void FusedRewrite::Discover(clang::Stmt *stmt) {
+  // Statements are known once they have an entry in `parents`, even if
+  // it is empty, as for the root
+  parents[stmt];
+  std::vector<std::pair<clang::Stmt *, clang::Stmt::child_iterator>> stack;
+  stack.push_back({stmt, stmt->child_begin()});
+  while (!stack.empty()) {
+    auto &top{stack.back()};
+    if (top.second == top.first->child_end()) {
+      Enqueue(top.first);
+      stack.pop_back();
+      continue;
+    }
+    auto child{*top.second++};
+    if (!child) {
+      continue;
+    }
+    auto known{parents.count(child)};
+    parents[child].push_back(top.first);
+    if (!known) {
+      stack.push_back({child, child->child_begin()});
+    }
+  }
+}
+
+clang::Stmt *FusedRewrite::RewriteLocally(clang::Stmt *stmt) {
+  auto sub{stmt};
+  unsigned num_rewrites{0};
+  for (auto iter{rewrites.begin()}; sub && iter != rewrites.end();) {
+    auto new_sub{(*iter)(*ast_ctx, sub)};
+    if (new_sub == sub) {
+      ++iter;
+      continue;
+    }
+    sub = new_sub;
+    if (++num_rewrites == kMaxLocalRewrites) {
+      DLOG(WARNING) << "Local rewrites of statement did not converge";
+      break;
+    }
+    iter = rewrites.begin();
+  }
+  return sub;
+}
+
+clang::Stmt *FusedRewrite::RewriteTree(clang::Stmt *root) {
+  parents.clear();
+  worklist.clear();
+  queued.clear();
+  Discover(root);
+  while (!worklist.empty()) {
+    auto stmt{worklist.front()};
+    worklist.pop_front();
+    queued.erase(stmt);
+    // Skip statements that were replaced after they were queued
+    auto iter{parents.find(stmt)};
+    if (iter == parents.end()) {
+      continue;
+    }
+    auto sub{RewriteLocally(stmt)};
+    if (sub == stmt) {
+      continue;
+    }
+    ++num_rewritten;
+    auto stmt_parents{std::move(iter->second)};
+    parents.erase(iter);
+    if (stmt == root) {
+      root = sub;
+    }
+    StmtMap repl{{stmt, sub}};
+    for (auto parent : stmt_parents) {
+      // Parents that were replaced themselves are no longer in the tree
+      if (parents.count(parent) && ReplaceChildren(parent, repl)) {
+        Enqueue(parent);
+      }
+    }
+    if (!sub) {
+      continue;
+    }
+    // A new `sub` may be made of statements that were never rewritten,
+    // which are queued. `sub` itself is queued last and can't be
+    // rewritten any further.
+    if (!parents.count(sub)) {
+      Discover(sub);
+      if (worklist.back() == sub) {
+        worklist.pop_back();
+        queued.erase(sub);
+      }
+    }
+    auto &sub_parents{parents[sub]};
+    for (auto parent : stmt_parents) {
+      if (parents.count(parent)) {
+        sub_parents.push_back(parent);
+      }
+    }
+  }
+  return root;
+}
+
+bool FusedRewrite::runOnModule(llvm::Module &module) {
+  LOG(INFO) << "Fused local rewriting";
+  PassStats stats("FusedRewrite", *ast_ctx);
+  num_rewritten = 0;
+  bool changed{false};
+  auto tracker{ChangeTracker::Get(*ast_ctx)};
+  for (auto decl : ast_ctx->getTranslationUnitDecl()->decls()) {
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      if (!fdecl->doesThisDeclarationHaveABody()) {
+        continue;
+      }
+      // Skip functions that converged during an earlier round
+      if (tracker && !tracker->IsDirty(fdecl)) {
+        continue;
+      }
+      auto num_before{num_rewritten};
+      auto body{RewriteTree(fdecl->getBody())};
+      if (num_rewritten != num_before) {
+        fdecl->setBody(body);
+        changed = true;
+        if (tracker) {
+          tracker->MarkChanged(fdecl);
+        }
+      }
+    } else if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+      if (auto init = var->getInit()) {
+        auto num_before{num_rewritten};
+        auto sub{RewriteTree(init)};
+        CHECK(sub) << "Initializer of " << var->getName().str()
+                   << " was removed";
+        if (num_rewritten != num_before) {
+          var->setInit(clang::cast<clang::Expr>(sub));
+          changed = true;
+        }
+      }
+    }
+  }
+  parents.clear();
+  stats.Finish(num_rewritten, changed);
+  return changed;
+}
+
+}  // namespace rellic
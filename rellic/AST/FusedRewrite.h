@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/InferenceRule.h"
+
+namespace rellic {
+
+// Rewrites a single statement whose children have already been rewritten.
+// Returns the replacement of `stmt`, `nullptr` to remove it, or `stmt`
+// itself if the rewrite does not apply.
+using LocalRewrite =
+    std::function<clang::Stmt *(clang::ASTContext &, clang::Stmt *)>;
+
+// Applies several local rewrites to a fixpoint, instead of one traversal
+// per rewriting pass. At each statement, the rewrites are tried in the
+// order they were added, until none of them applies anymore.
+//
+// Statements are rewritten from a worklist that starts out in post-order.
+// Only the parents of rewritten statements are queued again, so chains of
+// rewrites that enable each other are followed without matching the whole
+// function again.
+class FusedRewrite : public llvm::ModulePass {
+ private:
+  clang::ASTContext *ast_ctx;
+  rellic::IRToASTVisitor *ast_gen;
+
+  std::vector<LocalRewrite> rewrites;
+  std::vector<std::unique_ptr<RuleSet>> rule_sets;
+
+  // Parents of the statements of the tree being rewritten. Shared
+  // subtrees have several.
+  std::unordered_map<clang::Stmt *, llvm::SmallVector<clang::Stmt *, 1>>
+      parents;
+  std::deque<clang::Stmt *> worklist;
+  std::unordered_set<clang::Stmt *> queued;
+  size_t num_rewritten;
+
+  void Enqueue(clang::Stmt *stmt);
+  // Records the parents in the subtree of `stmt` that is not known yet,
+  // and queues its statements in post-order
+  void Discover(clang::Stmt *stmt);
+  clang::Stmt *RewriteLocally(clang::Stmt *stmt);
+  // Returns the rewritten `root`
+  clang::Stmt *RewriteTree(clang::Stmt *root);
+
+ public:
+  static char ID;
+
+  FusedRewrite(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+
+  void AddRewrite(LocalRewrite rewrite);
+  // Adds a rewrite that applies the first matching rule of `rules`
+  void AddRules(std::unique_ptr<RuleSet> rules);
+
+  bool runOnModule(llvm::Module &module) override;
+};
+
+}  // namespace rellic
+
+namespace llvm {
+void initializeFusedRewritePass(PassRegistry &);
+}
@@ -21,12 +21,21 @@
 #include <glog/logging.h>
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/CFG.h>
 #include <llvm/Analysis/LoopInfo.h>
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/Trace.h"
 #include "rellic/AST/Util.h"
 #include "rellic/BC/Util.h"
 
@@ -75,17 +84,34 @@ using StmtVec = std::vector<clang::Stmt *>;
 //   }
 // }
 
-static bool IsRegionBlock(llvm::Region *region, llvm::BasicBlock *block) {
-  return region->getRegionInfo()->getRegionFor(block) == region;
-}
+using PHISet = std::unordered_set<llvm::PHINode *>;
 
-static bool IsSubregionEntry(llvm::Region *region, llvm::BasicBlock *block) {
-  for (auto &subregion : *region) {
-    if (subregion->getEntry() == block) {
-      return true;
+// Collects the PHI nodes whose variables are read by the expression of
+// `val`. Other instructions are inlined into their users, so the PHI nodes
+// read by their operands count as well.
+static void CollectPHIReads(llvm::Value *val, PHISet &reads,
+                            std::unordered_set<llvm::Value *> &visited) {
+  if (!visited.insert(val).second) {
+    return;
+  }
+  if (auto phi = llvm::dyn_cast<llvm::PHINode>(val)) {
+    reads.insert(phi);
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
+    if (!llvm::isa<llvm::AllocaInst>(inst)) {
+      for (auto &op : inst->operands()) {
+        CollectPHIReads(op, reads, visited);
+      }
     }
   }
-  return false;
+}
+
+static void CollectPHIReads(llvm::Value *val, PHISet &reads) {
+  std::unordered_set<llvm::Value *> visited;
+  CollectPHIReads(val, reads, visited);
+}
+
+static bool IsRegionBlock(llvm::Region *region, llvm::BasicBlock *block) {
+  return region->getRegionInfo()->getRegionFor(block) == region;
 }
 
 // static bool IsSubregionExit(llvm::Region *region, llvm::BasicBlock *block) {
@@ -130,10 +156,22 @@ std::string GetRegionNameStr(llvm::Region *region) {
 
 }  // namespace
 
-clang::Expr *GenerateAST::CreateEdgeCond(llvm::BasicBlock *from,
-                                         llvm::BasicBlock *to) {
+std::vector<CondDAG::Node> &GenerateAST::GetOrCreateCaseConds(
+    llvm::SwitchInst *inst) {
+  auto &result = case_conds[inst];
+  if (result.empty()) {
+    for (auto &item : inst->cases()) {
+      result.push_back(conds->CreateAtom(ast_gen->CreateCaseCondExpr(
+          inst->getCondition(), item.getCaseValue())));
+    }
+  }
+  return result;
+}
+
+CondDAG::Node GenerateAST::CreateEdgeCond(llvm::BasicBlock *from,
+                                          llvm::BasicBlock *to) {
   // Construct the edge condition for CFG edge `(from, to)`
-  clang::Expr *result = nullptr;
+  auto result = conds->CreateTrue();
   auto term = from->getTerminator();
   switch (term->getOpcode()) {
     // Conditional branches
@@ -141,11 +179,33 @@ clang::Expr *GenerateAST::CreateEdgeCond(llvm::BasicBlock *from,
       auto br = llvm::cast<llvm::BranchInst>(term);
       if (br->isConditional()) {
         // Get the edge condition
-        result = clang::cast<clang::Expr>(
-            ast_gen->GetOrCreateStmt(br->getCondition()));
+        result = conds->CreateAtom(clang::cast<clang::Expr>(
+            ast_gen->GetOrCreateStmt(br->getCondition())));
         // Negate if `br` jumps to `to` when `expr` is false
         if (to == br->getSuccessor(1)) {
-          result = CreateNotExpr(*ast_ctx, result);
+          result = conds->CreateNot(result);
+        }
+      }
+    } break;
+    // Switches
+    case llvm::Instruction::Switch: {
+      auto sw = llvm::cast<llvm::SwitchInst>(term);
+      auto &cases = GetOrCreateCaseConds(sw);
+      if (to == sw->getDefaultDest()) {
+        // Case values are distinct, so `to` is reached unless a case of
+        // another successor matches
+        for (auto &item : sw->cases()) {
+          if (item.getCaseSuccessor() != to) {
+            result = conds->CreateAnd(
+                result, conds->CreateNot(cases[item.getCaseIndex()]));
+          }
+        }
+      } else {
+        result = conds->CreateFalse();
+        for (auto &item : sw->cases()) {
+          if (item.getCaseSuccessor() == to) {
+            result = conds->CreateOr(result, cases[item.getCaseIndex()]);
+          }
         }
       }
     } break;
@@ -170,35 +230,212 @@ clang::Expr *GenerateAST::CreateEdgeCond(llvm::BasicBlock *from,
   return result;
 }
 
-clang::Expr *GenerateAST::GetOrCreateReachingCond(llvm::BasicBlock *block) {
-  auto &cond = reaching_conds[block];
-  if (cond) {
-    return cond;
+constexpr unsigned GenerateAST::kNoID;
+
+unsigned GenerateAST::FindBlockID(llvm::BasicBlock *block) const {
+  auto it = block_ids.find(block);
+  return it == block_ids.end() ? kNoID : it->second;
+}
+
+unsigned GenerateAST::GetBlockID(llvm::BasicBlock *block) const {
+  auto id = FindBlockID(block);
+  CHECK_NE(id, kNoID) << "Unreachable block " << block->getName().str();
+  return id;
+}
+
+unsigned GenerateAST::GetRegionID(llvm::Region *region) const {
+  auto it = region_ids.find(region);
+  CHECK(it != region_ids.end())
+      << "Region without blocks " << GetRegionNameStr(region);
+  return it->second;
+}
+
+CondDAG::Node GenerateAST::GetOrCreateReachingCond(llvm::BasicBlock *block) {
+  auto id = GetBlockID(block);
+  if (reaching_conds[id] != CondDAG::kNoNode) {
+    return reaching_conds[id];
+  }
+  // Outside of cycles, a block that post-dominates its immediate dominator
+  // runs exactly when the dominator runs, so it takes over the condition of
+  // the dominator instead of one that is built over all its predecessors.
+  // Dominators in enclosing regions get their conditions later, so only
+  // conditions that already exist are reused.
+  auto node = domtree->getNode(block);
+  auto idom = node ? node->getIDom() : nullptr;
+  if (idom && !cyclic_blocks.test(id) &&
+      !cyclic_blocks.test(GetBlockID(idom->getBlock())) &&
+      postdomtree->dominates(block, idom->getBlock())) {
+    auto cond = reaching_conds[GetBlockID(idom->getBlock())];
+    if (cond != CondDAG::kNoNode) {
+      reaching_conds[id] = cond;
+      return cond;
+    }
   }
   // Gather reaching conditions from predecessors of the block
+  bool has_cond = false;
+  auto cond = conds->CreateFalse();
   for (auto pred : llvm::predecessors(block)) {
-    auto pred_cond = reaching_conds[pred];
+    auto pred_id = FindBlockID(pred);
+    auto pred_cond =
+        pred_id != kNoID ? reaching_conds[pred_id] : CondDAG::kNoNode;
+    auto has_pred_cond = pred_cond != CondDAG::kNoNode;
     auto edge_cond = CreateEdgeCond(pred, block);
+    auto has_edge_cond = edge_cond != conds->CreateTrue();
     // Construct reaching condition from `pred` to `block` as
-    // `reach_cond[pred] && edge_cond(pred, block)`
-    if (pred_cond || edge_cond) {
-      auto conj_cond = CreateAndExpr(*ast_ctx, pred_cond, edge_cond);
+    // `reach_cond[pred] && edge_cond(pred, block)`. Predecessors
+    // without a reaching condition yet (e.g. via back-edges) only
+    // contribute their edge condition.
+    if (has_pred_cond || has_edge_cond) {
+      auto conj_cond = has_pred_cond
+                           ? conds->CreateAnd(pred_cond, edge_cond)
+                           : edge_cond;
       // Append `conj_cond` to reaching conditions of other
       // predecessors via an `||`
-      cond = CreateOrExpr(*ast_ctx, cond, conj_cond);
+      cond = conds->CreateOr(cond, conj_cond);
+      has_cond = true;
     }
   }
   // Create `if(1)` in case we still don't have a reaching condition
-  if (!cond) {
-    cond = CreateTrueExpr(*ast_ctx);
+  if (!has_cond) {
+    cond = conds->CreateTrue();
+  }
+  // Keep the condition from compounding through the successors
+  if (cond_size_limit && conds->GetSize(cond) > cond_size_limit) {
+    cond = conds->Simplify(cond);
   }
   // Done
+  reaching_conds[id] = cond;
   return cond;
 }
 
+// PHI nodes are lowered out of SSA: every PHI node gets a variable, which
+// is assigned at the end of each predecessor. A predecessor assigns the
+// variables of all its successors one after another, and reaching
+// conditions re-evaluate branch conditions after that. So a variable that
+// is still read by such a condition, or by the copy to another PHI
+// variable, takes its incoming value in a separate variable, which is
+// copied at the start of the block of the PHI node. All other incoming
+// values are coalesced with the variable of their PHI node.
+void GenerateAST::LowerPHINodes(llvm::Function &func) {
+  phi_inputs.clear();
+  phi_decls.clear();
+
+  PHISet split;
+  std::vector<llvm::PHINode *> phis;
+  for (auto &block : func) {
+    for (auto &phi : block.phis()) {
+      phis.push_back(&phi);
+    }
+    auto term = block.getTerminator();
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+      if (br->isConditional()) {
+        CollectPHIReads(br->getCondition(), split);
+      }
+    } else if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+      CollectPHIReads(sw->getCondition(), split);
+    }
+    // Gather the copies at the end of `block`
+    PHISet dests;
+    std::vector<std::pair<llvm::PHINode *, llvm::Value *>> copies;
+    for (auto succ : llvm::successors(&block)) {
+      for (auto &phi : succ->phis()) {
+        dests.insert(&phi);
+        copies.push_back({&phi, phi.getIncomingValueForBlock(&block)});
+      }
+    }
+    for (auto &copy : copies) {
+      PHISet reads;
+      CollectPHIReads(copy.second, reads);
+      for (auto phi : reads) {
+        if (phi != copy.first && dests.count(phi)) {
+          split.insert(phi);
+        }
+      }
+    }
+  }
+
+  if (phis.empty()) {
+    return;
+  }
+
+  auto fdecl =
+      clang::cast<clang::FunctionDecl>(ast_gen->GetOrCreateDecl(&func));
+  for (auto phi : phis) {
+    auto var = clang::cast<clang::VarDecl>(ast_gen->GetOrCreateDecl(phi));
+    phi_decls.push_back(CreateDeclStmt(*ast_ctx, var));
+    if (!split.count(phi)) {
+      continue;
+    }
+    auto name = ast_gen->CreateVarName(fdecl, var->getName().str() + "_in",
+                                       "phi");
+    auto input = CreateVarDecl(*ast_ctx, fdecl,
+                               CreateIdentifier(*ast_ctx, name), var->getType());
+    fdecl->addDecl(input);
+    phi_decls.push_back(CreateDeclStmt(*ast_ctx, input));
+    phi_inputs[phi] = input;
+  }
+}
+
+StmtVec GenerateAST::CreatePHICopies(llvm::BasicBlock *block) {
+  StmtVec result;
+  llvm::SmallPtrSet<llvm::BasicBlock *, 4> succs(llvm::succ_begin(block),
+                                                 llvm::succ_end(block));
+  llvm::SmallPtrSet<llvm::BasicBlock *, 4> done;
+  for (auto succ : llvm::successors(block)) {
+    if (!done.insert(succ).second) {
+      continue;
+    }
+    StmtVec copies;
+    for (auto &phi : succ->phis()) {
+      auto val = phi.getIncomingValueForBlock(block);
+      auto input = phi_inputs.find(&phi);
+      auto is_split = input != phi_inputs.end();
+      // Undefined and unchanged values take no copy
+      if (llvm::isa<llvm::UndefValue>(val) || (val == &phi && !is_split)) {
+        continue;
+      }
+      auto var = is_split ? input->second
+                          : clang::cast<clang::ValueDecl>(
+                                ast_gen->GetOrCreateDecl(&phi));
+      copies.push_back(ast_gen->CreateAssignExpr(var, val));
+    }
+    if (copies.empty()) {
+      continue;
+    }
+    if (succs.size() == 1) {
+      result.insert(result.end(), copies.begin(), copies.end());
+      continue;
+    }
+    // Copy only when the edge to `succ` is taken, since a variable may
+    // still be read on the other edges
+    auto cond = conds->GetOrCreateExpr(CreateEdgeCond(block, succ));
+    result.push_back(
+        CreateIfStmt(*ast_ctx, cond, CreateCompoundStmt(*ast_ctx, copies)));
+  }
+  return result;
+}
+
 StmtVec GenerateAST::CreateBasicBlockStmts(llvm::BasicBlock *block) {
   StmtVec result;
+  if (block == &block->getParent()->getEntryBlock()) {
+    result = phi_decls;
+  }
   for (auto &inst : *block) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      // Take over the incoming value of a split PHI variable
+      auto input = phi_inputs.find(phi);
+      if (input != phi_inputs.end()) {
+        auto var = clang::cast<clang::VarDecl>(ast_gen->GetOrCreateDecl(phi));
+        result.push_back(CreateBinaryOperator(
+            *ast_ctx, clang::BO_Assign, CreateDeclRefExpr(*ast_ctx, var),
+            CreateDeclRefExpr(*ast_ctx, input->second), var->getType()));
+      }
+      continue;
+    }
+    if (inst.isTerminator()) {
+      auto copies = CreatePHICopies(block);
+      result.insert(result.end(), copies.begin(), copies.end());
+    }
     auto stmt = ast_gen->GetOrCreateStmt(&inst);
     if (!stmt) {
       continue;
@@ -208,8 +445,8 @@ StmtVec GenerateAST::CreateBasicBlockStmts(llvm::BasicBlock *block) {
         !inst.getType()->isVoidTy()) {
       auto fdecl = clang::cast<clang::FunctionDecl>(
           ast_gen->GetOrCreateDecl(inst.getFunction()));
-      auto num = GetNumDecls<clang::VarDecl>(fdecl);
-      auto id = CreateIdentifier(*ast_ctx, "val" + std::to_string(num));
+      auto name = ast_gen->CreateVarName(fdecl, "", "val");
+      auto id = CreateIdentifier(*ast_ctx, name);
       auto expr = clang::cast<clang::Expr>(stmt);
       auto var = CreateVarDecl(*ast_ctx, fdecl, id, expr->getType());
       fdecl->addDecl(var);
@@ -224,31 +461,54 @@ StmtVec GenerateAST::CreateBasicBlockStmts(llvm::BasicBlock *block) {
   return result;
 }
 
+void GenerateAST::BucketRegionBlocks() {
+  // Keep the block lists of the previous function for their storage
+  region_ids.clear();
+  for (auto &blocks : region_blocks) {
+    blocks.clear();
+  }
+  auto AddBlock = [this](llvm::Region *region, llvm::BasicBlock *block) {
+    auto id = region_ids.insert({region, region_ids.size()}).first->second;
+    if (id == region_blocks.size()) {
+      region_blocks.emplace_back();
+    }
+    region_blocks[id].push_back(block);
+  };
+  for (auto block : rpo_walk) {
+    auto region = regions->getRegionFor(block);
+    AddBlock(region, block);
+    // `block` is also the subregion entry of every ancestor region whose
+    // child region starts at `block`
+    while (region->getEntry() == block && region->getParent()) {
+      region = region->getParent();
+      AddBlock(region, block);
+    }
+  }
+  region_stmts.assign(region_ids.size(), nullptr);
+}
+
 StmtVec GenerateAST::CreateRegionStmts(llvm::Region *region) {
   StmtVec result;
-  for (auto block : rpo_walk) {
+  for (auto block : region_blocks[GetRegionID(region)]) {
     // Check if the block is a subregion entry
     auto subregion = GetSubregion(region, block);
-    // Ignore blocks that are neither a subregion or a region block
-    if (!subregion && !IsRegionBlock(region, block)) {
-      continue;
-    }
     // If the block is a head of a subregion, get the compound statement of
     // the subregion otherwise create a new compound and gate it behind a
     // reaching condition.
     clang::CompoundStmt *compound = nullptr;
     if (subregion) {
-      CHECK(compound = region_stmts[subregion]);
+      CHECK(compound = region_stmts[GetRegionID(subregion)]);
     } else {
       // Create a compound, wrapping the block
       auto block_body = CreateBasicBlockStmts(block);
       compound = CreateCompoundStmt(*ast_ctx, block_body);
     }
     // Gate the compound behind a reaching condition
-    block_stmts[block] =
-        CreateIfStmt(*ast_ctx, GetOrCreateReachingCond(block), compound);
+    auto cond = conds->GetOrCreateExpr(GetOrCreateReachingCond(block));
+    auto &block_stmt = block_stmts[GetBlockID(block)];
+    block_stmt = CreateIfStmt(*ast_ctx, cond, compound);
     // Store the compound
-    result.push_back(block_stmts[block]);
+    result.push_back(block_stmt);
   }
   return result;
 }
@@ -256,41 +516,124 @@ StmtVec GenerateAST::CreateRegionStmts(llvm::Region *region) {
 void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
                                        BBSet &successors) {
   // Initialize loop members
-  members.insert(loop->block_begin(), loop->block_end());
+  members.resize(rpo_walk.size());
+  for (auto block : loop->blocks()) {
+    members.set(GetBlockID(block));
+  }
   // Initialize loop successors
   llvm::SmallVector<llvm::BasicBlock *, 1> exits;
   loop->getExitBlocks(exits);
-  successors.insert(exits.begin(), exits.end());
+  successors.resize(rpo_walk.size());
+  for (auto block : exits) {
+    successors.set(GetBlockID(block));
+  }
   // Loop membership test
-  auto IsLoopMember = [&members](llvm::BasicBlock *block) {
-    return members.count(block) > 0;
+  auto IsLoopMember = [this, &members](llvm::BasicBlock *block) {
+    auto id = FindBlockID(block);
+    return id != kNoID && members.test(id);
   };
+  auto header = loop->getHeader();
+  auto region = regions->getRegionFor(header);
   // Refinement
-  auto new_blocks = successors;
-  while (successors.size() > 1 && !new_blocks.empty()) {
-    new_blocks.clear();
-    for (auto block : BBSet(successors)) {
+  BBSet new_blocks(rpo_walk.size());
+  std::vector<unsigned> current;
+  for (auto found = true; found && successors.count() > 1;) {
+    new_blocks.reset();
+    // Visit successors in a fixed order, since members found earlier in a
+    // round decide about the blocks visited later. IDs are in reverse
+    // post-order.
+    current.clear();
+    for (auto id : successors.set_bits()) {
+      current.push_back(id);
+    }
+    for (auto id : current) {
+      auto block = rpo_walk[id];
       // Check if all predecessors of `block` are loop members
       if (std::all_of(llvm::pred_begin(block), llvm::pred_end(block),
                       IsLoopMember)) {
         // Add `block` as a loop member
-        members.insert(block);
+        members.set(id);
         // Remove it as a loop successor
-        successors.erase(block);
+        successors.reset(id);
         // Add a successor of `block` to the set of discovered blocks if
         // if it is a region member, if it is NOT a loop member and if
         // the loop header dominates it.
-        auto header = loop->getHeader();
-        auto region = regions->getRegionFor(header);
         for (auto succ : llvm::successors(block)) {
           if (IsRegionBlock(region, succ) && !IsLoopMember(succ) &&
               domtree->dominates(header, succ)) {
-            new_blocks.insert(succ);
+            new_blocks.set(GetBlockID(succ));
           }
         }
       }
     }
-    successors.insert(new_blocks.begin(), new_blocks.end());
+    found = new_blocks.any();
+    successors |= new_blocks;
+  }
+}
+
+void GenerateAST::AnalyzeLoop(llvm::Loop *loop, LoopShape &shape) {
+  // Refine loop members and successors without invalidating LoopInfo
+  BBSet successors;
+  RefineLoopSuccessors(loop, shape.members, successors);
+  // Get loop exit edges in reverse post-order of their successors, so
+  // that the order of `break` statements does not depend on addresses
+  for (auto id : successors.set_bits()) {
+    auto succ = rpo_walk[id];
+    for (auto pred : llvm::predecessors(succ)) {
+      auto pred_id = FindBlockID(pred);
+      if (pred_id != kNoID && shape.members.test(pred_id)) {
+        shape.exits.push_back({pred, succ});
+      }
+    }
+  }
+}
+
+// Sibling regions are independent until their parent is structured, but
+// structuring them creates nodes in the one `clang::ASTContext`, whose
+// allocator and uniquing tables are not thread-safe, and nodes cannot be
+// moved between contexts afterwards. Loop refinement only reads the CFG
+// and its analyses, and is the part of structurization that grows with
+// the number of blocks for every loop, so that part is run for all cyclic
+// regions concurrently.
+void GenerateAST::AnalyzeLoopsConcurrently() {
+  std::vector<std::pair<llvm::Loop *, LoopShape *>> tasks;
+  std::vector<llvm::Region *> worklist{regions->getTopLevelRegion()};
+  while (!worklist.empty()) {
+    auto region = worklist.back();
+    worklist.pop_back();
+    for (auto &subregion : *region) {
+      worklist.push_back(&*subregion);
+    }
+    if (!loops->isLoopHeader(region->getEntry())) {
+      continue;
+    }
+    auto loop = region->outermostLoopInRegion(loops, region->getEntry());
+    if (loop) {
+      // Insert all shapes up front, so that `loop_shapes` is not modified
+      // while the workers fill them in
+      tasks.push_back({loop, &loop_shapes[region]});
+    }
+  }
+  if (tasks.size() < 2) {
+    // A single loop is analyzed when its region gets structured
+    loop_shapes.clear();
+    return;
+  }
+  // Dominance queries renumber the tree on demand unless its numbering
+  // is up to date, which would race between workers
+  domtree->updateDFSNumbers();
+  std::atomic<size_t> next{0};
+  auto Worker{[&] {
+    for (auto i = next++; i < tasks.size(); i = next++) {
+      AnalyzeLoop(tasks[i].first, *tasks[i].second);
+    }
+  }};
+  std::vector<std::thread> workers;
+  for (auto i = 0U; i < std::min<size_t>(num_threads, tasks.size()); ++i) {
+    workers.emplace_back(Worker);
+  }
+  for (auto &worker : workers) {
+    worker.join();
   }
 }
 
@@ -300,6 +643,39 @@ clang::CompoundStmt *GenerateAST::StructureAcyclicRegion(llvm::Region *region) {
   return CreateCompoundStmt(*ast_ctx, region_body);
 }
 
+// Loops whose only exit is taken from the header or the latch become
+// `while` and `do-while` statements right away, in the same form in which
+// `LoopRefine` would recover them from `while (1)`. All other loops are
+// left to `LoopRefine`.
+clang::Stmt *GenerateAST::CreateLoopStmt(llvm::Loop *loop,
+                                         const BBEdges &exits,
+                                         clang::IfStmt *exit_stmt,
+                                         StmtVec &loop_body) {
+  if (exits.size() == 1 && !loop_body.empty()) {
+    auto from = exits.front().first;
+    auto cond = CreateNotExpr(*ast_ctx, exit_stmt->getCond());
+    // The statement of the header comes first. If it is empty, the exit
+    // is the first thing the loop does.
+    auto header = clang::dyn_cast<clang::IfStmt>(loop_body.front());
+    auto header_body =
+        header ? clang::dyn_cast<clang::CompoundStmt>(header->getThen())
+               : nullptr;
+    if (from == loop->getHeader() && header_body &&
+        header_body->body_empty() && loop_body.size() > 1 &&
+        loop_body[1] == exit_stmt) {
+      StmtVec body(loop_body.begin() + 2, loop_body.end());
+      return CreateWhileStmt(*ast_ctx, cond,
+                             CreateCompoundStmt(*ast_ctx, body));
+    }
+    if (from == loop->getLoopLatch() && loop_body.back() == exit_stmt) {
+      StmtVec body(loop_body.begin(), loop_body.end() - 1);
+      return CreateDoStmt(*ast_ctx, cond, CreateCompoundStmt(*ast_ctx, body));
+    }
+  }
+  return CreateWhileStmt(*ast_ctx, CreateTrueExpr(*ast_ctx),
+                         CreateCompoundStmt(*ast_ctx, loop_body));
+}
+
 clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
   DLOG(INFO) << "Region " << GetRegionNameStr(region) << " is cyclic";
   auto region_body = CreateRegionStmts(region);
@@ -312,59 +688,169 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
   if (!loop) {
     return CreateCompoundStmt(*ast_ctx, region_body);
   }
-  // Refine loop members and successors without invalidating LoopInfo
-  BBSet members, successors;
-  RefineLoopSuccessors(loop, members, successors);
-  // Construct the initial loop body
-  StmtVec loop_body;
-  for (auto block : rpo_walk) {
-    if (members.count(block)) {
-      if (IsRegionBlock(region, block) || IsSubregionEntry(region, block)) {
-        auto stmt = block_stmts[block];
-        auto it = std::find(region_body.begin(), region_body.end(), stmt);
-        region_body.erase(it);
-        loop_body.push_back(stmt);
-      }
-    }
-  }
-  // Get loop exit edges
-  std::vector<BBEdge> exits;
-  for (auto succ : successors) {
-    for (auto pred : llvm::predecessors(succ)) {
-      if (members.count(pred)) {
-        exits.push_back({pred, succ});
-      }
-    }
+  // Use the shape of the loop if it was analyzed ahead of time
+  auto shape_it = loop_shapes.find(region);
+  if (shape_it == loop_shapes.end()) {
+    shape_it = loop_shapes.emplace(region, LoopShape()).first;
+    AnalyzeLoop(loop, shape_it->second);
   }
-  // Insert `break` statements
+  auto &members = shape_it->second.members;
+  auto &exits = shape_it->second.exits;
+  // Create `break` statements, keyed by the statement of the exiting block
+  std::unordered_map<clang::Stmt *, StmtVec> breaks;
+  clang::IfStmt *exit_stmt = nullptr;
   for (auto edge : exits) {
     auto from = edge.first;
     auto to = edge.second;
     // Create edge condition
-    auto cond = CreateAndExpr(*ast_ctx, GetOrCreateReachingCond(from),
-                              CreateEdgeCond(from, to));
-    // Find the statement corresponding to the exiting block
-    auto it = std::find(loop_body.begin(), loop_body.end(), block_stmts[from]);
-    CHECK(it != loop_body.end());
+    auto cond = conds->GetOrCreateExpr(conds->CreateAnd(
+        GetOrCreateReachingCond(from), CreateEdgeCond(from, to)));
     // Create a loop exiting `break` statement
     StmtVec break_stmt({CreateBreakStmt(*ast_ctx)});
-    auto exit_stmt =
+    exit_stmt =
         CreateIfStmt(*ast_ctx, cond, CreateCompoundStmt(*ast_ctx, break_stmt));
-    // Insert it after the exiting block statement
-    loop_body.insert(std::next(it), exit_stmt);
+    breaks[block_stmts[GetBlockID(from)]].push_back(exit_stmt);
+  }
+  // Split the region body into the loop body and the rest. Statements of
+  // `region_body` are in the same order as `region_blocks[region]`.
+  StmtVec loop_body, rest_body;
+  auto &blocks = region_blocks[GetRegionID(region)];
+  CHECK_EQ(blocks.size(), region_body.size());
+  size_t num_breaks = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    auto stmt = region_body[i];
+    if (!members.test(GetBlockID(blocks[i]))) {
+      rest_body.push_back(stmt);
+      continue;
+    }
+    loop_body.push_back(stmt);
+    // Insert `break` statements after the exiting block statement, the
+    // last exit edge first
+    auto it = breaks.find(stmt);
+    if (it != breaks.end()) {
+      loop_body.insert(loop_body.end(), it->second.rbegin(),
+                       it->second.rend());
+      num_breaks += it->second.size();
+    }
   }
+  CHECK_EQ(num_breaks, exits.size());
+  region_body = std::move(rest_body);
   // Create the loop statement
-  auto loop_stmt = CreateWhileStmt(*ast_ctx, CreateTrueExpr(*ast_ctx),
-                                   CreateCompoundStmt(*ast_ctx, loop_body));
+  auto loop_stmt = CreateLoopStmt(loop, exits, exit_stmt, loop_body);
   // Insert it at the beginning of the region body
   region_body.insert(region_body.begin(), loop_stmt);
   // Structure the rest of the loop body as a acyclic region
   return CreateCompoundStmt(*ast_ctx, region_body);
 }
 
+clang::LabelDecl *GenerateAST::CreateLabel(llvm::Function *func) {
+  auto fdecl =
+      clang::cast<clang::FunctionDecl>(ast_gen->GetOrCreateDecl(func));
+  auto name = ast_gen->CreateVarName(fdecl, "", "label");
+  auto label =
+      CreateLabelDecl(*ast_ctx, fdecl, CreateIdentifier(*ast_ctx, name));
+  fdecl->addDecl(label);
+  return label;
+}
+
+bool GenerateAST::NeedsGotos(llvm::Region *region) {
+  if (!goto_threshold) {
+    return false;
+  }
+  auto &blocks = region_blocks[GetRegionID(region)];
+  if (blocks.size() > goto_threshold) {
+    return true;
+  }
+  // The entry heads a cycle through the region, but no natural loop
+  auto entry = region->getEntry();
+  if (loops->isLoopHeader(entry) &&
+      !region->outermostLoopInRegion(loops, entry)) {
+    return true;
+  }
+  // Blocks of irreducible cycles, which are part of no natural loop
+  for (auto block : blocks) {
+    if (IsRegionBlock(region, block) &&
+        cyclic_blocks.test(GetBlockID(block)) && !loops->getLoopFor(block)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every block and subregion of `region` becomes a labeled compound that
+// ends by jumping to its successors, under the conditions of the edges to
+// them. Jumps to the next compound fall through. Only the conditions of
+// single edges become expressions, so the size of the result is linear in
+// the size of the region.
+//
+// Labels also keep the compounds apart in later passes, which consider the
+// `if` statements of a compound to be independent of the statements that
+// separate them.
+clang::CompoundStmt *GenerateAST::StructureGotoRegion(llvm::Region *region) {
+  DLOG(INFO) << "Region " << GetRegionNameStr(region) << " uses gotos";
+  auto func = region->getEntry()->getParent();
+  auto &blocks = region_blocks[GetRegionID(region)];
+  std::unordered_map<llvm::BasicBlock *, clang::LabelDecl *> labels;
+  for (auto block : blocks) {
+    labels[block] = CreateLabel(func);
+  }
+  // Jumps out of the region go to its end
+  clang::LabelDecl *end_label = nullptr;
+
+  StmtVec region_body;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    auto block = blocks[i];
+    auto next = i + 1 < blocks.size() ? labels[blocks[i + 1]] : nullptr;
+    StmtVec body;
+    std::vector<std::pair<CondDAG::Node, llvm::BasicBlock *>> succs;
+    if (auto subregion = GetSubregion(region, block)) {
+      auto subregion_stmt = region_stmts[GetRegionID(subregion)];
+      CHECK(subregion_stmt);
+      body.push_back(subregion_stmt);
+      if (auto exit = subregion->getExit()) {
+        succs.push_back({conds->CreateTrue(), exit});
+      }
+    } else {
+      body = CreateBasicBlockStmts(block);
+      llvm::SmallPtrSet<llvm::BasicBlock *, 4> visited;
+      for (auto succ : llvm::successors(block)) {
+        if (visited.insert(succ).second) {
+          succs.push_back({CreateEdgeCond(block, succ), succ});
+        }
+      }
+    }
+    // The last successor is taken when the conditions of all others fail
+    for (size_t j = 0; j < succs.size(); ++j) {
+      auto succ = succs[j].second;
+      auto is_last = j + 1 == succs.size();
+      auto inside = succ && region->contains(succ);
+      if (is_last && (inside ? labels[succ] == next : !next)) {
+        continue;
+      }
+      if (!inside && !end_label) {
+        end_label = CreateLabel(func);
+      }
+      auto label = inside ? labels[succ] : end_label;
+      clang::Stmt *jump = CreateGotoStmt(*ast_ctx, label);
+      if (!is_last) {
+        auto cond = conds->GetOrCreateExpr(succs[j].first);
+        jump = CreateIfStmt(*ast_ctx, cond, jump);
+      }
+      body.push_back(jump);
+    }
+    region_body.push_back(CreateLabelStmt(
+        *ast_ctx, labels[block], CreateCompoundStmt(*ast_ctx, body)));
+  }
+  if (end_label) {
+    region_body.push_back(
+        CreateLabelStmt(*ast_ctx, end_label, CreateNullStmt(*ast_ctx)));
+  }
+  return CreateCompoundStmt(*ast_ctx, region_body);
+}
+
 clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
   DLOG(INFO) << "Structuring region " << GetRegionNameStr(region);
-  auto &region_stmt = region_stmts[region];
+  auto &region_stmt = region_stmts[GetRegionID(region)];
   if (region_stmt) {
     LOG(WARNING) << "Asking to re-structure region: "
                  << GetRegionNameStr(region)
@@ -372,85 +858,160 @@ clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
     return region_stmt;
   }
   // Compute reaching conditions
-  for (auto block : rpo_walk) {
+  for (auto block : region_blocks[GetRegionID(region)]) {
     if (IsRegionBlock(region, block)) {
       GetOrCreateReachingCond(block);
     }
   }
   // Structure
-  region_stmt = loops->isLoopHeader(region->getEntry())
-                    ? StructureCyclicRegion(region)
-                    : StructureAcyclicRegion(region);
+  if (NeedsGotos(region)) {
+    region_stmt = StructureGotoRegion(region);
+  } else if (loops->isLoopHeader(region->getEntry())) {
+    region_stmt = StructureCyclicRegion(region);
+  } else {
+    region_stmt = StructureAcyclicRegion(region);
+  }
   return region_stmt;
 }
 
 char GenerateAST::ID = 0;
 
-GenerateAST::GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen)
-    : ModulePass(GenerateAST::ID), ast_ctx(&ctx), ast_gen(&gen) {}
+GenerateAST::GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                         FunctionFilter filter, unsigned num_threads,
+                         unsigned goto_threshold, unsigned cond_size_limit)
+    : ModulePass(GenerateAST::ID),
+      ast_ctx(&ctx),
+      ast_gen(&gen),
+      filter(filter),
+      all_funcs(true),
+      conds(new CondDAG(ctx)),
+      num_threads(num_threads),
+      goto_threshold(goto_threshold),
+      cond_size_limit(cond_size_limit) {}
+
+GenerateAST::GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+                         FunctionList funcs, unsigned num_threads,
+                         unsigned goto_threshold, unsigned cond_size_limit)
+    : ModulePass(GenerateAST::ID),
+      ast_ctx(&ctx),
+      ast_gen(&gen),
+      funcs(std::move(funcs)),
+      all_funcs(false),
+      conds(new CondDAG(ctx)),
+      num_threads(num_threads),
+      goto_threshold(goto_threshold),
+      cond_size_limit(cond_size_limit) {}
 
 void GenerateAST::getAnalysisUsage(llvm::AnalysisUsage &usage) const {
   usage.addRequired<llvm::DominatorTreeWrapperPass>();
+  usage.addRequired<llvm::PostDominatorTreeWrapperPass>();
   usage.addRequired<llvm::RegionInfoPass>();
   usage.addRequired<llvm::LoopInfoWrapperPass>();
 }
 
-bool GenerateAST::runOnModule(llvm::Module &module) {
-  for (auto &var : module.globals()) {
-    ast_gen->VisitGlobalVar(var);
+void GenerateAST::GenerateDefinition(llvm::Function &func) {
+  TraceSpan span(func.getName(), "GenerateAST", func.getName());
+  // Clear the conditions from previous functions. Per-block and
+  // per-region state is reset once blocks are numbered.
+  case_conds.clear();
+  loop_shapes.clear();
+  conds->Clear();
+  LowerPHINodes(func);
+  // Get dominator tree
+  domtree = &getAnalysis<llvm::DominatorTreeWrapperPass>(func).getDomTree();
+  postdomtree =
+      &getAnalysis<llvm::PostDominatorTreeWrapperPass>(func).getPostDomTree();
+  // Get single-entry, single-exit regions
+  regions = &getAnalysis<llvm::RegionInfoPass>(func).getRegionInfo();
+  // Get loops
+  loops = &getAnalysis<llvm::LoopInfoWrapperPass>(func).getLoopInfo();
+  // Get a reverse post-order walk for iterating over region blocks in
+  // structurization
+  llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
+  rpo_walk.assign(rpo.begin(), rpo.end());
+  block_ids.clear();
+  for (unsigned i = 0; i < rpo_walk.size(); ++i) {
+    block_ids[rpo_walk[i]] = i;
   }
-
-  for (auto &func : module.functions()) {
-    ast_gen->VisitFunctionDecl(func);
+  reaching_conds.assign(rpo_walk.size(), CondDAG::kNoNode);
+  block_stmts.assign(rpo_walk.size(), nullptr);
+  cyclic_blocks.clear();
+  cyclic_blocks.resize(rpo_walk.size());
+  for (auto scc = llvm::scc_begin(&func); !scc.isAtEnd(); ++scc) {
+    if (scc.hasCycle()) {
+      for (auto block : *scc) {
+        cyclic_blocks.set(GetBlockID(block));
+      }
+    }
   }
+  BucketRegionBlocks();
+  if (num_threads > 1) {
+    AnalyzeLoopsConcurrently();
+  }
+  // Recursively walk regions in post-order and structure
+  std::function<void(llvm::Region *)> POWalkSubRegions;
+  POWalkSubRegions = [&](llvm::Region *region) {
+    for (auto &subregion : *region) {
+      POWalkSubRegions(&*subregion);
+    }
+    StructureRegion(region);
+  };
+  // Call the above declared bad boy
+  POWalkSubRegions(regions->getTopLevelRegion());
+  // Get the function declaration AST node for `func`
+  auto fdecl =
+      clang::cast<clang::FunctionDecl>(ast_gen->GetOrCreateDecl(&func));
+  // Create a redeclaration of `fdecl` that will serve as a definition
+  auto tudecl = ast_ctx->getTranslationUnitDecl();
+  auto fdefn = CreateFunctionDecl(*ast_ctx, tudecl, fdecl->getIdentifier(),
+                                  fdecl->getType());
+  fdefn->setPreviousDecl(fdecl);
+  tudecl->addDecl(fdefn);
+  // Set parameters to the same as the previous declaration
+  fdefn->setParams(fdecl->parameters());
+  // Set body to the compound of the top-level region
+  fdefn->setBody(region_stmts[GetRegionID(regions->getTopLevelRegion())]);
+}
 
-  for (auto &func : module.functions()) {
-    if (func.isDeclaration()) {
-      continue;
+bool GenerateAST::runOnModule(llvm::Module &module) {
+  PassStats stats("GenerateAST", *ast_ctx);
+  ast_gen->LowerModuleDecls(module);
+
+  if (!all_funcs) {
+    for (auto func : funcs) {
+      GenerateDefinition(*func);
     }
-    // Clear the region statements from previous functions
-    region_stmts.clear();
-    // Get dominator tree
-    domtree = &getAnalysis<llvm::DominatorTreeWrapperPass>(func).getDomTree();
-    // Get single-entry, single-exit regions
-    regions = &getAnalysis<llvm::RegionInfoPass>(func).getRegionInfo();
-    // Get loops
-    loops = &getAnalysis<llvm::LoopInfoWrapperPass>(func).getLoopInfo();
-    // Get a reverse post-order walk for iterating over region blocks in
-    // structurization
-    llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
-    rpo_walk.assign(rpo.begin(), rpo.end());
-    // Recursively walk regions in post-order and structure
-    std::function<void(llvm::Region *)> POWalkSubRegions;
-    POWalkSubRegions = [&](llvm::Region *region) {
-      for (auto &subregion : *region) {
-        POWalkSubRegions(&*subregion);
+  } else {
+    for (auto &func : module.functions()) {
+      if (!func.isDeclaration() && (!filter || filter(func))) {
+        GenerateDefinition(func);
       }
-      StructureRegion(region);
-    };
-    // Call the above declared bad boy
-    POWalkSubRegions(regions->getTopLevelRegion());
-    // Get the function declaration AST node for `func`
-    auto fdecl =
-        clang::cast<clang::FunctionDecl>(ast_gen->GetOrCreateDecl(&func));
-    // Create a redeclaration of `fdecl` that will serve as a definition
-    auto tudecl = ast_ctx->getTranslationUnitDecl();
-    auto fdefn = CreateFunctionDecl(*ast_ctx, tudecl, fdecl->getIdentifier(),
-                                    fdecl->getType());
-    fdefn->setPreviousDecl(fdecl);
-    tudecl->addDecl(fdefn);
-    // Set parameters to the same as the previous declaration
-    fdefn->setParams(fdecl->parameters());
-    // Set body to the compound of the top-level region
-    fdefn->setBody(region_stmts[regions->getTopLevelRegion()]);
+    }
   }
 
+  stats.SetMapBytes(ast_gen->GetMemoryUsage());
+  stats.Finish(0, true);
   return true;
 }
 
 llvm::ModulePass *createGenerateASTPass(clang::ASTContext &ctx,
-                                        rellic::IRToASTVisitor &gen) {
-  return new GenerateAST(ctx, gen);
+                                        rellic::IRToASTVisitor &gen,
+                                        GenerateAST::FunctionFilter filter,
+                                        unsigned num_threads,
+                                        unsigned goto_threshold,
+                                        unsigned cond_size_limit) {
+  return new GenerateAST(ctx, gen, filter, num_threads, goto_threshold,
+                         cond_size_limit);
+}
+
+llvm::ModulePass *createGenerateASTPass(clang::ASTContext &ctx,
+                                        rellic::IRToASTVisitor &gen,
+                                        GenerateAST::FunctionList funcs,
+                                        unsigned num_threads,
+                                        unsigned goto_threshold,
+                                        unsigned cond_size_limit) {
+  return new GenerateAST(ctx, gen, std::move(funcs), num_threads,
+                         goto_threshold, cond_size_limit);
 }
 
 }  // namespace rellic
@@ -16,55 +16,158 @@
 
 #pragma once
 
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/Analysis/Passes.h>
+#include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/RegionInfo.h>
 #include <llvm/IR/Module.h>
 
-#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <limits>
+#include <unordered_map>
+#include <vector>
 
+#include "rellic/AST/CondDAG.h"
 #include "rellic/AST/IRToASTVisitor.h"
 
 namespace rellic {
 
 class GenerateAST : public llvm::ModulePass {
+ public:
+  // Selects the functions for which a definition is generated
+  using FunctionFilter = std::function<bool(llvm::Function &)>;
+  using FunctionList = std::vector<llvm::Function *>;
+
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
-  std::unordered_map<llvm::BasicBlock *, clang::Expr *> reaching_conds;
-  std::unordered_map<llvm::BasicBlock *, clang::IfStmt *> block_stmts;
-  std::unordered_map<llvm::Region *, clang::CompoundStmt *> region_stmts;
+  FunctionFilter filter;
+  // Unless `all_funcs`, definitions are only generated for `funcs`, and
+  // the other functions of the module are not visited
+  FunctionList funcs;
+  bool all_funcs;
+
+  void GenerateDefinition(llvm::Function &func);
+  // Blocks in reverse post-order. The position of a block in it is its
+  // ID, which indexes the per-block state below, and regions get IDs in
+  // the order in which `BucketRegionBlocks` meets them. Per-block and
+  // per-region state keeps its storage from one function to the next.
+  std::vector<llvm::BasicBlock *> rpo_walk;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> block_ids;
+  llvm::DenseMap<llvm::Region *, unsigned> region_ids;
+
+  static constexpr unsigned kNoID{std::numeric_limits<unsigned>::max()};
+
+  // Returns the ID of `block`, or `kNoID` if it is unreachable
+  unsigned FindBlockID(llvm::BasicBlock *block) const;
+  unsigned GetBlockID(llvm::BasicBlock *block) const;
+  unsigned GetRegionID(llvm::Region *region) const;
+
+  // Reaching conditions are kept as shared nodes of `conds` and only
+  // become `clang::Expr`s when a statement gets gated behind them.
+  // Blocks without a reaching condition yet have `CondDAG::kNoNode`.
+  std::unique_ptr<CondDAG> conds;
+  std::vector<CondDAG::Node> reaching_conds;
+  // Atoms `cond == val` of the cases of every switch, in case order
+  std::unordered_map<llvm::SwitchInst *, std::vector<CondDAG::Node>>
+      case_conds;
+  std::vector<clang::IfStmt *> block_stmts;
+  std::vector<clang::CompoundStmt *> region_stmts;
+  // Variables that take the incoming values of PHI nodes whose own
+  // variable is still read when the edges into their block are taken
+  std::unordered_map<llvm::PHINode *, clang::VarDecl *> phi_inputs;
+  // Declarations of the PHI variables of the current function
+  std::vector<clang::Stmt *> phi_decls;
 
   llvm::DominatorTree *domtree;
+  llvm::PostDominatorTree *postdomtree;
   llvm::RegionInfo *regions;
   llvm::LoopInfo *loops;
 
-  std::vector<llvm::BasicBlock *> rpo_walk;
+  // Blocks of every region and entries of its immediate subregions, in
+  // reverse post-order
+  std::vector<std::vector<llvm::BasicBlock *>> region_blocks;
+
+  void BucketRegionBlocks();
 
-  clang::Expr *CreateEdgeCond(llvm::BasicBlock *from, llvm::BasicBlock *to);
-  clang::Expr *GetOrCreateReachingCond(llvm::BasicBlock *block);
+  std::vector<CondDAG::Node> &GetOrCreateCaseConds(llvm::SwitchInst *inst);
+  CondDAG::Node CreateEdgeCond(llvm::BasicBlock *from, llvm::BasicBlock *to);
+  CondDAG::Node GetOrCreateReachingCond(llvm::BasicBlock *block);
+  void LowerPHINodes(llvm::Function &func);
+  std::vector<clang::Stmt *> CreatePHICopies(llvm::BasicBlock *block);
   std::vector<clang::Stmt *> CreateBasicBlockStmts(llvm::BasicBlock *block);
   std::vector<clang::Stmt *> CreateRegionStmts(llvm::Region *region);
 
-  using BBSet = std::unordered_set<llvm::BasicBlock *>;
+  // Sets of blocks by ID
+  using BBSet = llvm::BitVector;
+
+  // Blocks that are part of a cycle, natural loop or not
+  BBSet cyclic_blocks;
 
   void RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
                             BBSet &successors);
 
+  // Members of the loop of a cyclic region after refinement, and the edges
+  // that leave it, in reverse post-order of their successors
+  using BBEdges =
+      std::vector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>>;
+  struct LoopShape {
+    BBSet members;
+    BBEdges exits;
+  };
+  // Shapes of the loops of cyclic regions. They only depend on the CFG, so
+  // they may be computed concurrently ahead of structurization.
+  std::unordered_map<llvm::Region *, LoopShape> loop_shapes;
+  unsigned num_threads;
+
+  void AnalyzeLoop(llvm::Loop *loop, LoopShape &shape);
+  void AnalyzeLoopsConcurrently();
+
+  // Regions with more blocks and subregions than this, and regions with
+  // cycles that aren't natural loops, are structured with `goto`s. 0 turns
+  // the fallback off.
+  unsigned goto_threshold;
+  // Reaching conditions that print larger than this are simplified before
+  // they propagate to successors. 0 turns simplification off.
+  unsigned cond_size_limit;
+
+  clang::LabelDecl *CreateLabel(llvm::Function *func);
+  bool NeedsGotos(llvm::Region *region);
+
+  clang::Stmt *CreateLoopStmt(llvm::Loop *loop, const BBEdges &exits,
+                              clang::IfStmt *exit_stmt,
+                              std::vector<clang::Stmt *> &loop_body);
   clang::CompoundStmt *StructureAcyclicRegion(llvm::Region *region);
   clang::CompoundStmt *StructureCyclicRegion(llvm::Region *region);
+  clang::CompoundStmt *StructureGotoRegion(llvm::Region *region);
   clang::CompoundStmt *StructureRegion(llvm::Region *region);
 
  public:
   static char ID;
 
-  GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen);
+  // With `num_threads > 1`, the loops of sibling regions are analyzed
+  // concurrently. AST nodes are still created by the calling thread.
+  GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+              FunctionFilter filter = nullptr, unsigned num_threads = 1,
+              unsigned goto_threshold = 0, unsigned cond_size_limit = 0);
+  GenerateAST(clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+              FunctionList funcs, unsigned num_threads = 1,
+              unsigned goto_threshold = 0, unsigned cond_size_limit = 0);
 
   void getAnalysisUsage(llvm::AnalysisUsage &usage) const override;
   bool runOnModule(llvm::Module &module) override;
 };
 
-llvm::ModulePass *createGenerateASTPass(clang::ASTContext &ctx,
-                                        rellic::IRToASTVisitor &gen);
+llvm::ModulePass *createGenerateASTPass(
+    clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+    GenerateAST::FunctionFilter filter = nullptr, unsigned num_threads = 1,
+    unsigned goto_threshold = 0, unsigned cond_size_limit = 0);
+llvm::ModulePass *createGenerateASTPass(
+    clang::ASTContext &ctx, rellic::IRToASTVisitor &gen,
+    GenerateAST::FunctionList funcs, unsigned num_threads = 1,
+    unsigned goto_threshold = 0, unsigned cond_size_limit = 0);
 }  // namespace rellic
 
 namespace llvm {
@@ -20,9 +20,15 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Support/MD5.h>
 
+#include <algorithm>
+#include <functional>
 #include <iterator>
 
+#include "rellic/AST/LazyInit.h"
 #include "rellic/AST/Util.h"
 #include "rellic/BC/Compat/IntrinsicInst.h"
 #include "rellic/BC/Compat/Value.h"
@@ -30,7 +36,184 @@
 
 namespace rellic {
 
-IRToASTVisitor::IRToASTVisitor(clang::ASTContext &ctx) : ast_ctx(ctx) {}
+namespace {
+
+// How operands are cast to an integer type of their own size first
+enum class SignCast { kNone, kUnsigned, kSigned };
+
+// C operator of an LLVM binary operator, and of its `i1` form
+struct BinaryOpInfo {
+  bool valid;
+  clang::BinaryOperatorKind opc;
+  clang::BinaryOperatorKind bool_opc;
+  // Shifts only cast the left operand. Division and remainder cast both,
+  // and have the type of the cast left operand.
+  SignCast lhs_cast;
+  SignCast rhs_cast;
+};
+
+static constexpr BinaryOpInfo GetBinaryOpInfo(unsigned opcode) {
+  using Ops = llvm::Instruction::BinaryOps;
+  constexpr auto kNone{SignCast::kNone};
+  constexpr auto kUnsigned{SignCast::kUnsigned};
+  constexpr auto kSigned{SignCast::kSigned};
+  switch (static_cast<Ops>(opcode)) {
+    case Ops::LShr:
+      return {true, clang::BO_Shr, clang::BO_Shr, kUnsigned, kNone};
+    case Ops::AShr:
+      return {true, clang::BO_Shr, clang::BO_Shr, kSigned, kNone};
+    case Ops::Shl:
+      return {true, clang::BO_Shl, clang::BO_Shl, kNone, kNone};
+    case Ops::And:
+      return {true, clang::BO_And, clang::BO_LAnd, kNone, kNone};
+    case Ops::Or:
+      return {true, clang::BO_Or, clang::BO_LOr, kNone, kNone};
+    case Ops::Xor:
+      return {true, clang::BO_Xor, clang::BO_Xor, kNone, kNone};
+    case Ops::URem:
+      return {true, clang::BO_Rem, clang::BO_Rem, kUnsigned, kUnsigned};
+    case Ops::SRem:
+      return {true, clang::BO_Rem, clang::BO_Rem, kSigned, kSigned};
+    case Ops::UDiv:
+      return {true, clang::BO_Div, clang::BO_Div, kUnsigned, kUnsigned};
+    case Ops::SDiv:
+      return {true, clang::BO_Div, clang::BO_Div, kSigned, kSigned};
+    case Ops::FDiv:
+      return {true, clang::BO_Div, clang::BO_Div, kNone, kNone};
+    case Ops::Add:
+    case Ops::FAdd:
+      return {true, clang::BO_Add, clang::BO_Add, kNone, kNone};
+    case Ops::Sub:
+    case Ops::FSub:
+      return {true, clang::BO_Sub, clang::BO_Sub, kNone, kNone};
+    case Ops::Mul:
+    case Ops::FMul:
+      return {true, clang::BO_Mul, clang::BO_Mul, kNone, kNone};
+    default:
+      return {false, clang::BO_Add, clang::BO_Add, kNone, kNone};
+  }
+}
+
+// C operator of an LLVM comparison predicate
+struct CmpInfo {
+  bool valid;
+  clang::BinaryOperatorKind opc;
+};
+
+static constexpr CmpInfo GetCmpInfo(unsigned predicate) {
+  using Pred = llvm::CmpInst::Predicate;
+  switch (static_cast<Pred>(predicate)) {
+    case Pred::ICMP_UGT:
+    case Pred::ICMP_SGT:
+    case Pred::FCMP_OGT:
+      return {true, clang::BO_GT};
+    case Pred::ICMP_ULT:
+    case Pred::ICMP_SLT:
+    case Pred::FCMP_OLT:
+      return {true, clang::BO_LT};
+    case Pred::ICMP_UGE:
+    case Pred::ICMP_SGE:
+    case Pred::FCMP_OGE:
+      return {true, clang::BO_GE};
+    case Pred::ICMP_ULE:
+    case Pred::ICMP_SLE:
+    case Pred::FCMP_OLE:
+      return {true, clang::BO_LE};
+    case Pred::ICMP_EQ:
+    case Pred::FCMP_OEQ:
+      return {true, clang::BO_EQ};
+    case Pred::ICMP_NE:
+    case Pred::FCMP_UNE:
+      return {true, clang::BO_NE};
+    default:
+      return {false, clang::BO_EQ};
+  }
+}
+
+// C cast of an LLVM cast, and the signedness of its integer result
+enum class CastSign { kNone, kOperand, kSigned };
+
+struct CastInfo {
+  bool valid;
+  clang::CastKind kind;
+  CastSign sign;
+};
+
+static constexpr CastInfo GetCastInfo(unsigned opcode) {
+  using Ops = llvm::Instruction::CastOps;
+  switch (static_cast<Ops>(opcode)) {
+    case Ops::Trunc:
+      return {true, clang::CK_IntegralCast, CastSign::kOperand};
+    case Ops::BitCast:
+      return {true, clang::CK_BitCast, CastSign::kNone};
+    case Ops::SExt:
+      return {true, clang::CK_IntegralCast, CastSign::kSigned};
+    case Ops::ZExt:
+      return {true, clang::CK_IntegralCast, CastSign::kNone};
+    case Ops::PtrToInt:
+      return {true, clang::CK_PointerToIntegral, CastSign::kNone};
+    case Ops::IntToPtr:
+      return {true, clang::CK_IntegralToPointer, CastSign::kNone};
+    case Ops::SIToFP:
+      return {true, clang::CK_IntegralToFloating, CastSign::kNone};
+    case Ops::FPToUI:
+    case Ops::FPToSI:
+      return {true, clang::CK_FloatingToIntegral, CastSign::kNone};
+    case Ops::FPExt:
+    case Ops::FPTrunc:
+      return {true, clang::CK_FloatingCast, CastSign::kNone};
+    default:
+      return {false, clang::CK_NoOp, CastSign::kNone};
+  }
+}
+
+// `Info` of every value in [Begin, End), computed at compile time
+template <typename Info, unsigned Begin, unsigned End,
+          Info (*GetInfo)(unsigned)>
+struct OpcodeTable {
+  Info infos[End - Begin];
+
+  constexpr OpcodeTable() : infos() {
+    for (auto i = Begin; i < End; ++i) {
+      infos[i - Begin] = GetInfo(i);
+    }
+  }
+
+  constexpr Info Lookup(unsigned i) const {
+    return i >= Begin && i < End ? infos[i - Begin] : GetInfo(i);
+  }
+};
+
+static constexpr OpcodeTable<BinaryOpInfo, llvm::Instruction::BinaryOpsBegin,
+                             llvm::Instruction::BinaryOpsEnd, GetBinaryOpInfo>
+    kBinaryOps;
+static constexpr OpcodeTable<CmpInfo, llvm::CmpInst::FIRST_FCMP_PREDICATE,
+                             llvm::CmpInst::BAD_ICMP_PREDICATE, GetCmpInfo>
+    kCmpPredicates;
+static constexpr OpcodeTable<CastInfo, llvm::Instruction::CastOpsBegin,
+                             llvm::Instruction::CastOpsEnd, GetCastInfo>
+    kCastOps;
+
+}  // namespace
+
+IRToASTVisitor::IRToASTVisitor(clang::ASTContext &ctx)
+    : ast_ctx(ctx), types(TypeCache::Get(ctx)) {}
+
+IRToASTVisitor::~IRToASTVisitor() {
+  if (auto inits = LazyInitializers::Find(ast_ctx)) {
+    for (auto var : lazy_vars) {
+      inits->Remove(var);
+    }
+  }
+}
+
+clang::Expr *IRToASTVisitor::CreateSignCastExpr(clang::Expr *operand,
+                                                bool sign) {
+  auto size{ast_ctx.getTypeSize(operand->getType())};
+  auto type{types.GetIntType(size, sign)};
+  return CreateCStyleCastExpr(ast_ctx, type, clang::CastKind::CK_IntegralCast,
+                              operand);
+}
 
 clang::QualType IRToASTVisitor::GetQualType(llvm::Type *type) {
   DLOG(INFO) << "GetQualType: " << LLVMThingToString(type);
@@ -59,7 +242,7 @@ clang::QualType IRToASTVisitor::GetQualType(llvm::Type *type) {
     case llvm::Type::IntegerTyID: {
       auto size{type->getIntegerBitWidth()};
       CHECK(size > 0) << "Integer bit width has to be greater than 0";
-      result = GetLeastIntTypeForBitWidth(ast_ctx, size, /*sign=*/0);
+      result = types.GetIntType(size, /*sign=*/false);
     } break;
 
     case llvm::Type::FunctionTyID: {
@@ -76,19 +259,24 @@ clang::QualType IRToASTVisitor::GetQualType(llvm::Type *type) {
 
     case llvm::Type::PointerTyID: {
       auto ptr = llvm::cast<llvm::PointerType>(type);
-      result = ast_ctx.getPointerType(GetQualType(ptr->getElementType()));
+      result = types.GetPointerType(GetQualType(ptr->getElementType()));
     } break;
 
     case llvm::Type::ArrayTyID: {
       auto arr = llvm::cast<llvm::ArrayType>(type);
       auto elm = GetQualType(arr->getElementType());
-      result = GetConstantArrayType(ast_ctx, elm, arr->getNumElements());
+      result = types.GetArrayType(elm, arr->getNumElements());
     } break;
 
     case llvm::Type::StructTyID: {
       clang::RecordDecl *sdecl = nullptr;
-      auto &decl = type_decls[type];
-      if (!decl) {
+      auto decl = type_decls.lookup(type);
+      auto rep = struct_reps.lookup(type);
+      if (!decl && rep) {
+        result = GetQualType(rep);
+        type_decls[type] = type_decls.lookup(rep);
+      } else if (!decl) {
+        DCHECK(!frozen) << "Structure missing from the module summary";
         auto tudecl = ast_ctx.getTranslationUnitDecl();
         auto strct = llvm::cast<llvm::StructType>(type);
         auto sname = strct->getName().str();
@@ -98,7 +286,8 @@ clang::QualType IRToASTVisitor::GetQualType(llvm::Type *type) {
         }
         // Create a C struct declaration
         auto sid = CreateIdentifier(ast_ctx, sname);
-        decl = sdecl = CreateStructDecl(ast_ctx, tudecl, sid);
+        sdecl = CreateStructDecl(ast_ctx, tudecl, sid);
+        type_decls[type] = sdecl;
         // Add fields to the C struct
         for (auto ecnt = 0U; ecnt < strct->getNumElements(); ++ecnt) {
           auto etype = GetQualType(strct->getElementType(ecnt));
@@ -112,7 +301,9 @@ clang::QualType IRToASTVisitor::GetQualType(llvm::Type *type) {
       } else {
         sdecl = clang::cast<clang::RecordDecl>(decl);
       }
-      result = ast_ctx.getRecordType(sdecl);
+      if (sdecl) {
+        result = ast_ctx.getRecordType(sdecl);
+      }
     } break;
 
     case llvm::Type::MetadataTyID:
@@ -204,9 +395,8 @@ clang::Expr *IRToASTVisitor::CreateLiteralExpr(llvm::Constant *constant) {
         } break;
 
         case clang::BuiltinType::Kind::UInt128: {
-          auto least_type{GetLeastIntTypeForBitWidth(ast_ctx,
-                                                     val.getMinSignedBits(),
-                                                     /*sign=*/0)};
+          auto least_type{
+              types.GetIntType(val.getMinSignedBits(), /*sign=*/false)};
           auto least_size{ast_ctx.getTypeSize(least_type)};
           auto representable_size{
               ast_ctx.getTypeSize(ast_ctx.UnsignedLongLongTy)};
@@ -285,6 +475,29 @@ clang::Expr *IRToASTVisitor::CreateLiteralExpr(llvm::Constant *constant) {
   return result;
 }
 
+// Lowers constant expressions without materializing them as instructions
+clang::Expr *IRToASTVisitor::CreateConstantExpr(llvm::ConstantExpr *cexpr) {
+  auto &op = *llvm::cast<llvm::Operator>(cexpr);
+  if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(cexpr)) {
+    return CreateGEPExpr(*gep);
+  } else if (cexpr->isCast()) {
+    return CreateCastExpr(op);
+  } else if (cexpr->isCompare()) {
+    auto pred = static_cast<llvm::CmpInst::Predicate>(cexpr->getPredicate());
+    return CreateCmpExpr(op, pred);
+  } else if (llvm::Instruction::isBinaryOp(cexpr->getOpcode())) {
+    return CreateBinaryExpr(op);
+  } else if (cexpr->getOpcode() == llvm::Instruction::Select) {
+    return CreateSelectExpr(op);
+  }
+  // Lower the remaining kinds through a temporary instruction
+  auto inst = cexpr->getAsInstruction();
+  auto stmt = GetOrCreateStmt(inst);
+  stmts.erase(inst);
+  DeleteValue(inst);
+  return clang::cast<clang::Expr>(stmt);
+}
+
 #define ASSERT_ON_VALUE_TYPE(x)               \
   if (llvm::isa<x>(val)) {                    \
     LOG(FATAL) << "Invalid operand [" #x "]"; \
@@ -309,7 +522,7 @@ clang::Expr *IRToASTVisitor::GetOperandExpr(llvm::Value *val) {
     // Add a `&` operator
     ref = CreateParenExpr(
         ast_ctx, CreateUnaryOperator(ast_ctx, clang::UO_AddrOf, ref,
-                                     ast_ctx.getPointerType(ref->getType())));
+                                     types.GetPointerType(ref->getType())));
     return ref;
   }
   // Operand is a function argument or local variable
@@ -342,62 +555,171 @@ clang::Expr *IRToASTVisitor::GetOperandExpr(llvm::Value *val) {
 }
 
 clang::Decl *IRToASTVisitor::GetOrCreateIntrinsic(llvm::InlineAsm *val) {
-  auto &decl = value_decls[val];
-  if (decl) {
+  if (auto decl = module_decls.lookup(val)) {
     return decl;
   }
-
+  DCHECK(!frozen) << "Inline assembly missing from the module summary";
+
+  // Name inline assembly after its contents, so that the name does not
+  // depend on which functions were lowered before
+  llvm::MD5 md5;
+  md5.update(val->getAsmString());
+  md5.update(val->getConstraintString());
+  md5.update(LLVMThingToString(val->getType()));
+  llvm::MD5::MD5Result digest;
+  md5.final(digest);
   auto tudecl = ast_ctx.getTranslationUnitDecl();
-  auto num = GetNumDecls<clang::FunctionDecl>(tudecl);
-  auto name = "asm_" + std::to_string(num);
+  auto name = "asm_" + digest.digest().str().substr(0, 8).str();
   auto id = CreateIdentifier(ast_ctx, name);
   auto type = GetQualType(val->getType()->getPointerElementType());
-  decl = CreateFunctionDecl(ast_ctx, tudecl, id, type);
+  auto decl = CreateFunctionDecl(ast_ctx, tudecl, id, type);
+  module_decls[val] = decl;
 
   return decl;
 }
 
 clang::Stmt *IRToASTVisitor::GetOrCreateStmt(llvm::Value *val) {
-  auto &stmt = stmts[val];
-  if (stmt) {
+  if (auto stmt = stmts.lookup(val)) {
     return stmt;
   }
   // ConstantExpr
   if (auto cexpr = llvm::dyn_cast<llvm::ConstantExpr>(val)) {
-    auto inst = cexpr->getAsInstruction();
-    stmt = GetOrCreateStmt(inst);
-    stmts.erase(inst);
-    DeleteValue(inst);
+    auto stmt = CreateConstantExpr(cexpr);
+    stmts[val] = stmt;
     return stmt;
   }
   // ConstantAggregate
   if (auto caggr = llvm::dyn_cast<llvm::ConstantAggregate>(val)) {
-    stmt = CreateLiteralExpr(caggr);
+    auto stmt = CreateLiteralExpr(caggr);
+    stmts[val] = stmt;
     return stmt;
   }
   // ConstantData
   if (auto cdata = llvm::dyn_cast<llvm::ConstantData>(val)) {
-    stmt = CreateLiteralExpr(cdata);
+    auto stmt = CreateLiteralExpr(cdata);
+    stmts[val] = stmt;
     return stmt;
   }
   // Instruction
   if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
     visit(inst);
-    return stmt;
+    return stmts.lookup(val);
   }
 
   LOG(FATAL) << "Unsupported value type";
 
-  return stmt;
+  return nullptr;
 }
 
 void IRToASTVisitor::SetStmt(llvm::Value *val, clang::Stmt *stmt) {
   stmts[val] = stmt;
 }
 
+clang::Expr *IRToASTVisitor::CreateAssignExpr(clang::ValueDecl *var,
+                                              llvm::Value *val) {
+  auto type = var->getType();
+  return CreateBinaryOperator(ast_ctx, clang::BO_Assign,
+                              CreateDeclRefExpr(ast_ctx, var),
+                              GetOperandExpr(val), type);
+}
+
+clang::Expr *IRToASTVisitor::CreateCaseCondExpr(llvm::Value *val,
+                                                llvm::ConstantInt *case_val) {
+  auto lhs = GetOperandExpr(val);
+  auto rhs = GetOperandExpr(case_val);
+  return CreateBinaryOperator(
+      ast_ctx, clang::BO_EQ, CastExpr(ast_ctx, rhs->getType(), lhs),
+      CastExpr(ast_ctx, lhs->getType(), rhs), ast_ctx.IntTy);
+}
+
+IRToASTVisitor::NameScope &IRToASTVisitor::GetNameScope(
+    clang::DeclContext *decl_ctx) {
+  auto iter = name_scopes.find(decl_ctx);
+  if (iter != name_scopes.end()) {
+    return iter->second;
+  }
+  // Account for declarations that were created before the scope
+  auto &scope = name_scopes[decl_ctx];
+  scope.num_vars = 0;
+  for (auto decl : decl_ctx->decls()) {
+    if (clang::isa<clang::VarDecl>(decl)) {
+      ++scope.num_vars;
+    }
+    if (auto named = clang::dyn_cast<clang::NamedDecl>(decl)) {
+      scope.names.insert(named->getNameAsString());
+    }
+  }
+  return scope;
+}
+
+std::string IRToASTVisitor::CreateVarName(clang::DeclContext *decl_ctx,
+                                          std::string name,
+                                          const std::string &prefix) {
+  auto &scope = GetNameScope(decl_ctx);
+  if (name.empty() || scope.names.count(name)) {
+    auto num = scope.num_vars;
+    do {
+      name = prefix + std::to_string(num++);
+    } while (scope.names.count(name));
+  }
+  scope.names.insert(name);
+  ++scope.num_vars;
+  return name;
+}
+
+void IRToASTVisitor::ClearFunctionBody(llvm::Function &func) {
+  for (auto &inst : llvm::instructions(func)) {
+    stmts.erase(&inst);
+    value_decls.erase(&inst);
+  }
+}
+
+void IRToASTVisitor::ClearDecl(llvm::GlobalValue &value) {
+  CHECK(!frozen) << "Can't change the declarations of a summarized module";
+  auto decl{module_decls.lookup(&value)};
+  if (!decl) {
+    return;
+  }
+  module_decls.erase(&value);
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  tudecl->removeDecl(decl);
+  if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+    if (auto inits = LazyInitializers::Find(ast_ctx)) {
+      inits->Remove(var);
+    }
+  }
+  // Let the new declaration have the same name
+  GetNameScope(tudecl).names.erase(decl->getNameAsString());
+  if (auto func = llvm::dyn_cast<llvm::Function>(&value)) {
+    for (auto &arg : func->args()) {
+      module_decls.erase(&arg);
+    }
+    name_scopes.erase(clang::cast<clang::FunctionDecl>(decl));
+  }
+}
+
+size_t IRToASTVisitor::GetMemoryUsage() const {
+  auto bytes{type_decls.getMemorySize() + struct_reps.getMemorySize() +
+             module_decls.getMemorySize() + value_decls.getMemorySize() +
+             stmts.getMemorySize()};
+  for (auto &scope : name_scopes) {
+    auto &names{scope.second.names};
+    bytes += sizeof(scope) + names.bucket_count() * sizeof(void *) +
+             names.size() * (sizeof(std::string) + sizeof(void *));
+  }
+  return bytes;
+}
+
+clang::ValueDecl *IRToASTVisitor::LookupDecl(llvm::Value *val) const {
+  if (llvm::isa<llvm::GlobalValue>(val) || llvm::isa<llvm::Argument>(val) ||
+      llvm::isa<llvm::InlineAsm>(val)) {
+    return module_decls.lookup(val);
+  }
+  return value_decls.lookup(val);
+}
+
 clang::Decl *IRToASTVisitor::GetOrCreateDecl(llvm::Value *val) {
-  auto &decl = value_decls[val];
-  if (decl) {
+  if (auto decl = LookupDecl(val)) {
     return decl;
   }
 
@@ -409,17 +731,173 @@ clang::Decl *IRToASTVisitor::GetOrCreateDecl(llvm::Value *val) {
     VisitArgument(*arg);
   } else if (auto inst = llvm::dyn_cast<llvm::AllocaInst>(val)) {
     visitAllocaInst(*inst);
+  } else if (auto phi = llvm::dyn_cast<llvm::PHINode>(val)) {
+    visitPHINode(*phi);
   } else {
     LOG(FATAL) << "Unsupported value type";
   }
 
-  return decl;
+  return LookupDecl(val);
+}
+
+// Name of `type` without the `.N` suffixes that linking appends to
+// distinguish types of the same name
+static llvm::StringRef GetBaseName(llvm::StructType *type) {
+  auto name{type->hasName() ? type->getName() : llvm::StringRef()};
+  for (;;) {
+    auto pos{name.rfind('.')};
+    if (pos == llvm::StringRef::npos || pos + 1 == name.size() ||
+        name.substr(pos + 1).find_first_not_of("0123456789") !=
+            llvm::StringRef::npos) {
+      return name;
+    }
+    name = name.substr(0, pos);
+  }
+}
+
+void IRToASTVisitor::InternStructTypes(
+    const std::vector<llvm::StructType *> &types) {
+  auto IsKnown{[this](llvm::Type *type) {
+    return type_decls.count(type) || struct_reps.count(type);
+  }};
+  if (std::all_of(types.begin(), types.end(), IsKnown)) {
+    return;
+  }
+
+  // Partition refinement: start with classes of types with the same
+  // shape, then split classes whose elements fall into different classes
+  // until no class splits anymore
+  std::unordered_map<llvm::Type *, unsigned> classes;
+  std::function<void(llvm::Type *, llvm::raw_ostream &)> Describe;
+  Describe = [&](llvm::Type *type, llvm::raw_ostream &os) {
+    switch (type->getTypeID()) {
+      case llvm::Type::StructTyID: {
+        auto it{classes.find(type)};
+        if (it != classes.end()) {
+          os << '%' << it->second;
+        } else {
+          os << '%' << static_cast<void *>(type);
+        }
+      } break;
+      case llvm::Type::PointerTyID: {
+        auto ptr{llvm::cast<llvm::PointerType>(type)};
+        Describe(ptr->getElementType(), os);
+        os << " addrspace(" << ptr->getAddressSpace() << ")*";
+      } break;
+      case llvm::Type::ArrayTyID: {
+        auto arr{llvm::cast<llvm::ArrayType>(type)};
+        os << '[' << arr->getNumElements() << " x ";
+        Describe(arr->getElementType(), os);
+        os << ']';
+      } break;
+      case llvm::Type::FunctionTyID: {
+        auto func{llvm::cast<llvm::FunctionType>(type)};
+        Describe(func->getReturnType(), os);
+        os << '(';
+        for (auto param : func->params()) {
+          Describe(param, os);
+          os << ',';
+        }
+        os << (func->isVarArg() ? "...)" : ")");
+      } break;
+      default:
+        type->print(os);
+        break;
+    }
+  };
+
+  std::unordered_map<std::string, unsigned> ids;
+  for (auto type : types) {
+    std::string key;
+    llvm::raw_string_ostream os(key);
+    os << GetBaseName(type) << ' ' << type->isPacked() << type->isOpaque()
+       << ' ' << type->getNumElements();
+    classes[type] = ids.emplace(os.str(), ids.size()).first->second;
+  }
+
+  for (auto num_classes = 0U; num_classes != ids.size();) {
+    num_classes = ids.size();
+    ids.clear();
+    std::unordered_map<llvm::Type *, unsigned> refined;
+    for (auto type : types) {
+      std::string key;
+      llvm::raw_string_ostream os(key);
+      os << classes[type] << ':';
+      for (auto elem : type->elements()) {
+        Describe(elem, os);
+        os << ',';
+      }
+      refined[type] = ids.emplace(os.str(), ids.size()).first->second;
+    }
+    classes = std::move(refined);
+  }
+
+  // Every class is lowered as its member that already has a declaration,
+  // or else as its first member
+  std::unordered_map<unsigned, llvm::Type *> reps;
+  for (auto type : types) {
+    if (type_decls.count(type)) {
+      reps.emplace(classes[type], type);
+    }
+  }
+  for (auto type : types) {
+    auto rep{reps.emplace(classes[type], type).first->second};
+    if (rep != type && !type_decls.count(type)) {
+      struct_reps[type] = rep;
+    }
+  }
+}
+
+void IRToASTVisitor::LowerModuleDecls(llvm::Module &module) {
+  if (frozen) {
+    return;
+  }
+  // Lower structure types up front, so that the names of anonymous
+  // structures do not depend on which function bodies get generated.
+  // Isomorphic types, e.g. copies that linking made, share a declaration.
+  llvm::TypeFinder types;
+  types.run(module, /*onlyNamed=*/false);
+  std::vector<llvm::StructType *> structs(types.begin(), types.end());
+  InternStructTypes(structs);
+  for (auto type : structs) {
+    VisitStructType(*type);
+  }
+
+  for (auto &var : module.globals()) {
+    VisitGlobalVar(var);
+  }
+
+  for (auto &func : module.functions()) {
+    VisitFunctionDecl(func);
+  }
+}
+
+void IRToASTVisitor::Summarize(llvm::Module &module) {
+  LowerModuleDecls(module);
+  // Inline assembly is declared like a function, too
+  for (auto &func : module.functions()) {
+    CHECK(!func.isMaterializable())
+        << "Can't summarize a module with lazily loaded functions";
+    for (auto &inst : llvm::instructions(func)) {
+      auto call{llvm::dyn_cast<llvm::CallInst>(&inst)};
+      auto iasm{call ? llvm::dyn_cast<llvm::InlineAsm>(call->getCalledOperand())
+                     : nullptr};
+      if (iasm) {
+        GetOrCreateIntrinsic(iasm);
+      }
+    }
+  }
+  frozen = true;
+}
+
+void IRToASTVisitor::VisitStructType(llvm::StructType &type) {
+  DLOG(INFO) << "VisitStructType: " << LLVMThingToString(&type);
+  GetQualType(&type);
 }
 
 void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
   DLOG(INFO) << "VisitGlobalVar: " << LLVMThingToString(&gvar);
-  auto &var = value_decls[&gvar];
-  if (var) {
+  if (module_decls.lookup(&gvar)) {
     return;
   }
 
@@ -428,20 +906,32 @@ void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
     return;
   }
 
+  DCHECK(!frozen) << "Global missing from the module summary";
   auto type = llvm::cast<llvm::PointerType>(gvar.getType())->getElementType();
   auto tudecl = ast_ctx.getTranslationUnitDecl();
-  auto name = gvar.getName().str();
-  if (name.empty()) {
-    auto num = GetNumDecls<clang::VarDecl>(tudecl);
-    name = "gvar" + std::to_string(num);
-  }
+  auto name = CreateVarName(tudecl, gvar.getName().str(), "gvar");
   // Create a variable declaration
-  var = CreateVarDecl(ast_ctx, tudecl, CreateIdentifier(ast_ctx, name),
-                      GetQualType(type));
-  // Create an initalizer literal
-  if (gvar.hasInitializer()) {
-    clang::cast<clang::VarDecl>(var)->setInit(
-        GetOperandExpr(gvar.getInitializer()));
+  auto var = CreateVarDecl(ast_ctx, tudecl, CreateIdentifier(ast_ctx, name),
+                           GetQualType(type));
+  // Register it before the initializer, which may refer to it
+  module_decls[&gvar] = var;
+  // Create an initalizer literal, or let huge tables of integers and
+  // floats be printed straight from their data. Their elements are
+  // literals that refer to no declarations, so lowering them can wait.
+  auto data{gvar.hasInitializer() ? llvm::dyn_cast<llvm::ConstantDataArray>(
+                                        gvar.getInitializer())
+                                  : nullptr};
+  if (data && lazy_init_elements && !data->isString() &&
+      data->getNumElements() > lazy_init_elements) {
+    LazyInitializers::Get(ast_ctx).Add(
+        var, data->getNumElements(),
+        [this, data](unsigned idx) {
+          return GetOperandExpr(data->getElementAsConstant(idx));
+        },
+        data);
+    lazy_vars.push_back(var);
+  } else if (gvar.hasInitializer()) {
+    var->setInit(GetOperandExpr(gvar.getInitializer()));
   }
   // Add the global var
   tudecl->addDecl(var);
@@ -449,19 +939,21 @@ void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
 
 void IRToASTVisitor::VisitArgument(llvm::Argument &arg) {
   DLOG(INFO) << "VisitArgument: " << LLVMThingToString(&arg);
-  auto &parm = value_decls[&arg];
-  if (parm) {
+  if (module_decls.lookup(&arg)) {
     return;
   }
+  DCHECK(!frozen) << "Parameter missing from the module summary";
   // Create a name
   auto name = arg.hasName() ? arg.getName().str()
                             : "arg" + std::to_string(arg.getArgNo());
   // Get parent function declaration
   auto func = arg.getParent();
   auto fdecl = clang::cast<clang::FunctionDecl>(GetOrCreateDecl(func));
+  GetNameScope(fdecl).names.insert(name);
   // Create a declaration
-  parm = CreateParmVarDecl(ast_ctx, fdecl, CreateIdentifier(ast_ctx, name),
-                           GetQualType(arg.getType()));
+  module_decls[&arg] =
+      CreateParmVarDecl(ast_ctx, fdecl, CreateIdentifier(ast_ctx, name),
+                        GetQualType(arg.getType()));
 }
 
 void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
@@ -473,18 +965,21 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
     return;
   }
 
-  auto &decl = value_decls[&func];
-  if (decl) {
+  if (module_decls.lookup(&func)) {
     return;
   }
+  DCHECK(!frozen) << "Function missing from the module summary";
 
   DLOG(INFO) << "Creating FunctionDecl for " << name;
   auto tudecl = ast_ctx.getTranslationUnitDecl();
 
-  decl = CreateFunctionDecl(ast_ctx, tudecl, CreateIdentifier(ast_ctx, name),
-                            GetQualType(func.getFunctionType()));
+  auto decl =
+      CreateFunctionDecl(ast_ctx, tudecl, CreateIdentifier(ast_ctx, name),
+                         GetQualType(func.getFunctionType()));
+  module_decls[&func] = decl;
 
   tudecl->addDecl(decl);
+  GetNameScope(tudecl).names.insert(name);
 
   if (func.arg_empty()) {
     return;
@@ -496,7 +991,7 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
     params.push_back(parm);
   }
 
-  decl->getAsFunction()->setParams(params);
+  decl->setParams(params);
 }
 
 void IRToASTVisitor::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
@@ -527,11 +1022,12 @@ void IRToASTVisitor::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
 
 void IRToASTVisitor::visitCallInst(llvm::CallInst &inst) {
   DLOG(INFO) << "visitCallInst: " << LLVMThingToString(&inst);
-  auto &callexpr = stmts[&inst];
-  if (callexpr) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
+  clang::Stmt *callexpr{nullptr};
+
   auto type = GetQualType(inst.getType());
 
   std::vector<clang::Expr *> args;
@@ -546,14 +1042,14 @@ void IRToASTVisitor::visitCallInst(llvm::CallInst &inst) {
   auto callee = inst.getCalledOperand();
   if (auto func = llvm::dyn_cast<llvm::Function>(callee)) {
     auto decl = GetOrCreateDecl(func)->getAsFunction();
-    auto ptr = ast_ctx.getPointerType(decl->getType());
+    auto ptr = types.GetPointerType(decl->getType());
     auto ref = CreateDeclRefExpr(ast_ctx, decl);
     auto cast = CreateImplicitCastExpr(ast_ctx, ptr,
                                        clang::CK_FunctionToPointerDecay, ref);
     callexpr = CreateCallExpr(ast_ctx, cast, args, type);
   } else if (auto iasm = llvm::dyn_cast<llvm::InlineAsm>(callee)) {
     auto decl = GetOrCreateIntrinsic(iasm)->getAsFunction();
-    auto ptr = ast_ctx.getPointerType(decl->getType());
+    auto ptr = types.GetPointerType(decl->getType());
     auto ref = CreateDeclRefExpr(ast_ctx, decl);
     auto cast = CreateImplicitCastExpr(ast_ctx, ptr,
                                        clang::CK_FunctionToPointerDecay, ref);
@@ -564,17 +1060,22 @@ void IRToASTVisitor::visitCallInst(llvm::CallInst &inst) {
   } else {
     LOG(FATAL) << "Callee is not a function";
   }
+
+  stmts[&inst] = callexpr;
 }
 
 void IRToASTVisitor::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
   DLOG(INFO) << "visitGetElementPtrInst: " << LLVMThingToString(&inst);
-  auto &ref = stmts[&inst];
-  if (ref) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
-  auto indexed_type = inst.getPointerOperandType();
-  auto base = GetOperandExpr(inst.getPointerOperand());
+  stmts[&inst] = CreateGEPExpr(*llvm::cast<llvm::GEPOperator>(&inst));
+}
+
+clang::Expr *IRToASTVisitor::CreateGEPExpr(llvm::GEPOperator &gep) {
+  auto indexed_type = gep.getPointerOperandType();
+  auto base = GetOperandExpr(gep.getPointerOperand());
 
   auto IndexPtr = [&](llvm::Value &gep_idx) {
     auto base_type = base->getType();
@@ -587,7 +1088,7 @@ void IRToASTVisitor::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
   auto IndexStruct = [&](llvm::Value &gep_idx) {
     auto mem_idx = llvm::dyn_cast<llvm::ConstantInt>(&gep_idx);
     CHECK(mem_idx) << "Non-constant GEP index while indexing a structure";
-    auto tdecl = type_decls[indexed_type];
+    auto tdecl = type_decls.lookup(indexed_type);
     CHECK(tdecl) << "Structure declaration doesn't exist";
     auto record = clang::cast<clang::RecordDecl>(tdecl);
     auto field_it = record->field_begin();
@@ -597,11 +1098,11 @@ void IRToASTVisitor::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
                             /*is_arrow=*/false);
   };
 
-  for (auto &idx : llvm::make_range(inst.idx_begin(), inst.idx_end())) {
+  for (auto &idx : llvm::make_range(gep.idx_begin(), gep.idx_end())) {
     switch (indexed_type->getTypeID()) {
       // Initial pointer
       case llvm::Type::PointerTyID: {
-        CHECK(idx == *inst.idx_begin())
+        CHECK(idx == *gep.idx_begin())
             << "Indexing an llvm::PointerType is only valid at first index";
         IndexPtr(*idx);
         indexed_type =
@@ -631,14 +1132,13 @@ void IRToASTVisitor::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
     base = CreateParenExpr(ast_ctx, base);
   }
 
-  ref = CreateUnaryOperator(ast_ctx, clang::UO_AddrOf, base,
-                            ast_ctx.getPointerType(base->getType()));
+  return CreateUnaryOperator(ast_ctx, clang::UO_AddrOf, base,
+                             types.GetPointerType(base->getType()));
 }
 
 void IRToASTVisitor::visitExtractValueInst(llvm::ExtractValueInst &inst) {
   DLOG(INFO) << "visitExtractValueInst: " << LLVMThingToString(&inst);
-  auto &ref = stmts[&inst];
-  if (ref) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
@@ -657,7 +1157,7 @@ void IRToASTVisitor::visitExtractValueInst(llvm::ExtractValueInst &inst) {
   };
 
   auto IndexStruct = [&](unsigned ev_idx) {
-    auto tdecl = type_decls[indexed_type];
+    auto tdecl = type_decls.lookup(indexed_type);
     CHECK(tdecl) << "Structure declaration doesn't exist";
     auto record = clang::cast<clang::RecordDecl>(tdecl);
     auto field_it = record->field_begin();
@@ -694,40 +1194,35 @@ void IRToASTVisitor::visitExtractValueInst(llvm::ExtractValueInst &inst) {
     base = CreateParenExpr(ast_ctx, base);
   }
 
-  ref = base;
+  stmts[&inst] = base;
 }
 
 void IRToASTVisitor::visitAllocaInst(llvm::AllocaInst &inst) {
   DLOG(INFO) << "visitAllocaInst: " << LLVMThingToString(&inst);
-  auto &declstmt = stmts[&inst];
-  if (declstmt) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
   auto func = inst.getFunction();
   CHECK(func) << "AllocaInst does not have a parent function";
 
-  auto &var = value_decls[&inst];
+  auto var = value_decls.lookup(&inst);
   if (!var) {
     auto fdecl = clang::cast<clang::FunctionDecl>(GetOrCreateDecl(func));
-    auto name = inst.getName().str();
-    if (name.empty()) {
-      auto num = GetNumDecls<clang::VarDecl>(fdecl);
-      name = "var" + std::to_string(num);
-    }
+    auto name = CreateVarName(fdecl, inst.getName().str(), "var");
 
     var = CreateVarDecl(ast_ctx, fdecl, CreateIdentifier(ast_ctx, name),
                         GetQualType(inst.getAllocatedType()));
     fdecl->addDecl(var);
+    value_decls[&inst] = var;
   }
 
-  declstmt = CreateDeclStmt(ast_ctx, var);
+  stmts[&inst] = CreateDeclStmt(ast_ctx, var);
 }
 
 void IRToASTVisitor::visitStoreInst(llvm::StoreInst &inst) {
   DLOG(INFO) << "visitStoreInst: " << LLVMThingToString(&inst);
-  auto &assign = stmts[&inst];
-  if (assign) {
+  if (stmts.lookup(&inst)) {
     return;
   }
   // Stores in LLVM IR correspond to value assignments in C
@@ -739,15 +1234,14 @@ void IRToASTVisitor::visitStoreInst(llvm::StoreInst &inst) {
   auto rhs = GetOperandExpr(val);
   // Create the assignemnt itself
   auto type = GetQualType(ptr->getType()->getPointerElementType());
-  assign = CreateBinaryOperator(
+  stmts[&inst] = CreateBinaryOperator(
       ast_ctx, clang::BO_Assign,
       CreateUnaryOperator(ast_ctx, clang::UO_Deref, lhs, type), rhs, type);
 }
 
 void IRToASTVisitor::visitLoadInst(llvm::LoadInst &inst) {
   DLOG(INFO) << "visitLoadInst: " << LLVMThingToString(&inst);
-  auto &ref = stmts[&inst];
-  if (ref) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
@@ -755,293 +1249,162 @@ void IRToASTVisitor::visitLoadInst(llvm::LoadInst &inst) {
   auto op = GetOperandExpr(ptr);
   auto res_type = GetQualType(inst.getType());
 
-  ref = CreateUnaryOperator(ast_ctx, clang::UO_Deref, op, res_type);
+  stmts[&inst] = CreateUnaryOperator(ast_ctx, clang::UO_Deref, op, res_type);
 }
 
 void IRToASTVisitor::visitReturnInst(llvm::ReturnInst &inst) {
   DLOG(INFO) << "visitReturnInst: " << LLVMThingToString(&inst);
-  auto &retstmt = stmts[&inst];
-  if (retstmt) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
+  clang::Stmt *retstmt{nullptr};
+
   if (auto retval = inst.getReturnValue()) {
     auto retexpr = GetOperandExpr(retval);
     retstmt = CreateReturnStmt(ast_ctx, retexpr);
   } else {
     retstmt = CreateReturnStmt(ast_ctx, nullptr);
   }
+
+  stmts[&inst] = retstmt;
 }
 
 void IRToASTVisitor::visitBinaryOperator(llvm::BinaryOperator &inst) {
   DLOG(INFO) << "visitBinaryOperator: " << LLVMThingToString(&inst);
-  auto &binop = stmts[&inst];
-  if (binop) {
+  if (stmts.lookup(&inst)) {
     return;
   }
-  // Get operands
-  auto lhs = GetOperandExpr(inst.getOperand(0));
-  auto rhs = GetOperandExpr(inst.getOperand(1));
-  // Convenience wrapper
-  auto BinOpExpr{[this, &lhs, &rhs](clang::BinaryOperatorKind opc,
-                                    clang::QualType type) {
-    return CreateBinaryOperator(ast_ctx, opc,
-                                CastExpr(ast_ctx, rhs->getType(), lhs),
-                                CastExpr(ast_ctx, lhs->getType(), rhs), type);
-  }};
-  // Sign-cast int operand
-  auto IntSignCast = [this](clang::Expr *operand, bool sign) {
-    auto type = ast_ctx.getIntTypeForBitwidth(
-        ast_ctx.getTypeSize(operand->getType()), sign);
-    return CreateCStyleCastExpr(ast_ctx, type, clang::CastKind::CK_IntegralCast,
-                                operand);
-  };
 
+  stmts[&inst] = CreateBinaryExpr(*llvm::cast<llvm::Operator>(&inst));
+}
+
+clang::Expr *IRToASTVisitor::CreateBinaryExpr(llvm::Operator &op) {
+  auto info{kBinaryOps.Lookup(op.getOpcode())};
+  if (!info.valid) {
+    LOG(FATAL) << "Unknown BinaryOperator: "
+               << llvm::Instruction::getOpcodeName(op.getOpcode());
+  }
+
+  // Get operands
+  auto lhs = GetOperandExpr(op.getOperand(0));
+  auto rhs = GetOperandExpr(op.getOperand(1));
   // Determine C operator result type from it's operands
   auto c_type{ast_ctx.getIntegerTypeOrder(lhs->getType(), rhs->getType()) < 0
                   ? rhs->getType()
                   : lhs->getType()};
-  // Where the magic happens
-  switch (inst.getOpcode()) {
-    case llvm::BinaryOperator::LShr:
-      lhs = IntSignCast(lhs, false);
-      binop = BinOpExpr(clang::BO_Shr, c_type);
-      break;
-
-    case llvm::BinaryOperator::AShr:
-      lhs = IntSignCast(lhs, true);
-      binop = BinOpExpr(clang::BO_Shr, c_type);
-      break;
-
-    case llvm::BinaryOperator::Shl:
-      binop = BinOpExpr(clang::BO_Shl, c_type);
-      break;
-
-    case llvm::BinaryOperator::And:
-      binop = BinOpExpr(
-          inst.getType()->isIntegerTy(1U) ? clang::BO_LAnd : clang::BO_And,
-          c_type);
-      break;
-
-    case llvm::BinaryOperator::Or:
-      binop = BinOpExpr(
-          inst.getType()->isIntegerTy(1U) ? clang::BO_LOr : clang::BO_Or,
-          c_type);
-      break;
-
-    case llvm::BinaryOperator::Xor:
-      binop = BinOpExpr(clang::BO_Xor, c_type);
-      break;
-
-    case llvm::BinaryOperator::URem:
-      rhs = IntSignCast(rhs, false);
-      lhs = IntSignCast(lhs, false);
-      binop = BinOpExpr(clang::BO_Rem, lhs->getType());
-      break;
-
-    case llvm::BinaryOperator::SRem:
-      rhs = IntSignCast(rhs, true);
-      lhs = IntSignCast(lhs, true);
-      binop = BinOpExpr(clang::BO_Rem, lhs->getType());
-      break;
-
-    case llvm::BinaryOperator::UDiv:
-      rhs = IntSignCast(rhs, false);
-      lhs = IntSignCast(lhs, false);
-      binop = BinOpExpr(clang::BO_Div, lhs->getType());
-      break;
-
-    case llvm::BinaryOperator::SDiv:
-      rhs = IntSignCast(rhs, true);
-      lhs = IntSignCast(lhs, true);
-      binop = BinOpExpr(clang::BO_Div, lhs->getType());
-      break;
-
-    case llvm::BinaryOperator::FDiv:
-      binop = BinOpExpr(clang::BO_Div, c_type);
-      break;
-
-    case llvm::BinaryOperator::Add:
-    case llvm::BinaryOperator::FAdd:
-      binop = BinOpExpr(clang::BO_Add, c_type);
-      break;
-
-    case llvm::BinaryOperator::Sub:
-    case llvm::BinaryOperator::FSub:
-      binop = BinOpExpr(clang::BO_Sub, c_type);
-      break;
-
-    case llvm::BinaryOperator::Mul:
-    case llvm::BinaryOperator::FMul:
-      binop = BinOpExpr(clang::BO_Mul, c_type);
-      break;
-
-    default:
-      LOG(FATAL) << "Unknown BinaryOperator: " << inst.getOpcodeName();
-      break;
+  // Sign-cast int operands
+  if (info.lhs_cast != SignCast::kNone) {
+    lhs = CreateSignCastExpr(lhs, info.lhs_cast == SignCast::kSigned);
   }
+  if (info.rhs_cast != SignCast::kNone) {
+    rhs = CreateSignCastExpr(rhs, info.rhs_cast == SignCast::kSigned);
+    c_type = lhs->getType();
+  }
+  auto opc{op.getType()->isIntegerTy(1U) ? info.bool_opc : info.opc};
+  return CreateBinaryOperator(ast_ctx, opc,
+                              CastExpr(ast_ctx, rhs->getType(), lhs),
+                              CastExpr(ast_ctx, lhs->getType(), rhs), c_type);
 }
 
 void IRToASTVisitor::visitCmpInst(llvm::CmpInst &inst) {
   DLOG(INFO) << "visitCmpInst: " << LLVMThingToString(&inst);
-  auto &cmp = stmts[&inst];
-  if (cmp) {
+  if (stmts.lookup(&inst)) {
     return;
   }
-  // Get operands
-  auto lhs = GetOperandExpr(inst.getOperand(0));
-  auto rhs = GetOperandExpr(inst.getOperand(1));
-  // Convenience wrapper
-  auto CmpExpr = [this, lhs, rhs](clang::BinaryOperatorKind opc) {
-    return CreateBinaryOperator(
-        ast_ctx, opc, CastExpr(ast_ctx, rhs->getType(), lhs),
-        CastExpr(ast_ctx, lhs->getType(), rhs), ast_ctx.IntTy);
-  };
-  // Sign-cast int operand
-  auto IntSignCast = [this](clang::Expr *operand, bool sign) {
-    auto type = ast_ctx.getIntTypeForBitwidth(
-        ast_ctx.getTypeSize(operand->getType()), sign);
-    return CreateCStyleCastExpr(ast_ctx, type, clang::CastKind::CK_IntegralCast,
-                                operand);
-  };
-  // Cast operands for signed predicates
-  if (inst.isSigned()) {
-    lhs = IntSignCast(lhs, true);
-    rhs = IntSignCast(rhs, true);
-  }
-  // Cast operands for unsigned predicates
-  if (inst.isUnsigned()) {
-    lhs = IntSignCast(lhs, false);
-    rhs = IntSignCast(rhs, false);
-  }
-  // Where the magic happens
-  switch (inst.getPredicate()) {
-    case llvm::CmpInst::ICMP_UGT:
-    case llvm::CmpInst::ICMP_SGT:
-    case llvm::CmpInst::FCMP_OGT:
-      cmp = CmpExpr(clang::BO_GT);
-      break;
-
-    case llvm::CmpInst::ICMP_ULT:
-    case llvm::CmpInst::ICMP_SLT:
-    case llvm::CmpInst::FCMP_OLT:
-      cmp = CmpExpr(clang::BO_LT);
-      break;
-
-    case llvm::CmpInst::ICMP_UGE:
-    case llvm::CmpInst::ICMP_SGE:
-    case llvm::CmpInst::FCMP_OGE:
-      cmp = CmpExpr(clang::BO_GE);
-      break;
-
-    case llvm::CmpInst::ICMP_ULE:
-    case llvm::CmpInst::ICMP_SLE:
-    case llvm::CmpInst::FCMP_OLE:
-      cmp = CmpExpr(clang::BO_LE);
-      break;
 
-    case llvm::CmpInst::ICMP_EQ:
-    case llvm::CmpInst::FCMP_OEQ:
-      cmp = CmpExpr(clang::BO_EQ);
-      break;
+  stmts[&inst] =
+      CreateCmpExpr(*llvm::cast<llvm::Operator>(&inst), inst.getPredicate());
+}
 
-    case llvm::CmpInst::ICMP_NE:
-    case llvm::CmpInst::FCMP_UNE:
-      cmp = CmpExpr(clang::BO_NE);
-      break;
+clang::Expr *IRToASTVisitor::CreateCmpExpr(llvm::Operator &op,
+                                           llvm::CmpInst::Predicate pred) {
+  auto info{kCmpPredicates.Lookup(pred)};
+  if (!info.valid) {
+    LOG(FATAL) << "Unknown CmpInst predicate";
+  }
 
-    default:
-      LOG(FATAL) << "Unknown CmpInst predicate";
-      break;
+  // Get operands
+  auto lhs = GetOperandExpr(op.getOperand(0));
+  auto rhs = GetOperandExpr(op.getOperand(1));
+  // Cast operands for signed and unsigned predicates
+  auto sign{llvm::CmpInst::isSigned(pred)};
+  if (sign || llvm::CmpInst::isUnsigned(pred)) {
+    lhs = CreateSignCastExpr(lhs, sign);
+    rhs = CreateSignCastExpr(rhs, sign);
   }
+  return CreateBinaryOperator(ast_ctx, info.opc,
+                              CastExpr(ast_ctx, rhs->getType(), lhs),
+                              CastExpr(ast_ctx, lhs->getType(), rhs),
+                              ast_ctx.IntTy);
 }
 
 void IRToASTVisitor::visitCastInst(llvm::CastInst &inst) {
   DLOG(INFO) << "visitCastInst: " << LLVMThingToString(&inst);
-  auto &cast = stmts[&inst];
-  if (cast) {
+  if (stmts.lookup(&inst)) {
     return;
   }
 
+  stmts[&inst] = CreateCastExpr(*llvm::cast<llvm::Operator>(&inst));
+}
+
+clang::Expr *IRToASTVisitor::CreateCastExpr(llvm::Operator &op) {
+  auto info{kCastOps.Lookup(op.getOpcode())};
+  if (!info.valid) {
+    LOG(FATAL) << "Unknown CastInst cast type";
+  }
+
   // There should always be an operand with a cast instruction
   // Get a C-language expression of the operand
-  auto operand = GetOperandExpr(inst.getOperand(0));
+  auto operand = GetOperandExpr(op.getOperand(0));
   // Get destination type
-  auto type = GetQualType(inst.getType());
-  // Convenience wrapper
-  auto CastExpr = [this, &operand, &type](clang::CastKind opc) {
-    return CreateCStyleCastExpr(ast_ctx, type, opc, operand);
-  };
-  // Create cast
-  switch (inst.getOpcode()) {
-    case llvm::CastInst::Trunc: {
-      auto bitwidth = ast_ctx.getTypeSize(type);
-      auto sign = operand->getType()->isSignedIntegerType();
-      type = ast_ctx.getIntTypeForBitwidth(bitwidth, sign);
-      cast = CastExpr(clang::CastKind::CK_IntegralCast);
-    } break;
-
-    case llvm::CastInst::BitCast:
-      cast = CastExpr(clang::CastKind::CK_BitCast);
-      break;
-
-    case llvm::CastInst::SExt: {
-      auto bitwidth = ast_ctx.getTypeSize(type);
-      type = ast_ctx.getIntTypeForBitwidth(bitwidth, /*signed=*/1);
-      cast = CastExpr(clang::CastKind::CK_IntegralCast);
-    } break;
-
-    case llvm::CastInst::ZExt:
-      cast = CastExpr(clang::CastKind::CK_IntegralCast);
-      break;
-
-    case llvm::CastInst::PtrToInt:
-      cast = CastExpr(clang::CastKind::CK_PointerToIntegral);
-      break;
-
-    case llvm::CastInst::IntToPtr:
-      cast = CastExpr(clang::CastKind::CK_IntegralToPointer);
-      break;
-
-    case llvm::CastInst::SIToFP:
-      cast = CastExpr(clang::CastKind::CK_IntegralToFloating);
-      break;
-
-    case llvm::CastInst::FPToUI:
-    case llvm::CastInst::FPToSI:
-      cast = CastExpr(clang::CastKind::CK_FloatingToIntegral);
-      break;
-
-    case llvm::CastInst::FPExt:
-    case llvm::CastInst::FPTrunc:
-      cast = CastExpr(clang::CastKind::CK_FloatingCast);
-      break;
-
-    default:
-      LOG(FATAL) << "Unknown CastInst cast type";
-      break;
+  auto type = GetQualType(op.getType());
+  if (info.sign != CastSign::kNone) {
+    auto sign{info.sign == CastSign::kSigned ||
+              operand->getType()->isSignedIntegerType()};
+    type = types.GetIntType(ast_ctx.getTypeSize(type), sign);
   }
+  return CreateCStyleCastExpr(ast_ctx, type, info.kind, operand);
 }
 
 void IRToASTVisitor::visitSelectInst(llvm::SelectInst &inst) {
-  DLOG(INFO) << "visitCastInst: " << LLVMThingToString(&inst);
-  auto &select = stmts[&inst];
-  if (select) {
+  DLOG(INFO) << "visitSelectInst: " << LLVMThingToString(&inst);
+  if (stmts.lookup(&inst)) {
     return;
   }
 
-  auto cond = GetOperandExpr(inst.getCondition());
-  auto tval = GetOperandExpr(inst.getTrueValue());
-  auto fval = GetOperandExpr(inst.getFalseValue());
-  auto type = GetQualType(inst.getType());
+  stmts[&inst] = CreateSelectExpr(*llvm::cast<llvm::Operator>(&inst));
+}
 
-  select = CreateConditionalOperatorExpr(ast_ctx, cond, tval, fval, type);
+clang::Expr *IRToASTVisitor::CreateSelectExpr(llvm::Operator &op) {
+  auto cond = GetOperandExpr(op.getOperand(0));
+  auto tval = GetOperandExpr(op.getOperand(1));
+  auto fval = GetOperandExpr(op.getOperand(2));
+  auto type = GetQualType(op.getType());
+
+  return CreateConditionalOperatorExpr(ast_ctx, cond, tval, fval, type);
 }
 
 void IRToASTVisitor::visitPHINode(llvm::PHINode &inst) {
   DLOG(INFO) << "visitPHINode: " << LLVMThingToString(&inst);
-  LOG(FATAL) << "Unexpected llvm::PHINode. Try running llvm's reg2mem pass "
-                "before decompiling.";
+  if (stmts.lookup(&inst)) {
+    return;
+  }
+
+  auto var = value_decls.lookup(&inst);
+  if (!var) {
+    auto fdecl =
+        clang::cast<clang::FunctionDecl>(GetOrCreateDecl(inst.getFunction()));
+    auto name = CreateVarName(fdecl, inst.getName().str(), "phi");
+
+    var = CreateVarDecl(ast_ctx, fdecl, CreateIdentifier(ast_ctx, name),
+                        GetQualType(inst.getType()));
+    fdecl->addDecl(var);
+    value_decls[&inst] = var;
+  }
+  // Uses read the variable, which `GenerateAST` assigns on the edges into
+  // the block of `inst`
+  stmts[&inst] = CreateDeclRefExpr(ast_ctx, var);
 }
 
 }  // namespace rellic
@@ -16,40 +16,126 @@
 
 #pragma once
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Operator.h>
 
 #include <memory>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/Compat/ASTContext.h"
+#include "rellic/AST/TypeCache.h"
 
 namespace rellic {
 
 class IRToASTVisitor : public llvm::InstVisitor<IRToASTVisitor> {
  private:
   clang::ASTContext &ast_ctx;
-
-  std::unordered_map<llvm::Type *, clang::TypeDecl *> type_decls;
-  std::unordered_map<llvm::Value *, clang::ValueDecl *> value_decls;
-  std::unordered_map<llvm::Value *, clang::Stmt *> stmts;
-
+  TypeCache &types;
+
+  llvm::DenseMap<llvm::Type *, clang::TypeDecl *> type_decls;
+  // Structure types that are lowered as an isomorphic one
+  llvm::DenseMap<llvm::Type *, llvm::Type *> struct_reps;
+  // Declarations of functions, their parameters, globals and inline
+  // assembly, which all function bodies share
+  llvm::DenseMap<llvm::Value *, clang::ValueDecl *> module_decls;
+  // Declarations of the locals of function bodies
+  llvm::DenseMap<llvm::Value *, clang::ValueDecl *> value_decls;
+  // Whether the declarations of the module are complete and final
+  bool frozen = false;
+  llvm::DenseMap<llvm::Value *, clang::Stmt *> stmts;
+  // Globals with more elements of constant data are initialized lazily,
+  // 0 for none
+  unsigned lazy_init_elements = 0;
+  // Globals whose lazy initializers this visitor lowers
+  std::vector<clang::VarDecl *> lazy_vars;
+
+  // Names taken in a declaration context and the number of variables
+  // named in it, so that new variables are named in constant time
+  struct NameScope {
+    size_t num_vars;
+    std::unordered_set<std::string> names;
+  };
+  std::unordered_map<clang::DeclContext *, NameScope> name_scopes;
+
+  NameScope &GetNameScope(clang::DeclContext *decl_ctx);
+
+  clang::ValueDecl *LookupDecl(llvm::Value *val) const;
   clang::Expr *GetOperandExpr(llvm::Value *val);
   clang::QualType GetQualType(llvm::Type *type);
+  // Casts `operand` to the integer type of its size and of sign `sign`
+  clang::Expr *CreateSignCastExpr(clang::Expr *operand, bool sign);
 
   clang::Expr *CreateLiteralExpr(llvm::Constant *constant);
+  clang::Expr *CreateConstantExpr(llvm::ConstantExpr *cexpr);
+
+  // Lowering shared by instructions and constant expressions
+  clang::Expr *CreateGEPExpr(llvm::GEPOperator &gep);
+  clang::Expr *CreateBinaryExpr(llvm::Operator &op);
+  clang::Expr *CreateCmpExpr(llvm::Operator &op, llvm::CmpInst::Predicate pred);
+  clang::Expr *CreateCastExpr(llvm::Operator &op);
+  clang::Expr *CreateSelectExpr(llvm::Operator &op);
 
   clang::Decl *GetOrCreateIntrinsic(llvm::InlineAsm *val);
 
  public:
   IRToASTVisitor(clang::ASTContext &ctx);
+  // Lazy initializers that are left are dropped, so globals have to be
+  // printed before the visitor goes away
+  ~IRToASTVisitor();
 
   clang::Stmt *GetOrCreateStmt(llvm::Value *val);
   clang::Decl *GetOrCreateDecl(llvm::Value *val);
 
   void SetStmt(llvm::Value *val, clang::Stmt *stmt);
-
+  // Creates `var = val`, which passes `val` into the variable of a PHI node
+  clang::Expr *CreateAssignExpr(clang::ValueDecl *var, llvm::Value *val);
+  // Creates `val == case_val`, the condition of a case of a switch on `val`
+  clang::Expr *CreateCaseCondExpr(llvm::Value *val,
+                                  llvm::ConstantInt *case_val);
+  // Returns a unique name for a new variable of `decl_ctx`: `name`, or if
+  // that is empty or taken, `prefix` followed by the number of variables
+  // named in `decl_ctx` so far
+  std::string CreateVarName(clang::DeclContext *decl_ctx, std::string name,
+                            const std::string &prefix);
+  // Drops the statements and local declarations of the instructions of
+  // `func`, so that its body can be deleted
+  void ClearFunctionBody(llvm::Function &func);
+  // Drops the declaration of `value`, and of its parameters if it is a
+  // function, so that the next lookup declares it anew. Bodies that
+  // refer to the old declaration have to be lowered again.
+  void ClearDecl(llvm::GlobalValue &value);
+  // Estimates the bytes used by the maps of this visitor
+  size_t GetMemoryUsage() const;
+
+  // Lowers the structure types, globals and function prototypes of
+  // `module`, unless the module is summarized already
+  void LowerModuleDecls(llvm::Module &module);
+  // Lowers all declarations of `module` that function bodies refer to,
+  // including inline assembly, and freezes them: afterwards, lowering a
+  // body only looks up declarations of the module and never adds to
+  // them. `module` must not have lazily loaded function bodies.
+  void Summarize(llvm::Module &module);
+  bool IsSummarized() const { return frozen; }
+
+  // Lets globals whose initializers are constant data arrays of more than
+  // `num_elements` elements be lowered element by element as they are
+  // printed, see `LazyInitializers`. 0 lowers every initializer at once.
+  void SetLazyInitElements(unsigned num_elements) {
+    lazy_init_elements = num_elements;
+  }
+
+  // Makes isomorphic structure types among `types` share one declaration:
+  // types with the same name up to `.N` suffixes, the same packing and
+  // elements of the same types, where structures in turn only need to be
+  // isomorphic. Types that already have a declaration keep it.
+  void InternStructTypes(const std::vector<llvm::StructType *> &types);
+
+  void VisitStructType(llvm::StructType &type);
   void VisitGlobalVar(llvm::GlobalVariable &var);
   void VisitFunctionDecl(llvm::Function &func);
   void VisitArgument(llvm::Argument &arg);
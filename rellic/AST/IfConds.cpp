@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/IfConds.h"
+
+#include "rellic/AST/Z3Prefilter.h"
+
+namespace rellic {
+
+void GetIfConds(clang::CompoundStmt *compound, Z3ConvVisitor &z3_gen,
+                IfConds &ifs, IfCondCache *cache) {
+  for (auto stmt : compound->body()) {
+    auto ifstmt{clang::dyn_cast<clang::IfStmt>(stmt)};
+    if (!ifstmt) {
+      continue;
+    }
+    ifs.stmts.push_back(ifstmt);
+    auto cond{ifstmt->getCond()};
+    if (cache) {
+      auto iter{cache->find(cond)};
+      if (iter != cache->end()) {
+        ifs.conds.push_back(iter->second);
+        continue;
+      }
+    }
+    auto expr{z3_gen.Z3BoolCast(z3_gen.GetOrCreateZ3Expr(cond)).simplify()};
+    ifs.conds.push_back(expr);
+    if (cache) {
+      cache->emplace(cond, expr);
+    }
+  }
+  Simulate(ifs.conds.ctx(), ifs.conds, ifs.sigs, ifs.known);
+}
+
+}  // namespace rellic
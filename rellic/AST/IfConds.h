@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <z3++.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/Z3ConvVisitor.h"
+
+namespace rellic {
+
+// The if statements directly in a compound with their simplified Z3
+// conditions and simulation signatures, as in `Simulate`. Condition-based
+// and reachability-based refinement both start from these.
+struct IfConds {
+  std::vector<clang::IfStmt *> stmts;
+  z3::expr_vector conds;
+  std::vector<uint64_t> sigs;
+  std::vector<bool> known;
+
+  explicit IfConds(z3::context &ctx) : conds(ctx) {}
+};
+
+// Simplified conditions of if statements, keyed by condition. They stay
+// valid for as long as the conditions aren't edited in place.
+using IfCondCache = std::unordered_map<clang::Expr *, z3::expr>;
+
+// Collects the if statements of `compound` into `ifs`. Conditions found
+// in `cache`, if given, aren't converted and simplified again.
+void GetIfConds(clang::CompoundStmt *compound, Z3ConvVisitor &z3_gen,
+                IfConds &ifs, IfCondCache *cache = nullptr);
+
+// Results of equivalence proofs between conditions, keyed by the
+// conditions and by whether the proof was of complementarity
+using ProofMap = std::map<std::tuple<clang::Expr *, clang::Expr *, bool>, bool>;
+
+// Records that a statement is replaced, or removed if the replacement is
+// `nullptr`
+using SubstituteFn = std::function<void(clang::Stmt *, clang::Stmt *)>;
+
+}  // namespace rellic
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/IncrementalDecompiler.h"
+
+#include <glog/logging.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/LegacyPassManager.h>
+
+#include <memory>
+#include <utility>
+
+#include "rellic/AST/ChangeTracker.h"
+#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/GenerateAST.h"
+#include "rellic/AST/StmtRecycler.h"
+
+namespace rellic {
+
+IncrementalDecompiler::IncrementalDecompiler(llvm::Module &module,
+                                             clang::ASTContext &ctx,
+                                             PipelineDesc pipeline,
+                                             unsigned max_rounds,
+                                             Z3ProofCache *proofs)
+    : module(module),
+      ast_ctx(ctx),
+      gen(ctx),
+      solver(ctx, proofs),
+      pipeline(std::move(pipeline)),
+      runner(module, ctx, gen, solver) {
+  runner.SetMaxRounds(max_rounds);
+}
+
+void IncrementalDecompiler::ClearBody(llvm::Function &func) {
+  auto iter{definitions.find(&func)};
+  if (iter != definitions.end()) {
+    ast_ctx.getTranslationUnitDecl()->removeDecl(iter->second);
+    definitions.erase(iter);
+  }
+  gen.ClearFunctionBody(func);
+}
+
+void IncrementalDecompiler::SetCancellation(CancellationToken *token) {
+  runner.SetCancellation(token);
+  solver.SetCancellation(token);
+}
+
+void IncrementalDecompiler::InvalidateBody(llvm::Function &func) {
+  // The statements of a dirty function are gone already, and no new ones
+  // are created before the next update
+  if (dirty.insert(&func).second) {
+    ClearBody(func);
+  }
+}
+
+void IncrementalDecompiler::InvalidateDecl(llvm::GlobalValue &value) {
+  std::vector<llvm::GlobalValue *> values{&value};
+  std::unordered_set<llvm::Value *> seen{&value};
+  while (!values.empty()) {
+    auto gvalue{values.back()};
+    values.pop_back();
+    // Parameters are declared anew along with their function
+    if (auto func = llvm::dyn_cast<llvm::Function>(gvalue)) {
+      InvalidateBody(*func);
+    }
+    // Find the bodies and initializers that refer to `gvalue`, looking
+    // through constant expressions
+    std::vector<llvm::User *> users(gvalue->user_begin(), gvalue->user_end());
+    while (!users.empty()) {
+      auto user{users.back()};
+      users.pop_back();
+      if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+        InvalidateBody(*inst->getFunction());
+      } else if (!seen.insert(user).second) {
+        continue;
+      } else if (auto gvar = llvm::dyn_cast<llvm::GlobalVariable>(user)) {
+        values.push_back(gvar);
+      } else if (llvm::isa<llvm::Constant>(user)) {
+        users.insert(users.end(), user->user_begin(), user->user_end());
+      }
+    }
+    gen.ClearDecl(*gvalue);
+  }
+}
+
+void IncrementalDecompiler::Remove(llvm::GlobalValue &value) {
+  InvalidateDecl(value);
+  if (auto func = llvm::dyn_cast<llvm::Function>(&value)) {
+    dirty.erase(func);
+  }
+}
+
+void IncrementalDecompiler::Decompile(
+    const std::vector<llvm::Function *> &funcs) {
+  // Reuse an enclosing recycler, like a full pipeline does
+  std::unique_ptr<StmtRecycler> local_recycler;
+  if (!StmtRecycler::Get(ast_ctx)) {
+    local_recycler.reset(new StmtRecycler(ast_ctx));
+  }
+
+  solver.Reset();
+  std::unordered_set<llvm::Function *> selected(funcs.begin(), funcs.end());
+  auto filter{[&selected](llvm::Function &func) {
+    return selected.count(&func) != 0;
+  }};
+  llvm::legacy::PassManager ast;
+  ast.add(createGenerateASTPass(ast_ctx, gen, filter));
+  ast.run(module);
+
+  std::vector<clang::FunctionDecl *> fdefns;
+  for (auto func : funcs) {
+    auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(func))};
+    auto fdefn{fdecl->getDefinition()};
+    CHECK(fdefn) << "No definition generated for " << func->getName().str();
+    definitions[func] = fdefn;
+    fdefns.push_back(fdefn);
+  }
+
+  // Functions are cleaned up even after a cancellation, like they are
+  // lowered
+  StagePasses cleanup;
+  AddStagePass(cleanup, "dse", createDeadStmtElimPass(ast_ctx, gen));
+  ChangeTracker tracker(ast_ctx, fdefns);
+  runner.RunOnce(cleanup, "ast", &tracker, 0, /*cancellable=*/false);
+  if (auto recycler = StmtRecycler::Get(ast_ctx)) {
+    recycler->Collect();
+  }
+
+  runner.Refine(funcs, pipeline);
+  cut_short = runner.IsCancelled();
+}
+
+std::vector<llvm::Function *> IncrementalDecompiler::Update(
+    FunctionCallback done) {
+  // Declares invalidated and new globals and functions
+  gen.LowerModuleDecls(module);
+
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : module.functions()) {
+    if (!func.isDeclaration() &&
+        (dirty.count(&func) || !definitions.count(&func))) {
+      funcs.push_back(&func);
+    }
+  }
+  dirty.clear();
+
+  if (!done) {
+    if (!funcs.empty()) {
+      Decompile(funcs);
+    }
+    return funcs;
+  }
+
+  for (auto func : funcs) {
+    Decompile({func});
+    done(*func, definitions.lookup(func));
+  }
+  return funcs;
+}
+
+}  // namespace rellic
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/Module.h>
+
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/Cancellation.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/Pipeline.h"
+#include "rellic/AST/Z3Solver.h"
+
+namespace rellic {
+
+// Keeps the decompiled AST of `module` up to date while the module is
+// being edited. Only the functions affected by an edit are lowered and
+// refined again; all others keep their definitions.
+//
+// The `Invalidate` methods and `Remove` must be called before the IR
+// they describe changes, and `Update` once the edits are done. Functions
+// that gained a body since the last update are decompiled as well.
+class IncrementalDecompiler {
+ public:
+  // Receives a function and its definition once refinement is done
+  using FunctionCallback =
+      std::function<void(llvm::Function &, clang::FunctionDecl *)>;
+
+ private:
+  llvm::Module &module;
+  clang::ASTContext &ast_ctx;
+  IRToASTVisitor gen;
+  Z3Solver solver;
+  PipelineDesc pipeline;
+  StageRunner runner;
+  // Whether the pipeline of the last decompiled functions was cut short
+  bool cut_short{false};
+
+  llvm::DenseMap<llvm::Function *, clang::FunctionDecl *> definitions;
+  std::unordered_set<llvm::Function *> dirty;
+
+  // Removes the definition of `func` from the translation unit
+  void ClearBody(llvm::Function &func);
+  void Decompile(const std::vector<llvm::Function *> &funcs);
+
+ public:
+  // Fixpoint stages without a round limit of their own run at most
+  // `max_rounds` times, or until they converge if that is 0
+  IncrementalDecompiler(llvm::Module &module, clang::ASTContext &ctx,
+                        PipelineDesc pipeline, unsigned max_rounds = 100,
+                        Z3ProofCache *proofs = nullptr);
+
+  Z3Solver &GetSolver() { return solver; }
+  IRToASTVisitor &GetVisitor() { return gen; }
+  // Configures how the pipeline runs, e.g. the trivial function limits
+  // or the pass profile
+  StageRunner &GetRunner() { return runner; }
+
+  // Stops refinement once `token` is cancelled. Pipelines stop between
+  // passes, and functions that are left get definitions that are only
+  // lowered. `token` may be `nullptr`.
+  void SetCancellation(CancellationToken *token);
+  // Returns `true` if refining the functions that were decompiled last
+  // was stopped before their pipeline finished
+  bool WasCutShort() const { return cut_short; }
+
+  // The body of `func` is about to change
+  void InvalidateBody(llvm::Function &func);
+  // The type of `value` is about to change, e.g. the prototype of a
+  // function. Functions that refer to `value`, directly or through the
+  // initializers of globals, are lowered again.
+  void InvalidateDecl(llvm::GlobalValue &value);
+  // `value` is about to be erased from the module. Its users should be
+  // changed to refer to something else.
+  void Remove(llvm::GlobalValue &value);
+
+  // Lowers and refines the functions invalidated since the last update,
+  // and returns them in module order. With `done`, the functions run
+  // through the pipeline one at a time, and each is passed to `done` as
+  // soon as it is finished.
+  std::vector<llvm::Function *> Update(FunctionCallback done = nullptr);
+
+  // Returns the current definition of `func`, or `nullptr`
+  clang::FunctionDecl *GetDefinition(llvm::Function &func) const {
+    return definitions.lookup(&func);
+  }
+};
+
+}  // namespace rellic
@@ -18,19 +18,21 @@
 
 namespace rellic {
 
-clang::Stmt *ApplyFirstMatchingRule(clang::ASTContext &ctx, clang::Stmt *stmt,
-                                    std::vector<InferenceRule *> &rules) {
-  clang::ast_matchers::MatchFinder::MatchFinderOptions opts;
-  clang::ast_matchers::MatchFinder finder(opts);
+void RuleSet::AddRule(std::unique_ptr<InferenceRule> rule,
+                      clang::Stmt::StmtClass cls) {
+  candidates[cls].push_back(rule.get());
+  rules.push_back(std::move(rule));
+}
 
-  for (auto rule : rules) {
-    finder.addMatcher(rule->GetCondition(), rule);
+clang::Stmt *RuleSet::ApplyFirstMatchingRule(clang::ASTContext &ctx,
+                                             clang::Stmt *stmt) {
+  auto iter{candidates.find(stmt->getStmtClass())};
+  if (iter == candidates.end()) {
+    return stmt;
   }
 
-  finder.match(*stmt, ctx);
-
-  for (auto rule : rules) {
-    if (*rule) {
+  for (auto rule : iter->second) {
+    if (rule->Matches(stmt)) {
       return rule->GetOrCreateSubstitution(ctx, stmt);
     }
   }
@@ -38,4 +40,4 @@ clang::Stmt *ApplyFirstMatchingRule(clang::ASTContext &ctx, clang::Stmt *stmt,
   return stmt;
 }
 
-}  // namespace rellic
\ No newline at end of file
+}  // namespace rellic
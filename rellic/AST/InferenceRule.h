@@ -16,32 +16,47 @@
 
 #pragma once
 
-#include <clang/ASTMatchers/ASTMatchFinder.h>
-#include <clang/ASTMatchers/ASTMatchers.h>
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Stmt.h>
 
-namespace rellic {
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
-class InferenceRule : public clang::ast_matchers::MatchFinder::MatchCallback {
- protected:
-  clang::ast_matchers::StatementMatcher cond;
-  const clang::Stmt *match;
-  clang::Stmt *substitution;
+#include "rellic/AST/StmtMatcher.h"
 
- public:
-  InferenceRule(clang::ast_matchers::StatementMatcher matcher)
-      : cond(matcher), match(nullptr), substitution(nullptr) {}
+namespace rellic {
 
-  operator bool() { return match; }
+// A rewrite of the statements that match a pattern, usually written with
+// `rellic::matchers`
+class InferenceRule {
+ public:
+  virtual ~InferenceRule() = default;
 
-  const clang::ast_matchers::StatementMatcher &GetCondition() const {
-    return cond;
-  }
+  virtual bool Matches(const clang::Stmt *stmt) const = 0;
 
+  // Only called for statements that `Matches` accepted
   virtual clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
                                                clang::Stmt *stmt) = 0;
 };
 
-clang::Stmt *ApplyFirstMatchingRule(clang::ASTContext &ctx, clang::Stmt *stmt,
-                                    std::vector<InferenceRule *> &rules);
+// Rules that are applied to every candidate statement of a pass. Rules
+// are tried in the order they were added.
+class RuleSet {
+ private:
+  std::vector<std::unique_ptr<InferenceRule>> rules;
+  // Rules by the class of statements they can match
+  std::unordered_map<unsigned, std::vector<InferenceRule *>> candidates;
+
+ public:
+  // Adds `rule`, whose pattern only matches statements of class `cls`
+  void AddRule(std::unique_ptr<InferenceRule> rule,
+               clang::Stmt::StmtClass cls);
+
+  // Returns the substitution for `stmt` of the first matching rule, or
+  // `stmt` itself if no rule matches
+  clang::Stmt *ApplyFirstMatchingRule(clang::ASTContext &ctx,
+                                      clang::Stmt *stmt);
+};
 
-}  // namespace rellic
\ No newline at end of file
+}  // namespace rellic
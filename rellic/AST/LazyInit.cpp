@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/LazyInit.h"
+
+#include <glog/logging.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static std::mutex registries_mutex;
+// Never destroyed, since contexts may outlive static destruction
+static auto &registries{
+    *new std::unordered_map<const clang::ASTContext *,
+                            std::unique_ptr<LazyInitializers>>};
+
+static void DestroyRegistry(void *ctx) {
+  std::lock_guard<std::mutex> lock(registries_mutex);
+  registries.erase(static_cast<const clang::ASTContext *>(ctx));
+}
+
+}  // namespace
+
+LazyInitializers &LazyInitializers::Get(clang::ASTContext &ctx) {
+  std::lock_guard<std::mutex> lock(registries_mutex);
+  auto &registry{registries[&ctx]};
+  if (!registry) {
+    registry.reset(new LazyInitializers);
+    ctx.AddDeallocation(DestroyRegistry, &ctx);
+  }
+  return *registry;
+}
+
+LazyInitializers *LazyInitializers::Find(clang::ASTContext &ctx) {
+  std::lock_guard<std::mutex> lock(registries_mutex);
+  auto iter{registries.find(&ctx)};
+  return iter == registries.end() ? nullptr : iter->second.get();
+}
+
+void LazyInitializers::Add(clang::VarDecl *var, unsigned num_elements,
+                           ElementLowering lower,
+                           const llvm::ConstantDataSequential *data) {
+  CHECK(!var->getInit()) << "Variable is initialized already";
+  CHECK(!data || data->getNumElements() == num_elements);
+  inits[var] = {num_elements, std::move(lower), data};
+}
+
+unsigned LazyInitializers::GetNumElements(clang::VarDecl *var) const {
+  auto iter{inits.find(var)};
+  CHECK(iter != inits.end()) << "Variable has no lazy initializer";
+  return iter->second.num_elements;
+}
+
+const llvm::ConstantDataSequential *LazyInitializers::GetData(
+    clang::VarDecl *var) const {
+  auto iter{inits.find(var)};
+  CHECK(iter != inits.end()) << "Variable has no lazy initializer";
+  return iter->second.data;
+}
+
+clang::Expr *LazyInitializers::LowerElement(clang::VarDecl *var,
+                                            unsigned idx) {
+  auto iter{inits.find(var)};
+  CHECK(iter != inits.end()) << "Variable has no lazy initializer";
+  CHECK_LT(idx, iter->second.num_elements);
+  return iter->second.lower(idx);
+}
+
+void LazyInitializers::Materialize(clang::VarDecl *var) {
+  std::vector<clang::Expr *> exprs;
+  auto num_elements{GetNumElements(var)};
+  exprs.reserve(num_elements);
+  for (auto i = 0U; i < num_elements; ++i) {
+    exprs.push_back(LowerElement(var, i));
+  }
+  var->setInit(CreateInitListExpr(var->getASTContext(), exprs, var->getType()));
+  inits.erase(var);
+}
+
+void LazyInitializers::MaterializeAll() {
+  while (!inits.empty()) {
+    Materialize(inits.begin()->first);
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <llvm/IR/Constants.h>
+
+#include <functional>
+#include <unordered_map>
+
+namespace rellic {
+
+// Initializers of global variables that are too large to lower up front.
+// Such a variable has no initializer in the AST; instead, its elements
+// are lowered one at a time while it is printed, so that a table of
+// millions of elements is never held as one `clang::InitListExpr` and
+// reaches the output in chunks. Passes that walk initializers don't see
+// lazy ones, which are only ever constant data.
+//
+// Initializers can also keep the `llvm::ConstantDataSequential` they come
+// from, whose elements the printer then writes straight from the buffer
+// of the constant, without lowering them to clang nodes at all.
+//
+// Like `TypeCache`, every context has a single registry, which is
+// destroyed along with the context and must only be used by one thread
+// at a time.
+class LazyInitializers {
+ public:
+  // Lowers the element at an index of the initializer
+  using ElementLowering = std::function<clang::Expr *(unsigned)>;
+
+ private:
+  struct Initializer {
+    unsigned num_elements;
+    ElementLowering lower;
+    const llvm::ConstantDataSequential *data;
+  };
+  std::unordered_map<clang::VarDecl *, Initializer> inits;
+
+  LazyInitializers() = default;
+
+ public:
+  static LazyInitializers &Get(clang::ASTContext &ctx);
+  // The registry of `ctx`, or `nullptr` if it has none yet
+  static LazyInitializers *Find(clang::ASTContext &ctx);
+
+  // `lower` must produce the same text as writing the elements of `data`
+  // directly, if it is given
+  void Add(clang::VarDecl *var, unsigned num_elements, ElementLowering lower,
+           const llvm::ConstantDataSequential *data = nullptr);
+  void Remove(clang::VarDecl *var) { inits.erase(var); }
+  bool IsLazy(clang::VarDecl *var) const { return inits.count(var); }
+
+  unsigned GetNumElements(clang::VarDecl *var) const;
+  // Constant data that `var` is initialized with, or `nullptr`
+  const llvm::ConstantDataSequential *GetData(clang::VarDecl *var) const;
+  clang::Expr *LowerElement(clang::VarDecl *var, unsigned idx);
+
+  // Lowers all elements of `var` into an initializer list, sets it as the
+  // initializer and removes `var` from the registry
+  void Materialize(clang::VarDecl *var);
+  void MaterializeAll();
+};
+
+}  // namespace rellic
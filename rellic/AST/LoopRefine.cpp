@@ -17,45 +17,61 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
-#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/LoopRefine.h"
+#include "rellic/AST/Stats.h"
 
 namespace rellic {
 
 namespace {
 
-using namespace clang::ast_matchers;
+using namespace rellic::matchers;
 
-// Matches `while(1)`, `if(1)`, etc.
-static const auto cond_true = hasCondition(integerLiteral(equals(true)));
+static const auto break_stmt = Is<clang::BreakStmt>();
 // Matches `{ break; }`
 static const auto comp_break =
-    compoundStmt(has(breakStmt()), statementCountIs(1));
+    Is<clang::CompoundStmt>(Size(1), Front(break_stmt));
+// Matches `if(...) { ...; break; ... }`
+static const auto if_break = Is<clang::IfStmt>(Then(HasChild(break_stmt)));
+static const auto has_break = HasDescendant(break_stmt);
+
+// Returns the compound body of `while(1)`, `nullptr` for other statements
+static const clang::CompoundStmt *GetInfiniteLoopBody(
+    const clang::Stmt *stmt) {
+  static const auto pattern = Is<clang::WhileStmt>(
+      Cond(Is<clang::IntegerLiteral>(Equals(1))),
+      Body(Is<clang::CompoundStmt>()));
+  if (!pattern(stmt)) {
+    return nullptr;
+  }
+  return clang::cast<clang::CompoundStmt>(
+      clang::cast<clang::WhileStmt>(stmt)->getBody());
+}
+
+// Returns the first statement of `comp` that matches `matcher`, or
+// `nullptr`
+template <typename Matcher>
+static const clang::Stmt *FindFirst(const clang::CompoundStmt *comp,
+                                    const Matcher &matcher) {
+  for (auto stmt : comp->body()) {
+    if (matcher(stmt)) {
+      return stmt;
+    }
+  }
+  return nullptr;
+}
 
 class WhileRule : public InferenceRule {
  public:
-  WhileRule()
-      : InferenceRule(whileStmt(
-            stmt().bind("while"), cond_true,
-            hasBody(compoundStmt(
-                has(ifStmt(stmt().bind("if"), hasThen(comp_break))))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto loop = result.Nodes.getNodeAs<clang::WhileStmt>("while");
-    auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
-    auto ifstmt = result.Nodes.getNodeAs<clang::IfStmt>("if");
-    if (body->body_front() == ifstmt) {
-      match = loop;
-    }
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern =
+        Is<clang::CompoundStmt>(Front(Is<clang::IfStmt>(Then(comp_break))));
+    auto body = GetInfiniteLoopBody(stmt);
+    return body && pattern(body);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
-
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto comp = clang::cast<clang::CompoundStmt>(loop->getBody());
     auto cond = clang::cast<clang::IfStmt>(comp->body_front())->getCond();
     std::vector<clang::Stmt *> new_body(comp->body_begin() + 1,
@@ -68,28 +84,17 @@ class WhileRule : public InferenceRule {
 
 class DoWhileRule : public InferenceRule {
  public:
-  DoWhileRule()
-      : InferenceRule(whileStmt(
-            stmt().bind("while"), cond_true,
-            hasBody(compoundStmt(
-                has(ifStmt(stmt().bind("if"), hasThen(comp_break))))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto loop = result.Nodes.getNodeAs<clang::WhileStmt>("while");
-    auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
-    auto ifstmt = result.Nodes.getNodeAs<clang::IfStmt>("if");
-    if (body->body_back() == ifstmt) {
-      match = loop;
-    }
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::IfStmt>(Then(comp_break));
+    auto body = GetInfiniteLoopBody(stmt);
+    // The first `if` that breaks has to be the last statement
+    return body && !body->body_empty() &&
+           FindFirst(body, pattern) == body->body_back();
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
-
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto comp = clang::cast<clang::CompoundStmt>(loop->getBody());
     auto cond = clang::cast<clang::IfStmt>(comp->body_back())->getCond();
     std::vector<clang::Stmt *> new_body(comp->body_begin(),
@@ -101,36 +106,17 @@ class DoWhileRule : public InferenceRule {
 };
 
 class NestedDoWhileRule : public InferenceRule {
- private:
-  bool matched = false;
-
  public:
-  NestedDoWhileRule()
-      : InferenceRule(
-            whileStmt(stmt().bind("while"), cond_true,
-                      hasBody(compoundStmt(findAll(ifStmt(
-                          stmt().bind("if"), hasThen(has(breakStmt())))))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    if (!matched) {
-      auto loop = result.Nodes.getNodeAs<clang::WhileStmt>("while");
-      auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
-      auto ifstmt = result.Nodes.getNodeAs<clang::IfStmt>("if");
-      if (body->body_back() == ifstmt) {
-        match = loop;
-      }
-    } else {
-      match = nullptr;
-    }
-    matched = true;
+  bool Matches(const clang::Stmt *stmt) const override {
+    auto body = GetInfiniteLoopBody(stmt);
+    // The only `if` that breaks, nested or not, is the last statement
+    return body && !body->body_empty() && if_break(body->body_back()) &&
+           CountDescendants(body, if_break, 2) == 1;
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto comp = clang::cast<clang::CompoundStmt>(loop->getBody());
     auto cond = clang::cast<clang::IfStmt>(comp->body_back());
 
@@ -148,33 +134,24 @@ class NestedDoWhileRule : public InferenceRule {
 
 class LoopToSeq : public InferenceRule {
  public:
-  LoopToSeq()
-      : InferenceRule(
-            whileStmt(stmt().bind("while"), cond_true,
-                      hasBody(compoundStmt(hasAnySubstatement(anyOf(
-                          ifStmt(stmt().bind("if"), hasThen(has(breakStmt())),
-                                 hasElse(has(breakStmt()))),
-                          breakStmt())))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    auto loop = result.Nodes.getNodeAs<clang::WhileStmt>("while");
-    if (auto ifstmt = result.Nodes.getNodeAs<clang::IfStmt>("if")) {
-      auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
-      if (body->body_back() == ifstmt) {
-        match = loop;
-      }
-    } else {
-      match = loop;
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = AnyOf(
+        Is<clang::IfStmt>(Then(HasChild(break_stmt)),
+                          Else(HasChild(break_stmt))),
+        break_stmt);
+    auto body = GetInfiniteLoopBody(stmt);
+    if (!body) {
+      return false;
     }
+    // A `break` anywhere, or an `if` that breaks on both sides at the end
+    auto first = FindFirst(body, pattern);
+    return first &&
+           (clang::isa<clang::BreakStmt>(first) || first == body->body_back());
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
-
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto loop_body = clang::cast<clang::CompoundStmt>(loop->getBody());
 
     std::vector<clang::Stmt *> new_body(loop_body->body_begin(),
@@ -205,28 +182,19 @@ class LoopToSeq : public InferenceRule {
   }
 };
 
-static const auto has_break = hasDescendant(breakStmt());
-
 class CondToSeqRule : public InferenceRule {
  public:
-  CondToSeqRule()
-      : InferenceRule(whileStmt(
-            stmt().bind("while"), cond_true,
-            hasBody(compoundStmt(
-                has(ifStmt(hasThen(unless(has_break)), hasElse(has_break))),
-                statementCountIs(1))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    match = result.Nodes.getNodeAs<clang::WhileStmt>("while");
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::CompoundStmt>(
+        Size(1),
+        Front(Is<clang::IfStmt>(Then(Unless(has_break)), Else(has_break))));
+    auto body = GetInfiniteLoopBody(stmt);
+    return body && pattern(body);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
-
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
     auto ifstmt = clang::cast<clang::IfStmt>(body->body_front());
     auto inner_loop =
@@ -245,24 +213,17 @@ class CondToSeqRule : public InferenceRule {
 
 class CondToSeqNegRule : public InferenceRule {
  public:
-  CondToSeqNegRule()
-      : InferenceRule(whileStmt(
-            stmt().bind("while"), cond_true,
-            hasBody(compoundStmt(
-                has(ifStmt(hasThen(has_break), hasElse(unless(has_break)))),
-                statementCountIs(1))))) {}
-
-  void run(const MatchFinder::MatchResult &result) {
-    match = result.Nodes.getNodeAs<clang::WhileStmt>("while");
+  bool Matches(const clang::Stmt *stmt) const override {
+    static const auto pattern = Is<clang::CompoundStmt>(
+        Size(1),
+        Front(Is<clang::IfStmt>(Then(has_break), Else(Unless(has_break)))));
+    auto body = GetInfiniteLoopBody(stmt);
+    return body && pattern(body);
   }
 
   clang::Stmt *GetOrCreateSubstitution(clang::ASTContext &ctx,
-                                       clang::Stmt *stmt) {
-    auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
-
-    CHECK(loop && loop == match)
-        << "Substituted WhileStmt is not the matched WhileStmt!";
-
+                                       clang::Stmt *stmt) override {
+    auto loop = clang::cast<clang::WhileStmt>(stmt);
     auto body = clang::cast<clang::CompoundStmt>(loop->getBody());
     auto ifstmt = clang::cast<clang::IfStmt>(body->body_front());
     auto cond = CreateNotExpr(ctx, ifstmt->getCond());
@@ -278,41 +239,43 @@ class CondToSeqNegRule : public InferenceRule {
                            CreateCompoundStmt(ctx, new_body));
   }
 };
-
 }  // namespace
 
+std::unique_ptr<RuleSet> CreateLoopRefineRules() {
+  std::unique_ptr<RuleSet> rules(new RuleSet);
+  auto loop{clang::Stmt::WhileStmtClass};
+  rules->AddRule(std::make_unique<CondToSeqRule>(), loop);
+  rules->AddRule(std::make_unique<CondToSeqNegRule>(), loop);
+  rules->AddRule(std::make_unique<NestedDoWhileRule>(), loop);
+  rules->AddRule(std::make_unique<LoopToSeq>(), loop);
+  rules->AddRule(std::make_unique<WhileRule>(), loop);
+  rules->AddRule(std::make_unique<DoWhileRule>(), loop);
+  return rules;
+}
+
 char LoopRefine::ID = 0;
 
 LoopRefine::LoopRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen)
-    : ModulePass(LoopRefine::ID), ast_ctx(&ctx), ast_gen(&ast_gen) {}
+    : ModulePass(LoopRefine::ID),
+      ast_ctx(&ctx),
+      ast_gen(&ast_gen),
+      loop_rules(CreateLoopRefineRules()) {}
 
 bool LoopRefine::VisitWhileStmt(clang::WhileStmt *loop) {
   // DLOG(INFO) << "VisitWhileStmt";
-  std::vector<InferenceRule *> rules;
-
-  rules.push_back(new CondToSeqRule);
-  rules.push_back(new CondToSeqNegRule);
-  rules.push_back(new NestedDoWhileRule);
-  rules.push_back(new LoopToSeq);
-  rules.push_back(new WhileRule);
-  rules.push_back(new DoWhileRule);
-
-  auto sub = ApplyFirstMatchingRule(*ast_ctx, loop, rules);
+  auto sub = loop_rules->ApplyFirstMatchingRule(*ast_ctx, loop);
   if (sub != loop) {
-    substitutions[loop] = sub;
-  }
-
-  for (auto rule : rules) {
-    delete rule;
+    Substitute(loop, sub);
   }
-
   return true;
 }
 
 bool LoopRefine::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Rule-based loop refinement";
+  PassStats stats("LoopRefine", *ast_ctx);
   Initialize();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
@@ -20,6 +20,7 @@
 #include <llvm/Pass.h>
 
 #include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Util.h"
 
@@ -31,6 +32,8 @@ class LoopRefine : public llvm::ModulePass,
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
 
+  std::unique_ptr<RuleSet> loop_rules;
+
  public:
   static char ID;
 
@@ -41,6 +44,9 @@ class LoopRefine : public llvm::ModulePass,
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Rules that refine `while(1)` loops into sequences and conditional loops
+std::unique_ptr<RuleSet> CreateLoopRefineRules();
+
 llvm::ModulePass *createLoopRefinePass(clang::ASTContext &ctx,
                                        rellic::IRToASTVisitor &ast_gen);
 }  // namespace rellic
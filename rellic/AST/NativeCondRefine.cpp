@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/AST/NativeCondRefine.h"
+
+#include <clang/AST/ASTContext.h>
+#include <glog/logging.h>
+#include <llvm/ADT/FoldingSet.h>
+
+#include <algorithm>
+
+#include "rellic/AST/CompoundEditor.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// Whether `lhs` and `rhs` are the same expression. Equal structural hashes
+// make that likely, but don't guarantee it.
+static bool IsSameExpr(clang::ASTContext &ctx, const clang::Expr *lhs,
+                       const clang::Expr *rhs) {
+  llvm::FoldingSetNodeID lhs_id, rhs_id;
+  lhs->Profile(lhs_id, ctx, /*Canonical=*/true);
+  rhs->Profile(rhs_id, ctx, /*Canonical=*/true);
+  return lhs_id == rhs_id;
+}
+
+}  // namespace
+
+char NativeCondRefine::ID = 0;
+
+NativeCondRefine::NativeCondRefine(clang::ASTContext &ctx,
+                                   rellic::IRToASTVisitor &ast_gen)
+    : ModulePass(NativeCondRefine::ID),
+      ast_ctx(&ctx),
+      ast_gen(&ast_gen),
+      dag(ctx) {}
+
+// Converts `expr` and adds the number of its connectives and atoms to
+// `size`
+CondDAG::Node NativeCondRefine::Convert(clang::Expr *expr, uint64_t &size) {
+  ++size;
+  auto inner{expr->IgnoreParenImpCasts()};
+  if (auto unop = clang::dyn_cast<clang::UnaryOperator>(inner)) {
+    if (unop->getOpcode() == clang::UO_LNot) {
+      return dag.CreateNot(Convert(unop->getSubExpr(), size));
+    }
+  } else if (auto binop = clang::dyn_cast<clang::BinaryOperator>(inner)) {
+    if (binop->getOpcode() == clang::BO_LAnd) {
+      auto lhs{Convert(binop->getLHS(), size)};
+      return dag.CreateAnd(lhs, Convert(binop->getRHS(), size));
+    }
+    if (binop->getOpcode() == clang::BO_LOr) {
+      auto lhs{Convert(binop->getLHS(), size)};
+      return dag.CreateOr(lhs, Convert(binop->getRHS(), size));
+    }
+  }
+  // Structurally equal atoms are the same atom
+  auto atom{expr->IgnoreParens()};
+  auto hash{hasher.Hash(atom)};
+  auto range{atoms.equal_range(hash)};
+  for (auto iter{range.first}; iter != range.second; ++iter) {
+    if (IsSameExpr(*ast_ctx, iter->second->IgnoreParens(), atom)) {
+      return dag.CreateAtom(iter->second);
+    }
+  }
+  atoms.emplace(hash, expr);
+  return dag.CreateAtom(expr);
+}
+
+// Returns a smaller equivalent of `cond`, or `cond` itself
+clang::Expr *NativeCondRefine::Normalize(clang::Expr *cond) {
+  uint64_t size{0};
+  auto node{dag.Simplify(Convert(cond, size))};
+  if (dag.GetSize(node) >= size) {
+    return cond;
+  }
+  return dag.GetOrCreateExpr(node);
+}
+
+void NativeCondRefine::GetTests(CondDAG::Node node, Tests &tests) {
+  if (dag.GetKind(node) == CondDAG::Kind::And) {
+    GetTests(dag.GetLHS(node), tests);
+    GetTests(dag.GetRHS(node), tests);
+    return;
+  }
+  if (dag.GetKind(node) != CondDAG::Kind::Atom) {
+    return;
+  }
+  auto binop{clang::dyn_cast<clang::BinaryOperator>(
+      dag.GetAtom(node)->IgnoreParenImpCasts())};
+  if (!binop || binop->getOpcode() != clang::BO_EQ) {
+    return;
+  }
+  auto lhs{binop->getLHS()->IgnoreParens()};
+  auto rhs{binop->getRHS()->IgnoreParens()};
+  if (clang::isa<clang::IntegerLiteral>(lhs)) {
+    std::swap(lhs, rhs);
+  }
+  if (auto lit = clang::dyn_cast<clang::IntegerLiteral>(rhs)) {
+    tests.push_back({hasher.Hash(lhs), lhs, lit});
+  }
+}
+
+// Whether some expression is tested for different constants in `lhs` and
+// `rhs`. Constants are of the type of the comparison, so that equal
+// values are equal bits.
+bool NativeCondRefine::HaveDistinctTests(const Tests &lhs, const Tests &rhs) {
+  for (auto &ltest : lhs) {
+    for (auto &rtest : rhs) {
+      auto lval{ltest.value->getValue()};
+      auto rval{rtest.value->getValue()};
+      if (ltest.hash == rtest.hash &&
+          lval.getBitWidth() == rval.getBitWidth() && lval != rval &&
+          IsSameExpr(*ast_ctx, ltest.expr, rtest.expr)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool NativeCondRefine::CreateIfThenElseStmts(
+    std::vector<clang::IfStmt *> &ifs, std::vector<CondDAG::Node> &conds) {
+  auto merged{false};
+  std::vector<bool> removed(ifs.size(), false);
+  for (auto i = 0U; i < ifs.size(); ++i) {
+    if (removed[i]) {
+      continue;
+    }
+    // Ifs with the same condition as `ifs[i]`, or the opposite one
+    std::vector<std::pair<unsigned, bool>> members({{i, false}});
+    for (auto j = i + 1; j < ifs.size(); ++j) {
+      if (removed[j]) {
+        continue;
+      }
+      if (dag.IsEquivalent(conds[i], conds[j])) {
+        members.emplace_back(j, false);
+      } else if (dag.IsEquivalent(conds[i], dag.CreateNot(conds[j]))) {
+        members.emplace_back(j, true);
+      }
+    }
+    if (members.size() < 2) {
+      continue;
+    }
+    // Branches of the members keep their order, but lose their tests
+    std::vector<clang::Stmt *> thens, elses;
+    for (auto &member : members) {
+      auto ifstmt{ifs[member.first]};
+      removed[member.first] = true;
+      (member.second ? elses : thens).push_back(ifstmt->getThen());
+      if (auto other = ifstmt->getElse()) {
+        (member.second ? thens : elses).push_back(other);
+      }
+      Substitute(ifstmt, nullptr);
+    }
+    auto sub{CreateIfStmt(*ast_ctx, ifs[i]->getCond(),
+                          CreateCompoundStmt(*ast_ctx, thens))};
+    if (!elses.empty()) {
+      sub->setElse(CreateCompoundStmt(*ast_ctx, elses));
+    }
+    Substitute(ifs[i], sub);
+    merged = true;
+  }
+  return merged;
+}
+
+bool NativeCondRefine::CreateIfElseStmts(std::vector<clang::IfStmt *> &ifs,
+                                         std::vector<CondDAG::Node> &conds) {
+  std::vector<Tests> tests(ifs.size());
+  for (auto i = 0U; i < ifs.size(); ++i) {
+    GetTests(conds[i], tests[i]);
+  }
+  auto IsDisjoint = [&](unsigned i, unsigned j) {
+    return dag.IsDisjoint(conds[i], conds[j]) ||
+           HaveDistinctTests(tests[i], tests[j]);
+  };
+  // Gather ifs from the back whose conditions pairwise can't hold
+  // together, until their disjunction always holds
+  std::vector<unsigned> elifs;
+  auto disj{dag.CreateFalse()};
+  auto IsExhaustive = [&] { return dag.IsEquivalent(disj, dag.CreateTrue()); };
+  for (auto i = ifs.size(); i-- > 0;) {
+    if (IsExhaustive()) {
+      break;
+    }
+    auto disjoint{std::all_of(elifs.begin(), elifs.end(),
+                              [&](unsigned j) { return IsDisjoint(i, j); })};
+    if (ifs[i]->getElse() || !disjoint) {
+      elifs.clear();
+      disj = dag.CreateFalse();
+    }
+    // Ifs with an else branch can't be part of a cascade
+    if (!ifs[i]->getElse()) {
+      elifs.push_back(i);
+      disj = dag.CreateOr(disj, conds[i]);
+    }
+  }
+  if (elifs.size() < 2) {
+    return false;
+  }
+
+  // The last test of an exhaustive cascade is left out
+  auto exhaustive{IsExhaustive()};
+  clang::IfStmt *sub{nullptr};
+  for (auto it = elifs.rbegin(); it != elifs.rend(); ++it) {
+    auto stmt{ifs[*it]};
+    if (!sub) {
+      sub = CreateIfStmt(*ast_ctx, stmt->getCond(), stmt->getThen());
+      Substitute(stmt, sub);
+      continue;
+    }
+    Substitute(stmt, nullptr);
+    if (exhaustive && *it == elifs.front()) {
+      sub->setElse(stmt->getThen());
+    } else {
+      auto elif{CreateIfStmt(*ast_ctx, stmt->getCond(), stmt->getThen())};
+      sub->setElse(elif);
+      sub = elif;
+    }
+  }
+  return true;
+}
+
+bool NativeCondRefine::VisitIfStmt(clang::IfStmt *ifstmt) {
+  auto cond{Normalize(ifstmt->getCond())};
+  if (cond != ifstmt->getCond()) {
+    ifstmt->setCond(cond);
+    hasher.Forget(ifstmt);
+    changed = true;
+  }
+  return true;
+}
+
+bool NativeCondRefine::VisitWhileStmt(clang::WhileStmt *loop) {
+  auto cond{Normalize(loop->getCond())};
+  if (cond != loop->getCond()) {
+    loop->setCond(cond);
+    hasher.Forget(loop);
+    changed = true;
+  }
+  return true;
+}
+
+bool NativeCondRefine::VisitDoStmt(clang::DoStmt *loop) {
+  auto cond{Normalize(loop->getCond())};
+  if (cond != loop->getCond()) {
+    loop->setCond(cond);
+    hasher.Forget(loop);
+    changed = true;
+  }
+  return true;
+}
+
+bool NativeCondRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
+  std::vector<clang::IfStmt *> ifs;
+  std::vector<CondDAG::Node> conds;
+  for (auto stmt : compound->body()) {
+    if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+      uint64_t size{0};
+      ifs.push_back(ifstmt);
+      conds.push_back(Convert(ifstmt->getCond(), size));
+    }
+  }
+  if (ifs.size() < 2) {
+    return true;
+  }
+  // Cascades are formed once no more ifs can be merged
+  if (!CreateIfThenElseStmts(ifs, conds)) {
+    CreateIfElseStmts(ifs, conds);
+  }
+  // Apply the substitutions in place. `compound` is only replaced if
+  // statements were removed from it.
+  CompoundEditor editor(*ast_ctx, compound);
+  if (editor.Substitute(substitutions)) {
+    auto sub{editor.Commit()};
+    if (sub != compound) {
+      Substitute(compound, sub);
+    }
+    changed = true;
+  }
+  return true;
+}
+
+bool NativeCondRefine::runOnModule(llvm::Module &module) {
+  LOG(INFO) << "Native condition refinement";
+  PassStats stats("NativeCondRefine", *ast_ctx);
+  Initialize();
+  dag.Clear();
+  atoms.clear();
+  TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size(), changed);
+  return changed;
+}
+
+llvm::ModulePass *createNativeCondRefinePass(clang::ASTContext &ctx,
+                                             rellic::IRToASTVisitor &gen) {
+  return new NativeCondRefine(ctx, gen);
+}
+
+}  // namespace rellic
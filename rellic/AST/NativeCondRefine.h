@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <clang/AST/Expr.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/CondDAG.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/TransformVisitor.h"
+
+namespace rellic {
+
+// Refines conditions without Z3, as a cheaper stand-in for `z3-simplify`,
+// `cbr` and `rbr`. Conditions become `CondDAG` nodes over atoms that are
+// identified by their structure, so that:
+//
+//  * conditions of ifs and loops are rebuilt from their truth tables
+//    whenever that makes them smaller,
+//  * ifs of a compound with equivalent or complementary conditions are
+//    merged into if-then-else statements, and
+//  * runs of ifs whose conditions pairwise can't hold together become
+//    else-if cascades. Besides boolean structure, conditions that test
+//    the same expression for different integer constants are disjoint.
+//
+// Only what truth tables over at most six atoms show is used, so this
+// refines less than the Z3 passes do.
+class NativeCondRefine : public llvm::ModulePass,
+                         public TransformVisitor<NativeCondRefine> {
+ private:
+  clang::ASTContext *ast_ctx;
+  rellic::IRToASTVisitor *ast_gen;
+
+  CondDAG dag;
+  // First atom of every structure, by structural hash. Atoms with the
+  // same hash are only the same atom if they are also structurally equal.
+  std::unordered_multimap<uint64_t, clang::Expr *> atoms;
+
+  // Expressions that conjuncts of a condition compare for equality with
+  // integer constants
+  struct Test {
+    uint64_t hash;
+    clang::Expr *expr;
+    clang::IntegerLiteral *value;
+  };
+  using Tests = std::vector<Test>;
+
+  CondDAG::Node Convert(clang::Expr *expr, uint64_t &size);
+  clang::Expr *Normalize(clang::Expr *cond);
+  void GetTests(CondDAG::Node node, Tests &tests);
+  bool HaveDistinctTests(const Tests &lhs, const Tests &rhs);
+
+  bool CreateIfThenElseStmts(std::vector<clang::IfStmt *> &ifs,
+                             std::vector<CondDAG::Node> &conds);
+  bool CreateIfElseStmts(std::vector<clang::IfStmt *> &ifs,
+                         std::vector<CondDAG::Node> &conds);
+
+ public:
+  static char ID;
+
+  NativeCondRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+
+  bool VisitIfStmt(clang::IfStmt *ifstmt);
+  bool VisitWhileStmt(clang::WhileStmt *loop);
+  bool VisitDoStmt(clang::DoStmt *loop);
+  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+
+  bool runOnModule(llvm::Module &module) override;
+};
+
+llvm::ModulePass *createNativeCondRefinePass(clang::ASTContext &ctx,
+                                             rellic::IRToASTVisitor &ast_gen);
+}  // namespace rellic
+
+namespace llvm {
+void initializeNativeCondRefinePass(PassRegistry &);
+}
@@ -17,7 +17,10 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <utility>
+
 #include "rellic/AST/NestedCondProp.h"
+#include "rellic/AST/Stats.h"
 #include "rellic/AST/Util.h"
 #include "rellic/AST/Z3ConvVisitor.h"
 
@@ -40,70 +43,117 @@ static std::vector<clang::IfStmt *> GetIfStmts(clang::CompoundStmt *compound) {
 char NestedCondProp::ID = 0;
 
 NestedCondProp::NestedCondProp(clang::ASTContext &ctx,
-                               rellic::IRToASTVisitor &ast_gen)
+                               rellic::IRToASTVisitor &ast_gen,
+                               rellic::Z3Solver &solver)
     : ModulePass(NestedCondProp::ID),
       ast_ctx(&ctx),
       ast_gen(&ast_gen),
-      z3_ctx(new z3::context()),
-      z3_gen(new rellic::Z3ConvVisitor(ast_ctx, z3_ctx.get())) {}
+      z3_ctx(&solver.GetZ3Context()),
+      z3_gen(&solver.GetZ3ConvVisitor()) {}
 
-bool NestedCondProp::VisitIfStmt(clang::IfStmt *ifstmt) {
-  // DLOG(INFO) << "VisitIfStmt";
-  // Determine whether `cond` is a constant expression
-  auto cond = ifstmt->getCond();
-  if (!cond->isIntegerConstantExpr(*ast_ctx)) {
-    auto stmt_then = ifstmt->getThen();
-    auto stmt_else = ifstmt->getElse();
-    // `cond` is not a constant expression and we propagate it
-    // to `clang::IfStmt` nodes in it's `then` branch.
-    if (auto comp = clang::dyn_cast<clang::CompoundStmt>(stmt_then)) {
-      for (auto child : GetIfStmts(comp)) {
-        parent_conds[child] = cond;
-      }
-    } else {
-      LOG(FATAL) << "Then branch must be a clang::CompoundStmt!";
+void NestedCondProp::AddFacts(z3::expr expr,
+                              std::vector<z3::expr> &facts) {
+  if (expr.is_and()) {
+    for (auto i = 0U; i < expr.num_args(); ++i) {
+      AddFacts(expr.arg(i), facts);
     }
-    if (stmt_else) {
-      if (auto comp = clang::dyn_cast<clang::CompoundStmt>(stmt_else)) {
-        for (auto child : GetIfStmts(comp)) {
-          parent_conds[child] = CreateNotExpr(*ast_ctx, cond);
-        }
-      } else if (auto elif = clang::dyn_cast<clang::IfStmt>(stmt_else)) {
-        parent_conds[elif] = CreateNotExpr(*ast_ctx, cond);
-      } else {
-        LOG(FATAL)
-            << "Else branch must be a clang::CompoundStmt or clang::IfStmt!";
-      }
+  } else if (expr.is_not() && expr.arg(0).is_or()) {
+    // `!(a || b)` holds exactly when `!a` and `!b` hold
+    auto disj{expr.arg(0)};
+    for (auto i = 0U; i < disj.num_args(); ++i) {
+      AddFacts((!disj.arg(i)).simplify(), facts);
     }
+  } else if (!expr.is_true()) {
+    facts.push_back(expr);
   }
-  // Retrieve a parent `clang::IfStmt` condition
-  // and remove it from `cond` if it's present.
-  auto iter = parent_conds.find(ifstmt);
-  if (iter != parent_conds.end()) {
-    auto child_expr = z3_gen->GetOrCreateZ3Expr(ifstmt->getCond()).simplify();
-    auto parent_expr = z3_gen->GetOrCreateZ3Expr(iter->second).simplify();
-    z3::expr_vector src(*z3_ctx);
-    z3::expr_vector dst(*z3_ctx);
-    src.push_back(parent_expr);
+}
+
+// Replaces the facts in `expr` with `true` and their negations with
+// `false`. Since Z3 expressions are hash-consed, this is a single
+// structural pass over `expr` no matter how many facts there are.
+z3::expr NestedCondProp::Simplify(z3::expr expr,
+                                  const std::vector<z3::expr> &facts) {
+  z3::expr_vector src(*z3_ctx);
+  z3::expr_vector dst(*z3_ctx);
+  for (auto &fact : facts) {
+    src.push_back(fact);
     dst.push_back(z3_ctx->bool_val(true));
-    auto sub = child_expr.substitute(src, dst).simplify();
+    if (fact.is_not()) {
+      src.push_back(fact.arg(0));
+      dst.push_back(z3_ctx->bool_val(false));
+    }
+  }
+  return expr.substitute(src, dst).simplify();
+}
+
+bool NestedCondProp::VisitIfStmt(clang::IfStmt *ifstmt) {
+  // Simplify `cond` under the path condition of `ifstmt`. Parents are
+  // visited before their children, so the path condition is complete.
+  auto cond = ifstmt->getCond();
+  std::vector<z3::expr> facts;
+  auto iter = path_conds.find(ifstmt);
+  if (iter != path_conds.end()) {
+    facts = std::move(iter->second);
+    path_conds.erase(iter);
+    auto child_expr =
+        z3_gen->Z3BoolCast(z3_gen->GetOrCreateZ3Expr(cond)).simplify();
+    auto sub = Simplify(child_expr, facts);
     if (!z3::eq(child_expr, sub)) {
-      ifstmt->setCond(z3_gen->GetOrCreateCExpr(sub));
+      cond = z3_gen->GetOrCreateCExpr(sub);
+      ifstmt->setCond(cond);
       changed = true;
     }
   }
+  // Determine whether `cond` is a constant expression
+  if (cond->isIntegerConstantExpr(*ast_ctx)) {
+    return true;
+  }
+  // `cond` is not a constant expression and we propagate it, together
+  // with the path condition, to the `clang::IfStmt` nodes in its branches
+  auto cond_expr = z3_gen->Z3BoolCast(z3_gen->GetOrCreateZ3Expr(cond));
+  auto stmt_then = ifstmt->getThen();
+  auto stmt_else = ifstmt->getElse();
+  auto then_facts = facts;
+  AddFacts(cond_expr.simplify(), then_facts);
+  if (auto comp = clang::dyn_cast<clang::CompoundStmt>(stmt_then)) {
+    for (auto child : GetIfStmts(comp)) {
+      path_conds.emplace(child, then_facts);
+    }
+  } else {
+    LOG(FATAL) << "Then branch must be a clang::CompoundStmt!";
+  }
+  if (stmt_else) {
+    auto else_facts = facts;
+    AddFacts((!cond_expr).simplify(), else_facts);
+    if (auto comp = clang::dyn_cast<clang::CompoundStmt>(stmt_else)) {
+      for (auto child : GetIfStmts(comp)) {
+        path_conds.emplace(child, else_facts);
+      }
+    } else if (auto elif = clang::dyn_cast<clang::IfStmt>(stmt_else)) {
+      path_conds.emplace(elif, else_facts);
+    } else {
+      LOG(FATAL)
+          << "Else branch must be a clang::CompoundStmt or clang::IfStmt!";
+    }
+  }
   return true;
 }
 
 bool NestedCondProp::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Propagating nested conditions";
+  PassStats stats("NestedCondProp", *ast_ctx);
   Initialize();
+  path_conds.clear();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  path_conds.clear();
+  stats.SetMapBytes(z3_gen->GetMemoryUsage());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
 llvm::ModulePass *createNestedCondPropPass(clang::ASTContext &ctx,
-                                           rellic::IRToASTVisitor &gen) {
-  return new NestedCondProp(ctx, gen);
+                                           rellic::IRToASTVisitor &gen,
+                                           rellic::Z3Solver &solver) {
+  return new NestedCondProp(ctx, gen, solver);
 }
 }  // namespace rellic
\ No newline at end of file
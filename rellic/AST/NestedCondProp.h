@@ -21,9 +21,13 @@
 #include <llvm/Pass.h>
 #include <z3++.h>
 
+#include <unordered_map>
+#include <vector>
+
 #include "rellic/AST/IRToASTVisitor.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Z3ConvVisitor.h"
+#include "rellic/AST/Z3Solver.h"
 
 namespace rellic {
 
@@ -32,17 +36,23 @@ class NestedCondProp : public llvm::ModulePass,
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
-  std::unique_ptr<z3::context> z3_ctx;
-  std::unique_ptr<rellic::Z3ConvVisitor> z3_gen;
+  z3::context *z3_ctx;
+  rellic::Z3ConvVisitor *z3_gen;
+
+  // Conditions that hold whenever an IfStmt is reached, as conjuncts of
+  // the path condition accumulated from its enclosing IfStmts
+  std::unordered_map<clang::IfStmt *, std::vector<z3::expr>> path_conds;
 
-  std::unordered_map<clang::IfStmt *, clang::Expr *> parent_conds;
+  void AddFacts(z3::expr expr, std::vector<z3::expr> &facts);
+  z3::expr Simplify(z3::expr expr, const std::vector<z3::expr> &facts);
 
  public:
   static char ID;
 
   bool shouldTraversePostOrder() { return false; }
 
-  NestedCondProp(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+  NestedCondProp(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen,
+                 rellic::Z3Solver &solver);
 
   bool VisitIfStmt(clang::IfStmt *stmt);
 
@@ -50,7 +60,8 @@ class NestedCondProp : public llvm::ModulePass,
 };
 
 llvm::ModulePass *createNestedCondPropPass(clang::ASTContext &ctx,
-                                           rellic::IRToASTVisitor &ast_gen);
+                                           rellic::IRToASTVisitor &ast_gen,
+                                           rellic::Z3Solver &solver);
 }  // namespace rellic
 
 namespace llvm {
@@ -18,10 +18,40 @@
 #include <glog/logging.h>
 
 #include "rellic/AST/NestedScopeCombiner.h"
+#include "rellic/AST/Stats.h"
 #include "rellic/AST/Util.h"
 
 namespace rellic {
 
+clang::Stmt *CombineNestedScopes(clang::ASTContext &ctx, clang::Stmt *stmt) {
+  if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+    // Determine whether `cond` is a constant expression that is always true
+    // and `ifstmt` should be replaced by `then` in it's parent nodes.
+    llvm::APSInt val;
+    bool is_const = ifstmt->getCond()->isIntegerConstantExpr(val, ctx);
+    if (is_const && val.getBoolValue()) {
+      return ifstmt->getThen();
+    }
+  } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    bool has_compound = false;
+    std::vector<clang::Stmt *> new_body;
+    for (auto stmt : compound->body()) {
+      if (auto child = clang::dyn_cast_or_null<clang::CompoundStmt>(stmt)) {
+        new_body.insert(new_body.end(), child->body_begin(),
+                        child->body_end());
+        has_compound = true;
+      } else {
+        new_body.push_back(stmt);
+      }
+    }
+
+    if (has_compound) {
+      return CreateCompoundStmt(ctx, new_body);
+    }
+  }
+  return stmt;
+}
+
 char NestedScopeCombiner::ID = 0;
 
 NestedScopeCombiner::NestedScopeCombiner(clang::ASTContext &ctx,
@@ -32,40 +62,28 @@ NestedScopeCombiner::NestedScopeCombiner(clang::ASTContext &ctx,
 
 bool NestedScopeCombiner::VisitIfStmt(clang::IfStmt *ifstmt) {
   // DLOG(INFO) << "VisitIfStmt";
-  // Determine whether `cond` is a constant expression that is always true and
-  // `ifstmt` should be replaced by `then` in it's parent nodes.
-  llvm::APSInt val;
-  bool is_const = ifstmt->getCond()->isIntegerConstantExpr(val, *ast_ctx);
-  if (is_const && val.getBoolValue()) {
-    substitutions[ifstmt] = ifstmt->getThen();
+  auto sub = CombineNestedScopes(*ast_ctx, ifstmt);
+  if (sub != ifstmt) {
+    Substitute(ifstmt, sub);
   }
   return true;
 }
 
 bool NestedScopeCombiner::VisitCompoundStmt(clang::CompoundStmt *compound) {
   // DLOG(INFO) << "VisitCompoundStmt";
-  bool has_compound = false;
-  std::vector<clang::Stmt *> new_body;
-  for (auto stmt : compound->body()) {
-    if (auto child = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
-      new_body.insert(new_body.end(), child->body_begin(), child->body_end());
-      has_compound = true;
-    } else {
-      new_body.push_back(stmt);
-    }
-  }
-  
-  if (has_compound) {
-    substitutions[compound] = CreateCompoundStmt(*ast_ctx, new_body);
+  auto sub = CombineNestedScopes(*ast_ctx, compound);
+  if (sub != compound) {
+    Substitute(compound, sub);
   }
-  
   return true;
 }
 
 bool NestedScopeCombiner::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Combining nested scopes";
+  PassStats stats("NestedScopeCombiner", *ast_ctx);
   Initialize();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
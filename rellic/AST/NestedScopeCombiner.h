@@ -42,6 +42,10 @@ class NestedScopeCombiner : public llvm::ModulePass,
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Replaces `if(1) { ... }` with its `then` branch and flattens compounds
+// nested in `stmt`. Returns `stmt` itself if there is nothing to combine.
+clang::Stmt *CombineNestedScopes(clang::ASTContext &ctx, clang::Stmt *stmt);
+
 llvm::ModulePass *createNestedScopeCombinerPass(
     clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
 }  // namespace rellic
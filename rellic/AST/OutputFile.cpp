@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/OutputFile.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <vector>
+
+#ifdef RELLIC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef RELLIC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace rellic {
+
+bool ParseOutputCompression(llvm::StringRef name,
+                            OutputCompression &compression,
+                            std::string &error) {
+  if (name.empty() || name == "none") {
+    compression = OutputCompression::kNone;
+    return true;
+  } else if (name == "gzip") {
+#ifdef RELLIC_HAVE_ZLIB
+    compression = OutputCompression::kGzip;
+    return true;
+#else
+    error = "This build of rellic has no gzip support";
+    return false;
+#endif
+  } else if (name == "zstd") {
+#ifdef RELLIC_HAVE_ZSTD
+    compression = OutputCompression::kZstd;
+    return true;
+#else
+    error = "This build of rellic has no zstd support";
+    return false;
+#endif
+  }
+  error = "Unknown compression `" + name.str() + "`";
+  return false;
+}
+
+const char *GetOutputExtension(OutputCompression compression) {
+  switch (compression) {
+    case OutputCompression::kGzip:
+      return ".gz";
+    case OutputCompression::kZstd:
+      return ".zst";
+    default:
+      return "";
+  }
+}
+
+// Streaming compressor that writes its output to `file`
+class OutputFile::Compressor {
+ protected:
+  llvm::raw_ostream &file;
+  std::vector<char> out;
+
+ public:
+  Compressor(llvm::raw_ostream &file) : file(file), out(kBufferSize) {}
+  virtual ~Compressor() = default;
+
+  // Compresses `size` bytes at `ptr`, and finishes the stream if `finish`
+  // is set. Returns `false` if compression failed.
+  virtual bool Compress(const char *ptr, size_t size, bool finish) = 0;
+};
+
+namespace {
+
+#ifdef RELLIC_HAVE_ZLIB
+class GzipCompressor : public OutputFile::Compressor {
+ private:
+  z_stream stream{};
+  bool ok;
+
+ public:
+  GzipCompressor(llvm::raw_ostream &file) : Compressor(file) {
+    // A window of 2^15 bytes plus 16 selects the gzip format
+    ok = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                      Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+
+  ~GzipCompressor() override {
+    if (ok) {
+      deflateEnd(&stream);
+    }
+  }
+
+  bool Compress(const char *ptr, size_t size, bool finish) override {
+    if (!ok) {
+      return false;
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(ptr));
+    stream.avail_in = static_cast<uInt>(size);
+    int result;
+    do {
+      stream.next_out = reinterpret_cast<Bytef *>(out.data());
+      stream.avail_out = static_cast<uInt>(out.size());
+      result = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+      if (result == Z_STREAM_ERROR) {
+        ok = false;
+        return false;
+      }
+      file.write(out.data(), out.size() - stream.avail_out);
+    } while (stream.avail_out == 0 || (finish && result != Z_STREAM_END));
+    return true;
+  }
+};
+#endif
+
+#ifdef RELLIC_HAVE_ZSTD
+class ZstdCompressor : public OutputFile::Compressor {
+ private:
+  ZSTD_CCtx *ctx;
+
+ public:
+  ZstdCompressor(llvm::raw_ostream &file)
+      : Compressor(file), ctx(ZSTD_createCCtx()) {}
+
+  ~ZstdCompressor() override { ZSTD_freeCCtx(ctx); }
+
+  bool Compress(const char *ptr, size_t size, bool finish) override {
+    if (!ctx) {
+      return false;
+    }
+    ZSTD_inBuffer in{ptr, size, 0};
+    size_t remaining;
+    do {
+      ZSTD_outBuffer buf{out.data(), out.size(), 0};
+      remaining = ZSTD_compressStream2(ctx, &buf, &in,
+                                       finish ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining)) {
+        return false;
+      }
+      file.write(out.data(), buf.pos);
+    } while (finish ? remaining != 0 : in.pos != in.size);
+    return true;
+  }
+};
+#endif
+
+}  // namespace
+
+OutputFile::OutputFile(llvm::StringRef path, std::error_code &ec,
+                       OutputCompression compression)
+    : file(path, ec, llvm::sys::fs::F_None) {
+  // Blocks are collected here, so the file itself needs no buffer
+  file.SetUnbuffered();
+  SetBufferSize(kBufferSize);
+  switch (compression) {
+#ifdef RELLIC_HAVE_ZLIB
+    case OutputCompression::kGzip:
+      compressor.reset(new GzipCompressor(file));
+      break;
+#endif
+#ifdef RELLIC_HAVE_ZSTD
+    case OutputCompression::kZstd:
+      compressor.reset(new ZstdCompressor(file));
+      break;
+#endif
+    default:
+      CHECK(compression == OutputCompression::kNone)
+          << "Unsupported output compression";
+      break;
+  }
+}
+
+OutputFile::~OutputFile() { Close(); }
+
+void OutputFile::write_impl(const char *ptr, size_t size) {
+  pos += size;
+  if (compressor) {
+    failed |= !compressor->Compress(ptr, size, /*finish=*/false);
+  } else {
+    file.write(ptr, size);
+  }
+}
+
+bool OutputFile::Close() {
+  if (!closed) {
+    closed = true;
+    flush();
+    if (compressor) {
+      failed |= !compressor->Compress(nullptr, 0, /*finish=*/true);
+    }
+    file.close();
+  }
+  return !failed && !file.has_error();
+}
+
+}  // namespace rellic
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <string>
+#include <system_error>
+
+namespace rellic {
+
+enum class OutputCompression { kNone, kGzip, kZstd };
+
+// Parses `none`, `gzip` or `zstd`. Returns `false` and describes the
+// problem in `error` if `name` is unknown or this build lacks the library.
+bool ParseOutputCompression(llvm::StringRef name,
+                            OutputCompression &compression,
+                            std::string &error);
+
+// File name extension of files compressed with `compression`, e.g. `.gz`
+const char *GetOutputExtension(OutputCompression compression);
+
+// File that collects output in large blocks and optionally compresses
+// them on the fly, so that the file sees few large writes.
+class OutputFile : public llvm::raw_ostream {
+ public:
+  class Compressor;
+
+ private:
+  llvm::raw_fd_ostream file;
+  std::unique_ptr<Compressor> compressor;
+  uint64_t pos = 0;
+  bool closed = false;
+  bool failed = false;
+
+  void write_impl(const char *ptr, size_t size) override;
+  uint64_t current_pos() const override { return pos; }
+
+ public:
+  static constexpr size_t kBufferSize = 1U << 20;
+
+  OutputFile(llvm::StringRef path, std::error_code &ec,
+             OutputCompression compression = OutputCompression::kNone);
+  ~OutputFile() override;
+
+  // Writes the remaining output and closes the file. Returns `false` if
+  // any write failed.
+  bool Close();
+};
+
+}  // namespace rellic
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/AST/PassProfile.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+#include "rellic/BC/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// Regions nested deeper than this are all in one class
+static constexpr unsigned kMaxDepthClass{4};
+
+}  // namespace
+
+PassProfile::PassProfile(unsigned min_runs, unsigned sample_interval)
+    : min_runs(min_runs), sample_interval(std::max(sample_interval, 1U)) {}
+
+std::string PassProfile::GetShapeClass(llvm::Function &func) {
+  auto shape{GetCFGShape(func)};
+  auto blocks{shape.num_blocks ? llvm::Log2_32(shape.num_blocks) : 0U};
+  auto depth{std::min(shape.region_depth, kMaxDepthClass)};
+  return 'b' + std::to_string(blocks) + 'd' + std::to_string(depth) +
+         (shape.has_cycles ? "c" : "");
+}
+
+bool PassProfile::ShouldRun(const std::string &shape,
+                            const std::string &pass) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &entry{counts[{shape, pass}]};
+  if (entry.runs < min_runs || entry.changes) {
+    return true;
+  }
+  if (++entry.skipped < sample_interval) {
+    ++num_skipped;
+    return false;
+  }
+  entry.skipped = 0;
+  ++entry.pending;
+  return true;
+}
+
+void PassProfile::Record(const std::string &shape, const std::string &pass,
+                         bool changed) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &entry{counts[{shape, pass}]};
+  ++entry.runs;
+  entry.changes += changed;
+  if (entry.pending) {
+    --entry.pending;
+    ++num_samples;
+    num_sample_changes += changed;
+  }
+}
+
+bool PassProfile::Load(const std::string &path) {
+  auto buf{llvm::MemoryBuffer::getFile(path)};
+  if (!buf) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  for (llvm::line_iterator line(**buf); !line.is_at_eof(); ++line) {
+    // Entries are `<shape> <pass> <runs> <changes>`
+    auto shape{line->split(' ')};
+    auto num_changes{shape.second.rsplit(' ')};
+    auto num_runs{num_changes.first.rsplit(' ')};
+    Counts entry;
+    if (num_runs.first.empty() ||
+        num_runs.second.getAsInteger(10, entry.runs) ||
+        num_changes.second.getAsInteger(10, entry.changes)) {
+      LOG(WARNING) << "Ignoring malformed pass profile entry: "
+                   << line->str();
+      continue;
+    }
+    counts[{shape.first.str(), num_runs.first.str()}] = entry;
+  }
+  return true;
+}
+
+bool PassProfile::Save(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    LOG(ERROR) << "Failed to write pass profile: " << ec.message();
+    return false;
+  }
+  // Entries are sorted by their key, so that the file is stable
+  for (auto &entry : counts) {
+    if (entry.second.runs) {
+      os << entry.first.first << ' ' << entry.first.second << ' '
+         << entry.second.runs << ' ' << entry.second.changes << '\n';
+    }
+  }
+  return true;
+}
+
+}  // namespace rellic
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace rellic {
+
+// How often the passes of pipeline stages changed functions of each CFG
+// shape class in earlier runs. Functions of a class tend to need the same
+// passes, so a pass that never changed a function of a class, over enough
+// runs, is skipped for later functions of it.
+//
+// Every `sample_interval`-th pass run that would be skipped happens anyway
+// as a validation sample. Samples are recorded like other runs, so a pass
+// that starts to change functions of a class is no longer skipped.
+// Profiles can be shared between threads and persisted between runs.
+class PassProfile {
+ private:
+  struct Counts {
+    uint64_t runs = 0;
+    uint64_t changes = 0;
+    // Not persisted: runs skipped since the last sample, and samples that
+    // are yet to be recorded
+    uint64_t skipped = 0;
+    uint64_t pending = 0;
+  };
+
+  std::mutex mutex;
+  // Keyed by shape class and pass
+  std::map<std::pair<std::string, std::string>, Counts> counts;
+  unsigned min_runs;
+  unsigned sample_interval;
+
+  uint64_t num_skipped = 0;
+  uint64_t num_samples = 0;
+  uint64_t num_sample_changes = 0;
+
+ public:
+  PassProfile(unsigned min_runs = 16, unsigned sample_interval = 8);
+
+  // Class of `func` by the number of its blocks, rounded down to a power
+  // of two, the depth of its regions and whether it has cycles
+  static std::string GetShapeClass(llvm::Function &func);
+
+  // Returns `false` if `pass` can be skipped for a function of class
+  // `shape`. A `true` result has to be followed by `Record`.
+  bool ShouldRun(const std::string &shape, const std::string &pass);
+  // Records whether `pass` changed a function of class `shape`
+  void Record(const std::string &shape, const std::string &pass,
+              bool changed);
+
+  // Pass runs that were skipped, validation samples, and samples that
+  // changed their function, i.e. runs that skipping would have missed
+  uint64_t GetNumSkipped() const { return num_skipped; }
+  uint64_t GetNumSamples() const { return num_samples; }
+  uint64_t GetNumSampleChanges() const { return num_sample_changes; }
+
+  // Reads entries from `path`. Returns `false` if the file can't be read.
+  bool Load(const std::string &path);
+  // Writes all entries to `path`. Returns `false` on I/O errors.
+  bool Save(const std::string &path);
+};
+
+}  // namespace rellic
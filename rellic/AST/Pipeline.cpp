@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Pipeline.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
+#include <z3++.h>
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+
+#include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/CondReachRefine.h"
+#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/FusedRewrite.h"
+#include "rellic/AST/LoopRefine.h"
+#include "rellic/AST/NativeCondRefine.h"
+#include "rellic/AST/NestedCondProp.h"
+#include "rellic/AST/NestedScopeCombiner.h"
+#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/StmtRecycler.h"
+#include "rellic/AST/Trace.h"
+#include "rellic/AST/Z3CondSimplify.h"
+#include "rellic/BC/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static const struct {
+  const char *name;
+  const char *pipeline;
+} kPresets[] = {
+    // Skips the costliest Z3 passes and caps condition-based refinement
+    {"fast",
+     "cbr*4(z3-simplify(simplify),nsc,cbr);"
+     "loop*(loop);"
+     "fin(expr-combine)"},
+    // Refines conditions without Z3, for inputs where it is too costly
+    {"native",
+     "cbr*(native-refine,nsc);"
+     "loop*(loop);"
+     "fin(expr-combine)"},
+    {"default",
+     "cbr*(z3-simplify(aig,simplify),ncp,nsc,cbr-rbr);"
+     "loop*(loop);"
+     "fin(z3-simplify(auto),ncp,expr-combine)"},
+    // Refines conditions again after loops have been refined
+    {"thorough",
+     "cbr*(z3-simplify(aig,simplify),ncp,nsc,cbr-rbr);"
+     "loop*(loop);"
+     "refine*(z3-simplify(auto),ncp,nsc,cbr-rbr);"
+     "reloop*(loop);"
+     "fin(expr-combine)"},
+};
+
+// Passes that take no arguments
+static const char *kPlainPasses[] = {
+    "ncp", "nsc",  "cbr",         "rbr",          "cbr-rbr", "native-refine",
+    "dse", "loop", "expr-combine"};
+
+// Recursive descent parser of pipeline descriptions
+class PipelineParser {
+ private:
+  std::string text;
+  size_t pos = 0;
+  std::string &error;
+
+  bool Fail(const std::string &msg) {
+    error = msg + " at offset " + std::to_string(pos) + " of `" + text + "`";
+    return false;
+  }
+
+  bool AtEnd() { return pos == text.size(); }
+
+  bool Consume(char c) {
+    if (!AtEnd() && text[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  bool Expect(char c) {
+    return Consume(c) || Fail(std::string("expected `") + c + '`');
+  }
+
+  bool ParseName(std::string &name) {
+    auto start{pos};
+    while (!AtEnd() && (std::isalnum(static_cast<unsigned char>(text[pos])) ||
+                        text[pos] == '-' || text[pos] == '_')) {
+      ++pos;
+    }
+    if (pos == start) {
+      return Fail("expected a name");
+    }
+    name = text.substr(start, pos - start);
+    return true;
+  }
+
+  bool ParseNumber(unsigned &num) {
+    auto start{pos};
+    while (!AtEnd() && std::isdigit(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+    }
+    if (pos == start || pos - start > 9) {
+      return Fail("expected a round count");
+    }
+    num = std::stoul(text.substr(start, pos - start));
+    return true;
+  }
+
+  bool ParsePass(PassDesc &pass) {
+    if (!ParseName(pass.name)) {
+      return false;
+    }
+    if (Consume('(')) {
+      do {
+        pass.args.emplace_back();
+        if (!ParseName(pass.args.back())) {
+          return false;
+        }
+      } while (Consume(','));
+      return Expect(')');
+    }
+    return true;
+  }
+
+  bool ParseStage(StageDesc &stage) {
+    if (!ParseName(stage.name)) {
+      return false;
+    }
+    if (Consume('*')) {
+      stage.fixpoint = true;
+      auto next{AtEnd() ? '\0' : text[pos]};
+      if (std::isdigit(static_cast<unsigned char>(next)) &&
+          !ParseNumber(stage.max_rounds)) {
+        return false;
+      }
+    }
+    if (!Expect('(')) {
+      return false;
+    }
+    do {
+      stage.passes.emplace_back();
+      if (!ParsePass(stage.passes.back())) {
+        return false;
+      }
+    } while (Consume(','));
+    return Expect(')');
+  }
+
+ public:
+  PipelineParser(llvm::StringRef input, std::string &error) : error(error) {
+    // Drop whitespace and comments
+    auto in_comment{false};
+    for (auto c : input) {
+      if (c == '\n') {
+        in_comment = false;
+      } else if (c == '#') {
+        in_comment = true;
+      }
+      if (!in_comment && !std::isspace(static_cast<unsigned char>(c))) {
+        text += c;
+      }
+    }
+  }
+
+  bool Parse(PipelineDesc &desc) {
+    do {
+      if (AtEnd()) {
+        // Allow a trailing `;`
+        break;
+      }
+      desc.emplace_back();
+      if (!ParseStage(desc.back())) {
+        return false;
+      }
+    } while (Consume(';'));
+    if (!AtEnd()) {
+      return Fail("expected `;`");
+    }
+    if (desc.empty()) {
+      return Fail("expected a stage");
+    }
+    return true;
+  }
+};
+
+static bool IsTactic(z3::context &ctx, llvm::StringRef name) {
+  for (auto i = 0U; i < Z3_get_num_tactics(ctx); ++i) {
+    if (name == Z3_get_tactic_name(ctx, i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool CheckPass(const PassDesc &pass, z3::context &ctx,
+                      std::string &error) {
+  if (pass.name == "z3-simplify") {
+    if (pass.args.empty()) {
+      error = "`z3-simplify` needs at least one Z3 tactic";
+      return false;
+    }
+    // `auto` picks a chain for every condition
+    if (pass.args.size() == 1 && pass.args.front() == "auto") {
+      return true;
+    }
+    for (auto &tactic : pass.args) {
+      if (!IsTactic(ctx, tactic)) {
+        error = "Unknown Z3 tactic `" + tactic + "`";
+        return false;
+      }
+    }
+    return true;
+  }
+  if (!llvm::is_contained(kPlainPasses, pass.name)) {
+    error = "Unknown pass `" + pass.name + "`";
+    return false;
+  }
+  if (!pass.args.empty()) {
+    error = "Pass `" + pass.name + "` takes no arguments";
+    return false;
+  }
+  return true;
+}
+
+// Combining expressions rewrites them in place, which invalidates the
+// cached Z3 conversions of the solver
+static bool CheckOrder(const PipelineDesc &desc, std::string &error) {
+  auto combined{false};
+  for (auto &stage : desc) {
+    auto combines{std::any_of(
+        stage.passes.begin(), stage.passes.end(),
+        [](const PassDesc &pass) { return pass.name == "expr-combine"; })};
+    for (auto &pass : stage.passes) {
+      if (UsesZ3(pass) && (combined || (combines && stage.fixpoint))) {
+        error = "Pass `" + pass.name + "` of stage `" + stage.name +
+                "` can't run after `expr-combine`";
+        return false;
+      }
+      combined |= pass.name == "expr-combine";
+    }
+  }
+  return true;
+}
+
+// Reports a function that `stage` gave up on before it converged
+static void ReportUnconverged(const char *stage, unsigned round,
+                              clang::FunctionDecl *fdecl,
+                              const ChangeTracker::PassNames &names,
+                              bool oscillating) {
+  std::vector<std::string> passes(names.begin(), names.end());
+  LOG(WARNING) << "Function " << fdecl->getNameAsString()
+               << (oscillating ? " oscillates" : " did not converge")
+               << " after round " << round << " of stage " << stage
+               << "; last changed by " << llvm::join(passes, ", ");
+  if (Stats::IsEnabled()) {
+    Stats::Get().AddUnconverged(stage, fdecl->getNameAsString(), round,
+                                oscillating, std::move(passes));
+  }
+}
+
+}  // namespace
+
+const char *GetPipelinePreset(llvm::StringRef name) {
+  for (auto &preset : kPresets) {
+    if (name == preset.name) {
+      return preset.pipeline;
+    }
+  }
+  return nullptr;
+}
+
+bool ParsePipeline(llvm::StringRef text, PipelineDesc &desc,
+                   std::string &error) {
+  desc.clear();
+  if (auto preset = GetPipelinePreset(text.trim())) {
+    text = preset;
+  }
+
+  PipelineParser parser(text, error);
+  if (!parser.Parse(desc)) {
+    return false;
+  }
+
+  z3::context ctx;
+  llvm::StringSet<> names;
+  for (auto &stage : desc) {
+    // The `ast` stage always runs first and generates the AST
+    if (stage.name == "ast" || !names.insert(stage.name).second) {
+      error = "Stage name `" + stage.name + "` is already used";
+      return false;
+    }
+    for (auto &pass : stage.passes) {
+      if (!CheckPass(pass, ctx, error)) {
+        return false;
+      }
+    }
+  }
+  return CheckOrder(desc, error);
+}
+
+bool UsesZ3(const PassDesc &pass) {
+  return pass.name == "z3-simplify" || pass.name == "ncp" ||
+         pass.name == "cbr" || pass.name == "rbr" || pass.name == "cbr-rbr";
+}
+
+void RemoveZ3Passes(PipelineDesc &desc) {
+  for (auto &stage : desc) {
+    auto &passes{stage.passes};
+    passes.erase(std::remove_if(passes.begin(), passes.end(), UsesZ3),
+                 passes.end());
+  }
+  desc.erase(std::remove_if(
+                 desc.begin(), desc.end(),
+                 [](const StageDesc &stage) { return stage.passes.empty(); }),
+             desc.end());
+}
+
+llvm::ModulePass *CreatePipelinePass(const PassDesc &desc,
+                                     clang::ASTContext &ctx,
+                                     rellic::IRToASTVisitor &gen,
+                                     rellic::Z3Solver &solver) {
+  if (desc.name == "z3-simplify") {
+    auto pass{new rellic::Z3CondSimplify(ctx, gen, solver)};
+    if (desc.args.size() == 1 && desc.args.front() == "auto") {
+      pass->SetAdaptiveSimplifier();
+      return pass;
+    }
+    auto &z3_ctx{pass->GetZ3Context()};
+    z3::tactic tactic(z3_ctx, desc.args.front().c_str());
+    for (auto &name : llvm::drop_begin(desc.args)) {
+      tactic = tactic & z3::tactic(z3_ctx, name.c_str());
+    }
+    pass->SetZ3Simplifier(tactic, llvm::join(desc.args, ","));
+    return pass;
+  } else if (desc.name == "ncp") {
+    return rellic::createNestedCondPropPass(ctx, gen, solver);
+  } else if (desc.name == "nsc") {
+    return rellic::createNestedScopeCombinerPass(ctx, gen);
+  } else if (desc.name == "cbr") {
+    return rellic::createCondBasedRefinePass(ctx, gen, solver);
+  } else if (desc.name == "rbr") {
+    return rellic::createReachBasedRefinePass(ctx, gen, solver);
+  } else if (desc.name == "cbr-rbr") {
+    return rellic::createCondReachRefinePass(ctx, gen, solver);
+  } else if (desc.name == "native-refine") {
+    return rellic::createNativeCondRefinePass(ctx, gen);
+  } else if (desc.name == "dse") {
+    return rellic::createDeadStmtElimPass(ctx, gen);
+  } else if (desc.name == "loop") {
+    // Refine loops and combine the scopes they leave behind in one pass
+    auto pass{new rellic::FusedRewrite(ctx, gen)};
+    pass->AddRules(rellic::CreateLoopRefineRules());
+    pass->AddRewrite(rellic::CombineNestedScopes);
+    return pass;
+  } else if (desc.name == "expr-combine") {
+    auto pass{new rellic::FusedRewrite(ctx, gen)};
+    pass->AddRewrite(rellic::CombineNestedScopes);
+    pass->AddRules(rellic::CreateExprCombineRules());
+    return pass;
+  }
+  LOG(FATAL) << "Unknown pass " << desc.name;
+  return nullptr;
+}
+
+void AddStagePass(StagePasses &passes, llvm::StringRef name, llvm::Pass *pass) {
+  passes.push_back({name.str(), std::make_unique<llvm::legacy::PassManager>()});
+  passes.back().manager->add(pass);
+}
+
+StageRunner::StageRunner(llvm::Module &module, clang::ASTContext &ctx,
+                         IRToASTVisitor &gen, Z3Solver &solver)
+    : module(module), ast_ctx(ctx), gen(gen), solver(solver) {}
+
+bool StageRunner::IsCancelled() const {
+  return cancellation && cancellation->IsCancelled();
+}
+
+bool StageRunner::IsTrivial(llvm::Function &func) {
+  if (!trivial_blocks) {
+    return false;
+  }
+  auto shape{GetCFGShape(func)};
+  return !shape.has_cycles && shape.num_blocks <= trivial_blocks &&
+         shape.region_depth <= trivial_depth;
+}
+
+bool StageRunner::RunOnce(StagePasses &passes, const char *stage,
+                          ChangeTracker *tracker, unsigned round,
+                          bool cancellable) {
+  Stats::SetStage(stage, round);
+  TraceSpan span(stage, "stage");
+  StatsTimer timer;
+  auto changed{false};
+  for (auto &pass : passes) {
+    if (cancellable && IsCancelled()) {
+      break;
+    }
+    if (tracker) {
+      tracker->SetPass(pass.name);
+    }
+    if (listener) {
+      listener->BeforePass(stage, pass.name);
+    }
+    TraceSpan pass_span(pass.name, "pass");
+    auto pass_changed{pass.manager->run(module)};
+    if (listener) {
+      listener->AfterPass(stage, pass.name);
+    }
+    pass.changed |= pass_changed;
+    changed |= pass_changed;
+  }
+  if (Stats::IsEnabled()) {
+    Stats::Get().AddStageRun(stage, round, timer.GetSeconds(), changed);
+  }
+  return changed && !(cancellable && IsCancelled());
+}
+
+void StageRunner::RunStage(const StageDesc &stage, const Definitions &fdefns,
+                           const std::string &shape) {
+  auto profiled{profile && !shape.empty()};
+  StagePasses passes;
+  for (auto &pass : stage.passes) {
+    if (profiled && !profile->ShouldRun(shape, stage.name + '/' + pass.name)) {
+      continue;
+    }
+    AddStagePass(passes, pass.name,
+                 CreatePipelinePass(pass, ast_ctx, gen, solver));
+  }
+
+  auto name{stage.name.c_str()};
+  // Only revisit the functions that the previous round changed
+  ChangeTracker tracker(ast_ctx, fdefns);
+  if (!stage.fixpoint) {
+    RunOnce(passes, name, &tracker);
+  } else {
+    auto rounds{stage.max_rounds ? stage.max_rounds : max_rounds};
+    auto recycler{StmtRecycler::Get(ast_ctx)};
+    for (unsigned round{0}; RunOnce(passes, name, &tracker, round); ++round) {
+      // Reuse the compounds that this round replaced
+      if (recycler) {
+        recycler->Collect();
+      }
+      for (auto &change : tracker.NextRound()) {
+        ReportUnconverged(name, round, change.first, change.second,
+                          /*oscillating=*/true);
+      }
+      if (rounds && round + 1 == rounds) {
+        for (auto &change : tracker.GetDirty()) {
+          ReportUnconverged(name, round, change.first, change.second,
+                            /*oscillating=*/false);
+        }
+        break;
+      }
+    }
+  }
+
+  // Passes that a cancellation stopped tell nothing about the class
+  if (profiled && !IsCancelled()) {
+    for (auto &pass : passes) {
+      profile->Record(shape, stage.name + '/' + pass.name, pass.changed);
+    }
+  }
+}
+
+void StageRunner::Refine(const std::vector<llvm::Function *> &funcs,
+                         const PipelineDesc &pipeline, size_t first,
+                         const StageCallback &done) {
+  // Definitions by the shape class that decides which passes they skip
+  std::map<std::string, Definitions> classes;
+  Definitions trivial;
+  for (auto func : funcs) {
+    auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(func))};
+    auto fdefn{fdecl->getDefinition()};
+    if (!fdefn) {
+      continue;
+    }
+    if (IsTrivial(*func)) {
+      trivial.push_back(fdefn);
+    } else {
+      auto shape{profile ? PassProfile::GetShapeClass(*func) : ""};
+      classes[shape].push_back(fdefn);
+    }
+  }
+
+  // Functions with a small, acyclic and shallow CFG have little to refine,
+  // and only their scopes and expressions are combined
+  if (!trivial.empty()) {
+    StagePasses passes;
+    for (auto name : {"nsc", "expr-combine"}) {
+      AddStagePass(passes, name,
+                   CreatePipelinePass({name, {}}, ast_ctx, gen, solver));
+    }
+    ChangeTracker tracker(ast_ctx, trivial);
+    RunOnce(passes, "trivial", &tracker);
+  }
+
+  for (auto i = first; i < pipeline.size() && !IsCancelled(); ++i) {
+    for (auto &entry : classes) {
+      RunStage(pipeline[i], entry.second, entry.first);
+    }
+    if (done) {
+      done(i);
+    }
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/Cancellation.h"
+#include "rellic/AST/ChangeTracker.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/PassProfile.h"
+#include "rellic/AST/Z3Solver.h"
+
+namespace rellic {
+
+// A refinement pass and its arguments, e.g. the tactics of
+// `z3-simplify(aig,simplify)`
+struct PassDesc {
+  std::string name;
+  std::vector<std::string> args;
+};
+
+// Passes that run after each other. A `fixpoint` stage is repeated until
+// its passes stop changing the AST, or until it ran `max_rounds` times if
+// that is not 0.
+struct StageDesc {
+  std::string name;
+  std::vector<PassDesc> passes;
+  bool fixpoint = false;
+  unsigned max_rounds = 0;
+};
+
+// The refinement stages that run after the AST is generated
+using PipelineDesc = std::vector<StageDesc>;
+
+// Returns the description of the preset called `name`, or `nullptr`.
+// Presets are `fast`, `native`, `default` and `thorough`; `native` runs no
+// Z3 queries.
+const char *GetPipelinePreset(llvm::StringRef name);
+
+// Parses `text`, which is either the name of a preset or a list of stages
+// separated by `;`. A stage is written `name(pass,...)`, followed by `*`
+// for a fixpoint stage or `*N` for one that runs at most N rounds:
+//
+//   cbr*(z3-simplify(aig,simplify),ncp,nsc,cbr,rbr); loop*(loop);
+//   fin(expr-combine)
+//
+// Passes are `z3-simplify(TACTIC,...)`, `ncp`, `nsc`, `cbr`, `rbr`,
+// `cbr-rbr`, `native-refine`, `dse`, `loop` and `expr-combine`. `cbr-rbr`
+// does what `cbr` followed by `rbr` does, but converts every condition
+// only once. `native-refine` approximates `z3-simplify`, `cbr` and `rbr`
+// from the boolean structure of conditions alone.
+// `z3-simplify(auto)` picks the tactics for every condition by its size
+// and theory. Whitespace and `#` comments up to the end of a line are
+// ignored, so that longer pipelines can be kept in files.
+// Returns `false` and describes the problem in `error` if `text` is not
+// a valid pipeline.
+bool ParsePipeline(llvm::StringRef text, PipelineDesc &desc,
+                   std::string &error);
+
+// Returns `true` if `pass` runs Z3 queries
+bool UsesZ3(const PassDesc &pass);
+
+// Removes the passes that run Z3 queries, and the stages left without passes
+void RemoveZ3Passes(PipelineDesc &desc);
+
+// Creates the pass that `desc` describes
+llvm::ModulePass *CreatePipelinePass(const PassDesc &desc,
+                                     clang::ASTContext &ctx,
+                                     rellic::IRToASTVisitor &gen,
+                                     rellic::Z3Solver &solver);
+
+// A pass of a pipeline stage. Every pass has its own manager, so that the
+// changes of a fixpoint round can be attributed to the pass that made them.
+struct StagePass {
+  std::string name;
+  std::unique_ptr<llvm::legacy::PassManager> manager;
+  // Whether any run of the pass changed the AST
+  bool changed = false;
+};
+
+using StagePasses = std::vector<StagePass>;
+
+// Adds `pass`, which `passes` take ownership of, under `name`
+void AddStagePass(StagePasses &passes, llvm::StringRef name, llvm::Pass *pass);
+
+// Observes the pass runs of a `StageRunner`, e.g. to measure them
+class StageListener {
+ public:
+  virtual ~StageListener() = default;
+  virtual void BeforePass(llvm::StringRef stage, llvm::StringRef pass) {}
+  virtual void AfterPass(llvm::StringRef stage, llvm::StringRef pass) {}
+};
+
+// Runs the stages of a pipeline on function definitions of `module`.
+// Stages only visit the definitions they refine, and fixpoint rounds only
+// revisit the definitions that the previous round changed. Definitions
+// that oscillate between bodies are not refined any further, and those
+// that don't converge within the round limit are reported.
+class StageRunner {
+ public:
+  using Definitions = std::vector<clang::FunctionDecl *>;
+  // Called once stage `i` of a pipeline ran
+  using StageCallback = std::function<void(size_t i)>;
+
+ private:
+  llvm::Module &module;
+  clang::ASTContext &ast_ctx;
+  IRToASTVisitor &gen;
+  Z3Solver &solver;
+  unsigned max_rounds{0};
+  unsigned trivial_blocks{0};
+  unsigned trivial_depth{0};
+  CancellationToken *cancellation{nullptr};
+  PassProfile *profile{nullptr};
+  StageListener *listener{nullptr};
+
+  bool IsTrivial(llvm::Function &func);
+
+ public:
+  StageRunner(llvm::Module &module, clang::ASTContext &ctx,
+              IRToASTVisitor &gen, Z3Solver &solver);
+
+  // Fixpoint stages without a round limit of their own run at most
+  // `rounds` times, or until they converge if that is 0
+  void SetMaxRounds(unsigned rounds) { max_rounds = rounds; }
+  // Functions without cycles, with at most `blocks` blocks and regions
+  // nested at most `depth` deep, only get their scopes and expressions
+  // combined. 0 blocks turns this off.
+  void SetTrivialLimits(unsigned blocks, unsigned depth) {
+    trivial_blocks = blocks;
+    trivial_depth = depth;
+  }
+  // Stops stages between passes once `token` is cancelled. `token` may
+  // be `nullptr`.
+  void SetCancellation(CancellationToken *token) { cancellation = token; }
+  // Skips the passes that `profile` shows never change functions of a CFG
+  // shape class, and records what the others do. `profile` may be
+  // `nullptr`.
+  void SetPassProfile(PassProfile *new_profile) { profile = new_profile; }
+  // `listener` may be `nullptr`
+  void SetListener(StageListener *new_listener) { listener = new_listener; }
+
+  bool IsCancelled() const;
+
+  // Runs `passes` once as round `round` of `stage`, on the definitions
+  // that `tracker` marks dirty if it isn't `nullptr`, and records the time
+  // taken. Unless the stage isn't `cancellable`, it stops between passes
+  // once cancelled, and reports no change so that no other round starts.
+  bool RunOnce(StagePasses &passes, const char *stage, ChangeTracker *tracker,
+               unsigned round = 0, bool cancellable = true);
+
+  // Runs `stage` on `fdefns`, until it converges if it is a fixpoint
+  // stage. With a profile, `shape` is the CFG shape class of `fdefns`.
+  void RunStage(const StageDesc &stage, const Definitions &fdefns,
+                const std::string &shape = "");
+
+  // Refines the definitions of `funcs` with the stages of `pipeline` from
+  // stage `first` on, and calls `done` after every stage. Trivial
+  // functions only get the `trivial` stage. With a profile, functions of
+  // the same shape class run through the pipeline together. Stops once
+  // cancelled.
+  void Refine(const std::vector<llvm::Function *> &funcs,
+              const PipelineDesc &pipeline, size_t first = 0,
+              const StageCallback &done = nullptr);
+};
+
+}  // namespace rellic
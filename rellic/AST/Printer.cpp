@@ -0,0 +1,618 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Printer.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+
+#include "rellic/AST/LazyInit.h"
+
+namespace rellic {
+
+namespace {
+
+// Lazy initializers are flushed every so many elements
+static constexpr unsigned kInitChunkElements{4096};
+
+// Suffix of integer literals of type `type`, or `nullptr` for types whose
+// literals are left to clang
+static const char *GetIntegerSuffix(clang::QualType type) {
+  auto builtin{type->getAs<clang::BuiltinType>()};
+  switch (builtin ? builtin->getKind() : clang::BuiltinType::Void) {
+    case clang::BuiltinType::Int:
+      return "";
+    case clang::BuiltinType::UInt:
+      return "U";
+    case clang::BuiltinType::Long:
+      return "L";
+    case clang::BuiltinType::ULong:
+      return "UL";
+    case clang::BuiltinType::LongLong:
+      return "LL";
+    case clang::BuiltinType::ULongLong:
+      return "ULL";
+    default:
+      return nullptr;
+  }
+}
+
+// Whether elements of constant data of C type `type` can be printed
+// without lowering them first
+static bool IsPrintableData(clang::QualType type) {
+  auto builtin{type->getAs<clang::BuiltinType>()};
+  switch (builtin ? builtin->getKind() : clang::BuiltinType::Void) {
+    case clang::BuiltinType::Short:
+    case clang::BuiltinType::UShort:
+    case clang::BuiltinType::Float:
+    case clang::BuiltinType::Double:
+      return true;
+    default:
+      return GetIntegerSuffix(type) != nullptr;
+  }
+}
+
+// Mirrors `clang::StmtPrinter` for the node kinds that rellic generates,
+// and hands all other nodes to it. `level` counts units of two spaces,
+// and every nested statement adds `policy.Indentation` of them.
+class Printer {
+ private:
+  llvm::raw_ostream &os;
+  const clang::PrintingPolicy &policy;
+  unsigned level = 0;
+
+  void Indent() { os.indent(2 * level); }
+
+  void PrintStmt(clang::Stmt *stmt) {
+    level += policy.Indentation;
+    if (!stmt) {
+      Indent();
+      os << "<<<NULL STATEMENT>>>\n";
+    } else if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+      Indent();
+      PrintExpr(expr);
+      os << ";\n";
+    } else {
+      Visit(stmt);
+    }
+    level -= policy.Indentation;
+  }
+
+  void PrintCompound(clang::CompoundStmt *compound) {
+    os << "{\n";
+    for (auto stmt : compound->body()) {
+      PrintStmt(stmt);
+    }
+    Indent();
+    os << '}';
+  }
+
+  void PrintVarDecl(clang::VarDecl *var) {
+    auto tinfo{var->getTypeSourceInfo()};
+    auto type{tinfo ? tinfo->getType() : var->getType()};
+    type.print(os, policy, var->getName(), level);
+    if (auto init = var->getInit()) {
+      os << " = ";
+      PrintExpr(init);
+    }
+  }
+
+  void PrintDeclStmt(clang::DeclStmt *stmt) {
+    if (stmt->isSingleDecl()) {
+      auto var{clang::dyn_cast<clang::VarDecl>(stmt->getSingleDecl())};
+      if (var && var->getStorageClass() == clang::SC_None &&
+          var->getTSCSpec() == clang::TSCS_unspecified && !var->hasAttrs() &&
+          !var->isModulePrivate() &&
+          (!var->getInit() || var->getInitStyle() == clang::VarDecl::CInit)) {
+        PrintVarDecl(var);
+        return;
+      }
+    }
+    llvm::SmallVector<clang::Decl *, 2> decls(stmt->decl_begin(),
+                                              stmt->decl_end());
+    clang::Decl::printGroup(decls.data(), decls.size(), os, policy, level);
+  }
+
+  void PrintIf(clang::IfStmt *stmt) {
+    os << "if (";
+    PrintExpr(stmt->getCond());
+    os << ')';
+
+    auto else_stmt{stmt->getElse()};
+    if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt->getThen())) {
+      os << ' ';
+      PrintCompound(compound);
+      os << (else_stmt ? " " : "\n");
+    } else {
+      os << '\n';
+      PrintStmt(stmt->getThen());
+      if (else_stmt) {
+        Indent();
+      }
+    }
+
+    if (else_stmt) {
+      os << "else";
+      if (auto compound = clang::dyn_cast<clang::CompoundStmt>(else_stmt)) {
+        os << ' ';
+        PrintCompound(compound);
+        os << '\n';
+      } else if (auto elif = clang::dyn_cast<clang::IfStmt>(else_stmt)) {
+        os << ' ';
+        PrintIf(elif);
+      } else {
+        os << '\n';
+        PrintStmt(else_stmt);
+      }
+    }
+  }
+
+  // Whether `stmt` and the `else if` chain after it use none of the C++
+  // parts of `if` statements
+  static bool IsSimple(clang::IfStmt *stmt) {
+    for (; stmt;
+         stmt = clang::dyn_cast_or_null<clang::IfStmt>(stmt->getElse())) {
+      if (stmt->getInit() || stmt->getConditionVariableDeclStmt() ||
+          stmt->isConstexpr()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Visit(clang::Stmt *stmt) {
+    switch (stmt->getStmtClass()) {
+      case clang::Stmt::CompoundStmtClass:
+        Indent();
+        PrintCompound(clang::cast<clang::CompoundStmt>(stmt));
+        os << '\n';
+        return;
+      case clang::Stmt::NullStmtClass:
+        Indent();
+        os << ";\n";
+        return;
+      case clang::Stmt::DeclStmtClass:
+        Indent();
+        PrintDeclStmt(clang::cast<clang::DeclStmt>(stmt));
+        os << ";\n";
+        return;
+      case clang::Stmt::IfStmtClass: {
+        auto if_stmt{clang::cast<clang::IfStmt>(stmt)};
+        if (!IsSimple(if_stmt)) {
+          break;
+        }
+        Indent();
+        PrintIf(if_stmt);
+        return;
+      }
+      case clang::Stmt::WhileStmtClass: {
+        auto loop{clang::cast<clang::WhileStmt>(stmt)};
+        if (loop->getConditionVariableDeclStmt()) {
+          break;
+        }
+        Indent();
+        os << "while (";
+        PrintExpr(loop->getCond());
+        os << ")\n";
+        PrintStmt(loop->getBody());
+        return;
+      }
+      case clang::Stmt::DoStmtClass: {
+        auto loop{clang::cast<clang::DoStmt>(stmt)};
+        Indent();
+        os << "do ";
+        if (auto body = clang::dyn_cast<clang::CompoundStmt>(loop->getBody())) {
+          PrintCompound(body);
+          os << ' ';
+        } else {
+          os << '\n';
+          PrintStmt(loop->getBody());
+          Indent();
+        }
+        os << "while (";
+        PrintExpr(loop->getCond());
+        os << ");\n";
+        return;
+      }
+      case clang::Stmt::LabelStmtClass: {
+        // Labels stick out by one level, like in `clang::StmtPrinter`
+        auto label{clang::cast<clang::LabelStmt>(stmt)};
+        os.indent(level ? 2 * (level - 1) : 0);
+        os << label->getName() << ":\n";
+        level -= policy.Indentation;
+        PrintStmt(label->getSubStmt());
+        level += policy.Indentation;
+        return;
+      }
+      case clang::Stmt::GotoStmtClass: {
+        auto label{clang::cast<clang::GotoStmt>(stmt)->getLabel()};
+        Indent();
+        os << "goto " << label->getName() << ";\n";
+        return;
+      }
+      case clang::Stmt::BreakStmtClass:
+        Indent();
+        os << "break;\n";
+        return;
+      case clang::Stmt::ContinueStmtClass:
+        Indent();
+        os << "continue;\n";
+        return;
+      case clang::Stmt::ReturnStmtClass: {
+        Indent();
+        os << "return";
+        if (auto value = clang::cast<clang::ReturnStmt>(stmt)->getRetValue()) {
+          os << ' ';
+          PrintExpr(value);
+        }
+        os << ";\n";
+        return;
+      }
+      default:
+        break;
+    }
+    stmt->printPretty(os, nullptr, policy, level);
+  }
+
+  void PrintIntegerValue(const llvm::APInt &value, bool sign,
+                         const char *suffix) {
+    if (sign) {
+      os << value.getSExtValue();
+    } else {
+      os << value.getZExtValue();
+    }
+    os << suffix;
+  }
+
+  void PrintIntegerLiteral(clang::IntegerLiteral *lit) {
+    auto suffix{GetIntegerSuffix(lit->getType())};
+    auto value{lit->getValue()};
+    if (!suffix || value.getBitWidth() > 64) {
+      lit->printPretty(os, nullptr, policy, level);
+      return;
+    }
+    PrintIntegerValue(value, lit->getType()->isSignedIntegerType(), suffix);
+  }
+
+  void PrintExpr(clang::Expr *expr) {
+    if (!expr) {
+      os << "<null expr>";
+      return;
+    }
+    switch (expr->getStmtClass()) {
+      case clang::Stmt::DeclRefExprClass: {
+        auto ref{clang::cast<clang::DeclRefExpr>(expr)};
+        auto id{ref->getNameInfo().getName().getAsIdentifierInfo()};
+        if (!id || ref->hasQualifier() || ref->hasExplicitTemplateArgs()) {
+          break;
+        }
+        os << id->getName();
+        return;
+      }
+      case clang::Stmt::IntegerLiteralClass:
+        PrintIntegerLiteral(clang::cast<clang::IntegerLiteral>(expr));
+        return;
+      case clang::Stmt::ParenExprClass:
+        os << '(';
+        PrintExpr(clang::cast<clang::ParenExpr>(expr)->getSubExpr());
+        os << ')';
+        return;
+      case clang::Stmt::UnaryOperatorClass: {
+        auto unop{clang::cast<clang::UnaryOperator>(expr)};
+        auto opc{unop->getOpcode()};
+        if (!unop->isPostfix()) {
+          os << clang::UnaryOperator::getOpcodeStr(opc);
+          switch (opc) {
+            case clang::UO_Real:
+            case clang::UO_Imag:
+            case clang::UO_Extension:
+              os << ' ';
+              break;
+            case clang::UO_Plus:
+            case clang::UO_Minus:
+              // Keeps `- -x` from turning into `--x`
+              if (clang::isa<clang::UnaryOperator>(unop->getSubExpr())) {
+                os << ' ';
+              }
+              break;
+            default:
+              break;
+          }
+        }
+        PrintExpr(unop->getSubExpr());
+        if (unop->isPostfix()) {
+          os << clang::UnaryOperator::getOpcodeStr(opc);
+        }
+        return;
+      }
+      case clang::Stmt::BinaryOperatorClass:
+      case clang::Stmt::CompoundAssignOperatorClass: {
+        auto binop{clang::cast<clang::BinaryOperator>(expr)};
+        PrintExpr(binop->getLHS());
+        os << ' ' << clang::BinaryOperator::getOpcodeStr(binop->getOpcode())
+           << ' ';
+        PrintExpr(binop->getRHS());
+        return;
+      }
+      case clang::Stmt::ImplicitCastExprClass:
+        PrintExpr(clang::cast<clang::ImplicitCastExpr>(expr)->getSubExpr());
+        return;
+      case clang::Stmt::CStyleCastExprClass: {
+        auto cast{clang::cast<clang::CStyleCastExpr>(expr)};
+        os << '(';
+        cast->getTypeAsWritten().print(os, policy);
+        os << ')';
+        PrintExpr(cast->getSubExpr());
+        return;
+      }
+      case clang::Stmt::CallExprClass: {
+        auto call{clang::cast<clang::CallExpr>(expr)};
+        PrintExpr(call->getCallee());
+        os << '(';
+        for (auto i = 0U; i < call->getNumArgs(); ++i) {
+          if (i) {
+            os << ", ";
+          }
+          PrintExpr(call->getArg(i));
+        }
+        os << ')';
+        return;
+      }
+      case clang::Stmt::MemberExprClass: {
+        auto member{clang::cast<clang::MemberExpr>(expr)};
+        auto field{clang::dyn_cast<clang::FieldDecl>(member->getMemberDecl())};
+        auto id{member->getMemberNameInfo().getName().getAsIdentifierInfo()};
+        auto base{clang::dyn_cast<clang::MemberExpr>(member->getBase())};
+        auto base_field{
+            base ? clang::dyn_cast<clang::FieldDecl>(base->getMemberDecl())
+                 : nullptr};
+        // Members of anonymous structs and unions print differently
+        if (!field || !id || field->isAnonymousStructOrUnion() ||
+            (base_field && base_field->isAnonymousStructOrUnion()) ||
+            member->hasQualifier() || member->hasExplicitTemplateArgs()) {
+          break;
+        }
+        PrintExpr(member->getBase());
+        os << (member->isArrow() ? "->" : ".") << id->getName();
+        return;
+      }
+      case clang::Stmt::ArraySubscriptExprClass: {
+        auto sub{clang::cast<clang::ArraySubscriptExpr>(expr)};
+        PrintExpr(sub->getLHS());
+        os << '[';
+        PrintExpr(sub->getRHS());
+        os << ']';
+        return;
+      }
+      case clang::Stmt::ConditionalOperatorClass: {
+        auto cond{clang::cast<clang::ConditionalOperator>(expr)};
+        PrintExpr(cond->getCond());
+        os << " ? ";
+        PrintExpr(cond->getLHS());
+        os << " : ";
+        PrintExpr(cond->getRHS());
+        return;
+      }
+      case clang::Stmt::InitListExprClass: {
+        auto list{clang::cast<clang::InitListExpr>(expr)};
+        if (auto syntactic = list->getSyntacticForm()) {
+          PrintExpr(syntactic);
+          return;
+        }
+        os << '{';
+        for (auto i = 0U; i < list->getNumInits(); ++i) {
+          if (i) {
+            os << ", ";
+          }
+          if (auto init = list->getInit(i)) {
+            PrintExpr(init);
+          } else {
+            os << "{}";
+          }
+        }
+        os << '}';
+        return;
+      }
+      default:
+        break;
+    }
+    expr->printPretty(os, nullptr, policy, level);
+  }
+
+ public:
+  Printer(llvm::raw_ostream &os, const clang::PrintingPolicy &policy)
+      : os(os), policy(policy) {}
+
+  void PrintBody(clang::Stmt *body) { Visit(body); }
+
+  // Prints element `idx` of `data` as the literal of type `type` that
+  // `IRToASTVisitor` lowers it to would be printed
+  void PrintDataElement(const llvm::ConstantDataSequential *data,
+                        unsigned idx, clang::QualType type) {
+    auto kind{type->castAs<clang::BuiltinType>()->getKind()};
+    if (type->isRealFloatingType()) {
+      llvm::SmallString<16> str;
+      data->getElementAsAPFloat(idx).toString(str);
+      os << str;
+      // Keeps whole numbers apart from integers, like clang
+      if (str.find_first_not_of("-0123456789") == llvm::StringRef::npos) {
+        os << '.';
+      }
+      if (kind == clang::BuiltinType::Float) {
+        os << 'F';
+      }
+      return;
+    }
+    auto value{data->getElementAsAPInt(idx)};
+    switch (kind) {
+      // Casts of `int` and `unsigned int` literals
+      case clang::BuiltinType::Short:
+      case clang::BuiltinType::UShort: {
+        auto sign{kind == clang::BuiltinType::Short};
+        os << '(';
+        type.print(os, policy);
+        os << ')';
+        PrintIntegerValue(value, sign, sign ? "" : "U");
+      } break;
+      // Negated literals of the absolute value
+      default:
+        if (value.isNegative()) {
+          os << '-';
+        }
+        PrintIntegerValue(value.abs(), type->isSignedIntegerType(),
+                          GetIntegerSuffix(type));
+        break;
+    }
+  }
+
+  // Prints ` = {...}` like the initializer list that `var` would have
+  void PrintLazyInit(LazyInitializers &inits, clang::VarDecl *var) {
+    os << " = {";
+    auto num_elements{inits.GetNumElements(var)};
+    auto data{inits.GetData(var)};
+    auto type{var->getType()->getAsArrayTypeUnsafe()->getElementType()};
+    if (!IsPrintableData(type)) {
+      data = nullptr;
+    }
+    for (auto i = 0U; i < num_elements; ++i) {
+      if (i) {
+        os << ", ";
+      }
+      if (data) {
+        PrintDataElement(data, i, type);
+      } else {
+        PrintExpr(inits.LowerElement(var, i));
+      }
+      if ((i + 1) % kInitChunkElements == 0) {
+        os.flush();
+      }
+    }
+    os << '}';
+  }
+};
+
+// Type whose specifiers clang prints for a declaration of type `type`
+static clang::QualType GetBaseType(clang::QualType type) {
+  while (!type.isNull() && !type->isSpecifierType()) {
+    if (auto ptr = type->getAs<clang::PointerType>()) {
+      type = ptr->getPointeeType();
+    } else if (auto arr = type->getAsArrayTypeUnsafe()) {
+      type = arr->getElementType();
+    } else if (auto func = type->getAs<clang::FunctionType>()) {
+      type = func->getReturnType();
+    } else if (auto vec = type->getAs<clang::VectorType>()) {
+      type = vec->getElementType();
+    } else if (auto paren = type->getAs<clang::ParenType>()) {
+      type = paren->desugar();
+    } else {
+      break;
+    }
+  }
+  return type;
+}
+
+// Whether clang prints `decl` in one group with the tag `tag` right before
+// it, as in `struct { int x; } var;`
+static bool IsGroupedWith(clang::Decl *decl, clang::TagDecl *tag) {
+  clang::QualType type;
+  if (auto tdef = clang::dyn_cast<clang::TypedefNameDecl>(decl)) {
+    type = tdef->getUnderlyingType();
+  } else if (auto value = clang::dyn_cast<clang::ValueDecl>(decl)) {
+    type = value->getType();
+  }
+  type = GetBaseType(type);
+  if (type.isNull()) {
+    return false;
+  }
+  auto elab{clang::dyn_cast<clang::ElaboratedType>(type.getTypePtr())};
+  return elab && elab->getOwnedTagDecl() == tag;
+}
+
+}  // namespace
+
+void PrintDecl(clang::Decl *decl, llvm::raw_ostream &os) {
+  auto &ast_ctx{decl->getASTContext()};
+  auto policy{ast_ctx.getPrintingPolicy()};
+  auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+  auto inits{LazyInitializers::Find(ast_ctx)};
+  if (var && inits && inits->IsLazy(var)) {
+    decl->print(os, policy);
+    Printer(os, policy).PrintLazyInit(*inits, var);
+    return;
+  }
+  auto func{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  // K&R definitions print their parameters between prototype and body
+  if (!func || !func->doesThisDeclarationHaveABody() ||
+      !func->getBody() || !clang::isa<clang::CompoundStmt>(func->getBody()) ||
+      (!func->hasPrototype() && func->getNumParams()) || func->isPure() ||
+      func->isDeletedAsWritten() || func->isExplicitlyDefaulted()) {
+    decl->print(os, policy);
+    return;
+  }
+  // Terse output is the prototype and attributes without the body
+  auto terse{policy};
+  terse.TerseOutput = true;
+  decl->print(os, terse);
+  os << ' ';
+  policy.SuppressSpecifiers = false;
+  Printer(os, policy).PrintBody(func->getBody());
+}
+
+void PrintTranslationUnit(clang::TranslationUnitDecl *tudecl,
+                          llvm::raw_ostream &os) {
+  // Groups of tags and declarations are rare, leave them to clang
+  clang::TagDecl *tag{nullptr};
+  for (auto decl : tudecl->decls()) {
+    if (decl->isImplicit()) {
+      continue;
+    }
+    if (tag && IsGroupedWith(decl, tag)) {
+      // Which can't print lazy initializers
+      if (auto inits = LazyInitializers::Find(tudecl->getASTContext())) {
+        inits->MaterializeAll();
+      }
+      tudecl->print(os);
+      return;
+    }
+    auto tdecl{clang::dyn_cast<clang::TagDecl>(decl)};
+    tag = tdecl && !tdecl->isFreeStanding() ? tdecl : nullptr;
+  }
+
+  for (auto decl : tudecl->decls()) {
+    PrintTopLevelDecl(decl, os);
+  }
+}
+
+void PrintTopLevelDecl(clang::Decl *decl, llvm::raw_ostream &os) {
+  if (decl->isImplicit()) {
+    return;
+  }
+  PrintDecl(decl, os);
+  auto func{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  if (!func || !func->isThisDeclarationADefinition()) {
+    os << ';';
+  }
+  // Bodies end with a newline already
+  if (!func || !func->doesThisDeclarationHaveABody()) {
+    os << '\n';
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace rellic {
+
+// Printers that produce the same text as `clang::Decl::print`, with the
+// printing policy of the declaration's context. The bodies of function
+// definitions are printed directly for the statements and expressions
+// that rellic generates, instead of through clang's general-purpose
+// printers, and so are the lazy initializers of `LazyInitializers`, which
+// are flushed in chunks and whose integers and floats are written from
+// the constant data itself. Everything else is still printed by clang.
+
+void PrintDecl(clang::Decl *decl, llvm::raw_ostream &os);
+
+void PrintTranslationUnit(clang::TranslationUnitDecl *tudecl,
+                          llvm::raw_ostream &os);
+// Prints `decl` like `PrintTranslationUnit` prints each of its
+// declarations, or nothing if `decl` is implicit
+void PrintTopLevelDecl(clang::Decl *decl, llvm::raw_ostream &os);
+
+}  // namespace rellic
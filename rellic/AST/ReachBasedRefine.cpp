@@ -17,69 +17,128 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "rellic/AST/CompoundEditor.h"
 #include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/Z3Prefilter.h"
 
 namespace rellic {
 
-namespace {
-
-using IfStmtVec = std::vector<clang::IfStmt *>;
-
-static IfStmtVec GetIfStmts(clang::CompoundStmt *compound) {
-  IfStmtVec result;
-  for (auto stmt : compound->body()) {
-    if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
-      result.push_back(ifstmt);
-    }
-  }
-  return result;
-}
-
-}  // namespace
-
 char ReachBasedRefine::ID = 0;
 
 ReachBasedRefine::ReachBasedRefine(clang::ASTContext &ctx,
-                                   rellic::IRToASTVisitor &ast_gen)
+                                   rellic::IRToASTVisitor &ast_gen,
+                                   rellic::Z3Solver &solver)
     : ModulePass(ReachBasedRefine::ID),
       ast_ctx(&ctx),
       ast_gen(&ast_gen),
-      z3_ctx(new z3::context()),
-      z3_gen(new rellic::Z3ConvVisitor(ast_ctx, z3_ctx.get())),
-      z3_solver(*z3_ctx, "sat") {}
-
-bool ReachBasedRefine::Prove(z3::expr expr) {
-  z3::goal goal(*z3_ctx);
-  goal.add((!expr).simplify());
-  auto app = z3_solver(goal);
-  CHECK(app.size() == 1) << "Unexpected multiple goals in application!";
-  return app[0].is_decided_unsat();
-}
-
-z3::expr ReachBasedRefine::GetZ3Cond(clang::IfStmt *ifstmt) {
-  auto cond = ifstmt->getCond();
-  auto expr = z3_gen->Z3BoolCast(z3_gen->GetOrCreateZ3Expr(cond));
-  return expr.simplify();
-}
-
-void ReachBasedRefine::CreateIfElseStmts(IfStmtVec stmts) {
-  // Else-if candidate IfStmts and their Z3 form
-  // reaching conditions.
-  IfStmtVec elifs;
-  z3::expr_vector conds(*z3_ctx);
+      solver(&solver),
+      z3_ctx(&solver.GetZ3Context()),
+      z3_gen(&solver.GetZ3ConvVisitor()) {}
+
+void CreateIfElseStmts(clang::ASTContext &ctx, Z3Solver &solver, IfConds &ifs,
+                       const SubstituteFn &Substitute) {
+  auto z3_ctx{&solver.GetZ3Context()};
+  auto &stmts{ifs.stmts};
+  auto &conds{ifs.conds};
+  // A round of simulation in which two conditions hold shows that their
+  // conjunction is satisfiable, and a round in which all of them fail
+  // shows that their disjunction isn't a tautology
+  auto &sigs{ifs.sigs};
+  auto &known{ifs.known};
+  // Boolean structure of the conditions. Conjunctions that are constant
+  // false are unsatisfiable and disjunctions that are constant true are
+  // tautologies, whatever their atoms mean.
+  auto &engine{solver.GetCondEngine()};
+  auto &bdd{engine.GetBDD()};
+  std::vector<BDD::Node> nodes(conds.size());
+  auto use_bdd{true};
+  for (auto i = 0U; i < conds.size() && use_bdd; ++i) {
+    bool pure;
+    use_bdd = engine.GetOrCreate(conds[i], nodes[i], pure);
+  }
+  auto CheckBDD = [&] {
+    if (use_bdd && bdd.HasOverflowed()) {
+      use_bdd = false;
+      engine.Clear();
+    }
+    return use_bdd;
+  };
+  // Rounds in which some condition of `elifs` holds, and whether every
+  // condition of `elifs` had a known value in all rounds
+  uint64_t disj_sig = 0;
+  bool disj_known = true;
+  auto disj_bdd{BDD::kFalse};
+  // Else-if candidate IfStmts
+  std::vector<clang::IfStmt *> elifs;
+  // Incremental solver that holds the disjunction of the reaching
+  // conditions of `elifs`. Every new candidate only adds a definition
+  // `disj_n == disj_n-1 || cond`, so the checks below don't grow
+  // with the length of the cascade.
+  z3::solver incr(*z3_ctx);
+  auto disj = z3_ctx->bool_val(false);
+  unsigned num_disjs = 0;
+  auto AddCond = [&](unsigned i) {
+    auto name = "disj_" + std::to_string(num_disjs++);
+    auto next = z3_ctx->bool_const(name.c_str());
+    incr.add(next == (disj || conds[i]));
+    disj = next;
+    disj_sig |= sigs[i];
+    disj_known = disj_known && known[i];
+    if (use_bdd) {
+      disj_bdd = bdd.Or(disj_bdd, nodes[i]);
+    }
+  };
+  auto ClearConds = [&] {
+    incr.reset();
+    disj = z3_ctx->bool_val(false);
+    num_disjs = 0;
+    disj_sig = 0;
+    disj_known = true;
+    disj_bdd = BDD::kFalse;
+  };
+  auto Prefiltered = [] {
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddZ3Prefiltered("incremental");
+    }
+  };
+  // Checks whether `expr` is unsatisfiable in the current context.
+  // Checks that run out of resources count as satisfiable, so that
+  // cascades are only formed from proven conditions.
+  auto IsUnsat = [&solver, &incr](z3::expr expr) {
+    return solver.Check(incr, expr) == z3::unsat;
+  };
   // Test that determines if a new IfStmts is not
   // reachable from the already gathered IfStmts.
-  auto IsUnrechable = [this, &conds](z3::expr cond) {
-    return Prove(!(cond && z3::mk_or(conds)));
+  auto IsUnrechable = [&](unsigned i) {
+    if (sigs[i] & disj_sig) {
+      Prefiltered();
+      return false;
+    }
+    if (use_bdd && bdd.And(nodes[i], disj_bdd) == BDD::kFalse && CheckBDD()) {
+      Prefiltered();
+      return true;
+    }
+    return IsUnsat(conds[i] && disj);
   };
   // Test to determine if we have enough candidate
   // IfStmts to form an else-if cascade.
-  auto IsTautology = [this, &conds] {
-    return Prove(z3::mk_or(conds) == z3_ctx->bool_val(true));
+  auto IsTautology = [&] {
+    if (disj_known && ~disj_sig) {
+      Prefiltered();
+      return false;
+    }
+    if (CheckBDD() && disj_bdd == BDD::kTrue) {
+      Prefiltered();
+      return true;
+    }
+    return IsUnsat(!disj);
   };
 
   // Gather else-if candidates
-  for (auto stmt : llvm::make_range(stmts.rbegin(), stmts.rend())) {
+  for (auto i = stmts.size(); i-- > 0;) {
+    auto stmt = stmts[i];
+    solver.SetStatement(stmt);
     // Quit if we gathered enough IfStmts for a cascade.
     // This is recognized when the conjuction of reaching
     // conditions of all the IfStmts form a tautology.
@@ -87,13 +146,12 @@ void ReachBasedRefine::CreateIfElseStmts(IfStmtVec stmts) {
       break;
     }
     // Clear else-if IfStmts if we find a path among them.
-    auto cond = GetZ3Cond(stmt);
-    if (stmt->getElse() || !IsUnrechable(cond)) {
-      conds = z3::expr_vector(*z3_ctx);
+    if (stmt->getElse() || !IsUnrechable(i)) {
+      ClearConds();
       elifs.clear();
     }
     // Add the current if-statement to the else-if candidates.
-    conds.push_back(cond);
+    AddCond(i);
     elifs.push_back(stmt);
   }
 
@@ -108,17 +166,17 @@ void ReachBasedRefine::CreateIfElseStmts(IfStmtVec stmts) {
     auto cond = stmt->getCond();
     auto then = stmt->getThen();
     if (stmt == elifs.back()) {
-      sub = CreateIfStmt(*ast_ctx, cond, then);
-      substitutions[stmt] = sub;
+      sub = CreateIfStmt(ctx, cond, then);
+      Substitute(stmt, sub);
     } else if (stmt == elifs.front()) {
       std::vector<clang::Stmt *> thens({then});
-      sub->setElse(CreateCompoundStmt(*ast_ctx, thens));
-      substitutions[stmt] = nullptr;
+      sub->setElse(CreateCompoundStmt(ctx, thens));
+      Substitute(stmt, nullptr);
     } else {
-      auto elif = CreateIfStmt(*ast_ctx, cond, then);
+      auto elif = CreateIfStmt(ctx, cond, then);
       sub->setElse(elif);
       sub = elif;
-      substitutions[stmt] = nullptr;
+      Substitute(stmt, nullptr);
     }
   }
 }
@@ -126,31 +184,44 @@ void ReachBasedRefine::CreateIfElseStmts(IfStmtVec stmts) {
 bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
   // DLOG(INFO) << "VisitCompoundStmt";
   // Create else-if cascade substitutions for IfStmts in `compound`
-  CreateIfElseStmts(GetIfStmts(compound));
-  // Apply created else-if substitutions and
-  // create a replacement for `compound`
-  if (ReplaceChildren(compound, substitutions)) {
-    std::vector<clang::Stmt *> new_body;
-    for (auto stmt : compound->body()) {
-      if (stmt) {
-        new_body.push_back(stmt);
-      }
+  IfConds ifs(*z3_ctx);
+  GetIfConds(compound, *z3_gen, ifs);
+  CreateIfElseStmts(
+      *ast_ctx, *solver, ifs,
+      [this](clang::Stmt *stmt, clang::Stmt *sub) { Substitute(stmt, sub); });
+  // Apply created else-if substitutions in place. `compound` is
+  // only replaced if statements were removed from it.
+  CompoundEditor editor(*ast_ctx, compound);
+  if (editor.Substitute(substitutions)) {
+    auto sub{editor.Commit()};
+    if (sub != compound) {
+      Substitute(compound, sub);
     }
-    substitutions[compound] = CreateCompoundStmt(*ast_ctx, new_body);
+    changed = true;
   }
   return true;
 }
 
+bool ReachBasedRefine::TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+  // Charge Z3 queries to the budget of `fdecl`
+  solver->SetFunction(fdecl);
+  return TransformVisitor<ReachBasedRefine>::TraverseFunctionDecl(fdecl);
+}
+
 bool ReachBasedRefine::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Reachability-based refinement";
+  PassStats stats("ReachBasedRefine", *ast_ctx);
   Initialize();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.SetMapBytes(z3_gen->GetMemoryUsage());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
 llvm::ModulePass *createReachBasedRefinePass(clang::ASTContext &ctx,
-                                             rellic::IRToASTVisitor &gen) {
-  return new ReachBasedRefine(ctx, gen);
+                                             rellic::IRToASTVisitor &gen,
+                                             rellic::Z3Solver &solver) {
+  return new ReachBasedRefine(ctx, gen, solver);
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -20,9 +20,11 @@
 #include <llvm/Pass.h>
 
 #include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/IfConds.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Util.h"
 #include "rellic/AST/Z3ConvVisitor.h"
+#include "rellic/AST/Z3Solver.h"
 
 namespace rellic {
 
@@ -31,31 +33,30 @@ class ReachBasedRefine : public llvm::ModulePass,
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
-  std::unique_ptr<z3::context> z3_ctx;
-  std::unique_ptr<rellic::Z3ConvVisitor> z3_gen;
-
-  z3::tactic z3_solver;
-
-  z3::expr GetZ3Cond(clang::IfStmt *ifstmt);
-
-  bool Prove(z3::expr expr);
-
-  using IfStmtVec = std::vector<clang::IfStmt *>;
-
-  void CreateIfElseStmts(IfStmtVec stmts);
+  rellic::Z3Solver *solver;
+  z3::context *z3_ctx;
+  rellic::Z3ConvVisitor *z3_gen;
 
  public:
   static char ID;
 
-  ReachBasedRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+  ReachBasedRefine(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen,
+                   rellic::Z3Solver &solver);
 
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl);
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 
   bool runOnModule(llvm::Module &module) override;
 };
 
+// Turns runs of mutually unreachable if statements of `ifs` into else-if
+// cascades
+void CreateIfElseStmts(clang::ASTContext &ctx, Z3Solver &solver, IfConds &ifs,
+                       const SubstituteFn &Substitute);
+
 llvm::ModulePass *createReachBasedRefinePass(clang::ASTContext &ctx,
-                                             rellic::IRToASTVisitor &ast_gen);
+                                             rellic::IRToASTVisitor &ast_gen,
+                                             rellic::Z3Solver &solver);
 }  // namespace rellic
 
 namespace llvm {
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Shard.h"
+
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace rellic {
+
+namespace {
+
+static constexpr char kShardPrefix[]{"/* rellic shard "};
+static constexpr char kDefnPrefix[]{"/* rellic definition "};
+static constexpr char kSuffix[]{" */\n"};
+
+// Consumes the line `prefix` `value` `kSuffix` from the front of `text`
+static bool ConsumeMarker(llvm::StringRef &text, llvm::StringRef prefix,
+                          llvm::StringRef &value) {
+  if (!text.startswith(prefix)) {
+    return false;
+  }
+  auto end{text.find('\n')};
+  auto line{text.substr(0, end == llvm::StringRef::npos ? end : end + 1)};
+  if (!line.endswith(kSuffix)) {
+    return false;
+  }
+  value = line.drop_front(prefix.size()).drop_back(sizeof(kSuffix) - 1);
+  text = text.drop_front(line.size());
+  return true;
+}
+
+// Splits the text up to the next definition marker off `text`
+static llvm::StringRef ConsumePart(llvm::StringRef &text) {
+  auto end{text.startswith(kDefnPrefix) ? 0 : text.find(kDefnPrefix)};
+  // Markers only ever start a line
+  while (end != llvm::StringRef::npos && end && text[end - 1] != '\n') {
+    end = text.find(kDefnPrefix, end + 1);
+  }
+  auto part{text.substr(0, end)};
+  text = text.drop_front(part.size());
+  return part;
+}
+
+}  // namespace
+
+bool ParseShardSpec(llvm::StringRef spec, ShardSpec &shard,
+                    std::string &error) {
+  llvm::StringRef index;
+  llvm::StringRef count;
+  std::tie(index, count) = spec.split('/');
+  if (index.getAsInteger(10, shard.index) ||
+      count.getAsInteger(10, shard.count) || !shard.count ||
+      shard.index >= shard.count) {
+    error = "expected I/N with I < N, got `" + spec.str() + "`";
+    return false;
+  }
+  return true;
+}
+
+std::vector<unsigned> AssignShards(const std::vector<double> &costs,
+                                   unsigned num_shards) {
+  std::vector<unsigned> order(costs.size());
+  std::iota(order.begin(), order.end(), 0U);
+  std::stable_sort(order.begin(), order.end(),
+                   [&costs](unsigned lhs, unsigned rhs) {
+                     return costs[lhs] > costs[rhs];
+                   });
+  std::vector<unsigned> shards(costs.size());
+  std::vector<double> loads(num_shards);
+  for (auto idx : order) {
+    auto least{std::min_element(loads.begin(), loads.end())};
+    *least += costs[idx];
+    shards[idx] = least - loads.begin();
+  }
+  return shards;
+}
+
+void PrintShardOutput(const ShardOutput &output, llvm::raw_ostream &os) {
+  os << kShardPrefix << output.shard.index << '/' << output.shard.count
+     << kSuffix << output.decls;
+  for (auto &defn : output.defns) {
+    os << kDefnPrefix << defn.first << kSuffix << defn.second;
+  }
+}
+
+bool ParseShardOutput(llvm::StringRef text, ShardOutput &output,
+                      std::string &error) {
+  llvm::StringRef spec;
+  if (!ConsumeMarker(text, kShardPrefix, spec)) {
+    error = "missing shard header";
+    return false;
+  }
+  if (!ParseShardSpec(spec, output.shard, error)) {
+    return false;
+  }
+  output.decls = ConsumePart(text).str();
+  output.defns.clear();
+  while (!text.empty()) {
+    llvm::StringRef key;
+    unsigned idx;
+    if (!ConsumeMarker(text, kDefnPrefix, key) ||
+        key.getAsInteger(10, idx)) {
+      error = "malformed definition marker";
+      return false;
+    }
+    if (!output.defns.emplace(idx, ConsumePart(text).str()).second) {
+      error = "definition " + std::to_string(idx) + " appears twice";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MergeShardOutputs(const std::vector<ShardOutput> &shards,
+                       llvm::raw_ostream &os, std::string &error) {
+  if (shards.empty()) {
+    error = "no shards to merge";
+    return false;
+  }
+  auto count{shards.front().shard.count};
+  std::vector<const ShardOutput *> by_index(count);
+  for (auto &output : shards) {
+    auto &shard{output.shard};
+    if (shard.count != count || shard.index >= count) {
+      error = "shards of " + std::to_string(count) + " and " +
+              std::to_string(shard.count) + " runs can't be merged";
+      return false;
+    }
+    if (by_index[shard.index]) {
+      error = "shard " + std::to_string(shard.index) + " appears twice";
+      return false;
+    }
+    // Shards of different inputs or options would differ here
+    if (output.decls != shards.front().decls) {
+      error = "declarations of shard " + std::to_string(shard.index) +
+              " differ from those of shard " +
+              std::to_string(shards.front().shard.index);
+      return false;
+    }
+    by_index[shard.index] = &output;
+  }
+  for (auto i = 0U; i < count; ++i) {
+    if (!by_index[i]) {
+      error = "shard " + std::to_string(i) + " is missing";
+      return false;
+    }
+  }
+
+  std::map<unsigned, const std::string *> defns;
+  for (auto &output : shards) {
+    for (auto &defn : output.defns) {
+      if (!defns.emplace(defn.first, &defn.second).second) {
+        error = "definition " + std::to_string(defn.first) +
+                " appears in more than one shard";
+        return false;
+      }
+    }
+  }
+  os << shards.front().decls;
+  for (auto &defn : defns) {
+    os << *defn.second;
+  }
+  return true;
+}
+
+}  // namespace rellic
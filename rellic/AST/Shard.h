@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rellic {
+
+// Position of one `rellic-decomp --shard I/N` run among all N runs
+struct ShardSpec {
+  unsigned index = 0;
+  // 0 if decompilation isn't sharded
+  unsigned count = 0;
+};
+
+// Parses `I/N` with `I < N`. Returns `false` and describes the problem in
+// `error` if `spec` is malformed.
+bool ParseShardSpec(llvm::StringRef spec, ShardSpec &shard,
+                    std::string &error);
+
+// Partitions functions of costs `costs` into `num_shards` shards, and
+// returns the shard of every function. Functions are taken from the most
+// costly one and go to the shard with the least total cost, lowest index
+// first, so that the result only depends on `costs` and every run of the
+// same input agrees on it.
+std::vector<unsigned> AssignShards(const std::vector<double> &costs,
+                                   unsigned num_shards);
+
+// Output of a sharded run: the declarations of the whole module, which
+// all shards share, and the definitions of the functions of the shard,
+// keyed by the index of their function among all definitions of the
+// module. Shards are printed with comment lines in between that
+// delimit the parts, so that every shard is still a valid C file.
+struct ShardOutput {
+  ShardSpec shard;
+  std::string decls;
+  std::map<unsigned, std::string> defns;
+};
+
+void PrintShardOutput(const ShardOutput &output, llvm::raw_ostream &os);
+
+// Parses a printed shard. Returns `false` and describes the problem in
+// `error` if `text` isn't one.
+bool ParseShardOutput(llvm::StringRef text, ShardOutput &output,
+                      std::string &error);
+
+// Prints the declarations of `shards` once and then all definitions in
+// module order, as an unsharded run with `--jobs` prints them. Returns
+// `false` and describes the problem in `error` unless `shards` are all
+// N shards of the same input.
+bool MergeShardOutputs(const std::vector<ShardOutput> &shards,
+                       llvm::raw_ostream &os, std::string &error);
+
+}  // namespace rellic
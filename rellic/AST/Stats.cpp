@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Stats.h"
+
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <z3.h>
+
+namespace rellic {
+
+namespace {
+
+class NodeCounter : public clang::RecursiveASTVisitor<NodeCounter> {
+ public:
+  size_t num_nodes = 0;
+
+  bool VisitStmt(clang::Stmt *stmt) {
+    ++num_nodes;
+    return true;
+  }
+
+  bool VisitDecl(clang::Decl *decl) {
+    ++num_nodes;
+    return true;
+  }
+};
+
+static unsigned GetLatencyBucket(double seconds) {
+  auto bucket = 0U;
+  for (auto limit = 1e-5; seconds >= limit; limit *= 10) {
+    if (++bucket == Stats::kNumLatencyBuckets - 1) {
+      break;
+    }
+  }
+  return bucket;
+}
+
+static thread_local std::string current_stage;
+static thread_local unsigned current_round = 0;
+
+}  // namespace
+
+bool Stats::enabled = false;
+
+Stats &Stats::Get() {
+  static Stats stats;
+  return stats;
+}
+
+void Stats::SetStage(llvm::StringRef stage, unsigned round) {
+  current_stage = stage.str();
+  current_round = round;
+}
+
+void Stats::AddPassRun(llvm::StringRef pass, double seconds,
+                       size_t substitutions, size_t nodes_before,
+                       size_t nodes_after, bool changed, size_t ast_bytes,
+                       size_t z3_bytes, size_t map_bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  pass_runs.push_back({pass.str(), current_stage, current_round, seconds,
+                       substitutions, nodes_before, nodes_after, changed,
+                       ast_bytes, z3_bytes, map_bytes});
+}
+
+void Stats::AddStageRun(llvm::StringRef stage, unsigned round, double seconds,
+                        bool changed) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stage_runs.push_back({stage.str(), round, seconds, changed});
+}
+
+void Stats::AddUnconverged(llvm::StringRef stage, llvm::StringRef function,
+                           unsigned round, bool oscillating,
+                           std::vector<std::string> passes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  unconverged.push_back({stage.str(), function.str(), round, oscillating,
+                         std::move(passes)});
+}
+
+void Stats::AddFunctionMemory(llvm::StringRef function, int64_t peak_bytes,
+                              bool over_budget) {
+  std::lock_guard<std::mutex> lock(mutex);
+  function_memory.push_back({function.str(), peak_bytes, over_budget});
+}
+
+void Stats::AddSkippedFunction(llvm::StringRef function,
+                               llvm::StringRef reason) {
+  std::lock_guard<std::mutex> lock(mutex);
+  skipped.emplace_back(function.str(), reason.str());
+}
+
+void Stats::AddFunctionTime(llvm::StringRef function, double seconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  function_seconds[function.str()] += seconds;
+}
+
+void Stats::AddIRSimplification(llvm::StringRef function,
+                                size_t blocks_before, size_t blocks_after,
+                                size_t insts_before, size_t insts_after) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ir_simplifications.push_back({function.str(), blocks_before, blocks_after,
+                                insts_before, insts_after});
+}
+
+void Stats::AddZ3Query(llvm::StringRef kind, double seconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &stats = queries[kind.str()];
+  ++stats.queries;
+  stats.seconds += seconds;
+  ++stats.latencies[GetLatencyBucket(seconds)];
+}
+
+void Stats::AddZ3CacheHit(llvm::StringRef kind) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++queries[kind.str()].cache_hits;
+}
+
+void Stats::AddZ3Prefiltered(llvm::StringRef kind) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++queries[kind.str()].prefiltered;
+}
+
+void Stats::AddZ3Fallback(llvm::StringRef kind) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++queries[kind.str()].fallbacks;
+}
+
+void Stats::AddZ3TacticPath(llvm::StringRef path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++tactic_paths[path.str()];
+}
+
+void Stats::PrintJSON(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(mutex);
+  llvm::json::Array passes;
+  for (auto &run : pass_runs) {
+    passes.push_back(llvm::json::Object{
+        {"pass", run.pass},
+        {"stage", run.stage},
+        {"round", static_cast<int64_t>(run.round)},
+        {"seconds", run.seconds},
+        {"substitutions", static_cast<int64_t>(run.substitutions)},
+        {"nodes_before", static_cast<int64_t>(run.nodes_before)},
+        {"nodes_after", static_cast<int64_t>(run.nodes_after)},
+        {"changed", run.changed},
+        {"ast_bytes", static_cast<int64_t>(run.ast_bytes)},
+        {"z3_bytes", static_cast<int64_t>(run.z3_bytes)},
+        {"map_bytes", static_cast<int64_t>(run.map_bytes)}});
+  }
+
+  llvm::json::Array stages;
+  for (auto &run : stage_runs) {
+    stages.push_back(llvm::json::Object{
+        {"stage", run.stage},
+        {"round", static_cast<int64_t>(run.round)},
+        {"seconds", run.seconds},
+        {"changed", run.changed}});
+  }
+
+  llvm::json::Array failures;
+  for (auto &entry : unconverged) {
+    llvm::json::Array names;
+    for (auto &pass : entry.passes) {
+      names.push_back(pass);
+    }
+    failures.push_back(llvm::json::Object{
+        {"stage", entry.stage},
+        {"function", entry.function},
+        {"round", static_cast<int64_t>(entry.round)},
+        {"oscillating", entry.oscillating},
+        {"passes", std::move(names)}});
+  }
+
+  llvm::json::Array functions;
+  for (auto &entry : function_memory) {
+    functions.push_back(llvm::json::Object{
+        {"function", entry.function},
+        {"peak_bytes", entry.peak_bytes},
+        {"over_budget", entry.over_budget}});
+  }
+
+  llvm::json::Array skipped_functions;
+  for (auto &entry : skipped) {
+    skipped_functions.push_back(llvm::json::Object{
+        {"function", entry.first}, {"reason", entry.second}});
+  }
+
+  llvm::json::Object times;
+  for (auto &entry : function_seconds) {
+    times[entry.first] = entry.second;
+  }
+
+  llvm::json::Array simplified;
+  for (auto &entry : ir_simplifications) {
+    simplified.push_back(llvm::json::Object{
+        {"function", entry.function},
+        {"blocks_before", static_cast<int64_t>(entry.blocks_before)},
+        {"blocks_after", static_cast<int64_t>(entry.blocks_after)},
+        {"insts_before", static_cast<int64_t>(entry.insts_before)},
+        {"insts_after", static_cast<int64_t>(entry.insts_after)}});
+  }
+
+  llvm::json::Object z3;
+  for (auto &kind : queries) {
+    auto &stats = kind.second;
+    llvm::json::Array latencies;
+    for (auto num : stats.latencies) {
+      latencies.push_back(static_cast<int64_t>(num));
+    }
+    z3[kind.first] = llvm::json::Object{
+        {"queries", static_cast<int64_t>(stats.queries)},
+        {"cache_hits", static_cast<int64_t>(stats.cache_hits)},
+        {"prefiltered", static_cast<int64_t>(stats.prefiltered)},
+        {"fallbacks", static_cast<int64_t>(stats.fallbacks)},
+        {"seconds", stats.seconds},
+        {"latency_histogram", std::move(latencies)}};
+  }
+
+  llvm::json::Object paths;
+  for (auto &entry : tactic_paths) {
+    paths[entry.first] = static_cast<int64_t>(entry.second);
+  }
+
+  llvm::json::Object result{{"passes", std::move(passes)},
+                            {"stages", std::move(stages)},
+                            {"unconverged", std::move(failures)},
+                            {"functions", std::move(functions)},
+                            {"skipped", std::move(skipped_functions)},
+                            {"function_seconds", std::move(times)},
+                            {"ir_simplify", std::move(simplified)},
+                            {"z3", std::move(z3)},
+                            {"z3_tactic_paths", std::move(paths)}};
+  os << llvm::formatv("{0:2}", llvm::json::Value(std::move(result))) << '\n';
+}
+
+void Stats::PrintPassTimes(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, std::pair<double, unsigned>> totals;
+  double total = 0;
+  for (auto &run : pass_runs) {
+    auto &entry = totals[run.pass];
+    entry.first += run.seconds;
+    entry.second += 1;
+    total += run.seconds;
+  }
+  os << "===" << std::string(73, '-') << "===\n";
+  os << "                      rellic pass execution timing report\n";
+  os << "===" << std::string(73, '-') << "===\n";
+  os << "   Wall Time (s)     Runs  Name\n";
+  for (auto &entry : totals) {
+    os << llvm::format("  %10.4f (%5.1f%%)  %5u  ", entry.second.first,
+                       total > 0 ? 100 * entry.second.first / total : 0.0,
+                       entry.second.second)
+       << entry.first << '\n';
+  }
+  os << llvm::format("  %10.4f (100.0%%)         Total\n", total);
+  for (auto &kind : queries) {
+    os << llvm::format(
+        "  %10.4f          %7zu  Z3 %s queries (%zu cached, %zu prefiltered, "
+        "%zu fallbacks)\n",
+        kind.second.seconds, kind.second.queries, kind.first.c_str(),
+        kind.second.cache_hits, kind.second.prefiltered,
+        kind.second.fallbacks);
+  }
+}
+
+size_t GetNumASTNodes(clang::Decl *decl) {
+  NodeCounter counter;
+  counter.TraverseDecl(decl);
+  return counter.num_nodes;
+}
+
+size_t GetZ3AllocatedMemory() {
+  return static_cast<size_t>(Z3_get_estimated_alloc_size());
+}
+
+PassStats::PassStats(llvm::StringRef pass, clang::ASTContext &ctx)
+    : pass(pass.str()), ast_ctx(ctx), nodes_before(0), map_bytes(0) {
+  if (Stats::IsEnabled()) {
+    nodes_before = GetNumASTNodes(ast_ctx.getTranslationUnitDecl());
+    timer = StatsTimer();
+  }
+}
+
+void PassStats::Finish(size_t substitutions, bool changed) {
+  if (!Stats::IsEnabled()) {
+    return;
+  }
+  // Don't count the time spent counting nodes
+  auto seconds = timer.GetSeconds();
+  auto nodes_after = GetNumASTNodes(ast_ctx.getTranslationUnitDecl());
+  Stats::Get().AddPassRun(pass, seconds, substitutions, nodes_before,
+                          nodes_after, changed, ast_ctx.getASTAllocatedMemory(),
+                          GetZ3AllocatedMemory(), map_bytes);
+}
+
+}  // namespace rellic
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rellic {
+
+// Measures wall time from construction
+class StatsTimer {
+ private:
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  StatsTimer() : start(std::chrono::steady_clock::now()) {}
+
+  double GetSeconds() const {
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start};
+    return elapsed.count();
+  }
+};
+
+// Process-wide statistics of the decompilation pipeline. Collection is
+// off unless `Enable` is called, and is safe to use from worker threads.
+class Stats {
+ public:
+  // Z3 query latencies are bucketed by decade, from below 10us to 10s
+  // and above.
+  static constexpr unsigned kNumLatencyBuckets = 8;
+
+ private:
+  struct PassRun {
+    std::string pass;
+    std::string stage;
+    unsigned round;
+    double seconds;
+    size_t substitutions;
+    size_t nodes_before;
+    size_t nodes_after;
+    bool changed;
+    // Memory in use after the pass
+    size_t ast_bytes;
+    size_t z3_bytes;
+    size_t map_bytes;
+  };
+
+  struct StageRun {
+    std::string stage;
+    unsigned round;
+    double seconds;
+    bool changed;
+  };
+
+  // A function that a fixpoint stage stopped refining before it converged
+  struct Unconverged {
+    std::string stage;
+    std::string function;
+    unsigned round;
+    bool oscillating;
+    std::vector<std::string> passes;
+  };
+
+  // Most memory that the AST and Z3 grew by while refining a function
+  struct FunctionMemory {
+    std::string function;
+    int64_t peak_bytes;
+    bool over_budget;
+  };
+
+  // Size of a function before and after IR simplification
+  struct IRSimplification {
+    std::string function;
+    size_t blocks_before;
+    size_t blocks_after;
+    size_t insts_before;
+    size_t insts_after;
+  };
+
+  struct QueryStats {
+    size_t queries = 0;
+    size_t cache_hits = 0;
+    size_t prefiltered = 0;
+    size_t fallbacks = 0;
+    double seconds = 0;
+    std::array<size_t, kNumLatencyBuckets> latencies{};
+  };
+
+  static bool enabled;
+
+  std::mutex mutex;
+  std::vector<PassRun> pass_runs;
+  std::vector<StageRun> stage_runs;
+  std::vector<Unconverged> unconverged;
+  std::vector<FunctionMemory> function_memory;
+  // Functions that were not decompiled, and why
+  std::vector<std::pair<std::string, std::string>> skipped;
+  // Seconds that the pipeline took for every function decompiled on its own
+  std::map<std::string, double> function_seconds;
+  std::vector<IRSimplification> ir_simplifications;
+  std::map<std::string, QueryStats> queries;
+  // Conditions that the adaptive simplifier sent down each tactic chain
+  std::map<std::string, size_t> tactic_paths;
+
+ public:
+  static Stats &Get();
+
+  static void Enable() { enabled = true; }
+  static bool IsEnabled() { return enabled; }
+
+  // Sets the pipeline stage and fixpoint round that passes run in
+  // on the current thread.
+  static void SetStage(llvm::StringRef stage, unsigned round);
+
+  void AddPassRun(llvm::StringRef pass, double seconds, size_t substitutions,
+                  size_t nodes_before, size_t nodes_after, bool changed,
+                  size_t ast_bytes, size_t z3_bytes, size_t map_bytes);
+  void AddStageRun(llvm::StringRef stage, unsigned round, double seconds,
+                   bool changed);
+  // Records that `function` still changed during `round` of `stage`, and
+  // was given up because it oscillates or the stage ran out of rounds
+  void AddUnconverged(llvm::StringRef stage, llvm::StringRef function,
+                      unsigned round, bool oscillating,
+                      std::vector<std::string> passes);
+  void AddFunctionMemory(llvm::StringRef function, int64_t peak_bytes,
+                         bool over_budget);
+  void AddSkippedFunction(llvm::StringRef function, llvm::StringRef reason);
+  void AddFunctionTime(llvm::StringRef function, double seconds);
+  void AddIRSimplification(llvm::StringRef function, size_t blocks_before,
+                           size_t blocks_after, size_t insts_before,
+                           size_t insts_after);
+  void AddZ3Query(llvm::StringRef kind, double seconds);
+  void AddZ3CacheHit(llvm::StringRef kind);
+  // Counts a query that was decided without a solver
+  void AddZ3Prefiltered(llvm::StringRef kind);
+  // Counts a query that was given up because of a resource limit
+  void AddZ3Fallback(llvm::StringRef kind);
+  // Counts a condition that the adaptive simplifier sent down `path`
+  void AddZ3TacticPath(llvm::StringRef path);
+
+  // Writes all statistics as a JSON object
+  void PrintJSON(llvm::raw_ostream &os);
+  // Writes a table of the time spent in each pass
+  void PrintPassTimes(llvm::raw_ostream &os);
+};
+
+// Counts statements and declarations reachable from `decl`
+size_t GetNumASTNodes(clang::Decl *decl);
+
+// Returns the bytes that Z3 has allocated in all contexts of the process
+size_t GetZ3AllocatedMemory();
+
+// Records one run of a pass over the translation unit of `ctx`.
+// Does nothing if statistics are disabled.
+class PassStats {
+ private:
+  std::string pass;
+  clang::ASTContext &ast_ctx;
+  StatsTimer timer;
+  size_t nodes_before;
+  size_t map_bytes;
+
+ public:
+  PassStats(llvm::StringRef pass, clang::ASTContext &ctx);
+
+  // Sets the bytes used by the maps of the visitor that the pass uses
+  void SetMapBytes(size_t bytes) { map_bytes = bytes; }
+
+  void Finish(size_t substitutions, bool changed);
+};
+
+}  // namespace rellic
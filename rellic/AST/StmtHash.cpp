@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/StmtHash.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace rellic {
+
+namespace {
+
+static constexpr uint64_t kSeed{0x9e3779b97f4a7c15ULL};
+// Hash of missing children, such as the `else` of an `if`
+static constexpr uint64_t kNull{0x2545f4914f6cdd1dULL};
+
+// Combines `hash` with `val`. The order of combined values matters.
+static uint64_t Mix(uint64_t hash, uint64_t val) {
+  val *= 0xff51afd7ed558ccdULL;
+  val ^= val >> 33;
+  hash ^= val;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  return hash ^ (hash >> 29);
+}
+
+// FNV-1a, which unlike `llvm::hash_value` is not seeded per process
+static uint64_t Mix(uint64_t hash, llvm::StringRef str) {
+  uint64_t val{0xcbf29ce484222325ULL};
+  for (auto chr : str) {
+    val = (val ^ static_cast<unsigned char>(chr)) * 0x100000001b3ULL;
+  }
+  return Mix(Mix(hash, str.size()), val);
+}
+
+static uint64_t Mix(uint64_t hash, const llvm::APInt &val) {
+  hash = Mix(hash, val.getBitWidth());
+  for (unsigned i{0}; i < val.getNumWords(); ++i) {
+    hash = Mix(hash, val.getRawData()[i]);
+  }
+  return hash;
+}
+
+// Declarations are identified by their kind and name
+static uint64_t Mix(uint64_t hash, const clang::NamedDecl *decl) {
+  if (!decl) {
+    return Mix(hash, kNull);
+  }
+  hash = Mix(hash, decl->getKind());
+  if (auto id = decl->getIdentifier()) {
+    hash = Mix(hash, id->getName());
+  }
+  return hash;
+}
+
+}  // namespace
+
+uint64_t StmtHasher::Hash(const clang::Stmt *stmt) {
+  if (!stmt) {
+    return kNull;
+  }
+  auto iter{stmts.find(stmt)};
+  if (iter != stmts.end()) {
+    return iter->second;
+  }
+  auto hash{HashNode(stmt)};
+  stmts[stmt] = hash;
+  return hash;
+}
+
+uint64_t StmtHasher::Hash(clang::QualType type) {
+  if (type.isNull()) {
+    return kNull;
+  }
+  auto split{type.split()};
+  return Mix(HashType(split.Ty), split.Quals.getCVRQualifiers());
+}
+
+uint64_t StmtHasher::HashType(const clang::Type *type) {
+  auto iter{types.find(type)};
+  if (iter != types.end()) {
+    return iter->second;
+  }
+
+  auto hash{Mix(kSeed, type->getTypeClass())};
+  if (auto builtin = clang::dyn_cast<clang::BuiltinType>(type)) {
+    hash = Mix(hash, builtin->getKind());
+  } else if (auto ptr = clang::dyn_cast<clang::PointerType>(type)) {
+    hash = Mix(hash, Hash(ptr->getPointeeType()));
+  } else if (auto arr = clang::dyn_cast<clang::ArrayType>(type)) {
+    hash = Mix(hash, Hash(arr->getElementType()));
+    if (auto carr = clang::dyn_cast<clang::ConstantArrayType>(arr)) {
+      hash = Mix(hash, carr->getSize());
+    }
+  } else if (auto tag = clang::dyn_cast<clang::TagType>(type)) {
+    // Structures are identified by name, which also ends recursion
+    hash = Mix(hash, tag->getDecl());
+  } else if (auto tdef = clang::dyn_cast<clang::TypedefType>(type)) {
+    hash = Mix(hash, tdef->getDecl());
+  } else if (auto paren = clang::dyn_cast<clang::ParenType>(type)) {
+    hash = Mix(hash, Hash(paren->getInnerType()));
+  } else if (auto elab = clang::dyn_cast<clang::ElaboratedType>(type)) {
+    hash = Mix(hash, Hash(elab->getNamedType()));
+  } else if (auto func = clang::dyn_cast<clang::FunctionType>(type)) {
+    hash = Mix(hash, Hash(func->getReturnType()));
+    if (auto proto = clang::dyn_cast<clang::FunctionProtoType>(func)) {
+      for (auto param : proto->getParamTypes()) {
+        hash = Mix(hash, Hash(param));
+      }
+      hash = Mix(hash, proto->isVariadic());
+    }
+  }
+  types[type] = hash;
+  return hash;
+}
+
+uint64_t StmtHasher::HashNode(const clang::Stmt *stmt) {
+  auto hash{Mix(kSeed, stmt->getStmtClass())};
+  if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+    hash = Mix(hash, Hash(expr->getType()));
+  }
+
+  // Data of the node besides its children
+  if (auto lit = clang::dyn_cast<clang::IntegerLiteral>(stmt)) {
+    hash = Mix(hash, lit->getValue());
+  } else if (auto lit = clang::dyn_cast<clang::FloatingLiteral>(stmt)) {
+    hash = Mix(hash, lit->getValue().bitcastToAPInt());
+  } else if (auto lit = clang::dyn_cast<clang::CharacterLiteral>(stmt)) {
+    hash = Mix(Mix(hash, lit->getKind()), lit->getValue());
+  } else if (auto lit = clang::dyn_cast<clang::StringLiteral>(stmt)) {
+    hash = Mix(hash, lit->getBytes());
+  } else if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(stmt)) {
+    hash = Mix(hash, ref->getDecl());
+  } else if (auto member = clang::dyn_cast<clang::MemberExpr>(stmt)) {
+    hash = Mix(Mix(hash, member->getMemberDecl()), member->isArrow());
+  } else if (auto binop = clang::dyn_cast<clang::BinaryOperator>(stmt)) {
+    hash = Mix(hash, binop->getOpcode());
+  } else if (auto unop = clang::dyn_cast<clang::UnaryOperator>(stmt)) {
+    hash = Mix(hash, unop->getOpcode());
+  } else if (auto cast = clang::dyn_cast<clang::CastExpr>(stmt)) {
+    hash = Mix(hash, cast->getCastKind());
+  } else if (auto trait =
+                 clang::dyn_cast<clang::UnaryExprOrTypeTraitExpr>(stmt)) {
+    hash = Mix(hash, trait->getKind());
+    if (trait->isArgumentType()) {
+      hash = Mix(hash, Hash(trait->getArgumentType()));
+    }
+  } else if (auto decls = clang::dyn_cast<clang::DeclStmt>(stmt)) {
+    for (auto decl : decls->decls()) {
+      auto named{clang::dyn_cast<clang::NamedDecl>(decl)};
+      hash = Mix(hash, named);
+      if (auto value = clang::dyn_cast_or_null<clang::ValueDecl>(named)) {
+        hash = Mix(hash, Hash(value->getType()));
+      }
+    }
+  } else if (auto label = clang::dyn_cast<clang::LabelStmt>(stmt)) {
+    hash = Mix(hash, label->getDecl());
+  } else if (auto jump = clang::dyn_cast<clang::GotoStmt>(stmt)) {
+    hash = Mix(hash, jump->getLabel());
+  }
+
+  for (auto child : stmt->children()) {
+    hash = Mix(hash, Hash(child));
+  }
+  return hash;
+}
+
+}  // namespace rellic
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Stmt.h>
+#include <clang/AST/Type.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace rellic {
+
+// Structural hash of the statements and expressions that rellic
+// generates. Declarations are hashed by name and types by structure,
+// never by address, so that hashes are the same in every run.
+//
+// Hashes of subtrees are memoized, which makes hashing a statement whose
+// children were hashed before constant time. Memoized hashes go stale
+// when a subtree is edited in place: `Forget` has to be called for the
+// edited statement and its ancestors, or `Clear` for everything.
+class StmtHasher {
+ private:
+  std::unordered_map<const clang::Stmt *, uint64_t> stmts;
+  std::unordered_map<const clang::Type *, uint64_t> types;
+
+  uint64_t HashNode(const clang::Stmt *stmt);
+  uint64_t HashType(const clang::Type *type);
+
+ public:
+  uint64_t Hash(const clang::Stmt *stmt);
+  uint64_t Hash(clang::QualType type);
+
+  void Forget(const clang::Stmt *stmt) { stmts.erase(stmt); }
+  void Clear() { stmts.clear(); }
+};
+
+}  // namespace rellic
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/Support/Casting.h>
+
+#include <cstdint>
+
+namespace rellic {
+
+// Patterns over statements that compile down to plain nested checks.
+// Matchers are predicates `bool(const clang::Stmt *)`, and node predicates
+// such as `Cond` or `Then` receive the typed node that `Is` matched.
+// Unlike `clang::ast_matchers`, nothing is dispatched dynamically, bound
+// or allocated; rules that need a subnode take it from the statement
+// again after it matched.
+//
+// Child accessors like `Then` or `Else` fail on missing children, and
+// `HasChild`, `HasDescendant` and `Unless` mirror `has`, `hasDescendant`
+// and `unless`.
+namespace matchers {
+
+namespace detail {
+
+template <typename T>
+bool All(const T *) {
+  return true;
+}
+
+template <typename T, typename Pred, typename... Preds>
+bool All(const T *node, const Pred &pred, const Preds &...preds) {
+  return pred(node) && All(node, preds...);
+}
+
+template <typename Matcher>
+bool AnyDescendant(const clang::Stmt *stmt, const Matcher &matcher) {
+  for (auto child : stmt->children()) {
+    if (child && (matcher(child) || AnyDescendant(child, matcher))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Matcher>
+bool AnyOf(const clang::Stmt *stmt, const Matcher &matcher) {
+  return matcher(stmt);
+}
+
+template <typename Matcher, typename Next, typename... Rest>
+bool AnyOf(const clang::Stmt *stmt, const Matcher &matcher, const Next &next,
+           const Rest &...rest) {
+  return matcher(stmt) || AnyOf(stmt, next, rest...);
+}
+
+}  // namespace detail
+
+// Statements of class `T` that satisfy all of `preds`
+template <typename T, typename... Preds>
+auto Is(Preds... preds) {
+  return [=](const clang::Stmt *stmt) {
+    auto node{llvm::dyn_cast_or_null<T>(stmt)};
+    return node && detail::All(node, preds...);
+  };
+}
+
+template <typename... Matchers>
+auto AnyOf(Matchers... matchers) {
+  return [=](const clang::Stmt *stmt) {
+    return detail::AnyOf(stmt, matchers...);
+  };
+}
+
+template <typename Matcher>
+auto Unless(Matcher matcher) {
+  return [=](const clang::Stmt *stmt) { return !matcher(stmt); };
+}
+
+template <typename Matcher>
+auto IgnoringParenImpCasts(Matcher matcher) {
+  return [=](const clang::Stmt *stmt) {
+    auto expr{llvm::dyn_cast_or_null<clang::Expr>(stmt)};
+    return matcher(expr ? expr->IgnoreParenImpCasts() : stmt);
+  };
+}
+
+template <typename Matcher>
+auto IgnoringImpCasts(Matcher matcher) {
+  return [=](const clang::Stmt *stmt) {
+    auto expr{llvm::dyn_cast_or_null<clang::Expr>(stmt)};
+    return matcher(expr ? expr->IgnoreImpCasts() : stmt);
+  };
+}
+
+template <typename Matcher>
+auto HasChild(Matcher matcher) {
+  return [=](const clang::Stmt *node) {
+    for (auto child : node->children()) {
+      if (child && matcher(child)) {
+        return true;
+      }
+    }
+    return false;
+  };
+}
+
+template <typename Matcher>
+auto HasDescendant(Matcher matcher) {
+  return [=](const clang::Stmt *node) {
+    return detail::AnyDescendant(node, matcher);
+  };
+}
+
+// Counts the descendants of `stmt` that match `matcher`, but stops at
+// `limit`
+template <typename Matcher>
+unsigned CountDescendants(const clang::Stmt *stmt, const Matcher &matcher,
+                          unsigned limit) {
+  unsigned count{0};
+  for (auto child : stmt->children()) {
+    if (!child || count == limit) {
+      continue;
+    }
+    count += matcher(child);
+    if (count < limit) {
+      count += CountDescendants(child, matcher, limit - count);
+    }
+  }
+  return count;
+}
+
+#define RELLIC_CHILD_MATCHER(name, getter)           \
+  template <typename Matcher>                        \
+  auto name(Matcher matcher) {                       \
+    return [=](const auto *node) {                   \
+      const clang::Stmt *child{node->getter()};      \
+      return child && matcher(child);                \
+    };                                               \
+  }
+
+RELLIC_CHILD_MATCHER(Cond, getCond)
+RELLIC_CHILD_MATCHER(Body, getBody)
+RELLIC_CHILD_MATCHER(Then, getThen)
+RELLIC_CHILD_MATCHER(Else, getElse)
+RELLIC_CHILD_MATCHER(SubExpr, getSubExpr)
+RELLIC_CHILD_MATCHER(Base, getBase)
+RELLIC_CHILD_MATCHER(Index, getIdx)
+
+#undef RELLIC_CHILD_MATCHER
+
+// First and last statements of a `clang::CompoundStmt`
+template <typename Matcher>
+auto Front(Matcher matcher) {
+  return [=](const clang::CompoundStmt *node) {
+    return !node->body_empty() && matcher(node->body_front());
+  };
+}
+
+template <typename Matcher>
+auto Back(Matcher matcher) {
+  return [=](const clang::CompoundStmt *node) {
+    return !node->body_empty() && matcher(node->body_back());
+  };
+}
+
+inline auto Size(unsigned size) {
+  return [=](const clang::CompoundStmt *node) { return node->size() == size; };
+}
+
+inline auto Equals(uint64_t val) {
+  return [=](const clang::IntegerLiteral *node) {
+    return node->getValue() == val;
+  };
+}
+
+template <typename Opcode>
+auto HasOpcode(Opcode opc) {
+  return [=](const auto *node) { return node->getOpcode() == opc; };
+}
+
+inline auto IsComparison() {
+  return [](const clang::BinaryOperator *node) {
+    return node->isComparisonOp();
+  };
+}
+
+inline auto IsArrow() {
+  return [](const clang::MemberExpr *node) { return node->isArrow(); };
+}
+
+// References to declarations of class `T`
+template <typename T>
+auto To() {
+  return [](const clang::DeclRefExpr *node) {
+    return llvm::isa<T>(node->getDecl());
+  };
+}
+
+}  // namespace matchers
+}  // namespace rellic
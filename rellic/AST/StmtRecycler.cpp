@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/StmtRecycler.h"
+
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace rellic {
+
+namespace {
+
+static thread_local StmtRecycler *current_recycler{nullptr};
+
+class LiveCompounds : public clang::RecursiveASTVisitor<LiveCompounds> {
+ public:
+  std::unordered_set<clang::CompoundStmt *> compounds;
+
+  bool VisitCompoundStmt(clang::CompoundStmt *compound) {
+    compounds.insert(compound);
+    return true;
+  }
+};
+
+}  // namespace
+
+StmtRecycler::StmtRecycler(clang::ASTContext &ctx)
+    : ast_ctx(ctx), prev(current_recycler) {
+  current_recycler = this;
+}
+
+StmtRecycler::~StmtRecycler() {
+  CHECK_EQ(current_recycler, this) << "Recyclers must be destroyed in order";
+  current_recycler = prev;
+}
+
+StmtRecycler *StmtRecycler::Get(clang::ASTContext &ctx) {
+  for (auto recycler = current_recycler; recycler; recycler = recycler->prev) {
+    if (&recycler->ast_ctx == &ctx) {
+      return recycler;
+    }
+  }
+  return nullptr;
+}
+
+clang::CompoundStmt *StmtRecycler::Reuse(std::vector<clang::Stmt *> &stmts) {
+  auto iter{unused.find(stmts.size())};
+  if (iter == unused.end() || iter->second.empty()) {
+    return nullptr;
+  }
+  auto compound{iter->second.back()};
+  iter->second.pop_back();
+  std::copy(stmts.begin(), stmts.end(), compound->body_begin());
+  tracked.push_back(compound);
+  return compound;
+}
+
+void StmtRecycler::Track(clang::CompoundStmt *compound) {
+  tracked.push_back(compound);
+}
+
+void StmtRecycler::Collect() {
+  LiveCompounds live;
+  live.TraverseDecl(ast_ctx.getTranslationUnitDecl());
+  std::vector<clang::CompoundStmt *> survivors;
+  size_t num_collected{0};
+  for (auto compound : tracked) {
+    if (live.compounds.count(compound)) {
+      survivors.push_back(compound);
+    } else {
+      unused[compound->size()].push_back(compound);
+      ++num_collected;
+    }
+  }
+  tracked.swap(survivors);
+  DLOG(INFO) << "Collected " << num_collected << " unreachable compounds";
+}
+
+}  // namespace rellic
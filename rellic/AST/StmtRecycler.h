@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Stmt.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace rellic {
+
+// Reuses `clang::CompoundStmt` nodes that refinement leaves unreachable.
+// Nodes are allocated in the `clang::ASTContext` and never freed, so
+// without recycling every fixpoint round leaves the compounds it
+// replaced behind as garbage.
+//
+// While a recycler exists, `CreateCompoundStmt` on the same thread and
+// context records the compounds it creates, and reuses collected ones
+// that have the same number of children. Only compounds are recycled:
+// passes may keep other statements as map keys between rounds.
+class StmtRecycler {
+ private:
+  clang::ASTContext &ast_ctx;
+  // Enclosing recycler of the current thread
+  StmtRecycler *prev;
+
+  std::vector<clang::CompoundStmt *> tracked;
+  std::unordered_map<unsigned, std::vector<clang::CompoundStmt *>> unused;
+
+ public:
+  StmtRecycler(clang::ASTContext &ctx);
+  ~StmtRecycler();
+
+  // Returns the innermost recycler of `ctx` on the current thread
+  static StmtRecycler *Get(clang::ASTContext &ctx);
+
+  // Returns an unused compound with `stmts` as children, or `nullptr`
+  clang::CompoundStmt *Reuse(std::vector<clang::Stmt *> &stmts);
+  void Track(clang::CompoundStmt *compound);
+
+  // Marks tracked compounds that are not reachable from the translation
+  // unit as unused. Must only be called between passes, when no pass
+  // refers to statements outside of the translation unit anymore.
+  void Collect();
+};
+
+}  // namespace rellic
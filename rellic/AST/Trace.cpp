@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Trace.h"
+
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+
+#include <atomic>
+
+namespace rellic {
+
+namespace {
+
+static thread_local std::string current_function;
+
+static std::atomic<unsigned> num_threads{0};
+
+static int64_t GetMicroseconds(Trace::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+}  // namespace
+
+bool Trace::enabled = false;
+
+Trace &Trace::Get() {
+  static Trace trace;
+  return trace;
+}
+
+void Trace::Enable() {
+  Get().origin = Clock::now();
+  enabled = true;
+}
+
+void Trace::SetFunction(llvm::StringRef function) {
+  current_function = function.str();
+}
+
+const std::string &Trace::GetFunction() { return current_function; }
+
+unsigned Trace::GetThread() {
+  static thread_local unsigned thread{++num_threads};
+  return thread;
+}
+
+void Trace::AddSpan(llvm::StringRef name, llvm::StringRef category,
+                    llvm::StringRef function, Clock::time_point start,
+                    Clock::time_point end) {
+  auto thread{GetThread()};
+  std::lock_guard<std::mutex> lock(mutex);
+  spans.push_back(
+      {name.str(), category.str(), function.str(), thread, start, end});
+}
+
+void Trace::PrintJSON(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(mutex);
+  llvm::json::Array events;
+  for (auto &span : spans) {
+    llvm::json::Object args;
+    if (!span.function.empty()) {
+      args["function"] = span.function;
+    }
+    events.push_back(llvm::json::Object{
+        {"name", span.name},
+        {"cat", span.category},
+        {"ph", "X"},
+        {"ts", GetMicroseconds(span.start - origin)},
+        {"dur", GetMicroseconds(span.end - span.start)},
+        {"pid", 1},
+        {"tid", static_cast<int64_t>(span.thread)},
+        {"args", std::move(args)}});
+  }
+
+  llvm::json::Object result{{"traceEvents", std::move(events)},
+                            {"displayTimeUnit", "ms"}};
+  os << llvm::formatv("{0}", llvm::json::Value(std::move(result))) << '\n';
+}
+
+TraceSpan::TraceSpan(llvm::StringRef name, const char *category,
+                     llvm::StringRef function)
+    : active(Trace::IsEnabled()), category(category) {
+  if (active) {
+    this->name = name.str();
+    this->function =
+        function.empty() ? Trace::GetFunction() : function.str();
+    start = Trace::Clock::now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (active) {
+    Trace::Get().AddSpan(name, category, function, start,
+                         Trace::Clock::now());
+  }
+}
+
+}  // namespace rellic
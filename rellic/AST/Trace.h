@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rellic {
+
+// Process-wide timeline of the decompilation pipeline, written in the
+// Chrome `trace_event` format that `chrome://tracing` and Perfetto load.
+// Recording is off unless `Enable` is called, and is safe to use from
+// worker threads.
+class Trace {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+ private:
+  struct Span {
+    std::string name;
+    std::string category;
+    std::string function;
+    unsigned thread;
+    Clock::time_point start;
+    Clock::time_point end;
+  };
+
+  static bool enabled;
+
+  std::mutex mutex;
+  std::vector<Span> spans;
+  Clock::time_point origin;
+
+ public:
+  static Trace &Get();
+
+  static void Enable();
+  static bool IsEnabled() { return enabled; }
+
+  // Sets the function that spans started on the current thread are
+  // tagged with, unless they name one themselves
+  static void SetFunction(llvm::StringRef function);
+  static const std::string &GetFunction();
+
+  // Small number that identifies the current thread in the trace
+  static unsigned GetThread();
+
+  void AddSpan(llvm::StringRef name, llvm::StringRef category,
+               llvm::StringRef function, Clock::time_point start,
+               Clock::time_point end);
+
+  // Writes all spans as a JSON object
+  void PrintJSON(llvm::raw_ostream &os);
+};
+
+// Records the time from construction to destruction as a span of the
+// trace. Does nothing if tracing is disabled.
+class TraceSpan {
+ private:
+  bool active;
+  std::string name;
+  const char *category;
+  std::string function;
+  Trace::Clock::time_point start;
+
+ public:
+  TraceSpan(llvm::StringRef name, const char *category,
+            llvm::StringRef function = "");
+  ~TraceSpan();
+};
+
+}  // namespace rellic
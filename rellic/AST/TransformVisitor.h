@@ -18,6 +18,10 @@
 
 #include <clang/AST/RecursiveASTVisitor.h>
 
+#include <vector>
+
+#include "rellic/AST/ChangeTracker.h"
+#include "rellic/AST/StmtHash.h"
 #include "rellic/AST/Util.h"
 
 namespace rellic {
@@ -28,14 +32,65 @@ class TransformVisitor : public clang::RecursiveASTVisitor<Derived> {
   StmtMap substitutions;
   bool changed;
 
+  // Number of calls to `Substitute`, as it was when the traversal of each
+  // statement that is being traversed started. A statement whose subtree
+  // made no substitutions has no children to replace.
+  size_t num_substituted;
+  std::vector<size_t> traversal_starts;
+  bool subtree_substituted;
+
+  // Structural hashes of the statements seen during the current run.
+  // Statements whose children get replaced are forgotten.
+  StmtHasher hasher;
+
+  void Substitute(clang::Stmt *stmt, clang::Stmt *sub) {
+    substitutions[stmt] = sub;
+    ++num_substituted;
+  }
+
  public:
-  TransformVisitor() : changed(false) {}
+  TransformVisitor()
+      : changed(false), num_substituted(0), subtree_substituted(true) {}
 
   virtual bool shouldTraversePostOrder() { return true; }
 
   void Initialize() {
     changed = false;
     substitutions.clear();
+    num_substituted = 0;
+    traversal_starts.clear();
+    hasher.Clear();
+  }
+
+  bool dataTraverseStmtPre(clang::Stmt *stmt) {
+    traversal_starts.push_back(num_substituted);
+    return true;
+  }
+
+  bool dataTraverseStmtPost(clang::Stmt *stmt) {
+    subtree_substituted = traversal_starts.back() != num_substituted;
+    traversal_starts.pop_back();
+    return true;
+  }
+
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+    using Base = clang::RecursiveASTVisitor<Derived>;
+    auto tracker{ChangeTracker::Get(fdecl->getASTContext())};
+    if (!tracker) {
+      return Base::TraverseFunctionDecl(fdecl);
+    }
+    // Skip functions that converged during an earlier round
+    if (!tracker->IsDirty(fdecl)) {
+      return true;
+    }
+    auto outer_changed{changed};
+    changed = false;
+    auto result{Base::TraverseFunctionDecl(fdecl)};
+    if (changed) {
+      tracker->MarkChanged(fdecl);
+    }
+    changed |= outer_changed;
+    return result;
   }
 
   bool VisitFunctionDecl(clang::FunctionDecl *fdecl) {
@@ -52,7 +107,14 @@ class TransformVisitor : public clang::RecursiveASTVisitor<Derived> {
 
   bool VisitStmt(clang::Stmt *stmt) {
     // DLOG(INFO) << "VisitStmt";
-    changed |= ReplaceChildren(stmt, substitutions);
+    // Statements are visited right after their subtree when traversing in
+    // post-order, so skip the lookups if the subtree made no substitutions
+    if ((!this->getDerived().shouldTraversePostOrder() ||
+         subtree_substituted) &&
+        ReplaceChildren(stmt, substitutions)) {
+      changed = true;
+      hasher.Forget(stmt);
+    }
     return true;
   }
 };
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/TypeCache.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "rellic/AST/Compat/ASTContext.h"
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static std::mutex caches_mutex;
+// Never destroyed, since contexts may outlive static destruction
+static auto &caches{
+    *new std::unordered_map<const clang::ASTContext *,
+                            std::unique_ptr<TypeCache>>};
+
+static void DestroyCache(void *ctx) {
+  std::lock_guard<std::mutex> lock(caches_mutex);
+  caches.erase(static_cast<const clang::ASTContext *>(ctx));
+}
+
+}  // namespace
+
+TypeCache &TypeCache::Get(clang::ASTContext &ctx) {
+  std::lock_guard<std::mutex> lock(caches_mutex);
+  auto &cache{caches[&ctx]};
+  if (!cache) {
+    cache.reset(new TypeCache(ctx));
+    ctx.AddDeallocation(DestroyCache, &ctx);
+  }
+  return *cache;
+}
+
+clang::QualType TypeCache::GetIntType(unsigned size, bool sign) {
+  auto &result{int_types[size << 1 | sign]};
+  if (result.isNull()) {
+    result = GetLeastIntTypeForBitWidth(ast_ctx, size, sign);
+  }
+  return result;
+}
+
+clang::QualType TypeCache::GetPointerType(clang::QualType pointee) {
+  auto &result{ptr_types[pointee.getAsOpaquePtr()]};
+  if (result.isNull()) {
+    result = ast_ctx.getPointerType(pointee);
+  }
+  return result;
+}
+
+clang::QualType TypeCache::GetArrayType(clang::QualType elm, uint64_t size) {
+  auto &result{arr_types[{elm.getAsOpaquePtr(), size}]};
+  if (result.isNull()) {
+    result = GetConstantArrayType(ast_ctx, elm, size);
+  }
+  return result;
+}
+
+}  // namespace rellic
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Type.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <cstdint>
+#include <utility>
+
+namespace rellic {
+
+// Integer types by size and sign, and pointers to and arrays of any type,
+// as the lowering to C keeps asking for them. `clang::ASTContext` uniques
+// these types too, but finding them takes a folding set lookup at best
+// and a query of the target at worst.
+//
+// Every context has a single cache, which `Get` creates on first use and
+// which is destroyed along with the context. Like the context itself, a
+// cache must only be used by one thread at a time.
+class TypeCache {
+ private:
+  clang::ASTContext &ast_ctx;
+  // Keyed by `size << 1 | sign`
+  llvm::DenseMap<unsigned, clang::QualType> int_types;
+  // Keyed by the opaque pointers of the pointee and element types
+  llvm::DenseMap<void *, clang::QualType> ptr_types;
+  llvm::DenseMap<std::pair<void *, uint64_t>, clang::QualType> arr_types;
+
+  TypeCache(clang::ASTContext &ctx) : ast_ctx(ctx) {}
+
+ public:
+  static TypeCache &Get(clang::ASTContext &ctx);
+
+  // The least integer type of at least `size` bits, as in
+  // `GetLeastIntTypeForBitWidth`
+  clang::QualType GetIntType(unsigned size, bool sign);
+  clang::QualType GetPointerType(clang::QualType pointee);
+  clang::QualType GetArrayType(clang::QualType elm, uint64_t size);
+};
+
+}  // namespace rellic
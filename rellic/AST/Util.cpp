@@ -57,7 +57,7 @@ void InitCompilerInstance(clang::CompilerInstance &ins,
   ins.createASTContext();
 }
 
-bool ReplaceChildren(clang::Stmt *stmt, StmtMap &repl_map) {
+bool ReplaceChildren(clang::Stmt *stmt, const StmtMap &repl_map) {
   auto change = false;
   for (auto c_it = stmt->child_begin(); c_it != stmt->child_end(); ++c_it) {
     auto s_it = repl_map.find(*c_it);
@@ -119,11 +119,13 @@ clang::Expr *CastExpr(clang::ASTContext &ctx, clang::QualType dst,
 
 clang::IdentifierInfo *CreateIdentifier(clang::ASTContext &ctx,
                                         std::string name) {
-  std::string str = "";
-  for (auto chr : name) {
-    str.push_back(std::isalnum(chr) ? chr : '_');
+  // Sanitize in place, since most names are valid identifiers already
+  for (auto &chr : name) {
+    if (!std::isalnum(static_cast<unsigned char>(chr))) {
+      chr = '_';
+    }
   }
-  return &ctx.Idents.get(str);
+  return &ctx.Idents.get(name);
 }
 
 clang::DeclRefExpr *CreateDeclRefExpr(clang::ASTContext &ctx,
@@ -147,6 +149,29 @@ clang::BreakStmt *CreateBreakStmt(clang::ASTContext &ctx) {
   return new (ctx) clang::BreakStmt(clang::SourceLocation());
 }
 
+clang::NullStmt *CreateNullStmt(clang::ASTContext &ctx) {
+  return new (ctx) clang::NullStmt(clang::SourceLocation());
+}
+
+clang::LabelDecl *CreateLabelDecl(clang::ASTContext &ctx,
+                                  clang::DeclContext *decl_ctx,
+                                  clang::IdentifierInfo *id) {
+  return clang::LabelDecl::Create(ctx, decl_ctx, clang::SourceLocation(), id);
+}
+
+clang::LabelStmt *CreateLabelStmt(clang::ASTContext &ctx,
+                                  clang::LabelDecl *label, clang::Stmt *sub) {
+  auto stmt{new (ctx) clang::LabelStmt(clang::SourceLocation(), label, sub)};
+  label->setStmt(stmt);
+  return stmt;
+}
+
+clang::GotoStmt *CreateGotoStmt(clang::ASTContext &ctx,
+                                clang::LabelDecl *label) {
+  return new (ctx) clang::GotoStmt(label, clang::SourceLocation(),
+                                   clang::SourceLocation());
+}
+
 clang::ParenExpr *CreateParenExpr(clang::ASTContext &ctx, clang::Expr *expr) {
   return new (ctx)
       clang::ParenExpr(clang::SourceLocation(), clang::SourceLocation(), expr);
@@ -231,6 +256,12 @@ clang::Expr *CreateTrueExpr(clang::ASTContext &ctx) {
   return CreateIntegerLiteral(ctx, val, type);
 }
 
+clang::Expr *CreateFalseExpr(clang::ASTContext &ctx) {
+  auto type = ctx.UnsignedIntTy;
+  auto val = llvm::APInt(ctx.getIntWidth(type), 0);
+  return CreateIntegerLiteral(ctx, val, type);
+}
+
 clang::Expr *CreateCharacterLiteral(clang::ASTContext &ctx, llvm::APInt val,
                                     clang::QualType type) {
   return new (ctx) clang::CharacterLiteral(
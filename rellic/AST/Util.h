@@ -19,6 +19,7 @@
 #include <clang/AST/ASTContext.h>
 #include <clang/Basic/TargetInfo.h>
 #include <clang/Frontend/CompilerInstance.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/Support/Host.h>
 
 #include <unordered_map>
@@ -32,12 +33,15 @@ void InitCompilerInstance(
     clang::CompilerInstance &ins,
     std::string target_triple = llvm::sys::getDefaultTargetTriple());
 
-using StmtMap = std::unordered_map<clang::Stmt *, clang::Stmt *>;
+// Substitutions of statements, where `nullptr` removes a statement. The
+// map is open addressed, so that filling and clearing it in every round
+// of a pass doesn't allocate a node per substitution.
+using StmtMap = llvm::DenseMap<clang::Stmt *, clang::Stmt *>;
 
 void InitCompilerInstance(clang::CompilerInstance &ins,
                           std::string target_triple);
 
-bool ReplaceChildren(clang::Stmt *stmt, StmtMap &repl_map);
+bool ReplaceChildren(clang::Stmt *stmt, const StmtMap &repl_map);
 
 template <typename T>
 size_t GetNumDecls(clang::DeclContext *decl_ctx) {
@@ -64,6 +68,19 @@ clang::DoStmt *CreateDoStmt(clang::ASTContext &ctx, clang::Expr *cond,
 
 clang::BreakStmt *CreateBreakStmt(clang::ASTContext &ctx);
 
+clang::NullStmt *CreateNullStmt(clang::ASTContext &ctx);
+
+clang::LabelDecl *CreateLabelDecl(clang::ASTContext &ctx,
+                                  clang::DeclContext *decl_ctx,
+                                  clang::IdentifierInfo *id);
+
+// Also makes `sub` the statement of `label`
+clang::LabelStmt *CreateLabelStmt(clang::ASTContext &ctx,
+                                  clang::LabelDecl *label, clang::Stmt *sub);
+
+clang::GotoStmt *CreateGotoStmt(clang::ASTContext &ctx,
+                                clang::LabelDecl *label);
+
 clang::DeclRefExpr *CreateDeclRefExpr(clang::ASTContext &ctx,
                                       clang::ValueDecl *val);
 
@@ -109,6 +126,8 @@ clang::Expr *CreateIntegerLiteral(clang::ASTContext &ctx, llvm::APInt val,
 
 clang::Expr *CreateTrueExpr(clang::ASTContext &ctx);
 
+clang::Expr *CreateFalseExpr(clang::ASTContext &ctx);
+
 clang::Expr *CreateCharacterLiteral(clang::ASTContext &ctx, llvm::APInt val,
                                     clang::QualType type);
 
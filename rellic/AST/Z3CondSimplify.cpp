@@ -19,54 +19,172 @@
 
 #include "rellic/AST/Z3CondSimplify.h"
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "rellic/AST/Stats.h"
+
 namespace rellic {
 
+namespace {
+
+// Conditions of at most this many distinct terms are small
+static constexpr unsigned kSmallGoal = 64;
+// Conditions of more distinct terms, or of a larger depth, are large
+static constexpr unsigned kLargeGoal = 4096;
+static constexpr unsigned kDeepGoal = 512;
+
+struct GoalShape {
+  unsigned size = 0;
+  bool bitvector = false;
+};
+
+// Counts the distinct terms of `expr` into `shape` and returns its depth
+static unsigned MeasureGoal(z3::expr expr, GoalShape &shape,
+                            std::unordered_map<unsigned, unsigned> &depths) {
+  auto id{Z3_get_ast_id(expr.ctx(), expr)};
+  auto iter{depths.find(id)};
+  if (iter != depths.end()) {
+    return iter->second;
+  }
+  ++shape.size;
+  shape.bitvector |= expr.is_bv();
+  unsigned depth = 0;
+  if (expr.is_app()) {
+    for (auto i = 0U; i < expr.num_args(); ++i) {
+      depth = std::max(depth, MeasureGoal(expr.arg(i), shape, depths));
+    }
+  }
+  return depths[id] = depth + 1;
+}
+
+static z3::tactic CreateTactic(z3::context &ctx, llvm::StringRef chain) {
+  llvm::SmallVector<llvm::StringRef, 8> names;
+  chain.split(names, ',');
+  z3::tactic result(ctx, names.front().str().c_str());
+  for (auto name : llvm::drop_begin(names)) {
+    result = result & z3::tactic(ctx, name.str().c_str());
+  }
+  return result;
+}
+
+}  // namespace
+
 char Z3CondSimplify::ID = 0;
 
 Z3CondSimplify::Z3CondSimplify(clang::ASTContext &ctx,
-                               rellic::IRToASTVisitor &ast_gen)
+                               rellic::IRToASTVisitor &ast_gen,
+                               rellic::Z3Solver &solver)
     : ModulePass(Z3CondSimplify::ID),
       ast_ctx(&ctx),
       ast_gen(&ast_gen),
-      z3_ctx(new z3::context()),
-      z3_gen(new rellic::Z3ConvVisitor(ast_ctx, z3_ctx.get())),
-      z3_simplifier(*z3_ctx, "simplify") {}
+      solver(&solver),
+      z3_ctx(&solver.GetZ3Context()),
+      z3_gen(&solver.GetZ3ConvVisitor()),
+      z3_simplifier(*z3_ctx, "simplify"),
+      z3_simplifier_key("simplify") {}
+
+void Z3CondSimplify::SetAdaptiveSimplifier() {
+  static const struct {
+    const char *name;
+    const char *chain;
+  } kPaths[] = {
+      // Large conditions of any theory
+      {"large", "simplify"},
+      // Small conditions without bit-vectors
+      {"bool-small", "aig,simplify"},
+      // Other conditions without bit-vectors
+      {"bool", "aig,elim-and,tseitin-cnf,ctx-simplify"},
+      // Other conditions with bit-vectors
+      {"bv", "aig,propagate-bv-bounds,elim-and,tseitin-cnf,ctx-simplify"},
+  };
+  paths.clear();
+  for (auto &path : kPaths) {
+    paths.push_back({path.name, path.chain, CreateTactic(*z3_ctx, path.chain)});
+  }
+  z3_simplifier = paths.back().tactic;
+  z3_simplifier_key = "auto";
+}
+
+Z3CondSimplify::TacticPath &Z3CondSimplify::SelectPath(z3::expr expr) {
+  GoalShape shape;
+  std::unordered_map<unsigned, unsigned> depths;
+  auto depth{MeasureGoal(expr, shape, depths)};
+  if (shape.size > kLargeGoal || depth > kDeepGoal) {
+    return paths[0];
+  } else if (!shape.bitvector) {
+    return paths[shape.size <= kSmallGoal ? 1 : 2];
+  }
+  return paths[3];
+}
 
 clang::Expr *Z3CondSimplify::SimplifyCExpr(clang::Expr *c_expr) {
+  // Conditions that came out of an earlier round stay as they are
+  if (solver->IsSimplified(z3_simplifier_key, c_expr)) {
+    return c_expr;
+  }
   auto z3_expr = z3_gen->GetOrCreateZ3Expr(c_expr);
-  z3::goal goal(*z3_ctx);
-  goal.add(z3_expr);
-  // Apply on `z3_simplifier` on condition
-  auto app = z3_simplifier(goal);
-  CHECK(app.size() == 1) << "Unexpected multiple goals in application!";
-  auto z3_result = app[0].as_expr();
-  return z3_gen->GetOrCreateCExpr(z3_result);
+  // Apply `z3_simplifier`, or the chain that fits the condition. Results
+  // are cached under the key of the chain itself.
+  auto tactic{&z3_simplifier};
+  auto key{&z3_simplifier_key};
+  if (!paths.empty()) {
+    auto &path{SelectPath(z3_expr)};
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddZ3TacticPath(path.name);
+    }
+    tactic = &path.tactic;
+    key = &path.key;
+  }
+  z3::expr z3_result(*z3_ctx);
+  if (!solver->Simplify(*tactic, *key, z3_expr, z3_result)) {
+    // Keep the condition unsimplified
+    return c_expr;
+  }
+  auto result = z3_gen->GetOrCreateCExpr(z3_result);
+  solver->MarkSimplified(z3_simplifier_key, result);
+  return result;
 }
 
 bool Z3CondSimplify::VisitIfStmt(clang::IfStmt *stmt) {
+  solver->SetStatement(stmt);
   stmt->setCond(SimplifyCExpr(stmt->getCond()));
   return true;
 }
 
 bool Z3CondSimplify::VisitWhileStmt(clang::WhileStmt *loop) {
+  solver->SetStatement(loop);
   loop->setCond(SimplifyCExpr(loop->getCond()));
   return true;
 }
 
 bool Z3CondSimplify::VisitDoStmt(clang::DoStmt *loop) {
+  solver->SetStatement(loop);
   loop->setCond(SimplifyCExpr(loop->getCond()));
   return true;
 }
 
+bool Z3CondSimplify::TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+  // Charge Z3 queries to the budget of `fdecl`
+  solver->SetFunction(fdecl);
+  return TransformVisitor<Z3CondSimplify>::TraverseFunctionDecl(fdecl);
+}
+
 bool Z3CondSimplify::runOnModule(llvm::Module &module) {
   LOG(INFO) << "Simplifying conditions using Z3";
+  PassStats stats("Z3CondSimplify", *ast_ctx);
   Initialize();
   TraverseDecl(ast_ctx->getTranslationUnitDecl());
+  stats.Finish(substitutions.size(), changed);
   return changed;
 }
 
 llvm::ModulePass *createZ3CondSimplifyPass(clang::ASTContext &ctx,
-                                           rellic::IRToASTVisitor &gen) {
-  return new Z3CondSimplify(ctx, gen);
+                                           rellic::IRToASTVisitor &gen,
+                                           rellic::Z3Solver &solver) {
+  return new Z3CondSimplify(ctx, gen, solver);
 }
 }  // namespace rellic
\ No newline at end of file
@@ -21,9 +21,13 @@
 
 #include <z3++.h>
 
+#include <string>
+#include <vector>
+
 #include "rellic/AST/IRToASTVisitor.h"
 #include "rellic/AST/TransformVisitor.h"
 #include "rellic/AST/Z3ConvVisitor.h"
+#include "rellic/AST/Z3Solver.h"
 
 namespace rellic {
 
@@ -32,22 +36,52 @@ class Z3CondSimplify : public llvm::ModulePass,
  private:
   clang::ASTContext *ast_ctx;
   rellic::IRToASTVisitor *ast_gen;
-  std::unique_ptr<z3::context> z3_ctx;
-  std::unique_ptr<rellic::Z3ConvVisitor> z3_gen;
+  rellic::Z3Solver *solver;
+  z3::context *z3_ctx;
+  rellic::Z3ConvVisitor *z3_gen;
 
   z3::tactic z3_simplifier;
+  // Describes `z3_simplifier` to the simplification cache of `solver`
+  std::string z3_simplifier_key;
+
+  // Tactic chains that the adaptive simplifier picks from. Empty unless
+  // `SetAdaptiveSimplifier` was called.
+  struct TacticPath {
+    const char *name;
+    std::string key;
+    z3::tactic tactic;
+  };
+  std::vector<TacticPath> paths;
+
+  // Picks the chain of `paths` that fits the shape of `expr`
+  TacticPath &SelectPath(z3::expr expr);
 
   clang::Expr *SimplifyCExpr(clang::Expr *c_expr);
 
  public:
   static char ID;
 
-  Z3CondSimplify(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen);
+  Z3CondSimplify(clang::ASTContext &ctx, rellic::IRToASTVisitor &ast_gen,
+                 rellic::Z3Solver &solver);
 
   z3::context &GetZ3Context() { return *z3_ctx; }
   
-  void SetZ3Simplifier(z3::tactic tactic) { z3_simplifier = tactic; };
+  // Sets the tactic that simplifies conditions. `key` describes it, e.g.
+  // "aig,simplify", and must differ between tactics that do not simplify
+  // the same.
+  void SetZ3Simplifier(z3::tactic tactic, std::string key) {
+    z3_simplifier = tactic;
+    z3_simplifier_key = key;
+    paths.clear();
+  };
+
+  // Picks a tactic chain for every condition by its size, depth and
+  // whether it reasons about bit-vectors, instead of using one chain for
+  // all of them. Cheap chains are used for small boolean conditions, and
+  // for conditions so large that the full chain would likely time out.
+  void SetAdaptiveSimplifier();
 
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl);
   bool VisitIfStmt(clang::IfStmt *stmt);
   bool VisitWhileStmt(clang::WhileStmt *loop);
   bool VisitDoStmt(clang::DoStmt *loop);
@@ -56,7 +90,8 @@ class Z3CondSimplify : public llvm::ModulePass,
 };
 
 llvm::ModulePass *createZ3CondSimplifyPass(clang::ASTContext &ctx,
-                                           rellic::IRToASTVisitor &gen);
+                                           rellic::IRToASTVisitor &gen,
+                                           rellic::Z3Solver &solver);
 }  // namespace rellic
 
 namespace llvm {
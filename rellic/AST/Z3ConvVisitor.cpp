@@ -79,21 +79,44 @@ static bool IsSignExt(z3::expr op) {
   return false;
 }
 
-static std::string CreateZ3DeclName(clang::NamedDecl *decl) {
-  std::stringstream ss;
-  ss << std::hex << decl << std::dec;
-  ss << '_' << decl->getNameAsString();
-  return ss.str();
-}
-
 }  // namespace
 
 Z3ConvVisitor::Z3ConvVisitor(clang::ASTContext *c_ctx, z3::context *z3_ctx)
     : ast_ctx(c_ctx),
+      types(&TypeCache::Get(*c_ctx)),
       z3_ctx(z3_ctx),
       z3_expr_vec(*z3_ctx),
+      c_expr_keys(*z3_ctx),
       z3_decl_vec(*z3_ctx) {}
 
+void Z3ConvVisitor::ClearExprs() {
+  z3_expr_vec = z3::expr_vector(*z3_ctx);
+  z3_expr_map.clear();
+  c_expr_keys = z3::expr_vector(*z3_ctx);
+  c_expr_map.clear();
+}
+
+void Z3ConvVisitor::Clear() {
+  ClearExprs();
+  z3_decl_vec = z3::func_decl_vector(*z3_ctx);
+  z3_decl_map.clear();
+  c_decl_map.clear();
+}
+
+size_t Z3ConvVisitor::GetMemoryUsage() const {
+  return z3_expr_map.getMemorySize() + c_expr_map.getMemorySize() +
+         z3_decl_map.getMemorySize() + c_decl_map.getMemorySize() +
+         (z3_expr_vec.size() + c_expr_keys.size() + z3_decl_vec.size()) *
+             sizeof(void *);
+}
+
+// Names Z3 constants after their declaration and number them, so that
+// they are unique without formatting pointers. `!` can't collide with
+// function names, which are used as they are.
+std::string Z3ConvVisitor::CreateZ3DeclName(clang::NamedDecl *decl) {
+  return decl->getNameAsString() + '!' + std::to_string(z3_decl_vec.size());
+}
+
 // Inserts a `clang::Expr` <=> `z3::expr` mapping into
 void Z3ConvVisitor::InsertZ3Expr(clang::Expr *c_expr, z3::expr z_expr) {
   CHECK(c_expr) << "Inserting null clang::Expr key.";
@@ -158,15 +181,16 @@ z3::expr Z3ConvVisitor::Z3BoolToBVCast(z3::expr expr) {
 void Z3ConvVisitor::InsertCExpr(z3::expr z_expr, clang::Expr *c_expr) {
   CHECK(bool(z_expr)) << "Inserting null z3::expr key.";
   CHECK(c_expr) << "Inserting null clang::Expr value.";
-  auto hash{z_expr.hash()};
-  CHECK(!c_expr_map.count(hash)) << "z3::expr key already exists.";
-  c_expr_map[hash] = c_expr;
+  auto id{Z3_get_ast_id(*z3_ctx, z_expr)};
+  CHECK(!c_expr_map.count(id)) << "z3::expr key already exists.";
+  c_expr_map[id] = c_expr;
+  c_expr_keys.push_back(z_expr);
 }
 
 clang::Expr *Z3ConvVisitor::GetCExpr(z3::expr z_expr) {
-  auto hash{z_expr.hash()};
-  CHECK(c_expr_map.count(hash)) << "No Z3 equivalent for C declaration!";
-  return c_expr_map[hash];
+  auto iter{c_expr_map.find(Z3_get_ast_id(*z3_ctx, z_expr))};
+  CHECK(iter != c_expr_map.end()) << "No Z3 equivalent for C declaration!";
+  return iter->second;
 }
 
 void Z3ConvVisitor::InsertCValDecl(z3::func_decl z_decl,
@@ -180,8 +204,9 @@ void Z3ConvVisitor::InsertCValDecl(z3::func_decl z_decl,
 
 clang::ValueDecl *Z3ConvVisitor::GetCValDecl(z3::func_decl z_decl) {
   auto id{Z3_get_func_decl_id(*z3_ctx, z_decl)};
-  CHECK(c_decl_map.count(id)) << "No C equivalent for Z3 declaration!";
-  return c_decl_map[id];
+  auto iter{c_decl_map.find(id)};
+  CHECK(iter != c_decl_map.end()) << "No C equivalent for Z3 declaration!";
+  return iter->second;
 }
 
 z3::sort Z3ConvVisitor::GetZ3Sort(clang::QualType type) {
@@ -240,8 +265,7 @@ clang::Expr *Z3ConvVisitor::CreateLiteralExpr(z3::expr z_expr) {
     } break;
 
     case Z3_BV_SORT: {
-      auto type{GetLeastIntTypeForBitWidth(*ast_ctx, GetZ3SortSize(sort),
-                                           /*sign=*/0)};
+      auto type{types->GetIntType(GetZ3SortSize(sort), /*sign=*/false)};
       auto size{ast_ctx->getTypeSize(type)};
       llvm::APInt val(size, Z3_get_numeral_string(z_expr.ctx(), z_expr), 10);
       // Handle `char` and `short` types separately, because clang
@@ -328,7 +352,7 @@ z3::func_decl Z3ConvVisitor::GetOrCreateZ3Decl(clang::ValueDecl *c_decl) {
 
 // Retrieves or creates `clang::Expr` from `z3::expr`.
 clang::Expr *Z3ConvVisitor::GetOrCreateCExpr(z3::expr z_expr) {
-  if (!c_expr_map.count(z_expr.hash())) {
+  if (!c_expr_map.count(Z3_get_ast_id(*z3_ctx, z_expr))) {
     VisitZ3Expr(z_expr);
   }
   return GetCExpr(z_expr);
@@ -377,7 +401,7 @@ bool Z3ConvVisitor::VisitFunctionDecl(clang::FunctionDecl *func) {
     return true;
   }
 
-  auto fptr_type = ast_ctx->getPointerType(func->getType());
+  auto fptr_type = types->GetPointerType(func->getType());
   auto z_sort = z3::to_sort(
       *z3_ctx, Z3_mk_bv_sort(*z3_ctx, ast_ctx->getTypeSize(fptr_type)));
   auto z_const = z3_ctx->constant(name.c_str(), z_sort);
@@ -940,8 +964,8 @@ void Z3ConvVisitor::VisitUnaryApp(z3::expr z_op) {
     //  * `m`   is a bitmask integer literal
     case Z3_OP_EXTRACT: {
       if (z_op.lo() != 0) {
-        auto t_uint{GetLeastIntTypeForBitWidth(
-            *ast_ctx, ast_ctx->getTypeSize(c_sub->getType()), /*sign=*/0)};
+        auto t_uint{types->GetIntType(
+            ast_ctx->getTypeSize(c_sub->getType()), /*sign=*/false)};
         auto t_uint_size{ast_ctx->getTypeSize(t_uint)};
         auto t_res{ast_ctx->getIntegerTypeOrder(t_sub, t_uint) < 0 ? t_uint
                                                                    : t_sub};
@@ -965,7 +989,7 @@ void Z3ConvVisitor::VisitUnaryApp(z3::expr z_op) {
       }
       c_op = CastExpr(
           *ast_ctx,
-          GetLeastIntTypeForBitWidth(*ast_ctx, GetZ3SortSize(z_op), /*sign=*/0),
+          types->GetIntType(GetZ3SortSize(z_op), /*sign=*/false),
           CreateParenExpr(*ast_ctx, c_sub));
     } break;
 
@@ -973,7 +997,7 @@ void Z3ConvVisitor::VisitUnaryApp(z3::expr z_op) {
       // Resolve opcode
       auto z_func_name{z_func.name().str()};
       if (z_func_name == "AddrOf") {
-        auto t_op = ast_ctx->getPointerType(t_sub);
+        auto t_op = types->GetPointerType(t_sub);
         c_op = CreateUnaryOperator(*ast_ctx, clang::UO_AddrOf, c_sub, t_op);
       } else if (z_func_name == "Deref") {
         CHECK(t_sub->isPointerType()) << "Deref operand type is not a pointer";
@@ -988,14 +1012,14 @@ void Z3ConvVisitor::VisitUnaryApp(z3::expr z_op) {
             *ast_ctx, t_op, clang::CastKind::CK_ArrayToPointerDecay, c_sub);
       } else if (z_func_name == "PtrToInt") {
         auto s_size = GetZ3SortSize(z_op);
-        auto t_op = ast_ctx->getIntTypeForBitwidth(s_size, /*sign=*/0);
+        auto t_op = types->GetIntType(s_size, /*sign=*/false);
         c_op = CreateCStyleCastExpr(
             *ast_ctx, t_op, clang::CastKind::CK_PointerToIntegral, c_sub);
       } else if (z_func_name == "BoolToBV") {
         c_op = c_sub;
       } else if (z_func_name == "FunctionToPointerDecay") {
         c_op = CreateImplicitCastExpr(
-            *ast_ctx, ast_ctx->getPointerType(c_sub->getType()),
+            *ast_ctx, types->GetPointerType(c_sub->getType()),
             clang::CastKind::CK_FunctionToPointerDecay, c_sub);
       } else {
         LOG(FATAL) << "Unknown Z3 uninterpreted unary function: "
@@ -1173,8 +1197,7 @@ void Z3ConvVisitor::VisitConcatApp(z3::expr z_op) {
   //
   //  * `t` is the smallest integer type that can fit the result
   //        of `(concat l r)`
-  auto t_res{GetLeastIntTypeForBitWidth(*ast_ctx, GetZ3SortSize(z_op),
-                                        /*sign=*/0)};
+  auto t_res{types->GetIntType(GetZ3SortSize(z_op), /*sign=*/false)};
   if (!IsSignExt(z_op)) {
     auto t_uint{ast_ctx->UnsignedIntTy};
     auto t_uint_size{ast_ctx->getTypeSize(t_uint)};
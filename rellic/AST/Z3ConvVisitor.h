@@ -17,25 +17,30 @@
 #pragma once
 
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <llvm/ADT/DenseMap.h>
 #include <z3++.h>
 
-#include <unordered_map>
+#include "rellic/AST/TypeCache.h"
 
 namespace rellic {
 
 class Z3ConvVisitor : public clang::RecursiveASTVisitor<Z3ConvVisitor> {
  private:
   clang::ASTContext *ast_ctx;
+  TypeCache *types;
   z3::context *z3_ctx;
 
   // Expression maps
   z3::expr_vector z3_expr_vec;
-  std::unordered_map<clang::Expr *, unsigned> z3_expr_map;
-  std::unordered_map<unsigned, clang::Expr *> c_expr_map;
+  llvm::DenseMap<clang::Expr *, unsigned> z3_expr_map;
+  // Keyed by Z3 AST ids, which stay unique while `c_expr_keys` keeps
+  // the keys alive
+  z3::expr_vector c_expr_keys;
+  llvm::DenseMap<unsigned, clang::Expr *> c_expr_map;
   // Declaration maps
   z3::func_decl_vector z3_decl_vec;
-  std::unordered_map<clang::ValueDecl *, unsigned> z3_decl_map;
-  std::unordered_map<unsigned, clang::ValueDecl *> c_decl_map;
+  llvm::DenseMap<clang::ValueDecl *, unsigned> z3_decl_map;
+  llvm::DenseMap<unsigned, clang::ValueDecl *> c_decl_map;
 
   void InsertZ3Expr(clang::Expr *c_expr, z3::expr z3_expr);
   z3::expr GetZ3Expr(clang::Expr *c_expr);
@@ -58,13 +63,26 @@ class Z3ConvVisitor : public clang::RecursiveASTVisitor<Z3ConvVisitor> {
 
   void VisitZ3Expr(z3::expr z3_expr);
 
+  std::string CreateZ3DeclName(clang::NamedDecl *decl);
+
  public:
   z3::func_decl GetOrCreateZ3Decl(clang::ValueDecl *c_decl);
   z3::expr GetOrCreateZ3Expr(clang::Expr *c_expr);
 
+  // Z3 hash-conses its expressions, so structurally equal expressions
+  // are converted to one shared `clang::Expr` until `ClearExprs`
   clang::Expr *GetOrCreateCExpr(z3::expr z3_expr);
 
   Z3ConvVisitor(clang::ASTContext *c_ctx, z3::context *z3_ctx);
+
+  // Forgets all converted expressions. Declarations are kept.
+  void ClearExprs();
+  // Forgets converted expressions and declarations, so that Z3 can free
+  // everything this visitor created
+  void Clear();
+  // Estimates the bytes used by the maps of this visitor, without the
+  // expressions themselves, which Z3 owns
+  size_t GetMemoryUsage() const;
   bool shouldTraversePostOrder() { return true; }
 
   z3::expr Z3BoolCast(z3::expr expr);
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/AST/Z3Prefilter.h"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace rellic {
+
+namespace {
+
+static z3::expr CreateRandomValue(z3::sort sort, std::mt19937_64 &rng) {
+  auto &ctx = sort.ctx();
+  switch (sort.sort_kind()) {
+    case Z3_BOOL_SORT:
+      return ctx.bool_val((rng() & 1U) != 0);
+
+    case Z3_BV_SORT:
+      return ctx.bv_val(static_cast<uint64_t>(rng()), sort.bv_size());
+
+    default:
+      // Left to model completion
+      return z3::expr(ctx);
+  }
+}
+
+// Appends the free constants of `expr` that aren't in `seen` to `consts`
+static void CollectConsts(z3::expr expr, std::unordered_set<unsigned> &seen,
+                          z3::func_decl_vector &consts) {
+  std::function<void(z3::expr)> Collect = [&](z3::expr expr) {
+    if (!expr.is_app() ||
+        !seen.insert(Z3_get_ast_id(expr.ctx(), expr)).second) {
+      return;
+    }
+    if (expr.is_const() && expr.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+      consts.push_back(expr.decl());
+    }
+    for (auto i = 0U; i < expr.num_args(); ++i) {
+      Collect(expr.arg(i));
+    }
+  };
+  Collect(expr);
+}
+
+// Values of a term in all simulation rounds. Booleans keep round `r` in
+// bit `r` of `bits`, so that connectives take one operation for all
+// rounds. Bit-vectors keep round `r` in `words[r]`, truncated to their
+// width, and their operators are loops over independent words that
+// compilers vectorize.
+struct SimValue {
+  uint64_t bits = 0;
+  std::array<uint64_t, kNumSimRounds> words;
+};
+
+static uint64_t GetMask(unsigned width) {
+  return width >= 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+}
+
+static int64_t ToSigned(uint64_t val, unsigned width) {
+  auto sign{uint64_t(1) << (width - 1)};
+  return static_cast<int64_t>((val ^ sign) - sign);
+}
+
+// Evaluates terms over booleans and bit-vectors of at most 64 bits in all
+// rounds at once, with the semantics of SMT-LIB. Terms of other sorts and
+// operators, e.g. uninterpreted functions, are not supported.
+class BitSimulator {
+ private:
+  z3::context &ctx;
+  // Values of the free constants, keyed by the ids of their declarations
+  const std::unordered_map<unsigned, SimValue> &consts;
+  // Values of evaluated terms, keyed by their ids. Unsupported terms map
+  // to `nullptr`.
+  std::unordered_map<unsigned, std::unique_ptr<SimValue>> values;
+
+  std::unique_ptr<SimValue> Compute(z3::expr expr);
+
+ public:
+  BitSimulator(z3::context &ctx,
+               const std::unordered_map<unsigned, SimValue> &consts)
+      : ctx(ctx), consts(consts) {}
+
+  // Returns `nullptr` if `expr` isn't supported
+  const SimValue *Eval(z3::expr expr) {
+    auto id{Z3_get_ast_id(ctx, expr)};
+    auto iter{values.find(id)};
+    if (iter != values.end()) {
+      return iter->second.get();
+    }
+    auto &value{values[id]};
+    value = Compute(expr);
+    return value.get();
+  }
+};
+
+std::unique_ptr<SimValue> BitSimulator::Compute(z3::expr expr) {
+  if (!expr.is_app()) {
+    return nullptr;
+  }
+  auto sort{expr.get_sort()};
+  unsigned width{0};
+  if (sort.is_bv()) {
+    width = sort.bv_size();
+    if (width > 64) {
+      return nullptr;
+    }
+  } else if (!sort.is_bool()) {
+    return nullptr;
+  }
+  auto decl{expr.decl()};
+  std::vector<const SimValue *> args;
+  for (auto i = 0U; i < expr.num_args(); ++i) {
+    auto arg{Eval(expr.arg(i))};
+    if (!arg) {
+      return nullptr;
+    }
+    args.push_back(arg);
+  }
+  auto ArgWidth = [&](unsigned i) {
+    auto arg_sort{expr.arg(i).get_sort()};
+    return arg_sort.is_bv() ? arg_sort.bv_size() : 0U;
+  };
+
+  std::unique_ptr<SimValue> result(new SimValue);
+  auto &bits{result->bits};
+  auto &words{result->words};
+  auto mask{GetMask(width)};
+  auto Map = [&](auto fn) {
+    for (auto r = 0U; r < kNumSimRounds; ++r) {
+      words[r] = fn(args[0]->words[r], args.size() > 1 ? args[1]->words[r]
+                                                         : uint64_t(0)) &
+                 mask;
+    }
+  };
+  auto Fold = [&](auto fn) {
+    words = args[0]->words;
+    for (auto i = 1U; i < args.size(); ++i) {
+      for (auto r = 0U; r < kNumSimRounds; ++r) {
+        words[r] = fn(words[r], args[i]->words[r]) & mask;
+      }
+    }
+  };
+  auto Compare = [&](auto fn) {
+    for (auto r = 0U; r < kNumSimRounds; ++r) {
+      bits |= uint64_t(fn(args[0]->words[r], args[1]->words[r])) << r;
+    }
+  };
+  auto SignedCompare = [&](auto fn) {
+    auto arg_width{ArgWidth(0)};
+    Compare([&](uint64_t lhs, uint64_t rhs) {
+      return fn(ToSigned(lhs, arg_width), ToSigned(rhs, arg_width));
+    });
+  };
+  auto Neg = [mask](uint64_t val) { return (0 - val) & mask; };
+  auto IsNeg = [width](uint64_t val) { return (val >> (width - 1)) & 1; };
+  auto UDiv = [mask](uint64_t lhs, uint64_t rhs) {
+    return rhs ? lhs / rhs : mask;
+  };
+  auto URem = [](uint64_t lhs, uint64_t rhs) {
+    return rhs ? lhs % rhs : lhs;
+  };
+
+  switch (decl.decl_kind()) {
+    case Z3_OP_TRUE:
+      bits = ~uint64_t(0);
+      break;
+    case Z3_OP_FALSE:
+      break;
+    case Z3_OP_UNINTERPRETED: {
+      auto iter{consts.find(Z3_get_func_decl_id(ctx, decl))};
+      if (args.size() || iter == consts.end()) {
+        return nullptr;
+      }
+      *result = iter->second;
+      break;
+    }
+    case Z3_OP_BNUM: {
+      uint64_t num;
+      if (!Z3_get_numeral_uint64(ctx, expr, &num)) {
+        return nullptr;
+      }
+      words.fill(num & mask);
+      break;
+    }
+
+    case Z3_OP_NOT:
+      bits = ~args[0]->bits;
+      break;
+    case Z3_OP_AND:
+      bits = ~uint64_t(0);
+      for (auto arg : args) {
+        bits &= arg->bits;
+      }
+      break;
+    case Z3_OP_OR:
+      for (auto arg : args) {
+        bits |= arg->bits;
+      }
+      break;
+    case Z3_OP_XOR:
+      for (auto arg : args) {
+        bits ^= arg->bits;
+      }
+      break;
+    case Z3_OP_IFF:
+      bits = ~(args[0]->bits ^ args[1]->bits);
+      break;
+    case Z3_OP_IMPLIES:
+      bits = ~args[0]->bits | args[1]->bits;
+      break;
+    case Z3_OP_EQ:
+    case Z3_OP_DISTINCT:
+      if (args.size() != 2) {
+        return nullptr;
+      }
+      if (ArgWidth(0)) {
+        Compare([](uint64_t lhs, uint64_t rhs) { return lhs == rhs; });
+      } else {
+        bits = ~(args[0]->bits ^ args[1]->bits);
+      }
+      if (decl.decl_kind() == Z3_OP_DISTINCT) {
+        bits = ~bits;
+      }
+      break;
+    case Z3_OP_ITE: {
+      auto cond{args[0]->bits};
+      if (!width) {
+        bits = (cond & args[1]->bits) | (~cond & args[2]->bits);
+        break;
+      }
+      for (auto r = 0U; r < kNumSimRounds; ++r) {
+        words[r] =
+            (cond >> r) & 1 ? args[1]->words[r] : args[2]->words[r];
+      }
+      break;
+    }
+
+    case Z3_OP_ULEQ:
+      Compare([](uint64_t lhs, uint64_t rhs) { return lhs <= rhs; });
+      break;
+    case Z3_OP_UGEQ:
+      Compare([](uint64_t lhs, uint64_t rhs) { return lhs >= rhs; });
+      break;
+    case Z3_OP_ULT:
+      Compare([](uint64_t lhs, uint64_t rhs) { return lhs < rhs; });
+      break;
+    case Z3_OP_UGT:
+      Compare([](uint64_t lhs, uint64_t rhs) { return lhs > rhs; });
+      break;
+    case Z3_OP_SLEQ:
+      SignedCompare([](int64_t lhs, int64_t rhs) { return lhs <= rhs; });
+      break;
+    case Z3_OP_SGEQ:
+      SignedCompare([](int64_t lhs, int64_t rhs) { return lhs >= rhs; });
+      break;
+    case Z3_OP_SLT:
+      SignedCompare([](int64_t lhs, int64_t rhs) { return lhs < rhs; });
+      break;
+    case Z3_OP_SGT:
+      SignedCompare([](int64_t lhs, int64_t rhs) { return lhs > rhs; });
+      break;
+
+    case Z3_OP_BNEG:
+      Map([](uint64_t val, uint64_t) { return 0 - val; });
+      break;
+    case Z3_OP_BNOT:
+      Map([](uint64_t val, uint64_t) { return ~val; });
+      break;
+    case Z3_OP_BADD:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs + rhs; });
+      break;
+    case Z3_OP_BSUB:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs - rhs; });
+      break;
+    case Z3_OP_BMUL:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs * rhs; });
+      break;
+    case Z3_OP_BAND:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs & rhs; });
+      break;
+    case Z3_OP_BOR:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs | rhs; });
+      break;
+    case Z3_OP_BXOR:
+      Fold([](uint64_t lhs, uint64_t rhs) { return lhs ^ rhs; });
+      break;
+    case Z3_OP_BSHL:
+      Map([width](uint64_t lhs, uint64_t rhs) {
+        return rhs >= width ? 0 : lhs << rhs;
+      });
+      break;
+    case Z3_OP_BLSHR:
+      Map([width](uint64_t lhs, uint64_t rhs) {
+        return rhs >= width ? 0 : lhs >> rhs;
+      });
+      break;
+    case Z3_OP_BASHR:
+      Map([width](uint64_t lhs, uint64_t rhs) {
+        auto val{ToSigned(lhs, width)};
+        return static_cast<uint64_t>(val >> std::min<uint64_t>(rhs, 63));
+      });
+      break;
+    case Z3_OP_BUDIV:
+      Map(UDiv);
+      break;
+    case Z3_OP_BUREM:
+      Map(URem);
+      break;
+    case Z3_OP_BSDIV:
+      Map([&](uint64_t lhs, uint64_t rhs) {
+        auto quot{UDiv(IsNeg(lhs) ? Neg(lhs) : lhs,
+                       IsNeg(rhs) ? Neg(rhs) : rhs)};
+        return IsNeg(lhs) != IsNeg(rhs) ? Neg(quot) : quot;
+      });
+      break;
+    case Z3_OP_BSREM:
+      Map([&](uint64_t lhs, uint64_t rhs) {
+        auto rem{URem(IsNeg(lhs) ? Neg(lhs) : lhs,
+                      IsNeg(rhs) ? Neg(rhs) : rhs)};
+        return IsNeg(lhs) ? Neg(rem) : rem;
+      });
+      break;
+
+    case Z3_OP_CONCAT:
+      words = args[0]->words;
+      for (auto i = 1U; i < args.size(); ++i) {
+        auto arg_width{ArgWidth(i)};
+        for (auto r = 0U; r < kNumSimRounds; ++r) {
+          words[r] = (words[r] << arg_width) | args[i]->words[r];
+        }
+      }
+      break;
+    case Z3_OP_EXTRACT: {
+      auto low{Z3_get_decl_int_parameter(ctx, decl, 1)};
+      Map([low](uint64_t val, uint64_t) { return val >> low; });
+      break;
+    }
+    case Z3_OP_ZERO_EXT:
+      words = args[0]->words;
+      break;
+    case Z3_OP_SIGN_EXT: {
+      auto arg_width{ArgWidth(0)};
+      Map([arg_width](uint64_t val, uint64_t) {
+        return static_cast<uint64_t>(ToSigned(val, arg_width));
+      });
+      break;
+    }
+
+    default:
+      return nullptr;
+  }
+  return result;
+}
+
+static bool IsNegationOf(z3::expr lhs, z3::expr rhs) {
+  return lhs.is_app() && lhs.decl().decl_kind() == Z3_OP_NOT &&
+         z3::eq(lhs.arg(0), rhs);
+}
+
+}  // namespace
+
+void Simulate(z3::context &ctx, z3::expr_vector &conds,
+              std::vector<uint64_t> &sigs, std::vector<bool> &known) {
+  sigs.assign(conds.size(), 0);
+  known.assign(conds.size(), true);
+  // Gather free constants
+  z3::func_decl_vector consts(ctx);
+  std::unordered_set<unsigned> seen;
+  for (auto i = 0U; i < conds.size(); ++i) {
+    CollectConsts(conds[i], seen, consts);
+  }
+  // Draw the values of all rounds up front, with a fixed seed so that
+  // output is reproducible
+  std::mt19937_64 rng(conds.size());
+  std::vector<z3::expr_vector> rounds;
+  std::unordered_map<unsigned, SimValue> values;
+  for (auto r = 0U; r < kNumSimRounds; ++r) {
+    rounds.emplace_back(ctx);
+    for (auto i = 0U; i < consts.size(); ++i) {
+      auto decl = consts[i];
+      auto val = CreateRandomValue(decl.range(), rng);
+      rounds.back().push_back(val);
+      auto sort = decl.range();
+      if (!bool(val) || (sort.is_bv() && sort.bv_size() > 64)) {
+        continue;
+      }
+      auto &value = values[Z3_get_func_decl_id(ctx, decl)];
+      if (val.is_bool()) {
+        value.bits |= uint64_t(val.is_true()) << r;
+      } else {
+        value.words[r] = val.get_numeral_uint64();
+      }
+    }
+  }
+  // Simulate all rounds at once where possible, and leave all other
+  // conditions to Z3
+  BitSimulator sim(ctx, values);
+  std::vector<unsigned> rest;
+  for (auto i = 0U; i < conds.size(); ++i) {
+    auto value = conds[i].is_bool() ? sim.Eval(conds[i]) : nullptr;
+    if (value) {
+      sigs[i] = value->bits;
+    } else {
+      rest.push_back(i);
+    }
+  }
+  if (rest.empty()) {
+    return;
+  }
+  for (auto r = 0U; r < kNumSimRounds; ++r) {
+    z3::model model(ctx, Z3_mk_model(ctx));
+    for (auto i = 0U; i < consts.size(); ++i) {
+      auto val = rounds[r][i];
+      if (bool(val)) {
+        Z3_add_const_interp(ctx, model, consts[i], val);
+      }
+    }
+    for (auto i : rest) {
+      auto val = model.eval(conds[i], /*model_completion=*/true);
+      switch (Z3_get_bool_value(ctx, val)) {
+        case Z3_L_TRUE:
+          sigs[i] |= uint64_t(1) << r;
+          break;
+
+        case Z3_L_FALSE:
+          break;
+
+        default:
+          known[i] = false;
+          break;
+      }
+    }
+  }
+}
+
+std::vector<unsigned> GetSupport(z3::expr expr) {
+  z3::func_decl_vector consts(expr.ctx());
+  std::unordered_set<unsigned> seen;
+  CollectConsts(expr, seen, consts);
+  std::vector<unsigned> result;
+  for (auto i = 0U; i < consts.size(); ++i) {
+    result.push_back(Z3_get_func_decl_id(expr.ctx(), consts[i]));
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+bool SharesSupport(const std::vector<unsigned> &lhs,
+                   const std::vector<unsigned> &rhs) {
+  auto l{lhs.begin()};
+  auto r{rhs.begin()};
+  while (l != lhs.end() && r != rhs.end()) {
+    if (*l < *r) {
+      ++l;
+    } else if (*r < *l) {
+      ++r;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsSyntacticallyEquivalent(z3::expr lhs, z3::expr rhs, bool negated) {
+  if (!negated) {
+    return z3::eq(lhs, rhs);
+  }
+  return IsNegationOf(lhs, rhs) || IsNegationOf(rhs, lhs);
+}
+
+}  // namespace rellic
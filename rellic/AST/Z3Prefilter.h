@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <z3++.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace rellic {
+
+// Cheap tests that answer some queries about conditions without a solver.
+// Tests that can't decide a query leave it to the solver, so they are
+// sound whenever they do decide one.
+
+// Number of random assignments that condition signatures are made of
+static constexpr unsigned kNumSimRounds = 64;
+
+// Evaluates `conds` under `kNumSimRounds` random assignments of their free
+// constants. Bit `r` of `sigs[i]` is the value of `conds[i]` in round `r`,
+// so equivalent conditions get equal signatures and complementary ones get
+// complementary signatures. `known[i]` is cleared if `conds[i]` did not
+// evaluate to a boolean constant.
+//
+// Conditions over booleans and bit-vectors of at most 64 bits are
+// evaluated in all rounds at once, one word per round. Only conditions
+// with other terms are evaluated by Z3, under the same assignments.
+void Simulate(z3::context &ctx, z3::expr_vector &conds,
+              std::vector<uint64_t> &sigs, std::vector<bool> &known);
+
+// Returns the sorted ids of the free constants of `expr`
+std::vector<unsigned> GetSupport(z3::expr expr);
+
+// Returns `true` if the sorted supports `lhs` and `rhs` share a constant.
+// Conditions with disjoint, non-empty supports can only be equivalent if
+// both are constant.
+bool SharesSupport(const std::vector<unsigned> &lhs,
+                   const std::vector<unsigned> &rhs);
+
+// Returns `true` if `lhs` and `rhs` are the same expression, or if
+// `negated`, if one is the negation of the other
+bool IsSyntacticallyEquivalent(z3::expr lhs, z3::expr rhs, bool negated);
+
+}  // namespace rellic
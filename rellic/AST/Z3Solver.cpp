@@ -0,0 +1,901 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/AST/Z3Solver.h"
+
+#include <clang/AST/Stmt.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <vector>
+
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/Trace.h"
+
+namespace rellic {
+
+namespace {
+
+// Tactic that decides the queries of `Prove`
+static const char *kProverTactic = "sat";
+
+// Lines of the originating statement that a slow query file shows
+static constexpr unsigned kMaxStatementLines = 16;
+
+// Numbers the files of the slow query log of the whole process
+static std::atomic<unsigned> num_slow_queries{0};
+
+// Solvers of the process that are refining a function. Z3 only counts the
+// memory of the whole process, so each of them is charged an even share
+// of its growth.
+static std::atomic<unsigned> num_active_solvers{0};
+
+// Feeds a canonical serialization of the DAG of `root` into an MD5 hash.
+// Every node is serialized once, refering to its arguments by index.
+class QueryDigest {
+ private:
+  z3::context &ctx;
+  llvm::MD5 md5;
+  std::unordered_map<unsigned, unsigned> nodes;
+  std::unordered_map<unsigned, unsigned> symbols;
+
+  unsigned Visit(z3::expr expr) {
+    auto id{Z3_get_ast_id(ctx, expr)};
+    auto iter{nodes.find(id)};
+    if (iter != nodes.end()) {
+      return iter->second;
+    }
+
+    std::string node;
+    llvm::raw_string_ostream os(node);
+    if (expr.is_numeral()) {
+      os << '#' << Z3_get_numeral_string(ctx, expr);
+    } else if (expr.is_app()) {
+      auto decl{expr.decl()};
+      if (decl.decl_kind() == Z3_OP_UNINTERPRETED) {
+        auto sym{Z3_get_func_decl_id(ctx, decl)};
+        unsigned num = symbols.size();
+        os << 'u' << symbols.insert({sym, num}).first->second;
+      } else {
+        os << decl.name().str();
+        for (auto i = 0U; i < Z3_get_decl_num_parameters(ctx, decl); ++i) {
+          if (Z3_get_decl_parameter_kind(ctx, decl, i) ==
+              Z3_PARAMETER_INT) {
+            os << ':' << Z3_get_decl_int_parameter(ctx, decl, i);
+          }
+        }
+      }
+      for (auto i = 0U; i < expr.num_args(); ++i) {
+        os << ' ' << Visit(expr.arg(i));
+      }
+    } else {
+      LOG(FATAL) << "Unexpected Z3 expression in query: " << expr;
+    }
+    os << " : " << expr.get_sort().to_string() << '\n';
+
+    md5.update(os.str());
+    auto idx{nodes.size()};
+    nodes[id] = idx;
+    return idx;
+  }
+
+ public:
+  QueryDigest(z3::context &ctx) : ctx(ctx) {}
+
+  std::string Get(z3::expr root) {
+    Visit(root);
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+    return result.digest().str().str();
+  }
+};
+
+static void SetContextLimits(z3::context &ctx, unsigned timeout,
+                             unsigned rlimit) {
+  // Z3 treats a timeout of `UINT_MAX` and a resource limit of 0 as
+  // unlimited
+  ctx.set("timeout", std::to_string(timeout ? timeout : UINT_MAX).c_str());
+  ctx.set("rlimit", std::to_string(rlimit).c_str());
+}
+
+// Applies `tactic` to `goal` and stores its only subgoal in `result`.
+// Returns false if the tactic failed, e.g. because it ran into a limit.
+// Rellic is built without exceptions, so the error is read from the
+// context instead of letting z3::tactic::apply wrap a null result.
+static bool TryApply(z3::context &ctx, z3::tactic &tactic, z3::goal &goal,
+                     z3::goal &result) {
+  auto app{Z3_tactic_apply(ctx, tactic, goal)};
+  if (!app || Z3_get_error_code(ctx) != Z3_OK) {
+    return false;
+  }
+  z3::apply_result subgoals(ctx, app);
+  CHECK(subgoals.size() == 1) << "Unexpected multiple goals in application!";
+  result = subgoals[0];
+  return true;
+}
+
+// Applies `prover` to the negation of a query. Sets `failed` if a
+// `limited` proof gave up.
+static bool RunProver(z3::context &ctx, z3::tactic &prover, z3::expr negated,
+                      bool limited, bool &failed) {
+  z3::goal goal(ctx);
+  goal.add(negated);
+  z3::goal decided(ctx);
+  if (!TryApply(ctx, prover, goal, decided)) {
+    failed = true;
+    return false;
+  }
+  auto result{decided.is_decided_unsat()};
+  // Limited tactics give up by leaving the goal undecided
+  failed = limited && !result && !decided.is_decided_sat();
+  return result;
+}
+
+// Replaces opaque bit-vector atoms, e.g. the uninterpreted `ArraySub`,
+// `Member` and `CallFunc` terms of pointers, whose every occurrence is an
+// operand of an equality with other such atoms or numerals. Only the
+// equalities between them can then matter, and those have a model in a
+// sort that is just wide enough to give every atom and numeral its own
+// value, so the atoms and numerals are renamed into that sort. Atoms that
+// the query otherwise would have to be equal by congruence may get
+// different values, so an unsatisfiable abstraction implies that the
+// query is unsatisfiable, but not the other way around.
+class AtomAbstraction {
+ private:
+  z3::context &ctx;
+  std::unordered_set<unsigned> visited;
+  // Atoms, and whether all their occurrences allow abstraction
+  std::unordered_map<unsigned, bool> atoms;
+  // Equalities whose operands are all atoms or numerals
+  std::vector<z3::expr> equalities;
+  std::unordered_map<unsigned, z3::expr> rewritten;
+  std::unordered_map<unsigned, unsigned> values;
+  unsigned width = 0;
+
+  static bool IsAtom(z3::expr expr) {
+    return expr.is_bv() && expr.is_app() &&
+           expr.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+  }
+
+  static bool IsEquality(z3::expr expr) {
+    if (!expr.is_app() || expr.num_args() < 2 || !expr.arg(0).is_bv()) {
+      return false;
+    }
+    auto kind{expr.decl().decl_kind()};
+    return kind == Z3_OP_EQ || kind == Z3_OP_DISTINCT;
+  }
+
+  static bool IsPureEquality(z3::expr expr) {
+    if (!IsEquality(expr)) {
+      return false;
+    }
+    for (auto i = 0U; i < expr.num_args(); ++i) {
+      if (!IsAtom(expr.arg(i)) && !expr.arg(i).is_numeral()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  unsigned GetId(z3::expr expr) { return Z3_get_ast_id(ctx, expr); }
+
+  void Collect(z3::expr expr) {
+    if (!expr.is_app() || !visited.insert(GetId(expr)).second) {
+      return;
+    }
+    auto pure{IsPureEquality(expr)};
+    if (pure) {
+      equalities.push_back(expr);
+    }
+    for (auto i = 0U; i < expr.num_args(); ++i) {
+      auto arg{expr.arg(i)};
+      if (IsAtom(arg)) {
+        auto iter{atoms.emplace(GetId(arg), true).first};
+        iter->second &= pure;
+      }
+      Collect(arg);
+    }
+  }
+
+  bool IsAbstracted(z3::expr expr) {
+    auto iter{atoms.find(GetId(expr))};
+    return iter != atoms.end() && iter->second;
+  }
+
+  // Atoms of an equality are either all abstracted or none of them
+  bool HasAbstractedAtoms(z3::expr eq) {
+    for (auto i = 0U; i < eq.num_args(); ++i) {
+      if (IsAbstracted(eq.arg(i))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  z3::expr GetValue(z3::expr operand) {
+    // Z3 shares equal terms, so every numeral and atom is numbered once
+    auto iter{values.emplace(GetId(operand), values.size()).first};
+    if (operand.is_numeral()) {
+      return ctx.bv_val(iter->second, width);
+    }
+    auto name{"!atom" + std::to_string(iter->second)};
+    return ctx.bv_const(name.c_str(), width);
+  }
+
+  z3::expr Rewrite(z3::expr expr) {
+    if (!expr.is_app() || expr.num_args() == 0) {
+      return expr;
+    }
+    auto id{GetId(expr)};
+    auto iter{rewritten.find(id)};
+    if (iter != rewritten.end()) {
+      return iter->second;
+    }
+    z3::expr_vector args(ctx);
+    auto changed{false};
+    if (IsPureEquality(expr) && HasAbstractedAtoms(expr)) {
+      for (auto i = 0U; i < expr.num_args(); ++i) {
+        args.push_back(GetValue(expr.arg(i)));
+      }
+      // The declarations of equalities are specific to the old sort
+      z3::expr result(ctx);
+      if (expr.decl().decl_kind() == Z3_OP_EQ) {
+        result = args[0] == args[1];
+        for (auto i = 2U; i < args.size(); ++i) {
+          result = result && args[i - 1] == args[i];
+        }
+      } else {
+        result = z3::distinct(args);
+      }
+      rewritten.emplace(id, result);
+      return result;
+    } else {
+      for (auto i = 0U; i < expr.num_args(); ++i) {
+        args.push_back(Rewrite(expr.arg(i)));
+        changed |= !z3::eq(args.back(), expr.arg(i));
+      }
+    }
+    auto result{changed ? expr.decl()(args) : expr};
+    rewritten.emplace(id, result);
+    return result;
+  }
+
+ public:
+  AtomAbstraction(z3::context &ctx) : ctx(ctx) {}
+
+  z3::expr Abstract(z3::expr query) {
+    Collect(query);
+    // An equality can only be renamed as a whole, so all atoms of an
+    // equality with an atom that can't be abstracted stay as they are
+    for (auto changed = true; changed;) {
+      changed = false;
+      for (auto &eq : equalities) {
+        auto all{true};
+        for (auto i = 0U; i < eq.num_args() && all; ++i) {
+          all = !IsAtom(eq.arg(i)) || IsAbstracted(eq.arg(i));
+        }
+        for (auto i = 0U; i < eq.num_args() && !all; ++i) {
+          auto arg{eq.arg(i)};
+          if (IsAbstracted(arg)) {
+            atoms[GetId(arg)] = false;
+            changed = true;
+          }
+        }
+      }
+    }
+    // Count the atoms and numerals that need a value of their own
+    std::unordered_set<unsigned> operands;
+    unsigned max_width = 0;
+    for (auto &eq : equalities) {
+      if (!HasAbstractedAtoms(eq)) {
+        continue;
+      }
+      for (auto i = 0U; i < eq.num_args(); ++i) {
+        operands.insert(GetId(eq.arg(i)));
+        max_width = std::max(max_width, eq.arg(i).get_sort().bv_size());
+      }
+    }
+    width = 1;
+    while ((1ULL << width) < operands.size()) {
+      ++width;
+    }
+    if (width >= max_width) {
+      return query;
+    }
+    return Rewrite(query);
+  }
+};
+
+}  // namespace
+
+struct Z3Solver::Worker {
+  z3::context ctx;
+  z3::tactic prover;
+  // Negated queries, and the indices they have in the batch
+  z3::expr_vector queries;
+  std::vector<unsigned> indices;
+  std::vector<bool> results;
+  std::vector<bool> failed;
+  std::vector<double> seconds;
+
+  Worker() : prover(ctx, kProverTactic), queries(ctx) {}
+
+  void Add(unsigned idx, z3::context &src, z3::expr negated) {
+    indices.push_back(idx);
+    queries.push_back(z3::to_expr(ctx, Z3_translate(src, negated, ctx)));
+  }
+
+  void Run(unsigned timeout, unsigned rlimit, std::string function,
+           CancellationToken *cancellation) {
+    auto limited{timeout || rlimit};
+    if (limited) {
+      SetContextLimits(ctx, timeout, rlimit);
+    }
+    results.assign(queries.size(), false);
+    failed.assign(queries.size(), false);
+    seconds.assign(queries.size(), 0.0);
+    CancellationToken::Guard guard(cancellation, ctx);
+    for (auto i = 0U; i < queries.size(); ++i) {
+      if (cancellation && cancellation->IsCancelled()) {
+        failed[i] = true;
+        continue;
+      }
+      TraceSpan span("prove", "z3", function);
+      StatsTimer timer;
+      bool fail;
+      results[i] = RunProver(ctx, prover, queries[i], limited, fail);
+      // Interrupted proofs look like undecided ones without limits
+      failed[i] = fail || (cancellation && cancellation->IsCancelled());
+      seconds[i] = timer.GetSeconds();
+    }
+    if (limited) {
+      SetContextLimits(ctx, 0, 0);
+    }
+  }
+
+  void Clear() {
+    queries = z3::expr_vector(ctx);
+    indices.clear();
+  }
+};
+
+bool Z3ProofCache::Lookup(const std::string &key, bool &result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter{proofs.find(key)};
+  if (iter == proofs.end()) {
+    return false;
+  }
+  result = iter->second;
+  return true;
+}
+
+void Z3ProofCache::Insert(const std::string &key, bool result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  proofs[key] = result;
+}
+
+bool Z3ProofCache::Load(const std::string &path) {
+  auto buf{llvm::MemoryBuffer::getFile(path)};
+  if (!buf) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  for (llvm::line_iterator line(**buf); !line.is_at_eof(); ++line) {
+    // Entries are `<digest> <0|1>`
+    auto entry{line->split(' ')};
+    if (entry.second != "0" && entry.second != "1") {
+      LOG(WARNING) << "Ignoring malformed proof cache entry: " << line->str();
+      continue;
+    }
+    proofs[entry.first.str()] = entry.second == "1";
+  }
+  return true;
+}
+
+bool Z3ProofCache::Save(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    LOG(ERROR) << "Failed to write proof cache: " << ec.message();
+    return false;
+  }
+  // Sort entries so that the file is stable between runs
+  std::vector<std::pair<std::string, bool>> entries(proofs.begin(),
+                                                    proofs.end());
+  std::sort(entries.begin(), entries.end());
+  for (auto &entry : entries) {
+    os << entry.first << ' ' << (entry.second ? '1' : '0') << '\n';
+  }
+  return true;
+}
+
+Z3Solver::Z3Solver(clang::ASTContext &ctx, Z3ProofCache *proofs)
+    : ast_ctx(&ctx),
+      z3_ctx(new z3::context()),
+      z3_gen(new rellic::Z3ConvVisitor(&ctx, z3_ctx.get())),
+      z3_prover(*z3_ctx, kProverTactic),
+      proofs(proofs),
+      cancellation(nullptr),
+      function(nullptr),
+      statement(nullptr),
+      num_fallbacks(0),
+      function_start(0),
+      z3_sample(static_cast<int64_t>(GetZ3AllocatedMemory())),
+      z3_charged(0),
+      slow_query_seconds(0),
+      abstract_atoms(false) {}
+
+Z3Solver::~Z3Solver() {
+  if (function) {
+    --num_active_solvers;
+  }
+  if (!Stats::IsEnabled()) {
+    return;
+  }
+  std::vector<std::pair<std::string, FunctionMemory>> usages;
+  for (auto &entry : memory) {
+    usages.emplace_back(entry.first->getNameAsString(), entry.second);
+  }
+  std::sort(usages.begin(), usages.end(), [](auto &lhs, auto &rhs) {
+    return lhs.first < rhs.first;
+  });
+  for (auto &usage : usages) {
+    Stats::Get().AddFunctionMemory(usage.first, usage.second.peak,
+                                   usage.second.over_budget);
+  }
+}
+
+void Z3Solver::SetFunction(clang::FunctionDecl *fdecl) {
+  if (TracksMemory()) {
+    auto used{GetUsedMemory()};
+    if (function) {
+      memory[function].grown += used - function_start;
+    }
+    function_start = used;
+  }
+  if (fdecl && !function) {
+    ++num_active_solvers;
+  } else if (!fdecl && function) {
+    --num_active_solvers;
+  }
+  function = fdecl;
+  statement = nullptr;
+  if (Trace::IsEnabled()) {
+    trace_function = fdecl ? fdecl->getNameAsString() : "";
+  }
+}
+
+bool Z3Solver::TracksMemory() const {
+  return limits.memory_budget || Stats::IsEnabled();
+}
+
+int64_t Z3Solver::GetUsedMemory() {
+  // Growth of Z3 memory since the last sample is shared by the solvers
+  // that are active now, this one included if it refines a function
+  auto z3_used{static_cast<int64_t>(GetZ3AllocatedMemory())};
+  auto active{std::max<int64_t>(num_active_solvers, 1)};
+  z3_charged += (z3_used - z3_sample) / active;
+  z3_sample = z3_used;
+  return static_cast<int64_t>(ast_ctx->getASTAllocatedMemory()) + z3_charged;
+}
+
+bool Z3Solver::CheckMemory() {
+  if (!function || !TracksMemory()) {
+    return true;
+  }
+  auto &usage{memory[function]};
+  auto grown{usage.grown + GetUsedMemory() - function_start};
+  usage.peak = std::max(usage.peak, grown);
+  if (limits.memory_budget && !usage.over_budget &&
+      grown > static_cast<int64_t>(limits.memory_budget)) {
+    LOG(WARNING) << "Refining " << function->getNameAsString() << " used "
+                 << grown << " bytes, which exceeds the memory budget; the "
+                 << "rest of its conditions are left unrefined";
+    usage.over_budget = true;
+  }
+  return !usage.over_budget;
+}
+
+void Z3Solver::SetSlowQueryLog(const std::string &dir, double min_seconds) {
+  slow_query_dir = dir;
+  slow_query_seconds = min_seconds;
+}
+
+void Z3Solver::LogSlowQuery(llvm::StringRef kind, llvm::StringRef tactic,
+                            z3::context &ctx, z3::expr goal, double seconds,
+                            clang::Stmt *stmt, z3::solver *solver) {
+  if (slow_query_dir.empty() || seconds < slow_query_seconds) {
+    return;
+  }
+  auto name{function ? function->getNameAsString() : "unknown"};
+  llvm::SmallString<128> path(slow_query_dir);
+  llvm::sys::path::append(
+      path, name + '.' + std::to_string(num_slow_queries++) + ".smt2");
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    LOG(WARNING) << "Failed to write slow query " << path.str().str() << ": "
+                 << ec.message();
+    return;
+  }
+  os << "; " << kind << " query of " << name << " took "
+     << llvm::format("%.3f", seconds) << "s\n";
+  if (!tactic.empty()) {
+    os << "; tactic: " << tactic << '\n';
+  }
+  if (stmt) {
+    std::string text;
+    llvm::raw_string_ostream sos(text);
+    stmt->printPretty(sos, nullptr, ast_ctx->getPrintingPolicy());
+    sos.flush();
+    os << "; statement:\n";
+    llvm::StringRef rest(text);
+    for (auto i = 0U; !rest.empty(); ++i) {
+      if (i == kMaxStatementLines) {
+        os << ";   ...\n";
+        break;
+      }
+      auto line{rest.split('\n')};
+      os << ";   " << line.first << '\n';
+      rest = line.second;
+    }
+  }
+  std::vector<Z3_ast> assertions;
+  z3::expr_vector asserted(ctx);
+  if (solver) {
+    asserted = solver->assertions();
+    for (auto i = 0U; i < asserted.size(); ++i) {
+      assertions.push_back(asserted[i]);
+    }
+  }
+  os << Z3_benchmark_to_smtlib_string(
+      ctx, name.c_str(), "", "unknown", "",
+      static_cast<unsigned>(assertions.size()), assertions.data(), goal);
+  // Simplifications reproduce by applying the tactic to the assertions
+  if (kind == "simplify" && !tactic.empty()) {
+    llvm::SmallVector<llvm::StringRef, 4> names;
+    tactic.split(names, ',');
+    if (names.size() == 1) {
+      os << "(apply " << names.front() << ")\n";
+    } else {
+      os << "(apply (then " << llvm::join(names, " ") << "))\n";
+    }
+  }
+}
+
+void Z3Solver::SetNumThreads(unsigned num_threads) {
+  workers.clear();
+  if (num_threads > 1) {
+    for (auto i = 0U; i < num_threads; ++i) {
+      workers.emplace_back(new Worker);
+    }
+  }
+}
+
+bool Z3Solver::GetQueryTimeout(unsigned &timeout) {
+  timeout = limits.query_timeout;
+  if (!CheckMemory()) {
+    return false;
+  }
+  if (cancellation) {
+    if (cancellation->IsCancelled()) {
+      return false;
+    }
+    // Queries end by the deadline
+    auto left{cancellation->GetTimeLeft()};
+    if (left) {
+      timeout = timeout ? std::min(timeout, left) : left;
+    }
+  }
+  if (!limits.function_timeout) {
+    return true;
+  }
+  auto used{static_cast<unsigned>(spent[function] * 1000)};
+  if (used >= limits.function_timeout) {
+    return false;
+  }
+  auto left{limits.function_timeout - used};
+  timeout = timeout ? std::min(timeout, left) : left;
+  return true;
+}
+
+void Z3Solver::SetContextLimits(unsigned timeout, unsigned rlimit) {
+  rellic::SetContextLimits(*z3_ctx, timeout, rlimit);
+}
+
+void Z3Solver::FinishQuery(llvm::StringRef kind, double seconds) {
+  if (limits.function_timeout) {
+    spent[function] += seconds;
+  }
+  if (Stats::IsEnabled()) {
+    Stats::Get().AddZ3Query(kind, seconds);
+  }
+}
+
+void Z3Solver::Fallback(llvm::StringRef kind) {
+  ++num_fallbacks;
+  if (Stats::IsEnabled()) {
+    Stats::Get().AddZ3Fallback(kind);
+  }
+}
+
+bool Z3Solver::Prove(z3::expr expr) {
+  TraceSpan span("prove", "z3", trace_function);
+  bool valid;
+  if (engine.DecideValid(expr, valid)) {
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddZ3Prefiltered("prove");
+    }
+    return valid;
+  }
+  auto negated{(!expr).simplify()};
+  if (abstract_atoms) {
+    negated = AtomAbstraction(*z3_ctx).Abstract(negated);
+  }
+  // Check whether the same query was already answered
+  std::string key;
+  bool result;
+  if (proofs) {
+    key = QueryDigest(*z3_ctx).Get(negated);
+    if (proofs->Lookup(key, result)) {
+      if (Stats::IsEnabled()) {
+        Stats::Get().AddZ3CacheHit("prove");
+      }
+      return result;
+    }
+  }
+  CancellationToken::Guard guard(cancellation, *z3_ctx);
+  unsigned timeout;
+  if (!GetQueryTimeout(timeout)) {
+    Fallback("prove");
+    return false;
+  }
+  auto limited{timeout || limits.query_rlimit};
+  if (limited) {
+    SetContextLimits(timeout, limits.query_rlimit);
+  }
+  StatsTimer timer;
+  bool failed;
+  result = RunProver(*z3_ctx, z3_prover, negated, limited, failed);
+  // Interrupted proofs look like undecided ones without limits
+  failed = failed || (cancellation && cancellation->IsCancelled());
+  if (limited) {
+    SetContextLimits(0, 0);
+  }
+  auto seconds{timer.GetSeconds()};
+  FinishQuery("prove", seconds);
+  LogSlowQuery("prove", kProverTactic, *z3_ctx, negated, seconds, statement);
+  if (failed) {
+    Fallback("prove");
+    return false;
+  }
+  if (proofs) {
+    proofs->Insert(key, result);
+  }
+  return result;
+}
+
+std::vector<bool> Z3Solver::ProveAll(const z3::expr_vector &exprs,
+                                     const std::vector<clang::Stmt *> &stmts) {
+  std::vector<bool> results(exprs.size(), false);
+  auto GetStatement = [&](unsigned i) {
+    return stmts.empty() ? statement : stmts[i];
+  };
+  if (workers.size() < 2) {
+    auto outer{statement};
+    for (auto i = 0U; i < exprs.size(); ++i) {
+      statement = GetStatement(i);
+      results[i] = Prove(exprs[i]);
+    }
+    statement = outer;
+    return results;
+  }
+  // Answer cached queries and distribute the others. Translation uses
+  // both contexts, so it has to happen before the threads start.
+  std::vector<std::string> keys(exprs.size());
+  unsigned timeout;
+  auto has_budget{GetQueryTimeout(timeout)};
+  auto next{0U};
+  for (auto i = 0U; i < exprs.size(); ++i) {
+    bool valid;
+    if (engine.DecideValid(exprs[i], valid)) {
+      if (Stats::IsEnabled()) {
+        Stats::Get().AddZ3Prefiltered("prove");
+      }
+      results[i] = valid;
+      continue;
+    }
+    auto negated{(!exprs[i]).simplify()};
+    if (abstract_atoms) {
+      negated = AtomAbstraction(*z3_ctx).Abstract(negated);
+    }
+    if (proofs) {
+      bool result;
+      keys[i] = QueryDigest(*z3_ctx).Get(negated);
+      if (proofs->Lookup(keys[i], result)) {
+        if (Stats::IsEnabled()) {
+          Stats::Get().AddZ3CacheHit("prove");
+        }
+        results[i] = result;
+        continue;
+      }
+    }
+    if (!has_budget) {
+      Fallback("prove");
+      continue;
+    }
+    workers[next++ % workers.size()]->Add(i, *z3_ctx, negated);
+  }
+
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    if (!worker->indices.empty()) {
+      threads.emplace_back(&Worker::Run, worker.get(), timeout,
+                           limits.query_rlimit, trace_function, cancellation);
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto &worker : workers) {
+    for (auto k = 0U; k < worker->indices.size(); ++k) {
+      auto i{worker->indices[k]};
+      FinishQuery("prove", worker->seconds[k]);
+      LogSlowQuery("prove", kProverTactic, worker->ctx, worker->queries[k],
+                   worker->seconds[k], GetStatement(i));
+      if (worker->failed[k]) {
+        Fallback("prove");
+      } else {
+        results[i] = worker->results[k];
+        if (proofs) {
+          proofs->Insert(keys[i], results[i]);
+        }
+      }
+    }
+    worker->Clear();
+  }
+  return results;
+}
+
+bool Z3Solver::ApplyTactic(z3::tactic &tactic, llvm::StringRef key,
+                           z3::expr expr, z3::expr &result) {
+  CancellationToken::Guard guard(cancellation, *z3_ctx);
+  unsigned timeout;
+  if (!GetQueryTimeout(timeout)) {
+    Fallback("simplify");
+    return false;
+  }
+  auto limited{timeout || limits.query_rlimit};
+  if (limited) {
+    SetContextLimits(timeout, limits.query_rlimit);
+  }
+  TraceSpan span("simplify", "z3", trace_function);
+  StatsTimer timer;
+  z3::goal goal(*z3_ctx);
+  goal.add(expr);
+  z3::goal simplified(*z3_ctx);
+  auto done{TryApply(*z3_ctx, tactic, goal, simplified)};
+  if (done) {
+    result = simplified.as_expr();
+  }
+  if (limited) {
+    SetContextLimits(0, 0);
+  }
+  auto seconds{timer.GetSeconds()};
+  FinishQuery("simplify", seconds);
+  LogSlowQuery("simplify", key, *z3_ctx, expr, seconds, statement);
+  if (!done) {
+    Fallback("simplify");
+  }
+  return done;
+}
+
+bool Z3Solver::Simplify(z3::tactic &tactic, z3::expr expr,
+                        z3::expr &result) {
+  return ApplyTactic(tactic, "", expr, result);
+}
+
+bool Z3Solver::Simplify(z3::tactic &tactic, const std::string &key,
+                        z3::expr expr, z3::expr &result) {
+  auto &cache{simplify_caches[key]};
+  auto iter{cache.results.find(Z3_get_ast_id(*z3_ctx, expr))};
+  if (iter != cache.results.end()) {
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddZ3CacheHit("simplify");
+    }
+    result = iter->second.second;
+    return true;
+  }
+  if (!ApplyTactic(tactic, key, expr, result)) {
+    return false;
+  }
+  cache.results.emplace(Z3_get_ast_id(*z3_ctx, expr),
+                        std::make_pair(expr, result));
+  cache.results.emplace(Z3_get_ast_id(*z3_ctx, result),
+                        std::make_pair(result, result));
+  return true;
+}
+
+void Z3Solver::MarkSimplified(const std::string &key, clang::Expr *expr) {
+  simplify_caches[key].simplified.insert(expr);
+}
+
+bool Z3Solver::IsSimplified(const std::string &key, clang::Expr *expr) {
+  auto iter{simplify_caches.find(key)};
+  return iter != simplify_caches.end() && iter->second.simplified.count(expr);
+}
+
+z3::check_result Z3Solver::Check(z3::solver &solver, z3::expr expr) {
+  CancellationToken::Guard guard(cancellation, *z3_ctx);
+  unsigned timeout;
+  if (!GetQueryTimeout(timeout)) {
+    Fallback("incremental");
+    return z3::unknown;
+  }
+  if (timeout || limits.query_rlimit) {
+    z3::params params(*z3_ctx);
+    params.set("timeout", timeout ? timeout : UINT_MAX);
+    params.set("rlimit", limits.query_rlimit);
+    solver.set(params);
+  }
+  TraceSpan span("incremental", "z3", trace_function);
+  StatsTimer timer;
+  solver.push();
+  solver.add(expr);
+  // Limits and cancellation make the check return `z3::unknown`
+  auto result{solver.check()};
+  solver.pop();
+  auto seconds{timer.GetSeconds()};
+  FinishQuery("incremental", seconds);
+  LogSlowQuery("incremental", "", *z3_ctx, expr, seconds, statement,
+               &solver);
+  if (result == z3::unknown) {
+    Fallback("incremental");
+  }
+  return result;
+}
+
+void Z3Solver::Invalidate() {
+  z3_gen->ClearExprs();
+  for (auto &entry : simplify_caches) {
+    entry.second.simplified.clear();
+  }
+}
+
+void Z3Solver::Reset() {
+  SetFunction(nullptr);
+  z3_gen->Clear();
+  simplify_caches.clear();
+  engine.Clear();
+}
+
+}  // namespace rellic
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/StringRef.h>
+#include <z3++.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/Cancellation.h"
+#include "rellic/AST/CondEngine.h"
+#include "rellic/AST/Z3ConvVisitor.h"
+
+namespace rellic {
+
+// Results of `Z3Solver::Prove` keyed by a digest of the structure of the
+// query. Uninterpreted symbols are numbered by their first occurrence, so
+// digests don't depend on declaration names or on the `z3::context`. Can
+// be shared between threads and persisted between runs.
+class Z3ProofCache {
+ private:
+  std::mutex mutex;
+  std::unordered_map<std::string, bool> proofs;
+
+ public:
+  bool Lookup(const std::string &key, bool &result);
+  void Insert(const std::string &key, bool result);
+
+  // Reads entries from `path`. Returns `false` if the file can't be read.
+  bool Load(const std::string &path);
+  // Writes all entries to `path`. Returns `false` on I/O errors.
+  bool Save(const std::string &path);
+};
+
+// Resource limits of the Z3 queries of a pipeline. Zero means unlimited.
+struct Z3Limits {
+  // Wall time limit of a single query, in milliseconds
+  unsigned query_timeout = 0;
+  // Z3 resource limit of a single query. Unlike timeouts, resource
+  // limits are deterministic.
+  unsigned query_rlimit = 0;
+  // Total wall time that queries may take for one function, in
+  // milliseconds. Queries of a function that used up its budget fail
+  // immediately.
+  unsigned function_timeout = 0;
+  // Bytes that the AST and Z3 may grow by while one function is refined.
+  // Like the time budget, queries of a function that crossed it fail
+  // immediately. The AST is counted per solver. Z3 only counts memory for
+  // the whole process, so solvers that refine functions at the same time
+  // are charged even shares of its growth.
+  size_t memory_budget = 0;
+};
+
+// Z3 state shared by all passes of a refinement pipeline. Owns a single
+// `z3::context` and a `Z3ConvVisitor`, so that conditions are converted
+// once and not again by every pass and fixpoint iteration.
+//
+// Conversions are cached per `clang::Expr`. Passes that rewrite
+// expressions in place must call `Invalidate` afterwards.
+//
+// Queries that exceed the resource limits don't fail the pipeline. They
+// fall back to a conservative answer instead, which leaves the affected
+// statements unrefined. The same goes for queries that a cancellation
+// token stops.
+class Z3Solver {
+ private:
+  clang::ASTContext *ast_ctx;
+  std::unique_ptr<z3::context> z3_ctx;
+  std::unique_ptr<rellic::Z3ConvVisitor> z3_gen;
+
+  z3::tactic z3_prover;
+  // Decides queries about the boolean structure of conditions before
+  // they reach `z3_prover`
+  CondEngine engine;
+
+  Z3ProofCache *proofs;
+
+  Z3Limits limits;
+  CancellationToken *cancellation;
+  // Function whose statements are being refined
+  clang::FunctionDecl *function;
+  // Name of `function` that queries are traced with, if tracing is enabled
+  std::string trace_function;
+  // Statement that the current queries originate from
+  clang::Stmt *statement;
+  // Time spent on queries, in seconds, per function
+  std::unordered_map<clang::FunctionDecl *, double> spent;
+  size_t num_fallbacks;
+
+  // Bytes that the AST and Z3 grew by while refining a function
+  struct FunctionMemory {
+    int64_t grown = 0;
+    int64_t peak = 0;
+    bool over_budget = false;
+  };
+  std::unordered_map<clang::FunctionDecl *, FunctionMemory> memory;
+  // Bytes in use when `function` was set
+  int64_t function_start;
+  // Z3 memory of the process at the last call of `GetUsedMemory`, and the
+  // share of its growth that this solver was charged so far
+  int64_t z3_sample;
+  int64_t z3_charged;
+
+  // Results of `Simplify` for one tactic, keyed by the ID of the input
+  // expression. Inputs are kept alongside so that their IDs stay taken.
+  // Conditions that a tactic produced are marked as already simplified.
+  struct SimplifyCache {
+    std::unordered_map<unsigned, std::pair<z3::expr, z3::expr>> results;
+    std::unordered_set<clang::Expr *> simplified;
+  };
+  std::unordered_map<std::string, SimplifyCache> simplify_caches;
+
+  // Queries that take at least `slow_query_seconds` are written to
+  // `slow_query_dir`, if it is set
+  std::string slow_query_dir;
+  double slow_query_seconds;
+  // Whether `Prove` abstracts opaque atoms that only occur in equalities
+  bool abstract_atoms;
+
+  // Writes the query `goal` in `ctx`, with the assertions of `solver` if
+  // there is one, as an SMT-LIB2 file that reproduces it
+  void LogSlowQuery(llvm::StringRef kind, llvm::StringRef tactic,
+                    z3::context &ctx, z3::expr goal, double seconds,
+                    clang::Stmt *stmt, z3::solver *solver = nullptr);
+
+  // Threads of `ProveAll`, each with its own `z3::context`
+  struct Worker;
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  bool TracksMemory() const;
+  // Bytes of the AST and of the share of Z3 memory of this solver
+  int64_t GetUsedMemory();
+  // Updates the memory usage of the current function. Returns `false` if
+  // the function is over its budget.
+  bool CheckMemory();
+
+  // Computes the time limit of the next query. Returns `false` if the
+  // current function has no time or memory left, or if the cancellation
+  // token is cancelled.
+  bool GetQueryTimeout(unsigned &timeout);
+  void SetContextLimits(unsigned timeout, unsigned rlimit);
+  void FinishQuery(llvm::StringRef kind, double seconds);
+  // Applies `tactic`, which `key` describes if it isn't empty
+  bool ApplyTactic(z3::tactic &tactic, llvm::StringRef key, z3::expr expr,
+                   z3::expr &result);
+  void Fallback(llvm::StringRef kind);
+
+ public:
+  Z3Solver(clang::ASTContext &ctx, Z3ProofCache *proofs = nullptr);
+  ~Z3Solver();
+
+  z3::context &GetZ3Context() { return *z3_ctx; }
+  rellic::Z3ConvVisitor &GetZ3ConvVisitor() { return *z3_gen; }
+  CondEngine &GetCondEngine() { return engine; }
+
+  void SetLimits(const Z3Limits &new_limits) { limits = new_limits; }
+  // Ends queries by the deadline of `token` and interrupts them when it
+  // is cancelled. `token` may be `nullptr`.
+  void SetCancellation(CancellationToken *token) { cancellation = token; }
+  // Charges the time and memory of subsequent queries to `fdecl`
+  void SetFunction(clang::FunctionDecl *fdecl);
+  // Describes the statement of subsequent queries in the slow query log
+  void SetStatement(clang::Stmt *stmt) { statement = stmt; }
+  // Writes queries that take at least `min_seconds` to files in `dir`
+  void SetSlowQueryLog(const std::string &dir, double min_seconds);
+  // Lets `Prove` replace bit-vector atoms, e.g. uninterpreted pointer
+  // terms, that only occur in equalities with atoms and numerals by
+  // constants of the smallest sort that keeps them apart. This saves
+  // bit-blasting wide words, but may miss proofs that need two such
+  // atoms to be equal by congruence, which then fail conservatively.
+  void SetAbstractAtoms(bool enable) { abstract_atoms = enable; }
+  // Number of queries that were given up because of resource limits
+  size_t GetNumFallbacks() const { return num_fallbacks; }
+  // Proves the queries of `ProveAll` on up to `num_threads` threads
+  void SetNumThreads(unsigned num_threads);
+  unsigned GetNumThreads() const {
+    return workers.empty() ? 1U : static_cast<unsigned>(workers.size());
+  }
+
+  // Returns `true` if `expr` is valid. Queries that the condition engine
+  // decides don't reach Z3. Other results are looked up in and added to
+  // the proof cache, if there is one. Returns `false` if the
+  // proof runs out of resources.
+  bool Prove(z3::expr expr);
+
+  // Like `Prove`, for every expression of `exprs`. With more than one
+  // thread, the queries are translated to the contexts of the threads and
+  // proven concurrently. The time limit is computed once for the batch.
+  // `stmts`, if not empty, holds the statement of every query.
+  std::vector<bool> ProveAll(const z3::expr_vector &exprs,
+                             const std::vector<clang::Stmt *> &stmts = {});
+
+  // Applies `tactic` to `expr` and stores the simplified expression in
+  // `result`. Returns `false` if the tactic runs out of resources.
+  bool Simplify(z3::tactic &tactic, z3::expr expr, z3::expr &result);
+
+  // Like `Simplify`, but reuses the earlier results of the tactic that
+  // `key` describes, e.g. "aig,simplify". Results are also taken to
+  // simplify to themselves.
+  bool Simplify(z3::tactic &tactic, const std::string &key, z3::expr expr,
+                z3::expr &result);
+
+  // Marks `expr` as the output of the tactic that `key` describes, or
+  // checks whether it is one. Marks are dropped by `Invalidate`.
+  void MarkSimplified(const std::string &key, clang::Expr *expr);
+  bool IsSimplified(const std::string &key, clang::Expr *expr);
+
+  // Checks whether `expr` is satisfiable together with the assertions
+  // of `solver`. Returns `z3::unknown` if the check runs out of
+  // resources.
+  z3::check_result Check(z3::solver &solver, z3::expr expr);
+
+  // Drops cached `clang::Expr` <=> `z3::expr` conversions, and the marks
+  // of simplified conditions
+  void Invalidate();
+
+  // Drops every Z3 term that earlier functions left behind: conversions
+  // of expressions and declarations, simplification results and the
+  // condition engine. The context, tactics and worker threads are kept,
+  // so that one solver can be reused for any number of functions without
+  // growing. Limits, time and memory accounting are not affected.
+  void Reset();
+};
+
+}  // namespace rellic
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+
+#include "rellic/BC/Version.h"
+
+namespace rellic {
+
+// Reads the file `path`, which large files are mapped for. Without a
+// terminating null, mapping does not fall back to a copy for files whose
+// size is a multiple of the page size.
+inline llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> GetFileBuffer(
+    const llvm::Twine &path, bool null_terminated) {
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(13, 0)
+  return llvm::MemoryBuffer::getFile(path, /*IsText=*/false, null_terminated);
+#else
+  return llvm::MemoryBuffer::getFile(path, /*FileSize=*/-1, null_terminated);
+#endif
+}
+
+}  // namespace rellic
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/BC/Simplify.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "rellic/BC/Version.h"
+
+namespace rellic {
+
+namespace {
+
+// Folding conditions rarely takes more rounds than that
+static constexpr unsigned kMaxRounds = 4;
+
+static size_t GetNumInstructions(llvm::Function &func) {
+  size_t result{0};
+  for (auto &block : func) {
+    result += block.size();
+  }
+  return result;
+}
+
+static bool SimplifyInstructions(llvm::Function &func) {
+  auto changed{false};
+  llvm::SimplifyQuery query(func.getParent()->getDataLayout());
+  for (auto &block : func) {
+    for (auto &inst : llvm::make_early_inc_range(block)) {
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(15, 0)
+      auto val{llvm::simplifyInstruction(&inst, query.getWithInstruction(&inst))};
+#else
+      auto val{llvm::SimplifyInstruction(&inst, query.getWithInstruction(&inst))};
+#endif
+      if (val && val != &inst) {
+        inst.replaceAllUsesWith(val);
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+// Replaces comparisons with identical ones that dominate them
+static bool CombineComparisons(llvm::Function &func,
+                               llvm::DominatorTree &domtree) {
+  using Key = std::tuple<unsigned, llvm::Value *, llvm::Value *>;
+  std::map<Key, std::vector<llvm::CmpInst *>> cmps;
+  auto changed{false};
+  for (auto node : llvm::depth_first(domtree.getRootNode())) {
+    for (auto &inst : *node->getBlock()) {
+      auto cmp{llvm::dyn_cast<llvm::CmpInst>(&inst)};
+      if (!cmp) {
+        continue;
+      }
+      auto &candidates{cmps[Key(cmp->getPredicate(), cmp->getOperand(0),
+                                cmp->getOperand(1))]};
+      auto dom{llvm::find_if(candidates, [&](llvm::CmpInst *cand) {
+        return domtree.dominates(cand, cmp);
+      })};
+      if (dom != candidates.end()) {
+        cmp->replaceAllUsesWith(*dom);
+        changed = true;
+      } else {
+        candidates.push_back(cmp);
+      }
+    }
+  }
+  return changed;
+}
+
+// Decides branches on conditions that a dominating branch already tested
+static bool FoldDominatedConditions(llvm::Function &func,
+                                    llvm::DominatorTree &domtree) {
+  auto changed{false};
+  auto &llvm_ctx{func.getContext()};
+  for (auto &block : func) {
+    auto br{llvm::dyn_cast<llvm::BranchInst>(block.getTerminator())};
+    if (!br || !br->isConditional() ||
+        br->getSuccessor(0) == br->getSuccessor(1)) {
+      continue;
+    }
+    auto cond{br->getCondition()};
+    if (llvm::isa<llvm::Constant>(cond)) {
+      continue;
+    }
+    for (auto i = 0U; i < 2; ++i) {
+      llvm::BasicBlockEdge edge(&block, br->getSuccessor(i));
+      auto val{i == 0 ? llvm::ConstantInt::getTrue(llvm_ctx)
+                      : llvm::ConstantInt::getFalse(llvm_ctx)};
+      for (auto &use : llvm::make_early_inc_range(cond->uses())) {
+        auto user{llvm::dyn_cast<llvm::BranchInst>(use.getUser())};
+        if (user && user != br && domtree.dominates(edge, user->getParent())) {
+          use.set(val);
+          changed = true;
+        }
+      }
+    }
+  }
+  return changed;
+}
+
+static bool FoldTerminators(llvm::Function &func) {
+  auto changed{false};
+  for (auto &block : func) {
+    changed |= llvm::ConstantFoldTerminator(&block,
+                                            /*DeleteDeadConditions=*/true);
+  }
+  changed |= llvm::removeUnreachableBlocks(func);
+  return changed;
+}
+
+static bool MergeBlocks(llvm::Function &func) {
+  auto changed{false};
+  for (auto &block : llvm::make_early_inc_range(func)) {
+    changed |= llvm::MergeBlockIntoPredecessor(&block);
+  }
+  return changed;
+}
+
+static bool DeleteDeadInstructions(llvm::Function &func) {
+  auto changed{false};
+  for (auto &block : func) {
+    for (auto &inst : llvm::make_early_inc_range(llvm::reverse(block))) {
+      if (llvm::isInstructionTriviallyDead(&inst)) {
+        inst.eraseFromParent();
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+}  // namespace
+
+SimplifyCounts SimplifyFunction(llvm::Function &func) {
+  SimplifyCounts result;
+  result.blocks_before = func.size();
+  result.insts_before = GetNumInstructions(func);
+  for (auto round = 0U; round < kMaxRounds && !func.isDeclaration(); ++round) {
+    auto changed{SimplifyInstructions(func)};
+    {
+      llvm::DominatorTree domtree(func);
+      changed |= CombineComparisons(func, domtree);
+      changed |= FoldDominatedConditions(func, domtree);
+    }
+    changed |= DeleteDeadInstructions(func);
+    // Control flow changes after this, so the dominator tree is rebuilt
+    // in the next round
+    changed |= FoldTerminators(func);
+    changed |= MergeBlocks(func);
+    if (!changed) {
+      break;
+    }
+  }
+  result.blocks_after = func.size();
+  result.insts_after = GetNumInstructions(func);
+  DLOG(INFO) << "Simplified " << func.getName().str() << " from "
+             << result.blocks_before << " to " << result.blocks_after
+             << " blocks";
+  return result;
+}
+
+}  // namespace rellic
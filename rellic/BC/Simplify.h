@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+
+namespace rellic {
+
+// Sizes of a function before and after `SimplifyFunction`
+struct SimplifyCounts {
+  size_t blocks_before = 0;
+  size_t blocks_after = 0;
+  size_t insts_before = 0;
+  size_t insts_after = 0;
+};
+
+// Folds conditions and control flow of `func` that would otherwise reach
+// the AST as conditions for Z3 to simplify:
+//
+//  * Instructions that simplify to other values or constants, and
+//    comparisons that repeat a dominating one
+//  * Branches on conditions that are decided by a dominating branch on
+//    the same condition, and branches on constants
+//  * Unreachable blocks, and blocks whose single predecessor has no other
+//    successor
+//
+// Loops are kept as they are, and no instructions are introduced, so the
+// result is structured like the input.
+SimplifyCounts SimplifyFunction(llvm::Function &func);
+
+}  // namespace rellic
@@ -19,8 +19,17 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/DominanceFrontier.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/RegionInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
@@ -28,11 +37,18 @@
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
 #include "rellic/BC/Compat/Error.h"
 #include "rellic/BC/Compat/IRReader.h"
+#include "rellic/BC/Compat/MemoryBuffer.h"
 #include "rellic/BC/Compat/Verifier.h"
 
 namespace rellic {
@@ -53,6 +69,39 @@ inline static std::string DoLLVMThingToString(T *thing) {
   }
 }
 
+// Returns `false` if `type` has no C equivalent yet
+static bool IsSupportedType(llvm::Type *type,
+                            std::unordered_set<llvm::Type *> &seen) {
+  if (!seen.insert(type).second) {
+    return true;
+  }
+  switch (type->getTypeID()) {
+    case llvm::Type::VoidTyID:
+    case llvm::Type::HalfTyID:
+    case llvm::Type::FloatTyID:
+    case llvm::Type::DoubleTyID:
+    case llvm::Type::X86_FP80TyID:
+    case llvm::Type::IntegerTyID:
+    case llvm::Type::LabelTyID:
+    case llvm::Type::MetadataTyID:
+      return true;
+
+    case llvm::Type::FunctionTyID:
+    case llvm::Type::PointerTyID:
+    case llvm::Type::ArrayTyID:
+    case llvm::Type::StructTyID:
+      for (auto elem : type->subtypes()) {
+        if (!IsSupportedType(elem, seen)) {
+          return false;
+        }
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 }  // namespace
 
 std::string LLVMThingToString(llvm::Value *thing) {
@@ -76,12 +125,53 @@ bool VerifyModule(llvm::Module *module) {
   }
 }
 
+// Reads the input file `file_name`, or standard input for `-`. Bitcode
+// stays mapped for as long as the buffer lives, instead of being copied;
+// only textual IR is read with the terminating null that its parser needs.
+static std::unique_ptr<llvm::MemoryBuffer> ReadInputFile(
+    const std::string &file_name, llvm::SMDiagnostic &err) {
+  auto buf{file_name == "-" ? llvm::MemoryBuffer::getSTDIN()
+                            : GetFileBuffer(file_name,
+                                            /*null_terminated=*/false)};
+  if (buf && file_name != "-") {
+    auto start{
+        reinterpret_cast<const unsigned char *>((*buf)->getBufferStart())};
+    auto end{reinterpret_cast<const unsigned char *>((*buf)->getBufferEnd())};
+    if (!llvm::isBitcode(start, end)) {
+      buf = GetFileBuffer(file_name, /*null_terminated=*/true);
+    }
+  }
+  if (!buf) {
+    err = llvm::SMDiagnostic(file_name, llvm::SourceMgr::DK_Error,
+                             "Could not open input file: " +
+                                 buf.getError().message());
+    return nullptr;
+  }
+  return std::move(*buf);
+}
+
+// Lazily parses the input file `file_name`. The module keeps the buffer
+// of the file alive, which bodies are read from when they are needed.
+static std::unique_ptr<llvm::Module> ParseLazyInputFile(
+    llvm::LLVMContext &context, const std::string &file_name,
+    llvm::SMDiagnostic &err) {
+  auto buf{ReadInputFile(file_name, err)};
+  if (!buf) {
+    return nullptr;
+  }
+  return llvm::getLazyIRModule(std::move(buf), err, context);
+}
+
 // Reads an LLVM module from a file.
 llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
-                                 std::string file_name, bool allow_failure) {
+                                 std::string file_name, bool allow_failure,
+                                 bool verify) {
   llvm::SMDiagnostic err;
-  auto mod_ptr = llvm::parseIRFile(file_name, err, *context);
-  auto module = mod_ptr.release();
+  llvm::Module *module{nullptr};
+  // The parsed module does not refer to the buffer anymore
+  if (auto buf = ReadInputFile(file_name, err)) {
+    module = llvm::parseIR(buf->getMemBufferRef(), err, *context).release();
+  }
 
   if (!module) {
     LOG_IF(FATAL, !allow_failure) << "Unable to parse module file " << file_name
@@ -97,7 +187,7 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
     return nullptr;
   }
 
-  if (!VerifyModule(module)) {
+  if (verify && !VerifyModule(module)) {
     LOG_IF(FATAL, !allow_failure)
         << "Error verifying module read from file " << file_name;
     delete module;
@@ -107,6 +197,186 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
   return module;
 }
 
+llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure) {
+  auto name{buffer.getBufferIdentifier().str()};
+  llvm::SMDiagnostic err;
+  auto module{llvm::parseIR(buffer, err, *context).release()};
+
+  if (!module) {
+    LOG_IF(FATAL, !allow_failure) << "Unable to parse module " << name << ": "
+                                  << err.getMessage().str();
+    return nullptr;
+  }
+
+  if (!VerifyModule(module)) {
+    LOG_IF(FATAL, !allow_failure) << "Error verifying module " << name;
+    delete module;
+    return nullptr;
+  }
+
+  return module;
+}
+
+// Lazily reads an LLVM module from a file.
+llvm::Module *LoadLazyModuleFromFile(llvm::LLVMContext *context,
+                                     std::string file_name,
+                                     bool allow_failure) {
+  llvm::SMDiagnostic err;
+  auto module = ParseLazyInputFile(*context, file_name, err);
+
+  if (!module) {
+    LOG_IF(FATAL, !allow_failure) << "Unable to parse module file " << file_name
+                                  << ": " << err.getMessage().str();
+    return nullptr;
+  }
+
+  if (auto ec = module->materializeMetadata()) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to materialize metadata from " << file_name << ": "
+        << llvm::toString(std::move(ec));
+    return nullptr;
+  }
+
+  // Functions that are still materializable are not verified yet
+  if (!VerifyModule(module.get())) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Error verifying module read from file " << file_name;
+    return nullptr;
+  }
+
+  return module.release();
+}
+
+bool MaterializeFunction(llvm::Function &func, bool allow_failure) {
+  if (!func.isMaterializable()) {
+    return true;
+  }
+
+  if (auto ec = func.materialize()) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to materialize function " << func.getName().str() << ": "
+        << llvm::toString(std::move(ec));
+    return false;
+  }
+
+  std::string error;
+  llvm::raw_string_ostream error_stream(error);
+  if (llvm::verifyFunction(func, &error_stream)) {
+    error_stream.flush();
+    LOG_IF(FATAL, !allow_failure) << "Error verifying function "
+                                  << func.getName().str() << ": " << error;
+    return false;
+  }
+
+  return true;
+}
+
+// Lazily reads an LLVM module from a file, materializing only selected
+// function bodies.
+llvm::Module *LoadSelectedFunctionsFromFile(
+    llvm::LLVMContext *context, std::string file_name,
+    std::function<bool(llvm::Function &)> select, bool allow_failure,
+    bool verify) {
+  llvm::SMDiagnostic err;
+  auto module = ParseLazyInputFile(*context, file_name, err);
+
+  if (!module) {
+    LOG_IF(FATAL, !allow_failure) << "Unable to parse module file " << file_name
+                                  << ": " << err.getMessage().str();
+    return nullptr;
+  }
+
+  // Materialize selected bodies and turn every other definition into a
+  // declaration without ever reading its body
+  for (auto &func : *module) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    if (!select(func)) {
+      func.deleteBody();
+      continue;
+    }
+    if (auto ec = func.materialize()) {
+      LOG_IF(FATAL, !allow_failure)
+          << "Unable to materialize function " << func.getName().str()
+          << " from " << file_name << ": " << llvm::toString(std::move(ec));
+      return nullptr;
+    }
+  }
+
+  // Aliases must refer to definitions, so turn aliases of functions
+  // that are now declarations into declarations as well
+  std::vector<llvm::GlobalAlias *> decl_aliases;
+  for (auto &alias : module->aliases()) {
+    auto base{alias.getBaseObject()};
+    if (base && base->isDeclaration()) {
+      decl_aliases.push_back(&alias);
+    }
+  }
+  for (auto alias : decl_aliases) {
+    llvm::GlobalValue *decl{nullptr};
+    auto type{alias->getValueType()};
+    if (auto func_type = llvm::dyn_cast<llvm::FunctionType>(type)) {
+      decl = llvm::Function::Create(
+          func_type, llvm::GlobalValue::ExternalLinkage, "", module.get());
+    } else {
+      decl = new llvm::GlobalVariable(*module, type, /*isConstant=*/false,
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      nullptr, "");
+    }
+    decl->takeName(alias);
+    alias->replaceAllUsesWith(
+        llvm::ConstantExpr::getBitCast(decl, alias->getType()));
+    alias->eraseFromParent();
+  }
+
+  // Finish reading module-level metadata
+  if (auto ec = module->materializeAll()) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to materialize everything from " << file_name << ": "
+        << llvm::toString(std::move(ec));
+    return nullptr;
+  }
+
+  // Remove declarations and variables that nothing refers to anymore.
+  // Removing a variable drops the uses of its initializer, so repeat
+  // until nothing changes.
+  for (bool changed = true; changed;) {
+    changed = false;
+    std::vector<llvm::GlobalVariable *> dead_vars;
+    for (auto &var : module->globals()) {
+      var.removeDeadConstantUsers();
+      if (var.use_empty() && !var.getName().startswith("llvm.")) {
+        dead_vars.push_back(&var);
+      }
+    }
+    for (auto var : dead_vars) {
+      var->eraseFromParent();
+      changed = true;
+    }
+  }
+  std::vector<llvm::Function *> dead_funcs;
+  for (auto &func : *module) {
+    func.removeDeadConstantUsers();
+    if (func.isDeclaration() && func.use_empty()) {
+      dead_funcs.push_back(&func);
+    }
+  }
+  for (auto func : dead_funcs) {
+    func->eraseFromParent();
+  }
+
+  if (verify && !VerifyModule(module.get())) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Error verifying module read from file " << file_name;
+    return nullptr;
+  }
+
+  return module.release();
+}
+
 bool IsGlobalMetadata(const llvm::GlobalObject &go) {
   return go.getSection() == "llvm.metadata";
 }
@@ -135,4 +405,96 @@ bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id) {
   }
 }
 
-}  // namespace rellic
\ No newline at end of file
+bool IsDecompilable(llvm::Function &func, std::string &reason) {
+  std::unordered_set<llvm::Type *> seen;
+  auto CheckType = [&](llvm::Type *type, llvm::Instruction &inst) {
+    if (IsSupportedType(type, seen)) {
+      return true;
+    }
+    reason = "Unsupported type " + LLVMThingToString(type) + " in " +
+             LLVMThingToString(&inst);
+    return false;
+  };
+  for (auto &block : func) {
+    auto term = block.getTerminator();
+    switch (term->getOpcode()) {
+      case llvm::Instruction::Br:
+      case llvm::Instruction::Switch:
+      case llvm::Instruction::Ret:
+      case llvm::Instruction::Unreachable:
+        break;
+
+      default:
+        reason = std::string("Unsupported terminator '") +
+                 term->getOpcodeName() + "'";
+        return false;
+    }
+    for (auto &inst : block) {
+      // Mirror the instructions that `IRToASTVisitor` lowers
+      switch (inst.getOpcode()) {
+        case llvm::Instruction::Call:
+        case llvm::Instruction::GetElementPtr:
+        case llvm::Instruction::ExtractValue:
+        case llvm::Instruction::Alloca:
+        case llvm::Instruction::Load:
+        case llvm::Instruction::Store:
+        case llvm::Instruction::ICmp:
+        case llvm::Instruction::FCmp:
+        case llvm::Instruction::Select:
+        case llvm::Instruction::PHI:
+        case llvm::Instruction::Br:
+        case llvm::Instruction::Switch:
+        case llvm::Instruction::Ret:
+        case llvm::Instruction::Unreachable:
+          break;
+
+        default:
+          if (!inst.isBinaryOp() && !inst.isCast()) {
+            reason = std::string("Unsupported instruction '") +
+                     inst.getOpcodeName() + "'";
+            return false;
+          }
+          break;
+      }
+      if (!CheckType(inst.getType(), inst)) {
+        return false;
+      }
+      for (auto &op : inst.operands()) {
+        if (!CheckType(op->getType(), inst)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+CFGShape GetCFGShape(llvm::Function &func) {
+  CFGShape shape;
+  shape.num_blocks = func.size();
+  if (func.isDeclaration()) {
+    return shape;
+  }
+
+  llvm::SmallVector<std::pair<const llvm::BasicBlock *,
+                              const llvm::BasicBlock *>,
+                    4>
+      backedges;
+  llvm::FindFunctionBackedges(func, backedges);
+  shape.has_cycles = !backedges.empty();
+
+  llvm::DominatorTree domtree(func);
+  llvm::PostDominatorTree postdomtree(func);
+  llvm::DominanceFrontier frontier;
+  frontier.analyze(domtree);
+  llvm::RegionInfo regions;
+  regions.recalculate(func, &domtree, &postdomtree, &frontier);
+  for (auto &block : func) {
+    if (auto region = regions.getRegionFor(&block)) {
+      shape.region_depth = std::max(shape.region_depth, region->getDepth());
+    }
+  }
+  return shape;
+}
+
+}  // namespace rellic
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include "rellic/BC/Compat/IntrinsicInst.h"
 
@@ -25,6 +26,8 @@ class Type;
 class Value;
 class LLVMContext;
 class GlobalObject;
+class Function;
+class MemoryBufferRef;
 }  // namespace llvm
 
 namespace rellic {
@@ -35,10 +38,38 @@ std::string LLVMThingToString(llvm::Type *thing);
 // Try to verify a module.
 bool VerifyModule(llvm::Module *module);
 
-// Parses and loads a bitcode file into memory.
+// Parses and loads a bitcode file into memory. Without `verify`, the
+// module is not verified, which is only safe for files that were
+// verified before, e.g. when another copy of a module is loaded.
 llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
                                  std::string file_name,
-                                 bool allow_failure = false);
+                                 bool allow_failure = false,
+                                 bool verify = true);
+
+// Parses and loads bitcode or textual IR from `buffer`, which only needs
+// to stay alive during the call
+llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure = false);
+
+// Lazily loads a bitcode file without reading any function bodies.
+// Bodies are read by `MaterializeFunction`.
+llvm::Module *LoadLazyModuleFromFile(llvm::LLVMContext *context,
+                                     std::string file_name,
+                                     bool allow_failure = false);
+
+// Reads and verifies the body of `func`, if it isn't loaded yet
+bool MaterializeFunction(llvm::Function &func, bool allow_failure = false);
+
+// Lazily loads a bitcode file and materializes only the bodies of the
+// functions accepted by `select`. Other functions become declarations,
+// and declarations and global variables that the selected functions do
+// not depend on are removed. Only the remaining module is verified, and
+// only with `verify`.
+llvm::Module *LoadSelectedFunctionsFromFile(
+    llvm::LLVMContext *context, std::string file_name,
+    std::function<bool(llvm::Function &)> select,
+    bool allow_failure = false, bool verify = true);
 
 // Check if an intrinsic ID is an annotation
 bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id);
@@ -46,4 +77,20 @@ bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id);
 // check if a global object is llvm metadata
 bool IsGlobalMetadata(const llvm::GlobalObject &go);
 
+// Returns `false` if the body of `func` uses a construct that can't be
+// decompiled yet, and describes the first such construct in `reason`
+bool IsDecompilable(llvm::Function &func, std::string &reason);
+
+// Size and nesting of the control flow of a function
+struct CFGShape {
+  unsigned num_blocks = 0;
+  // Depth of the most deeply nested single-entry, single-exit region. The
+  // top-level region, which is all a straight-line function has, is 0.
+  unsigned region_depth = 0;
+  // Whether there are cycles, natural loops or not
+  bool has_cycles = false;
+};
+
+CFGShape GetCFGShape(llvm::Function &func);
+
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rellic/Decompiler.h"
+
+#include <llvm/InitializePasses.h>
+#include <llvm/PassRegistry.h>
+
+#include <mutex>
+
+#include "rellic/AST/Pipeline.h"
+#include "rellic/AST/Printer.h"
+#include "rellic/AST/Util.h"
+#include "rellic/BC/Util.h"
+
+namespace rellic {
+
+namespace {
+
+static void InitOptPasses() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    auto &pr{*llvm::PassRegistry::getPassRegistry()};
+    llvm::initializeCore(pr);
+    llvm::initializeAnalysis(pr);
+  });
+}
+
+}  // namespace
+
+void Decompilation::Print(llvm::raw_ostream &os) {
+  PrintTranslationUnit(GetASTContext().getTranslationUnitDecl(), os);
+}
+
+std::unique_ptr<Decompilation> Decompile(llvm::MemoryBufferRef bitcode,
+                                         const DecompilationOptions &options,
+                                         std::string &error,
+                                         DecompiledFunctionCallback callback) {
+  PipelineDesc pipeline;
+  if (!ParsePipeline(options.pipeline, pipeline, error)) {
+    return nullptr;
+  }
+
+  InitOptPasses();
+  std::unique_ptr<Decompilation> result(new Decompilation);
+  result->llvm_ctx.reset(new llvm::LLVMContext);
+  result->module.reset(LoadModuleFromMemory(result->llvm_ctx.get(), bitcode,
+                                            /*allow_failure=*/true));
+  if (!result->module) {
+    error = "Unable to load module " + bitcode.getBufferIdentifier().str();
+    return nullptr;
+  }
+  auto &module{*result->module};
+  PrepareModule(module, options.prepare);
+
+  result->ins.reset(new clang::CompilerInstance);
+  InitCompilerInstance(*result->ins, module.getTargetTriple());
+  result->decompiler.reset(new IncrementalDecompiler(
+      module, result->GetASTContext(), std::move(pipeline),
+      options.max_rounds, options.proofs));
+  result->decompiler->GetSolver().SetLimits(options.limits);
+  result->decompiler->SetCancellation(options.cancellation);
+  auto &runner{result->decompiler->GetRunner()};
+  runner.SetTrivialLimits(options.trivial_blocks, options.trivial_depth);
+  runner.SetPassProfile(options.profile);
+
+  auto &funcs{result->funcs};
+  auto &decompiler{*result->decompiler};
+  decompiler.Update(
+      [&funcs, &callback, &decompiler](llvm::Function &func,
+                                       clang::FunctionDecl *fdefn) {
+        std::string code;
+        llvm::raw_string_ostream os(code);
+        PrintDecl(fdefn, os);
+        os.flush();
+        funcs.push_back(
+            {&func, fdefn, std::move(code), decompiler.WasCutShort()});
+        if (callback) {
+          callback(funcs.back());
+        }
+      });
+  return result;
+}
+
+}  // namespace rellic
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/Cancellation.h"
+#include "rellic/AST/IncrementalDecompiler.h"
+#include "rellic/AST/PassProfile.h"
+#include "rellic/AST/Z3Solver.h"
+#include "rellic/Prepare.h"
+
+namespace rellic {
+
+// Options of `Decompile`. The defaults match those of `rellic-decomp`.
+struct DecompilationOptions {
+  // Preset name or pipeline text, as accepted by `ParsePipeline`
+  std::string pipeline = "default";
+  // Round limit of fixpoint stages without one of their own, 0 for none
+  unsigned max_rounds = 100;
+  // Functions without cycles, with at most `trivial_blocks` blocks and
+  // regions nested at most `trivial_depth` deep, skip refinement and only
+  // get their scopes and expressions combined. 0 blocks turns this off.
+  unsigned trivial_blocks = 0;
+  unsigned trivial_depth = 1;
+  Z3Limits limits;
+  // Shared by concurrent decompilations, or `nullptr`
+  Z3ProofCache *proofs = nullptr;
+  // Stops refinement once cancelled or past its deadline, or `nullptr`.
+  // The functions are then returned as refined so far, and those whose
+  // pipeline didn't start are only lowered.
+  CancellationToken *cancellation = nullptr;
+  // Skips the passes that never change functions of a CFG shape class,
+  // and learns from those that run, or `nullptr`
+  PassProfile *profile = nullptr;
+
+  // Preparation of the IR
+  PrepareOptions prepare;
+};
+
+// A function whose body was decompiled
+struct DecompiledFunction {
+  llvm::Function *func;
+  clang::FunctionDecl *fdefn;
+  // C code of `fdefn`, as `rellic-decomp` prints it
+  std::string code;
+  // Whether the pipeline was stopped by `DecompilationOptions::cancellation`
+  // before it finished
+  bool cut_short;
+};
+
+using DecompiledFunctionCallback =
+    std::function<void(const DecompiledFunction &)>;
+
+// The module and AST of a decompilation. Declarations and definitions
+// stay valid for as long as this object lives.
+class Decompilation {
+ private:
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<clang::CompilerInstance> ins;
+  std::unique_ptr<IncrementalDecompiler> decompiler;
+  std::vector<DecompiledFunction> funcs;
+
+  Decompilation() = default;
+
+  friend std::unique_ptr<Decompilation> Decompile(
+      llvm::MemoryBufferRef bitcode, const DecompilationOptions &options,
+      std::string &error, DecompiledFunctionCallback callback);
+
+ public:
+  llvm::Module &GetModule() { return *module; }
+  clang::ASTContext &GetASTContext() { return ins->getASTContext(); }
+  // Allows the module to be edited and decompiled again afterwards
+  IncrementalDecompiler &GetDecompiler() { return *decompiler; }
+
+  // Functions in module order, as first decompiled
+  const std::vector<DecompiledFunction> &GetFunctions() const {
+    return funcs;
+  }
+
+  // Prints the whole translation unit, like `rellic-decomp`
+  void Print(llvm::raw_ostream &os);
+};
+
+// Decompiles the bitcode or textual IR in `bitcode`, which only needs to
+// stay alive during the call. `callback` receives every function as soon
+// as its pipeline is done, so that callers can process it while later
+// functions are still being refined. Returns `nullptr` and describes the
+// problem in `error` if the input can't be loaded or the options are
+// invalid.
+std::unique_ptr<Decompilation> Decompile(
+    llvm::MemoryBufferRef bitcode, const DecompilationOptions &options,
+    std::string &error, DecompiledFunctionCallback callback = nullptr);
+
+}  // namespace rellic
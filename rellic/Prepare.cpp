@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rellic/Prepare.h"
+
+#include <glog/logging.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include <string>
+#include <vector>
+
+#include "rellic/AST/Stats.h"
+#include "rellic/BC/Simplify.h"
+#include "rellic/BC/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// Folds conditions of `func` that Z3 would otherwise have to simplify
+static void SimplifyIR(llvm::Function &func, const PrepareOptions &options,
+                       bool report) {
+  if (!options.simplify_ir || func.isDeclaration()) {
+    return;
+  }
+  auto counts{SimplifyFunction(func)};
+  if (report && Stats::IsEnabled()) {
+    Stats::Get().AddIRSimplification(func.getName(), counts.blocks_before,
+                                     counts.blocks_after, counts.insts_before,
+                                     counts.insts_after);
+  }
+}
+
+}  // namespace
+
+void RemovePHINodes(llvm::Function &func) {
+  std::vector<llvm::PHINode *> work_list;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      work_list.push_back(phi);
+    }
+  }
+  for (auto phi : work_list) {
+    llvm::DemotePHIToStack(phi);
+  }
+}
+
+void LowerSwitches(llvm::Function &func) {
+  llvm::legacy::FunctionPassManager fpm(func.getParent());
+  fpm.add(llvm::createLowerSwitchPass());
+  fpm.doInitialization();
+  fpm.run(func);
+  fpm.doFinalization();
+}
+
+void LowerSwitches(llvm::Module &module) {
+  llvm::legacy::PassManager pm;
+  pm.add(llvm::createLowerSwitchPass());
+  pm.run(module);
+}
+
+void SkipUnsupported(llvm::Function &func, const PrepareOptions &options,
+                     bool report) {
+  std::string reason;
+  if (!options.skip_unsupported || func.isDeclaration() ||
+      IsDecompilable(func, reason)) {
+    return;
+  }
+  if (report) {
+    LOG(WARNING) << "Emitting only a declaration of " << func.getName().str()
+                 << ": " << reason;
+    if (Stats::IsEnabled()) {
+      Stats::Get().AddSkippedFunction(func.getName(), reason);
+    }
+  }
+  func.deleteBody();
+}
+
+void PrepareFunction(llvm::Function &func, const PrepareOptions &options,
+                     bool report) {
+  if (options.remove_phi_nodes) {
+    RemovePHINodes(func);
+  }
+
+  if (options.lower_switch) {
+    LowerSwitches(func);
+  }
+
+  SkipUnsupported(func, options, report);
+  SimplifyIR(func, options, report);
+}
+
+void PrepareModule(llvm::Module &module, const PrepareOptions &options,
+                   bool report) {
+  if (options.remove_phi_nodes) {
+    for (auto &func : module) {
+      RemovePHINodes(func);
+    }
+  }
+
+  if (options.lower_switch) {
+    LowerSwitches(module);
+  }
+
+  for (auto &func : module) {
+    SkipUnsupported(func, options, report);
+    SimplifyIR(func, options, report);
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+
+namespace rellic {
+
+// How the IR is prepared for decompilation, see the `rellic-decomp` flags
+// of the same names
+struct PrepareOptions {
+  bool remove_phi_nodes = false;
+  bool lower_switch = false;
+  bool simplify_ir = false;
+  bool skip_unsupported = false;
+};
+
+// Demotes the PHI nodes of `func` to stack slots
+void RemovePHINodes(llvm::Function &func);
+
+// Lowers the switches of `func`, or of all functions of `module`, to
+// branches
+void LowerSwitches(llvm::Function &func);
+void LowerSwitches(llvm::Module &module);
+
+// Turns `func` into a declaration if `options` skip unsupported functions
+// and it can't be decompiled, so that it does not abort the decompilation
+// of the rest of the module. Only reports it if `report` is set.
+void SkipUnsupported(llvm::Function &func, const PrepareOptions &options,
+                     bool report);
+
+// Prepares a single function, e.g. one whose body was loaded lazily
+void PrepareFunction(llvm::Function &func, const PrepareOptions &options,
+                     bool report = true);
+
+// Prepares all functions of `module`. Skipped functions and simplified
+// bodies are only reported if `report` is set, so that every copy of a
+// module reports them once.
+void PrepareModule(llvm::Module &module, const PrepareOptions &options,
+                   bool report = true);
+
+}  // namespace rellic
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def compile_corpus(clang, corpus, tempdir):
+    inputs = []
+    for source in sorted(glob.glob(os.path.join(corpus, "*.c"))):
+        output = os.path.join(
+            tempdir, os.path.splitext(os.path.basename(source))[0] + ".bc"
+        )
+        p = subprocess.run(
+            [clang, "-c", "-emit-llvm", source, "-o", output],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+        )
+        if p.returncode != 0:
+            print("Skipping {}: {}".format(source, p.stderr), file=sys.stderr)
+            continue
+        inputs.append(output)
+    return inputs
+
+
+def print_summary(result):
+    for bench in result["benchmarks"]:
+        print("{:<40} {:>10.4f}s".format(bench["name"], bench["seconds"]))
+        for stage in bench["stages"]:
+            print(
+                "  {:<38} {:>10.4f}s {:>10} KiB RSS growth".format(
+                    stage["name"], stage["seconds"], stage["rss_growth_kb"]
+                )
+            )
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark the decompilation pipeline on synthetic CFGs "
+        "and the roundtrip test corpus"
+    )
+    parser.add_argument("rellic_bench", help="path to rellic-bench")
+    parser.add_argument("corpus", help="directory with C sources to compile")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument("--output", help="JSON file with the results")
+    parser.add_argument(
+        "--bench-arg",
+        action="append",
+        default=[],
+        help="extra argument to pass to rellic-bench",
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tempdir:
+        inputs = compile_corpus(args.clang, args.corpus, tempdir)
+        output = args.output or os.path.join(tempdir, "bench.json")
+        cmd = [args.rellic_bench, "--output", output]
+        if inputs:
+            cmd.append("--inputs=" + ",".join(inputs))
+        cmd.extend(args.bench_arg)
+        p = subprocess.run(cmd)
+        if p.returncode != 0:
+            return p.returncode
+
+        with open(output) as f:
+            print_summary(json.load(f))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
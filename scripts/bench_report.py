@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+
+import argparse
+import csv
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+
+from bench import compile_corpus
+import stress
+
+# Bumped whenever rows or environment fields change meaning
+SCHEMA_VERSION = 1
+
+COLUMNS = ["suite", "benchmark", "stage", "metric", "value"]
+
+
+def run_bench(rellic_bench, suite, args, tempdir):
+    """Runs rellic-bench and returns its results"""
+    output = os.path.join(tempdir, suite + ".json")
+    p = subprocess.run([rellic_bench, "--output", output] + args)
+    if p.returncode != 0:
+        raise RuntimeError("rellic-bench failed on the {} suite".format(suite))
+    with open(output) as f:
+        return json.load(f)
+
+
+def run_inputs(rellic_bench, suite, sources, clang, extra, tempdir):
+    """Benchmarks the C files in `sources` and names them after the files"""
+    bitcode = os.path.join(tempdir, suite)
+    os.makedirs(bitcode)
+    inputs = compile_corpus(clang, sources, bitcode)
+    if not inputs:
+        return None
+    args = ["--families=", "--inputs=" + ",".join(inputs)] + extra
+    result = run_bench(rellic_bench, suite, args, tempdir)
+    for bench in result["benchmarks"]:
+        bench["name"] = os.path.splitext(os.path.basename(bench["name"]))[0]
+    return result
+
+
+def get_rows(suite, result):
+    """Flattens the results of a suite into rows of `COLUMNS`"""
+    rows = []
+    for bench in result["benchmarks"]:
+        rows.append([suite, bench["name"], "", "seconds", bench["seconds"]])
+        for stage in bench["stages"]:
+            for metric in ["seconds", "heap_bytes", "rss_growth_kb"]:
+                rows.append(
+                    [suite, bench["name"], stage["name"], metric, stage[metric]]
+                )
+    return rows
+
+
+def get_environment(clang, args):
+    p = subprocess.run(
+        [clang, "--version"], stdout=subprocess.PIPE, universal_newlines=True
+    )
+    return {
+        "timestamp": datetime.datetime.utcnow().strftime("%Y-%m-%dT%H:%M:%SZ"),
+        "host": platform.node(),
+        "system": platform.system(),
+        "release": platform.release(),
+        "machine": platform.machine(),
+        "cpus": os.cpu_count(),
+        "python": platform.python_version(),
+        "clang": p.stdout.splitlines()[0] if p.stdout else "",
+        "repetitions": args.repetitions,
+        "stress_scale": args.stress_scale,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark synthetic CFGs, the roundtrip test corpus and "
+        "the stress inputs, and export the results of this commit in a stable "
+        "schema for dashboards"
+    )
+    parser.add_argument("rellic_bench", help="path to rellic-bench")
+    parser.add_argument("corpus", help="directory with C sources to compile")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument(
+        "--output",
+        required=True,
+        help="report to write, as CSV if it ends in .csv and as JSON otherwise",
+    )
+    parser.add_argument(
+        "--stress-scale",
+        type=float,
+        default=0.1,
+        help="factor to scale the sizes of stress inputs by",
+    )
+    parser.add_argument(
+        "--repetitions", type=int, default=3, help="number of runs of every benchmark"
+    )
+    parser.add_argument(
+        "--bench-arg",
+        action="append",
+        default=[],
+        help="extra argument to pass to rellic-bench (repeatable)",
+    )
+    args = parser.parse_args()
+
+    extra = ["--repetitions={}".format(args.repetitions)] + args.bench_arg
+    rows = []
+    with tempfile.TemporaryDirectory() as tempdir:
+        synthetic = run_bench(args.rellic_bench, "synthetic", extra, tempdir)
+        rows.extend(get_rows("synthetic", synthetic))
+
+        roundtrip = run_inputs(
+            args.rellic_bench, "roundtrip", args.corpus, args.clang, extra, tempdir
+        )
+        if roundtrip:
+            rows.extend(get_rows("roundtrip", roundtrip))
+
+        sources = os.path.join(tempdir, "stress-sources")
+        stress.generate(sources, args.stress_scale)
+        results = run_inputs(
+            args.rellic_bench, "stress", sources, args.clang, extra, tempdir
+        )
+        if results:
+            rows.extend(get_rows("stress", results))
+
+    rows.sort(key=lambda row: row[:4])
+    # The commit hash comes from `rellic::Version::GetCommitHash`
+    commit = synthetic["commit"]
+    version = synthetic["version"]
+    environment = get_environment(args.clang, args)
+
+    if args.output.endswith(".csv"):
+        with open(args.output, "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(["schema_version", "commit", "version"] + COLUMNS)
+            for row in rows:
+                writer.writerow([SCHEMA_VERSION, commit, version] + row)
+        # Environment metadata doesn't fit the rows, so it goes next to them
+        with open(os.path.splitext(args.output)[0] + ".env.json", "w") as f:
+            json.dump(environment, f, indent=2, sort_keys=True)
+    else:
+        report = {
+            "schema_version": SCHEMA_VERSION,
+            "commit": commit,
+            "version": version,
+            "environment": environment,
+            "results": [dict(zip(COLUMNS, row)) for row in rows],
+        }
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+
+    print("Wrote {} results of commit {} to {}".format(len(rows), commit, args.output))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,7 +5,12 @@ import subprocess
 import argparse
 import tempfile
 import os
+import socket
 import sys
+import time
+import json
+import threading
+from concurrent.futures import ThreadPoolExecutor
 
 
 class RunError(Exception):
@@ -17,12 +22,14 @@ class RunError(Exception):
 
 
 def run_cmd(cmd, timeout):
+    """Runs `cmd` and returns its completed process, with the wall time in
+    `seconds` and the peak resident set size in `peak_rss_kb`"""
+    start = time.monotonic()
     try:
-        p = subprocess.run(
+        p = subprocess.Popen(
             cmd,
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
-            timeout=timeout,
             universal_newlines=True,
         )
     except FileNotFoundError as e:
@@ -30,7 +37,48 @@ def run_cmd(cmd, timeout):
     except PermissionError as e:
         raise RunError('Error: File "' + e.filename + '" is not an executable.')
 
-    return p
+    timer = threading.Timer(timeout, p.kill) if timeout else None
+    if timer is not None:
+        timer.start()
+    outputs = {}
+    readers = [
+        threading.Thread(target=lambda: outputs.update(stdout=p.stdout.read())),
+        threading.Thread(target=lambda: outputs.update(stderr=p.stderr.read())),
+    ]
+    for reader in readers:
+        reader.start()
+    # Reap the process ourselves to get its resource usage
+    _, status, usage = os.wait4(p.pid, 0)
+    for reader in readers:
+        reader.join()
+    p.stdout.close()
+    p.stderr.close()
+    if timer is not None:
+        timer.cancel()
+    if os.WIFSIGNALED(status):
+        p.returncode = -os.WTERMSIG(status)
+    else:
+        p.returncode = os.WEXITSTATUS(status)
+    if timer is not None and p.returncode == -9 and not timer.is_alive():
+        raise subprocess.TimeoutExpired(cmd, timeout)
+
+    result = subprocess.CompletedProcess(
+        cmd, p.returncode, outputs["stdout"], outputs["stderr"]
+    )
+    result.seconds = time.monotonic() - start
+    # macOS reports bytes instead of KiB
+    scale = 1024 if sys.platform == "darwin" else 1
+    result.peak_rss_kb = usage.ru_maxrss // scale
+    return result
+
+
+def record(stages, name, p):
+    """Adds the time and peak memory of `p` to stage `name` of `stages`"""
+    if stages is None:
+        return
+    stage = stages.setdefault(name, {"seconds": 0.0, "peak_rss_kb": 0})
+    stage["seconds"] += p.seconds
+    stage["peak_rss_kb"] = max(stage["peak_rss_kb"], p.peak_rss_kb)
 
 
 def compile(self, clang, input, output, timeout, options=None):
@@ -49,11 +97,11 @@ def compile(self, clang, input, output, timeout, options=None):
     return p
 
 
-def decompile(self, rellic, input, output, timeout):
+def decompile(self, rellic, input, output, timeout, options=None):
     cmd = [rellic]
-    cmd.extend(
-        ["--lower_switch", "--remove_phi_nodes", "--input", input, "--output", output]
-    )
+    cmd.extend(["--input", input, "--output", output])
+    if options is not None:
+        cmd.extend(options)
     p = run_cmd(cmd, timeout)
 
     self.assertEqual(p.returncode, 0, "rellic-decomp failure: %s" % p.stderr)
@@ -64,19 +112,136 @@ def decompile(self, rellic, input, output, timeout):
     return p
 
 
-def roundtrip(self, rellic, filename, clang, timeout, translate_only):
+def shard_decompile(self, rellic, merge, shards, input, output, timeout, options):
+    """Decompiles `input` in `shards` rellic-decomp --shard runs and merges
+    their outputs into `output` with rellic-merge"""
+    outputs = []
+    runs = []
+    for idx in range(shards):
+        shard_c = f"{output}.shard{idx}"
+        shard_options = list(options) + [f"--shard={idx}/{shards}"]
+        runs.append(decompile(self, rellic, input, shard_c, timeout, shard_options))
+        outputs.append(shard_c)
+    p = run_cmd([merge, "--output", output] + outputs, timeout)
+    self.assertEqual(p.returncode, 0, "rellic-merge failure: %s" % p.stderr)
+    return runs + [p]
+
+
+def batch_decompile(rellic, filenames, clang, tempdir, timeout, rellic_args):
+    """Decompiles all `filenames` with a single rellic-decomp --batch run and
+    returns the path of the C output of every file"""
+    manifest = os.path.join(tempdir, "manifest")
+    outputs = {}
+    with open(manifest, "w") as f:
+        for idx, filename in enumerate(filenames):
+            rt_bc = os.path.join(tempdir, f"rt{idx}.bc")
+            rt_c = os.path.join(tempdir, f"rt{idx}.c")
+            run_cmd([clang, "-c", "-emit-llvm", filename, "-o", rt_bc], timeout)
+            f.write(f"{rt_bc} {rt_c}\n")
+            outputs[filename] = rt_c
+
+    cmd = [rellic, "--batch", manifest]
+    cmd.extend(rellic_args)
+    # Failures show up as missing outputs of the affected tests
+    run_cmd(cmd, timeout)
+    return outputs
+
+
+class Server:
+    """A rellic-decomp --serve process that decompiles bitcode sent to it"""
+
+    def __init__(self, rellic, tempdir, rellic_args, timeout=None):
+        self.path = os.path.join(tempdir, "rellic.sock")
+        self.timeout = timeout
+        cmd = [rellic, "--serve", self.path]
+        cmd.extend(rellic_args)
+        self.proc = subprocess.Popen(cmd)
+
+    def connect(self):
+        # The socket shows up only once the server is ready
+        while True:
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                sock.connect(self.path)
+                return sock
+            except (FileNotFoundError, ConnectionRefusedError):
+                sock.close()
+                if self.proc.poll() is not None:
+                    raise RunError("rellic-decomp --serve exited early")
+                time.sleep(0.1)
+
+    def request(self, header, payload=b""):
+        with self.connect() as sock:
+            # A hung server fails the request instead of the whole run
+            sock.settimeout(self.timeout)
+            try:
+                sock.sendall(header.encode() + b"\n" + payload)
+                with sock.makefile("rb") as f:
+                    status, size = f.readline().decode().split()
+                    return status, f.read(int(size)).decode()
+            except socket.timeout:
+                raise subprocess.TimeoutExpired(header, self.timeout)
+
+    def decompile(self, input, output):
+        with open(input, "rb") as f:
+            bitcode = f.read()
+        status, payload = self.request(f"decompile {len(bitcode)}", bitcode)
+        if status == "ok":
+            with open(output, "w") as f:
+                f.write(payload)
+        return status, payload
+
+    def shutdown(self):
+        self.request("shutdown")
+        self.proc.wait()
+
+
+def roundtrip(
+    self,
+    rellic,
+    filename,
+    clang,
+    timeout,
+    translate_only,
+    rellic_args,
+    rt_c=None,
+    server=None,
+    stages=None,
+    merge=None,
+    shards=0,
+):
     with tempfile.TemporaryDirectory() as tempdir:
         out1 = os.path.join(tempdir, "out1")
-        compile(self, clang, filename, out1, timeout)
+        record(stages, "compile", compile(self, clang, filename, out1, timeout))
 
         # capture binary run outputs
         cp1 = run_cmd([out1], timeout)
 
-        rt_bc = os.path.join(tempdir, "rt.bc")
-        compile(self, clang, filename, rt_bc, timeout, ["-c", "-emit-llvm"])
-
-        rt_c = os.path.join(tempdir, "rt.c")
-        decompile(self, rellic, rt_bc, rt_c, timeout)
+        # Use the output of a batch run if there is one
+        if rt_c is None:
+            rt_bc = os.path.join(tempdir, "rt.bc")
+            p = compile(self, clang, filename, rt_bc, timeout, ["-c", "-emit-llvm"])
+            record(stages, "compile", p)
+
+            rt_c = os.path.join(tempdir, "rt.c")
+            if shards:
+                for p in shard_decompile(
+                    self, rellic, merge, shards, rt_bc, rt_c, timeout, rellic_args
+                ):
+                    record(stages, "decompile", p)
+            elif server is None:
+                p = decompile(self, rellic, rt_bc, rt_c, timeout, rellic_args)
+                record(stages, "decompile", p)
+            else:
+                start = time.monotonic()
+                status, payload = server.decompile(rt_bc, rt_c)
+                # The memory of the server is not attributed to requests
+                if stages is not None:
+                    stages["decompile"] = {
+                        "seconds": time.monotonic() - start,
+                        "peak_rss_kb": 0,
+                    }
+                self.assertEqual(status, "ok", "rellic-decomp failure: %s" % payload)
 
         # ensure there is a C output file
         self.assertTrue(os.path.exists(rt_c))
@@ -87,7 +252,8 @@ def roundtrip(self, rellic, filename, clang, timeout, translate_only):
         # We should recompile, lets see how this goes
         if not translate_only:
             out2 = os.path.join(tempdir, "out2")
-            compile(self, clang, rt_c, out2, timeout, ["-Wno-everything"])
+            p = compile(self, clang, rt_c, out2, timeout, ["-Wno-everything"])
+            record(stages, "rebuild", p)
 
             # capture outputs of binary after roundtrip
             cp2 = run_cmd([out2], timeout)
@@ -101,31 +267,229 @@ class TestRoundtrip(unittest.TestCase):
     pass
 
 
+class LockedResult:
+    """Serializes the calls that parallel tests make to one test result"""
+
+    def __init__(self, result):
+        self._result = result
+        self._lock = threading.Lock()
+
+    def __getattr__(self, name):
+        attr = getattr(self._result, name)
+        if not callable(attr):
+            return attr
+
+        def locked(*args, **kwargs):
+            with self._lock:
+                return attr(*args, **kwargs)
+
+        return locked
+
+
+class ParallelSuite(unittest.TestSuite):
+    """Runs its tests on `jobs` threads"""
+
+    def __init__(self, tests, jobs):
+        super().__init__(tests)
+        self.jobs = jobs
+
+    def run(self, result, debug=False):
+        locked = LockedResult(result)
+        with ThreadPoolExecutor(self.jobs) as executor:
+            list(executor.map(lambda test: test(locked), self))
+        return result
+
+
+class Report:
+    """Per-test results and stage timings, written after every test so that
+    an interrupted run can be resumed"""
+
+    def __init__(self, path, resume):
+        self.path = path
+        self.lock = threading.Lock()
+        self.tests = {}
+        if resume and path and os.path.exists(path):
+            with open(path) as f:
+                self.tests = json.load(f)["tests"]
+
+    def passed(self, name):
+        return self.tests.get(name, {}).get("status") == "pass"
+
+    def add(self, name, status, stages):
+        with self.lock:
+            self.tests[name] = {"status": status, "stages": stages}
+            if self.path:
+                with open(self.path + ".tmp", "w") as f:
+                    json.dump({"tests": self.tests}, f, indent=2, sort_keys=True)
+                os.replace(self.path + ".tmp", self.path)
+
+
+def compare(report, baseline_path, tolerance, min_seconds):
+    """Prints the stages that are slower or use more memory than in the
+    baseline report and returns whether there were any"""
+    with open(baseline_path) as f:
+        baseline = json.load(f)["tests"]
+    regressions = []
+    for name, test in sorted(report.tests.items()):
+        for stage, now in sorted(test["stages"].items()):
+            then = baseline.get(name, {}).get("stages", {}).get(stage)
+            if then is None:
+                continue
+            limit = then["seconds"] * (1 + tolerance)
+            if now["seconds"] > max(limit, then["seconds"] + min_seconds):
+                regressions.append(
+                    "{} {}: {:.3f}s, was {:.3f}s".format(
+                        name, stage, now["seconds"], then["seconds"]
+                    )
+                )
+            limit = then["peak_rss_kb"] * (1 + tolerance)
+            if then["peak_rss_kb"] and now["peak_rss_kb"] > limit:
+                regressions.append(
+                    "{} {}: {} KiB peak RSS, was {} KiB".format(
+                        name, stage, now["peak_rss_kb"], then["peak_rss_kb"]
+                    )
+                )
+    for regression in regressions:
+        print("Regression: " + regression, file=sys.stderr)
+    return bool(regressions)
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("rellic", help="path to rellic-decomp")
-    parser.add_argument("tests", help="path to test directory")
+    parser.add_argument("tests", help="path to test directory or file")
     parser.add_argument("clang", help="path to clang")
     parser.add_argument(
         "--translate-only", action="store_true", default=False, help="Translate only, do not recompile"
     )
+    parser.add_argument(
+        "--batch",
+        action="store_true",
+        default=False,
+        help="Decompile all tests in a single rellic-decomp --batch run",
+    )
+    parser.add_argument(
+        "--server",
+        action="store_true",
+        default=False,
+        help="Decompile all tests through a single rellic-decomp --serve process",
+    )
+    parser.add_argument(
+        "--shards",
+        type=int,
+        default=0,
+        help="Decompile every test in this many rellic-decomp --shard runs",
+    )
+    parser.add_argument(
+        "--merge", help="path to rellic-merge, which combines --shards outputs"
+    )
     parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
+    parser.add_argument(
+        "--rellic-arg",
+        action="append",
+        default=[],
+        help="extra argument to pass to rellic-decomp (repeatable)",
+    )
+    parser.add_argument(
+        "-j", "--jobs", type=int, default=1, help="number of tests to run in parallel"
+    )
+    parser.add_argument(
+        "--report", help="JSON file with the result and stage timings of every test"
+    )
+    parser.add_argument(
+        "--resume",
+        action="store_true",
+        default=False,
+        help="skip the tests that passed in an existing --report",
+    )
+    parser.add_argument(
+        "--baseline", help="fail if stages got slower than in this --report"
+    )
+    parser.add_argument(
+        "--tolerance",
+        type=float,
+        default=0.25,
+        help="relative slowdown or memory growth over --baseline that is accepted",
+    )
+    parser.add_argument(
+        "--min-seconds",
+        type=float,
+        default=0.1,
+        help="slowdown over --baseline in seconds that is always accepted",
+    )
 
     args = parser.parse_args()
+    if args.shards and not args.merge:
+        parser.error("--shards needs --merge")
+
+    report = Report(args.report, args.resume)
+
+    if os.path.isfile(args.tests):
+        paths = [args.tests]
+    else:
+        paths = sorted(item.path for item in os.scandir(args.tests) if item.is_file())
+
+    tests = []
+    for path in paths:
+        name, ext = os.path.splitext(os.path.basename(path))
+        # Allow for READMEs and data/headers
+        if ext in [".c", ".cpp"] and not report.passed(name):
+            tests.append((name, path))
+
+    batch_dir = tempfile.TemporaryDirectory()
+    outputs = {}
+    if args.batch:
+        outputs = batch_decompile(
+            args.rellic,
+            [path for _, path in tests],
+            args.clang,
+            batch_dir.name,
+            args.timeout,
+            args.rellic_arg,
+        )
+
+    server = None
+    if args.server:
+        server = Server(args.rellic, batch_dir.name, args.rellic_arg, args.timeout)
 
-    def test_generator(path):
+    def test_generator(name, path):
         def test(self):
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only)
+            stages = {}
+            status = "fail"
+            try:
+                roundtrip(
+                    self,
+                    args.rellic,
+                    path,
+                    args.clang,
+                    args.timeout,
+                    args.translate_only,
+                    args.rellic_arg,
+                    outputs.get(path),
+                    server,
+                    stages,
+                    args.merge,
+                    args.shards,
+                )
+                status = "pass"
+            finally:
+                report.add(name, status, stages)
 
         return test
 
-    for item in os.scandir(args.tests):
-        if item.is_file():
-            name, ext = os.path.splitext(item.name)
-            # Allow for READMEs and data/headers
-            if ext in [".c", ".cpp"]:
-                test_name = f"test_{name}"
-                test = test_generator(item.path)
-                setattr(TestRoundtrip, test_name, test)
+    for name, path in tests:
+        setattr(TestRoundtrip, f"test_{name}", test_generator(name, path))
 
-    unittest.main(argv=[sys.argv[0]])
+    suite = ParallelSuite(
+        unittest.defaultTestLoader.loadTestsFromTestCase(TestRoundtrip),
+        max(args.jobs, 1),
+    )
+    try:
+        result = unittest.TextTestRunner().run(suite)
+    finally:
+        if server is not None:
+            server.shutdown()
+    failed = not result.wasSuccessful()
+    if args.baseline:
+        failed |= compare(report, args.baseline, args.tolerance, args.min_seconds)
+    sys.exit(failed)
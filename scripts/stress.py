@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+HEADER = "#include <stdio.h>\n\n"
+
+
+def switch(n):
+    """One `switch` with `n` cases, some of which fall through"""
+    lines = [HEADER, "unsigned sw(unsigned x) {\n  unsigned r = x;\n"]
+    lines.append("  switch (x) {\n")
+    for i in range(n):
+        lines.append("    case {}:\n      r = r * {}u + {}u;\n".format(i, i % 7 + 2, i))
+        if i % 3 != 0:
+            lines.append("      break;\n")
+    lines.append("    default:\n      r ^= 0x5au;\n  }\n  return r;\n}\n\n")
+    lines.append(
+        "int main(void) {{\n  unsigned h = 0;\n"
+        "  for (unsigned x = 0; x != {}u; ++x) {{\n    h = h * 31u + sw(x);\n  }}\n"
+        '  printf("%u\\n", h);\n  return 0;\n}}\n'.format(n + 2)
+    )
+    return "".join(lines)
+
+
+def loops(depth):
+    """`depth` nested loops that each have a `break` and a `continue`"""
+    lines = [HEADER, "unsigned nest(unsigned seed) {\n  unsigned h = seed;\n"]
+    for d in range(depth):
+        indent = "  " * (d + 1)
+        lines.append(
+            "{0}for (unsigned i{1} = 0; i{1} != 3u; ++i{1}) {{\n"
+            "{0}  if ((h + i{1}) % {2}u == 0u) break;\n"
+            "{0}  if ((h ^ i{1}) % {3}u == 1u) continue;\n".format(
+                indent, d, d + 5, d + 3
+            )
+        )
+    lines.append("{}h = h * 33u + 1u;\n".format("  " * (depth + 1)))
+    for d in reversed(range(depth)):
+        lines.append("{}}}\n".format("  " * (d + 1)))
+    lines.append("  return h;\n}\n\n")
+    lines.append(
+        "int main(void) {\n  unsigned h = 0;\n"
+        "  for (unsigned s = 0; s != 8u; ++s) {\n    h ^= nest(s);\n  }\n"
+        '  printf("%u\\n", h);\n  return 0;\n}\n'
+    )
+    return "".join(lines)
+
+
+def if_chain(n):
+    """An `if`-`else if` chain with `n` links"""
+    lines = [HEADER, "unsigned chain(unsigned x) {\n"]
+    for i in range(n):
+        keyword = "if" if i == 0 else "} else if"
+        op = "==" if i % 2 == 0 else "<"
+        lines.append(
+            "  {} (x {} {}u) {{\n    return x * {}u;\n".format(keyword, op, i * 3, i + 1)
+        )
+    lines.append("  }\n  return 0u;\n}\n\n")
+    lines.append(
+        "int main(void) {{\n  unsigned h = 0;\n"
+        "  for (unsigned x = 0; x != {}u; ++x) {{\n    h = h * 31u + chain(x);\n  }}\n"
+        '  printf("%u\\n", h);\n  return 0;\n}}\n'.format(n * 3 + 2)
+    )
+    return "".join(lines)
+
+
+def blocks(n):
+    """One function with about `n` basic blocks"""
+    lines = [HEADER, "unsigned big(unsigned x) {\n  unsigned h = x;\n"]
+    # Each diamond contributes three blocks
+    for i in range(n // 3):
+        lines.append(
+            "  if (h & {}u) h += {}u; else h ^= {}u;\n".format(
+                1 << (i % 31), i, i * 7
+            )
+        )
+    lines.append("  return h;\n}\n\n")
+    lines.append(
+        'int main(void) {\n  printf("%u\\n", big(1u) ^ big(12345u));\n'
+        "  return 0;\n}\n"
+    )
+    return "".join(lines)
+
+
+def functions(n):
+    """A module with `n` functions that call each other in chains of 100"""
+    lines = [HEADER]
+    for i in range(n):
+        lines.append("unsigned f{}(unsigned x);\n".format(i))
+    lines.append("\n")
+    for i in range(n):
+        if i % 100 != 99 and i + 1 != n:
+            body = "f{}(x * 3u + {}u)".format(i + 1, i)
+        else:
+            body = "x ^ {}u".format(i)
+        lines.append("unsigned f{}(unsigned x) {{ return {}; }}\n".format(i, body))
+    lines.append("\nint main(void) {\n  unsigned h = 0;\n")
+    for i in range(0, n, 100):
+        lines.append("  h ^= f{}(h);\n".format(i))
+    lines.append('  printf("%u\\n", h);\n  return 0;\n}\n')
+    return "".join(lines)
+
+
+# Name, generator, size and the number of seconds decompilation may take
+FAMILIES = [
+    ("switch_64", switch, 64, 30),
+    ("switch_1024", switch, 1024, 120),
+    ("loops_4", loops, 4, 30),
+    ("loops_8", loops, 8, 120),
+    ("if_chain_256", if_chain, 256, 60),
+    ("if_chain_2048", if_chain, 2048, 300),
+    ("blocks_10k", blocks, 10500, 600),
+    ("functions_50k", functions, 50000, 600),
+]
+
+
+def generate(directory, scale):
+    """Writes the stress inputs scaled by `scale` to `directory` and returns
+    the decompilation time limit of each"""
+    os.makedirs(directory, exist_ok=True)
+    limits = {}
+    for name, generator, size, seconds in FAMILIES:
+        with open(os.path.join(directory, name + ".c"), "w") as f:
+            f.write(generator(max(int(size * scale), 1)))
+        limits[name] = seconds
+    return limits
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Roundtrip large synthetic inputs and check that they are "
+        "decompiled within their time limits"
+    )
+    parser.add_argument("rellic", help="path to rellic-decomp")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument(
+        "--output-dir", help="directory to write the stress inputs and report to"
+    )
+    parser.add_argument(
+        "--generate-only",
+        action="store_true",
+        default=False,
+        help="only write the stress inputs",
+    )
+    parser.add_argument(
+        "--scale", type=float, default=1.0, help="factor to scale input sizes by"
+    )
+    parser.add_argument(
+        "--limit-scale",
+        type=float,
+        default=1.0,
+        help="factor to scale time limits by, for slower machines",
+    )
+    parser.add_argument(
+        "-j", "--jobs", type=int, default=1, help="number of inputs to run in parallel"
+    )
+    parser.add_argument(
+        "--rellic-arg",
+        action="append",
+        default=[],
+        help="extra argument to pass to rellic-decomp (repeatable)",
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tempdir:
+        directory = args.output_dir or tempdir
+        limits = generate(directory, args.scale)
+        if args.generate_only:
+            return 0
+
+        report = os.path.join(directory, "stress.json")
+        roundtrip = os.path.join(os.path.dirname(__file__), "roundtrip.py")
+        cmd = [
+            sys.executable,
+            roundtrip,
+            "--jobs",
+            str(args.jobs),
+            "--report",
+            report,
+            # Let slow decompilations finish so that their time is reported
+            "--timeout",
+            str(int(max(limits.values()) * args.limit_scale * 2)),
+        ]
+        cmd.extend("--rellic-arg=" + arg for arg in args.rellic_arg)
+        cmd.extend([args.rellic, directory, args.clang])
+        failed = subprocess.run(cmd).returncode != 0
+
+        with open(report) as f:
+            tests = json.load(f)["tests"]
+        for name, limit in sorted(limits.items()):
+            stages = tests.get(name, {}).get("stages", {})
+            seconds = stages.get("decompile", {}).get("seconds")
+            if seconds is None:
+                print("{:<20} not decompiled".format(name))
+                continue
+            limit *= args.limit_scale
+            status = "ok" if seconds <= limit else "TOO SLOW"
+            print("{:<20} {:>10.2f}s of {:>6.0f}s {}".format(name, seconds, limit, status))
+            failed |= seconds > limit
+
+    return int(failed)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
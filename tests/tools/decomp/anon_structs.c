@@ -0,0 +1,18 @@
+#include <stdio.h>
+
+struct {
+  int x;
+  short y;
+} a = {1, 2};
+
+struct {
+  int x;
+  short y;
+} b = {3, 4};
+
+int main(void) {
+  a.x += b.y;
+  b.x += a.y;
+  printf("%d %d %d %d\n", a.x, a.y, b.x, b.y);
+  return 0;
+}
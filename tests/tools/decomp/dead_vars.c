@@ -0,0 +1,23 @@
+#include <stdio.h>
+
+int counter = 0;
+
+int next(void) { return ++counter; }
+
+int compute(int x) {
+  int unused = x * 3;
+  int chain = unused + 1;
+  int kept = next();
+  int loop = 0;
+  for (int i = 0; i < x; ++i) {
+    loop = loop + i;
+  }
+  chain = next();
+  return x + 1;
+}
+
+int main(void) {
+  printf("%d\n", compute(4));
+  printf("%d\n", counter);
+  return 0;
+}
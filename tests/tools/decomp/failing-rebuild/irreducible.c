@@ -0,0 +1,17 @@
+#include <stdio.h>
+
+int main(int argc, char **argv)
+{
+    unsigned i = 0;
+    if (argc > 1)
+        goto odd;
+    do {
+        printf("even %u\n", i);
+        ++i;
+odd:
+        printf("odd %u\n", i);
+        ++i;
+    } while (i < 10);
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+struct point {
+  int x;
+  int y;
+};
+
+int area(int w, int h) {
+  struct point p;
+  p.x = w;
+  p.y = h;
+  return p.x * p.y;
+}
+
+int main(void) {
+  return area(3, 4);
+}
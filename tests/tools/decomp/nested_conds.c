@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+int classify(int x, int y) {
+  int r = 0;
+  if (x > 0 && y > 0) {
+    if (x > 0) {
+      r += 1;
+    }
+    if (y > 0 && x > 10) {
+      r += 2;
+    }
+  } else {
+    if (x > 0) {
+      if (y > 0) {
+        r = -100;
+      } else {
+        r += 4;
+      }
+    }
+  }
+  return r;
+}
+
+int main(void) {
+  for (int x = -2; x < 14; x += 3) {
+    for (int y = -1; y < 2; ++y) {
+      printf("%d\n", classify(x, y));
+    }
+  }
+  return 0;
+}
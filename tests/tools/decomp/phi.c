@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+int nums[] = {3, 1, 4, 1, 5, 9, 2, 6};
+
+int main(void) {
+  int i = 0;
+  int sum = 0;
+  while (i < 8 && nums[i] != 9) {
+    sum += (nums[i] > 2 || nums[i] == 1) ? nums[i] : -1;
+    ++i;
+  }
+  int any = sum > 10 && (i & 1 || sum % 3 == 0);
+  printf("%d %d %d\n", i, sum, any);
+  return 0;
+}
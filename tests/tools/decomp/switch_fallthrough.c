@@ -0,0 +1,27 @@
+#include <stdio.h>
+
+int classify(int c) {
+  int r = 0;
+  switch (c) {
+  case 'a':
+  case 'e':
+  case 'i':
+    r += 1;
+  case 'o':
+    r += 2;
+    break;
+  case '0':
+    return -1;
+  default:
+    r = 7;
+  }
+  return r;
+}
+
+int main(void) {
+  const char *s = "aeo0zi";
+  for (int i = 0; s[i]; ++i) {
+    printf("%d\n", classify(s[i]));
+  }
+  return 0;
+}
@@ -0,0 +1,9 @@
+typedef int v4si __attribute__((vector_size(16)));
+
+int sum(int x) {
+  v4si v = {x, x, x, x};
+  v = v + v;
+  return v[0] + v[3];
+}
+
+int main(void) { return sum(1) == 4 ? 0 : 1; }
@@ -0,0 +1,701 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/InitializePasses.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/GenerateAST.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/Pipeline.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/TypeCache.h"
+#include "rellic/AST/Util.h"
+#include "rellic/AST/Z3Solver.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Version/Version.h"
+
+DEFINE_string(families, "diamonds,switch,loops,straight",
+              "Comma-separated synthetic CFG families to benchmark.");
+DEFINE_string(sizes, "8,32,128", "Comma-separated sizes of each family.");
+DEFINE_string(inputs, "", "Comma-separated LLVM bitcode files to benchmark.");
+DEFINE_string(output, "", "Output JSON file. Defaults to stdout.");
+DEFINE_uint32(repetitions, 1, "Number of times every benchmark is run.");
+DEFINE_string(passes, "default",
+              "Refinement pipeline to benchmark: a preset name or a "
+              "pipeline, as accepted by rellic-decomp --passes.");
+DEFINE_uint32(max_rounds, 100,
+              "Maximum number of rounds of fixpoint stages that don't set "
+              "their own limit in --passes. 0 means no limit.");
+DEFINE_string(conv_families, "",
+              "Comma-separated expression families that Z3ConvVisitor "
+              "converts from Z3 to C and back: arith, bitwise, logic, "
+              "sext or mixed.");
+DEFINE_string(conv_widths, "8,32,64",
+              "Comma-separated bit widths of the variables of every "
+              "expression family.");
+DEFINE_string(conv_depths, "4,8",
+              "Comma-separated depths of the expressions of every family.");
+DEFINE_uint32(conv_exprs, 256,
+              "Number of expressions that every conversion benchmark "
+              "converts.");
+
+namespace {
+
+// Refinement stages selected by --passes
+static rellic::PipelineDesc pipeline;
+
+// Creates `i32 name(i32 arg0)` with an `i32` accumulator on the stack.
+// The families below only use loads and stores of the accumulator, so
+// they don't need PHI nodes.
+struct SyntheticFunction {
+  llvm::Function *func;
+  llvm::IRBuilder<> ir;
+  llvm::Value *arg;
+  llvm::Value *acc;
+
+  SyntheticFunction(llvm::Module &module, const std::string &name)
+      : ir(module.getContext()) {
+    auto &ctx{module.getContext()};
+    auto i32{ir.getInt32Ty()};
+    auto type{llvm::FunctionType::get(i32, {i32}, false)};
+    func = llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                  name, &module);
+    arg = &*func->arg_begin();
+    ir.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", func));
+    acc = ir.CreateAlloca(i32);
+    ir.CreateStore(arg, acc);
+  }
+
+  llvm::BasicBlock *CreateBlock(const std::string &name) {
+    return llvm::BasicBlock::Create(func->getContext(), name, func);
+  }
+
+  llvm::Value *Load() { return ir.CreateLoad(ir.getInt32Ty(), acc); }
+
+  void Update(llvm::Instruction::BinaryOps op, uint32_t val) {
+    ir.CreateStore(ir.CreateBinOp(op, Load(), ir.getInt32(val)), acc);
+  }
+
+  void Return() { ir.CreateRet(Load()); }
+};
+
+// A chain of `size` if-then-else diamonds
+static void CreateDiamonds(llvm::Module &module, unsigned size) {
+  SyntheticFunction fn(module, "diamonds");
+  for (auto i = 0U; i < size; ++i) {
+    auto then_bb{fn.CreateBlock("then")};
+    auto else_bb{fn.CreateBlock("else")};
+    auto join_bb{fn.CreateBlock("join")};
+    auto cond{fn.ir.CreateICmpSLT(fn.Load(), fn.ir.getInt32(i * 7))};
+    fn.ir.CreateCondBr(cond, then_bb, else_bb);
+    fn.ir.SetInsertPoint(then_bb);
+    fn.Update(llvm::Instruction::Add, i);
+    fn.ir.CreateBr(join_bb);
+    fn.ir.SetInsertPoint(else_bb);
+    fn.Update(llvm::Instruction::Xor, i);
+    fn.ir.CreateBr(join_bb);
+    fn.ir.SetInsertPoint(join_bb);
+  }
+  fn.Return();
+}
+
+// A switch over the argument with `size` cases, like a jump table
+static void CreateSwitch(llvm::Module &module, unsigned size) {
+  SyntheticFunction fn(module, "wide_switch");
+  auto default_bb{fn.CreateBlock("default")};
+  auto exit_bb{fn.CreateBlock("exit")};
+  auto sw{fn.ir.CreateSwitch(fn.arg, default_bb, size)};
+  for (auto i = 0U; i < size; ++i) {
+    auto case_bb{fn.CreateBlock("case")};
+    sw->addCase(fn.ir.getInt32(i), case_bb);
+    fn.ir.SetInsertPoint(case_bb);
+    fn.Update(llvm::Instruction::Mul, i + 3);
+    fn.ir.CreateBr(exit_bb);
+  }
+  fn.ir.SetInsertPoint(default_bb);
+  fn.Update(llvm::Instruction::Sub, 1);
+  fn.ir.CreateBr(exit_bb);
+  fn.ir.SetInsertPoint(exit_bb);
+  fn.Return();
+}
+
+// `size` nested counting loops
+static void CreateLoops(llvm::Module &module, unsigned size) {
+  SyntheticFunction fn(module, "nested_loops");
+  auto i32{fn.ir.getInt32Ty()};
+  std::vector<llvm::Value *> counters;
+  for (auto i = 0U; i < size; ++i) {
+    counters.push_back(fn.ir.CreateAlloca(i32));
+  }
+  std::vector<llvm::BasicBlock *> latches;
+  llvm::BasicBlock *exit_bb{nullptr};
+  for (auto i = 0U; i < size; ++i) {
+    fn.ir.CreateStore(fn.ir.getInt32(0), counters[i]);
+    auto header_bb{fn.CreateBlock("header")};
+    auto body_bb{fn.CreateBlock("body")};
+    auto latch_bb{fn.CreateBlock("latch")};
+    auto loop_exit_bb{fn.CreateBlock("exit")};
+    fn.ir.CreateBr(header_bb);
+    fn.ir.SetInsertPoint(header_bb);
+    auto cnt{fn.ir.CreateLoad(i32, counters[i])};
+    fn.ir.CreateCondBr(fn.ir.CreateICmpSLT(cnt, fn.arg), body_bb,
+                       loop_exit_bb);
+    fn.ir.SetInsertPoint(latch_bb);
+    auto next{fn.ir.CreateAdd(fn.ir.CreateLoad(i32, counters[i]),
+                              fn.ir.getInt32(1))};
+    fn.ir.CreateStore(next, counters[i]);
+    fn.ir.CreateBr(header_bb);
+    // The exit of an inner loop continues with the latch of its parent
+    fn.ir.SetInsertPoint(loop_exit_bb);
+    if (latches.empty()) {
+      exit_bb = loop_exit_bb;
+    } else {
+      fn.ir.CreateBr(latches.back());
+    }
+    latches.push_back(latch_bb);
+    fn.ir.SetInsertPoint(body_bb);
+  }
+  fn.Update(llvm::Instruction::Add, 1);
+  fn.ir.CreateBr(latches.back());
+  fn.ir.SetInsertPoint(exit_bb);
+  fn.Return();
+}
+
+// A single block with `size` arithmetic instructions
+static void CreateStraightLine(llvm::Module &module, unsigned size) {
+  SyntheticFunction fn(module, "straight_line");
+  static const llvm::Instruction::BinaryOps ops[]{
+      llvm::Instruction::Add, llvm::Instruction::Mul, llvm::Instruction::Xor,
+      llvm::Instruction::Sub};
+  for (auto i = 0U; i < size; ++i) {
+    fn.Update(ops[i % 4], i + 1);
+  }
+  fn.Return();
+}
+
+using FamilyGenerator = std::function<void(llvm::Module &, unsigned)>;
+
+static const std::map<std::string, FamilyGenerator> kFamilies{
+    {"diamonds", CreateDiamonds},
+    {"switch", CreateSwitch},
+    {"loops", CreateLoops},
+    {"straight", CreateStraightLine}};
+
+static void PrepareModule(llvm::Module &module) {
+  std::vector<llvm::PHINode *> work_list;
+  for (auto &func : module) {
+    for (auto &inst : llvm::instructions(func)) {
+      if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+        work_list.push_back(phi);
+      }
+    }
+  }
+  for (auto phi : work_list) {
+    DemotePHIToStack(phi);
+  }
+  llvm::legacy::PassManager pm;
+  pm.add(llvm::createLowerSwitchPass());
+  pm.run(module);
+}
+
+// Operators of the expressions that Z3ConvVisitor benchmarks convert.
+// Families only use operators that both directions of the conversion
+// support.
+enum class ConvFamily { kArith, kBitwise, kLogic, kSignExt, kMixed };
+
+static const std::map<std::string, ConvFamily> kConvFamilies{
+    {"arith", ConvFamily::kArith},
+    {"bitwise", ConvFamily::kBitwise},
+    {"logic", ConvFamily::kLogic},
+    {"sext", ConvFamily::kSignExt},
+    {"mixed", ConvFamily::kMixed}};
+
+// Generates random expressions of a family over bit-vector variables of
+// a single width. The seed is fixed, so every run converts the same
+// expressions.
+class ExprGenerator {
+ private:
+  ConvFamily family;
+  const std::vector<z3::expr> &vars;
+  std::mt19937 rng;
+
+  bool Has(ConvFamily other) {
+    return family == other || family == ConvFamily::kMixed;
+  }
+
+  // A numeral or a variable, truncated to `width` bits
+  z3::expr CreateLeaf(unsigned width) {
+    if (!(rng() % 4)) {
+      return vars[0].ctx().bv_val(uint64_t(rng()), width);
+    }
+    auto var{vars[rng() % vars.size()]};
+    return width < var.get_sort().bv_size() ? var.extract(width - 1, 0) : var;
+  }
+
+ public:
+  ExprGenerator(ConvFamily family, const std::vector<z3::expr> &vars,
+                unsigned seed)
+      : family(family), vars(vars), rng(seed) {}
+
+  z3::expr CreateBV(unsigned depth, unsigned width) {
+    if (!depth) {
+      return CreateLeaf(width);
+    }
+    std::vector<std::function<z3::expr()>> ops;
+    auto Sub = [this, depth, width] { return CreateBV(depth - 1, width); };
+    if (Has(ConvFamily::kArith)) {
+      ops.push_back([&] { return Sub() + Sub(); });
+      ops.push_back([&] { return Sub() * Sub(); });
+      ops.push_back([&] { return Sub() / Sub(); });
+      ops.push_back([&] { return z3::srem(Sub(), Sub()); });
+      ops.push_back([&] { return z3::ashr(Sub(), Sub()); });
+    }
+    auto half{width / 2};
+    if (Has(ConvFamily::kBitwise)) {
+      ops.push_back([&] { return Sub() | Sub(); });
+      ops.push_back([&] { return Sub() ^ Sub(); });
+      ops.push_back([&] { return ~Sub(); });
+      if (half) {
+        ops.push_back([&] {
+          return z3::concat(CreateBV(depth - 1, width - half),
+                            CreateBV(depth - 1, half));
+        });
+      }
+    }
+    if (Has(ConvFamily::kLogic)) {
+      ops.push_back(
+          [&] { return z3::ite(CreateBool(depth - 1), Sub(), Sub()); });
+    }
+    // Concatenations that `IsSignExt` recognizes, which are lowered as
+    // casts instead of shifts
+    if (Has(ConvFamily::kSignExt) && half) {
+      ops.push_back([&] {
+        auto ones{rng() % 2 ? ~uint64_t(0) : 0};
+        auto &ctx{vars[0].ctx()};
+        return z3::concat(ctx.bv_val(ones, width - half),
+                          CreateBV(depth - 1, half));
+      });
+      ops.push_back([&] { return Sub() + Sub(); });
+    }
+    if (ops.empty()) {
+      return CreateLeaf(width);
+    }
+    return ops[rng() % ops.size()]();
+  }
+
+  z3::expr CreateBool(unsigned depth) {
+    auto width{vars[0].get_sort().bv_size()};
+    auto Cmp = [this, depth, width] {
+      auto lhs{CreateBV(depth ? depth - 1 : 0, width)};
+      auto rhs{CreateBV(depth ? depth - 1 : 0, width)};
+      return rng() % 2 ? lhs == rhs : lhs <= rhs;
+    };
+    if (!depth) {
+      return Cmp();
+    }
+    switch (rng() % 4) {
+      case 0:
+        return CreateBool(depth - 1) && CreateBool(depth - 1);
+      case 1:
+        return CreateBool(depth - 1) || CreateBool(depth - 1);
+      case 2:
+        return !CreateBool(depth - 1);
+      default:
+        return Cmp();
+    }
+  }
+
+  // Logic expressions are conditions, the others are bit-vectors
+  z3::expr Create(unsigned depth) {
+    auto cond{family == ConvFamily::kLogic ||
+              (family == ConvFamily::kMixed && rng() % 2)};
+    return cond ? CreateBool(depth)
+                : CreateBV(depth, vars[0].get_sort().bv_size());
+  }
+};
+
+static int64_t GetPeakRSSKB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+struct StageResult {
+  double seconds = 0;
+  int64_t heap_bytes = 0;
+  // How much the peak RSS of the process grew while the stage ran. The
+  // peak is process-wide, so only its growth can be attributed to a stage.
+  int64_t rss_growth_kb = 0;
+};
+
+// Measures the time and the peak RSS growth of a stage from construction
+struct StageTimer {
+  rellic::StatsTimer timer;
+  int64_t peak_rss_kb = GetPeakRSSKB();
+};
+
+// Stage results in pipeline order
+using BenchResult = std::vector<std::pair<std::string, StageResult>>;
+
+// Times the passes of the pipeline selected by --passes, as they run in
+// `rellic-decomp`
+class Bench : public rellic::StageListener {
+ private:
+  BenchResult result;
+  // Measures the pass that is running
+  std::unique_ptr<StageTimer> pass_timer;
+
+  StageResult &GetStage(const std::string &name) {
+    for (auto &stage : result) {
+      if (stage.first == name) {
+        return stage.second;
+      }
+    }
+    result.push_back({name, StageResult()});
+    return result.back().second;
+  }
+
+  void Record(const std::string &name, const StageTimer &timer) {
+    auto &stage{GetStage(name)};
+    stage.seconds += timer.timer.GetSeconds();
+    stage.heap_bytes = llvm::sys::Process::GetMallocUsage();
+    stage.rss_growth_kb += GetPeakRSSKB() - timer.peak_rss_kb;
+  }
+
+  // Converts all statement conditions to Z3 with a fresh solver
+  void ConvertConditions(clang::ASTContext &ast_ctx) {
+    class CondCollector : public clang::RecursiveASTVisitor<CondCollector> {
+     public:
+      std::vector<clang::Expr *> conds;
+      bool VisitIfStmt(clang::IfStmt *stmt) {
+        conds.push_back(stmt->getCond());
+        return true;
+      }
+      bool VisitWhileStmt(clang::WhileStmt *stmt) {
+        conds.push_back(stmt->getCond());
+        return true;
+      }
+    } collector;
+    collector.TraverseDecl(ast_ctx.getTranslationUnitDecl());
+
+    rellic::Z3Solver solver(ast_ctx);
+    StageTimer timer;
+    for (auto cond : collector.conds) {
+      solver.GetZ3ConvVisitor().GetOrCreateZ3Expr(cond);
+    }
+    Record("Z3ConvVisitor", timer);
+  }
+
+ public:
+  void BeforePass(llvm::StringRef stage, llvm::StringRef pass) override {
+    pass_timer.reset(new StageTimer);
+  }
+
+  void AfterPass(llvm::StringRef stage, llvm::StringRef pass) override {
+    Record((stage + "/" + pass).str(), *pass_timer);
+  }
+
+  BenchResult Run(llvm::Module &module) {
+    result.clear();
+
+    clang::CompilerInstance ins;
+    rellic::InitCompilerInstance(ins, module.getTargetTriple());
+    auto &ast_ctx{ins.getASTContext()};
+    rellic::IRToASTVisitor gen(ast_ctx);
+    rellic::Z3Solver solver(ast_ctx);
+
+    rellic::StageRunner runner(module, ast_ctx, gen, solver);
+    runner.SetMaxRounds(FLAGS_max_rounds);
+    runner.SetListener(this);
+
+    rellic::StagePasses ast;
+    rellic::AddStagePass(ast, "GenerateAST",
+                         rellic::createGenerateASTPass(ast_ctx, gen));
+    rellic::AddStagePass(ast, "DeadStmtElim",
+                         rellic::createDeadStmtElimPass(ast_ctx, gen));
+    runner.RunOnce(ast, "ast", nullptr);
+
+    ConvertConditions(ast_ctx);
+
+    std::vector<llvm::Function *> funcs;
+    for (auto &func : module) {
+      if (!func.isDeclaration()) {
+        funcs.push_back(&func);
+      }
+    }
+    runner.Refine(funcs, pipeline);
+
+    std::string code;
+    llvm::raw_string_ostream os(code);
+    StageTimer timer;
+    ast_ctx.getTranslationUnitDecl()->print(os);
+    os.flush();
+    Record("print", timer);
+
+    return result;
+  }
+
+  // Converts generated Z3 expressions to C, and the resulting C
+  // expressions back to Z3
+  BenchResult RunConversion(ConvFamily family, unsigned width,
+                            unsigned depth) {
+    result.clear();
+
+    clang::CompilerInstance ins;
+    rellic::InitCompilerInstance(ins);
+    auto &ast_ctx{ins.getASTContext()};
+    rellic::Z3Solver solver(ast_ctx);
+    auto &conv{solver.GetZ3ConvVisitor()};
+
+    auto tudecl{ast_ctx.getTranslationUnitDecl()};
+    auto type{rellic::TypeCache::Get(ast_ctx).GetIntType(width, false)};
+    std::vector<z3::expr> vars;
+    for (auto i = 0U; i < 8; ++i) {
+      auto id{rellic::CreateIdentifier(ast_ctx, "var" + std::to_string(i))};
+      auto var{rellic::CreateVarDecl(ast_ctx, tudecl, id, type)};
+      tudecl->addDecl(var);
+      vars.push_back(
+          conv.GetOrCreateZ3Expr(rellic::CreateDeclRefExpr(ast_ctx, var)));
+    }
+
+    ExprGenerator gen(family, vars, width * 1000 + depth);
+    z3::expr_vector z3_exprs(solver.GetZ3Context());
+    for (auto i = 0U; i < FLAGS_conv_exprs; ++i) {
+      z3_exprs.push_back(gen.Create(depth));
+    }
+
+    std::vector<clang::Expr *> c_exprs;
+    StageTimer to_c;
+    for (auto i = 0U; i < z3_exprs.size(); ++i) {
+      c_exprs.push_back(conv.GetOrCreateCExpr(z3_exprs[i]));
+    }
+    Record("Z3ToC", to_c);
+
+    // Forget the Z3 expressions that the C expressions came from
+    conv.ClearExprs();
+    StageTimer to_z3;
+    for (auto expr : c_exprs) {
+      conv.GetOrCreateZ3Expr(expr);
+    }
+    Record("CToZ3", to_z3);
+
+    return result;
+  }
+};
+
+// Runs `run` `FLAGS_repetitions` times and keeps the fastest time and the
+// largest memory figures of every stage
+static llvm::json::Value RunRepeated(const std::string &name,
+                                     std::function<BenchResult()> run) {
+  LOG(INFO) << "Running benchmark " << name;
+  BenchResult best;
+  for (auto rep = 0U; rep < std::max(FLAGS_repetitions, 1U); ++rep) {
+    auto result{run()};
+    if (best.empty()) {
+      best = result;
+      continue;
+    }
+    for (auto i = 0U; i < best.size() && i < result.size(); ++i) {
+      auto &lhs{best[i].second};
+      auto &rhs{result[i].second};
+      lhs.seconds = std::min(lhs.seconds, rhs.seconds);
+      lhs.heap_bytes = std::max(lhs.heap_bytes, rhs.heap_bytes);
+      lhs.rss_growth_kb = std::max(lhs.rss_growth_kb, rhs.rss_growth_kb);
+    }
+  }
+
+  llvm::json::Array stages;
+  double total{0};
+  for (auto &stage : best) {
+    total += stage.second.seconds;
+    stages.push_back(
+        llvm::json::Object{{"name", stage.first},
+                           {"seconds", stage.second.seconds},
+                           {"heap_bytes", stage.second.heap_bytes},
+                           {"rss_growth_kb", stage.second.rss_growth_kb}});
+  }
+  return llvm::json::Object{{"name", name},
+                            {"repetitions", int64_t(FLAGS_repetitions)},
+                            {"seconds", total},
+                            {"stages", std::move(stages)}};
+}
+
+// Decompiles fresh modules from `create`
+static llvm::json::Value RunBenchmark(
+    const std::string &name,
+    std::function<std::unique_ptr<llvm::Module>(llvm::LLVMContext &)> create) {
+  Bench bench;
+  return RunRepeated(name, [&] {
+    llvm::LLVMContext llvm_ctx;
+    auto module{create(llvm_ctx)};
+    CHECK(module) << "Failed to create module for " << name;
+    PrepareModule(*module);
+    return bench.Run(*module);
+  });
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    [--families diamonds,switch,loops,straight] \\" << std::endl
+        << "    [--sizes 8,32,128] \\" << std::endl
+        << "    [--inputs INPUT_BC_FILE,...] \\" << std::endl
+        << "    [--conv_families arith,bitwise,logic,sext,mixed] \\"
+        << std::endl
+        << "    [--conv_widths 8,32,64] \\" << std::endl
+        << "    [--conv_depths 4,8] \\" << std::endl
+        << "    [--repetitions N] \\" << std::endl
+        << "    [--passes PRESET_OR_PIPELINE] \\" << std::endl
+        << "    [--max_rounds N] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::SetVersionString(rellic::Version::GetVersionString());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto &pr{*llvm::PassRegistry::getPassRegistry()};
+  initializeCore(pr);
+  initializeAnalysis(pr);
+
+  std::string error;
+  if (!rellic::ParsePipeline(FLAGS_passes, pipeline, error)) {
+    LOG(ERROR) << "Invalid --passes: " << error;
+    return EXIT_FAILURE;
+  }
+
+  llvm::json::Array benchmarks;
+
+  llvm::SmallVector<llvm::StringRef, 4> families, sizes, inputs;
+  llvm::StringRef(FLAGS_families).split(families, ',', -1, false);
+  llvm::StringRef(FLAGS_sizes).split(sizes, ',', -1, false);
+  llvm::StringRef(FLAGS_inputs).split(inputs, ',', -1, false);
+
+  for (auto family : families) {
+    auto iter{kFamilies.find(family.str())};
+    if (iter == kFamilies.end()) {
+      LOG(ERROR) << "Unknown CFG family: " << family.str();
+      return EXIT_FAILURE;
+    }
+    for (auto size_str : sizes) {
+      unsigned size;
+      if (size_str.getAsInteger(10, size)) {
+        LOG(ERROR) << "Invalid size: " << size_str.str();
+        return EXIT_FAILURE;
+      }
+      auto &generator{iter->second};
+      benchmarks.push_back(RunBenchmark(
+          family.str() + "/" + size_str.str(),
+          [&generator, size](llvm::LLVMContext &llvm_ctx) {
+            std::unique_ptr<llvm::Module> module(
+                new llvm::Module("bench", llvm_ctx));
+            generator(*module, size);
+            CHECK(rellic::VerifyModule(module.get()));
+            return module;
+          }));
+    }
+  }
+
+  llvm::SmallVector<llvm::StringRef, 4> conv_families, widths, depths;
+  llvm::StringRef(FLAGS_conv_families).split(conv_families, ',', -1, false);
+  llvm::StringRef(FLAGS_conv_widths).split(widths, ',', -1, false);
+  llvm::StringRef(FLAGS_conv_depths).split(depths, ',', -1, false);
+
+  for (auto family : conv_families) {
+    auto iter{kConvFamilies.find(family.str())};
+    if (iter == kConvFamilies.end()) {
+      LOG(ERROR) << "Unknown expression family: " << family.str();
+      return EXIT_FAILURE;
+    }
+    for (auto width_str : widths) {
+      for (auto depth_str : depths) {
+        unsigned width;
+        unsigned depth;
+        if (width_str.getAsInteger(10, width) || !width || width > 64 ||
+            depth_str.getAsInteger(10, depth)) {
+          LOG(ERROR) << "Invalid width or depth: " << width_str.str() << ", "
+                     << depth_str.str();
+          return EXIT_FAILURE;
+        }
+        Bench bench;
+        benchmarks.push_back(RunRepeated(
+            "z3conv/" + family.str() + "/w" + width_str.str() + "/d" +
+                depth_str.str(),
+            [&] { return bench.RunConversion(iter->second, width, depth); }));
+      }
+    }
+  }
+
+  for (auto input : inputs) {
+    benchmarks.push_back(
+        RunBenchmark(input.str(), [input](llvm::LLVMContext &llvm_ctx) {
+          return std::unique_ptr<llvm::Module>(
+              rellic::LoadModuleFromFile(&llvm_ctx, input.str()));
+        }));
+  }
+
+  llvm::json::Object result{
+      {"version", rellic::Version::GetVersionString()},
+      {"commit", rellic::Version::GetCommitHash()},
+      {"benchmarks", std::move(benchmarks)}};
+
+  std::error_code ec;
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  if (!FLAGS_output.empty()) {
+    file.reset(
+        new llvm::raw_fd_ostream(FLAGS_output, ec, llvm::sys::fs::F_Text));
+    CHECK(!ec) << "Failed to create output file: " << ec.message();
+  }
+  auto &output{file ? *file : llvm::outs()};
+  output << llvm::formatv("{0:2}", llvm::json::Value(std::move(result)))
+         << '\n';
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
@@ -17,27 +17,62 @@
 #include <clang/Basic/TargetInfo.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <llvm/IR/InstIterator.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/InitializePasses.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Regex.h>
 #include <llvm/Support/raw_ostream.h>
-#include <llvm/Transforms/Utils.h>
-#include <llvm/Transforms/Utils/Local.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/Cancellation.h"
+#include "rellic/AST/Checkpoint.h"
 #include "rellic/AST/DeadStmtElim.h"
-#include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/FunctionCache.h"
 #include "rellic/AST/GenerateAST.h"
 #include "rellic/AST/IRToASTVisitor.h"
-#include "rellic/AST/LoopRefine.h"
-#include "rellic/AST/NestedCondProp.h"
-#include "rellic/AST/NestedScopeCombiner.h"
-#include "rellic/AST/ReachBasedRefine.h"
-#include "rellic/AST/Z3CondSimplify.h"
+#include "rellic/AST/OutputFile.h"
+#include "rellic/AST/PassProfile.h"
+#include "rellic/AST/Pipeline.h"
+#include "rellic/AST/Printer.h"
+#include "rellic/AST/Shard.h"
+#include "rellic/AST/Stats.h"
+#include "rellic/AST/StmtRecycler.h"
+#include "rellic/AST/Trace.h"
+#include "rellic/AST/Z3Solver.h"
 #include "rellic/BC/Util.h"
+#include "rellic/Prepare.h"
 #include "rellic/Version/Version.h"
 
 #ifndef LLVM_VERSION_STRING
@@ -46,119 +81,1452 @@
 
 DEFINE_string(input, "", "Input LLVM bitcode file.");
 DEFINE_string(output, "", "Output file.");
-DEFINE_bool(disable_z3, false, "Disable Z3 based AST tranformations.");
+DEFINE_string(functions, "",
+              "Comma-separated names of the functions to decompile. Other "
+              "function bodies are never loaded.");
+DEFINE_string(function_regex, "",
+              "Decompile only functions whose whole name matches this "
+              "regular expression. Other function bodies are never loaded.");
+DEFINE_bool(disable_z3, false,
+            "Disable Z3 based AST tranformations. --passes=native refines "
+            "conditions without Z3 instead.");
+DEFINE_string(passes, "default",
+              "Refinement pipeline: a preset (fast, native, default or "
+              "thorough), a list of stages such as "
+              "\"cbr*(nsc,cbr);fin(expr-combine)\", "
+              "or @FILE to read the list from a file.");
+DEFINE_uint32(max_rounds, 100,
+              "Maximum number of rounds of fixpoint stages that don't set "
+              "their own limit in --passes. 0 means no limit.");
 DEFINE_bool(remove_phi_nodes, false,
-            "Remove PHINodes from input bitcode before decompilation.");
+            "Demote PHINodes of the input bitcode to stack variables before "
+            "decompilation, instead of lowering them to assignments.");
 DEFINE_bool(lower_switch, false,
-            "Remove SwitchInst by lowering them to branches.");
+            "Lower SwitchInst to branches before decompilation, instead of "
+            "turning every case into an edge condition.");
+DEFINE_bool(simplify_ir, false,
+            "Fold redundant comparisons, branches on constants or on "
+            "conditions that a dominating branch decided, and straight-line "
+            "blocks before generating the AST.");
+DEFINE_bool(skip_unsupported, false,
+            "Report functions that use IR constructs which can't be "
+            "decompiled yet and emit only their declarations, instead of "
+            "aborting.");
+DEFINE_string(z3_cache, "",
+              "File in which Z3 proof results are kept between runs.");
+DEFINE_string(function_cache, "",
+              "Directory in which decompiled function definitions are kept "
+              "and reused between runs.");
+DEFINE_bool(checkpoints, false,
+            "With --function_cache, also keep the AST of every function "
+            "after each pipeline stage, so that interrupted runs resume "
+            "after the last finished stage.");
+DEFINE_uint32(z3_timeout, 0,
+              "Time limit of a single Z3 query in milliseconds. Queries that "
+              "time out leave their conditions unrefined. 0 means no limit.");
+DEFINE_uint32(z3_rlimit, 0,
+              "Deterministic Z3 resource limit of a single query. 0 means "
+              "no limit.");
+DEFINE_uint32(z3_function_timeout, 0,
+              "Total time limit of the Z3 queries of one function in "
+              "milliseconds. 0 means no limit.");
+DEFINE_uint32(memory_budget, 0,
+              "Memory in MiB that the AST and Z3 may grow by while one "
+              "function is refined. The remaining Z3 queries of a function "
+              "that exceeds it fail, which leaves its conditions unrefined. "
+              "0 means no limit.");
+DEFINE_uint32(deadline_ms, 0,
+              "Wall time in milliseconds after which refinement stops and "
+              "functions are emitted as refined so far. With --serve, every "
+              "request has its own deadline, and with --batch every file. "
+              "0 means no limit.");
+DEFINE_string(pass_profile, "",
+              "Learn from this file, and update it, which passes change "
+              "functions of each CFG shape class, and skip passes that "
+              "never do for a class, except for validation samples. "
+              "Disables --function_cache.");
+DEFINE_uint32(z3_threads, 1,
+              "Number of threads that prove the independent Z3 queries of "
+              "a function concurrently.");
+DEFINE_uint32(structure_threads, 1,
+              "Number of threads that analyze the loops of a function "
+              "concurrently while its control flow is structured.");
+DEFINE_uint32(goto_threshold, 0,
+              "Structure regions with more blocks than this, and cycles "
+              "that aren't natural loops, with gotos instead of reaching "
+              "conditions. 0 turns the fallback off.");
+DEFINE_uint32(cond_size_limit, 0,
+              "Simplify reaching conditions with more nodes than this as "
+              "soon as they are built, before they grow through the "
+              "successors of their block. 0 turns this off.");
+DEFINE_uint32(trivial_blocks, 0,
+              "Functions without cycles, with at most this many blocks and "
+              "regions nested at most --trivial_depth deep, skip refinement "
+              "and only get their scopes and expressions combined. 0 turns "
+              "the fast path off.");
+DEFINE_uint32(trivial_depth, 1,
+              "Deepest nesting of regions in functions that take the fast "
+              "path of --trivial_blocks.");
+DEFINE_uint32(lazy_init_elements, 0,
+              "Lower initializers of globals that are arrays of more than "
+              "this many integers or floats only while printing them, in "
+              "chunks. 0 lowers all initializers up front.");
+DEFINE_bool(z3_abstract_atoms, false,
+            "Prove Z3 queries with the opaque atoms, e.g. pointers, that "
+            "only occur in equalities renamed into small bit-vectors.");
+DEFINE_string(slow_query_dir, "",
+              "Write Z3 queries that take at least --slow_query_ms as "
+              "SMT-LIB2 files into this directory.");
+DEFINE_uint32(slow_query_ms, 1000,
+              "Time in milliseconds from which a Z3 query is written to "
+              "--slow_query_dir.");
+DEFINE_string(stats, "", "Write pipeline statistics as JSON to this file.");
+DEFINE_string(trace, "",
+              "Write a timeline of passes, functions and Z3 queries in the "
+              "Chrome trace event format to this file.");
+DEFINE_bool(time_passes, false, "Print time spent in each pass to stderr.");
+DEFINE_bool(stream, false,
+            "Print every function definition as soon as it is decompiled "
+            "and free its state afterwards.");
+DEFINE_uint32(stream_queue, 8,
+              "With --stream, number of printed definitions that may wait "
+              "for a separate thread to write them, or 0 to write them "
+              "before decompiling the next function.");
+DEFINE_uint32(jobs, 1,
+              "Number of worker threads that decompile functions in "
+              "parallel. With --batch, the number of files that are "
+              "decompiled in parallel.");
+DEFINE_string(schedule_stats, "",
+              "With --jobs, order functions by the time they took in this "
+              "--stats file of a previous run, instead of by estimates.");
+DEFINE_string(output_compression, "none",
+              "Compress output files while writing them: `none`, `gzip` "
+              "or `zstd`.");
+DEFINE_string(split_output, "",
+              "Write `decls.h` with the module declarations into the "
+              "--output directory, along with one C file per `function`, "
+              "or per compile `unit` the functions came from.");
+DEFINE_string(shard, "",
+              "Decompile only the functions of shard I of N, given as I/N, "
+              "out of a partition that all N runs of the same input and "
+              "options agree on. rellic-merge combines the outputs.");
+DEFINE_string(batch, "",
+              "Decompile every file listed in this manifest, instead of "
+              "--input. Every line holds an input bitcode file and an "
+              "output C file, separated by whitespace.");
+DEFINE_string(serve, "",
+              "Serve decompilation requests on this Unix domain socket, "
+              "instead of decompiling --input.");
 
 DECLARE_bool(version);
 
 namespace {
 
-static void RemovePHINodes(llvm::Module& module) {
-  std::vector<llvm::PHINode*> work_list;
-  for (auto& func : module) {
-    for (auto& inst : llvm::instructions(func)) {
-      if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-        work_list.push_back(phi);
+static void InitOptPasses(void) {
+  auto& pr = *llvm::PassRegistry::getPassRegistry();
+  initializeCore(pr);
+  initializeAnalysis(pr);
+}
+
+// The preparation of the IR that the flags select
+static rellic::PrepareOptions GetPrepareOptions() {
+  rellic::PrepareOptions options;
+  options.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  options.lower_switch = FLAGS_lower_switch;
+  options.simplify_ir = FLAGS_simplify_ir;
+  options.skip_unsupported = FLAGS_skip_unsupported;
+  return options;
+}
+
+// A bitcode file and the functions to decompile from it
+struct Input {
+  std::string path;
+  // Comma-separated function names and a regular expression over names.
+  // Every function is selected if both are empty.
+  std::string functions;
+  std::string function_regex;
+
+  Input(std::string path, std::string functions = FLAGS_functions,
+        std::string function_regex = FLAGS_function_regex)
+      : path(path), functions(functions), function_regex(function_regex) {}
+
+  bool IsSelective() const {
+    return !functions.empty() || !function_regex.empty();
+  }
+};
+
+// Loads the functions of `input` that are selected by name or expression
+static llvm::Module* LoadSelectedFunctions(llvm::LLVMContext& llvm_ctx,
+                                          const Input& input, bool warn,
+                                          bool allow_failure, bool verify) {
+  llvm::SmallVector<llvm::StringRef, 8> names;
+  llvm::StringRef(input.functions).split(names, ',', -1, false);
+  std::unordered_set<std::string> unmatched;
+  for (auto name : names) {
+    unmatched.insert(name.str());
+  }
+  // Anchor the expression so that it matches whole names
+  std::unique_ptr<llvm::Regex> regex;
+  if (!input.function_regex.empty()) {
+    regex.reset(new llvm::Regex("^(" + input.function_regex + ")$"));
+    std::string error;
+    CHECK(regex->isValid(error)) << "Invalid --function_regex "
+                                 << input.function_regex << ": " << error;
+  }
+
+  unsigned num_selected{0};
+  auto module{rellic::LoadSelectedFunctionsFromFile(
+      &llvm_ctx, input.path,
+      [&](llvm::Function& func) {
+        auto name{func.getName()};
+        auto selected{unmatched.erase(name.str()) > 0 ||
+                      (regex && regex->match(name))};
+        num_selected += selected;
+        return selected;
+      },
+      allow_failure, verify)};
+
+  if (module && warn) {
+    for (auto& name : unmatched) {
+      LOG(WARNING) << "No definition of function " << name << " in "
+                   << input.path;
+    }
+    LOG_IF(WARNING, !num_selected)
+        << "No functions selected for decompilation";
+  }
+  return module;
+}
+
+// Loads the module of `input`. Only selected function bodies are read if
+// `input` selects functions. With `lazy`, function bodies are otherwise
+// left to be read on demand. Without `verify`, eagerly loaded modules are
+// not verified, for inputs that were loaded and verified before.
+static llvm::Module* LoadInput(llvm::LLVMContext& llvm_ctx, const Input& input,
+                               bool lazy = false, bool warn = false,
+                               bool allow_failure = false,
+                               bool verify = true) {
+  if (input.IsSelective()) {
+    return LoadSelectedFunctions(llvm_ctx, input, warn, allow_failure,
+                                 verify);
+  } else if (lazy) {
+    return rellic::LoadLazyModuleFromFile(&llvm_ctx, input.path,
+                                          allow_failure);
+  } else {
+    return rellic::LoadModuleFromFile(&llvm_ctx, input.path, allow_failure,
+                                      verify);
+  }
+}
+
+// Refinement stages selected by --passes
+static rellic::PipelineDesc pipeline;
+
+// Compression of output files selected by --output_compression
+static rellic::OutputCompression compression{rellic::OutputCompression::kNone};
+
+// Shard of the functions selected by --shard
+static rellic::ShardSpec shard;
+
+// Cancelled by --deadline_ms, or when a client of --serve disconnects
+static rellic::CancellationToken cancellation;
+
+// Loaded from --pass_profile, or `nullptr`
+static std::unique_ptr<rellic::PassProfile> profile;
+
+// A function whose AST is checkpointed after every stage of its pipeline
+struct Checkpoints {
+  rellic::FunctionCache* cache;
+  llvm::Function* func;
+  std::string key;
+};
+
+// Describes `stage` in checkpoint names. Fixpoint stages without their
+// own round limit depend on --max_rounds.
+static std::string DescribeStage(const rellic::StageDesc& stage) {
+  std::stringstream ss;
+  ss << stage.name;
+  if (stage.fixpoint) {
+    ss << '*' << (stage.max_rounds ? stage.max_rounds : FLAGS_max_rounds);
+  }
+  ss << '(';
+  for (auto& pass : stage.passes) {
+    ss << pass.name << '(' << llvm::join(pass.args, ",") << "),";
+  }
+  ss << ')';
+  return ss.str();
+}
+
+// Loads the latest checkpoint of `checkpoints` that `stage_ids` names.
+// Returns the index of its stage, or -1 if the function has to be
+// generated from scratch.
+static int ResumeFromCheckpoint(llvm::Module& module,
+                                clang::ASTContext& ast_ctx,
+                                rellic::IRToASTVisitor& gen,
+                                const Checkpoints* checkpoints,
+                                const std::vector<std::string>& stage_ids) {
+  if (!checkpoints) {
+    return -1;
+  }
+  for (auto i = stage_ids.size(); i-- > 0;) {
+    std::unique_ptr<llvm::MemoryBuffer> buf;
+    if (!checkpoints->cache->LookupCheckpoint(checkpoints->key, stage_ids[i],
+                                              buf)) {
+      continue;
+    }
+    // The checkpoint refers to the declarations of the module
+    llvm::legacy::PassManager decls;
+    decls.add(rellic::createGenerateASTPass(
+        ast_ctx, gen, [](llvm::Function& func) { return false; }));
+    decls.run(module);
+    if (!rellic::LoadCheckpoint(ast_ctx, gen, *checkpoints->func,
+                                buf->getBuffer())) {
+      return -1;
+    }
+    LOG(INFO) << "Resuming " << checkpoints->func->getName().str()
+              << " after stage " << (i ? pipeline[i - 1].name : "ast");
+    return static_cast<int>(i);
+  }
+  return -1;
+}
+
+static void WriteCheckpoint(clang::ASTContext& ast_ctx,
+                            rellic::IRToASTVisitor& gen,
+                            const Checkpoints* checkpoints,
+                            const std::string& stage_id) {
+  std::string data;
+  if (checkpoints &&
+      rellic::SaveCheckpoint(ast_ctx, gen, *checkpoints->func, data)) {
+    checkpoints->cache->InsertCheckpoint(checkpoints->key, stage_id, data);
+  }
+}
+
+// Applies the Z3 flags to `solver`
+static void ConfigureSolver(rellic::Z3Solver& solver) {
+  rellic::Z3Limits limits;
+  limits.query_timeout = FLAGS_z3_timeout;
+  limits.query_rlimit = FLAGS_z3_rlimit;
+  limits.function_timeout = FLAGS_z3_function_timeout;
+  limits.memory_budget = static_cast<size_t>(FLAGS_memory_budget) << 20;
+  solver.SetLimits(limits);
+  solver.SetCancellation(&cancellation);
+  solver.SetNumThreads(FLAGS_z3_threads);
+  solver.SetAbstractAtoms(FLAGS_z3_abstract_atoms);
+  if (!FLAGS_slow_query_dir.empty()) {
+    solver.SetSlowQueryLog(FLAGS_slow_query_dir, FLAGS_slow_query_ms / 1000.0);
+  }
+}
+
+// Applies the refinement flags to `runner`
+static void ConfigureRunner(rellic::StageRunner& runner) {
+  runner.SetMaxRounds(FLAGS_max_rounds);
+  runner.SetTrivialLimits(FLAGS_trivial_blocks, FLAGS_trivial_depth);
+  runner.SetCancellation(&cancellation);
+  runner.SetPassProfile(profile.get());
+}
+
+// Generates and refines the definition of `func`, without visiting the
+// other functions of `module`. With `checkpoints`, the pipeline resumes
+// after the last stage whose checkpoint exists. Returns the number of Z3
+// queries that fell back because of a resource limit, whose conditions
+// are less refined than they could be.
+//
+// `solver` is shared by all refinement passes. It is reset first, so
+// that callers can keep one solver, and its `z3::context`, for all the
+// functions they decompile one after another.
+static size_t RunPipeline(llvm::Module& module, clang::ASTContext& ast_ctx,
+                          rellic::IRToASTVisitor& gen, llvm::Function& func,
+                          rellic::Z3Solver& solver,
+                          const Checkpoints* checkpoints = nullptr) {
+  // Reuse an enclosing recycler, so that statements of previously
+  // finished functions can be reused as well
+  std::unique_ptr<rellic::StmtRecycler> local_recycler;
+  auto recycler{rellic::StmtRecycler::Get(ast_ctx)};
+  if (!recycler) {
+    local_recycler.reset(new rellic::StmtRecycler(ast_ctx));
+    recycler = local_recycler.get();
+  }
+
+  solver.Reset();
+  auto num_fallbacks{solver.GetNumFallbacks()};
+
+  // Checkpoint names of the `ast` stage and of every later stage
+  std::vector<std::string> stage_ids{"ast"};
+  for (auto& stage : pipeline) {
+    stage_ids.push_back(stage_ids.back() + ';' + DescribeStage(stage));
+  }
+  auto resumed{
+      ResumeFromCheckpoint(module, ast_ctx, gen, checkpoints, stage_ids)};
+
+  rellic::StageRunner runner(module, ast_ctx, gen, solver);
+  ConfigureRunner(runner);
+  if (resumed < 0) {
+    rellic::StagePasses ast;
+    rellic::GenerateAST::FunctionList funcs{&func};
+    rellic::AddStagePass(
+        ast, "GenerateAST",
+        rellic::createGenerateASTPass(ast_ctx, gen, funcs,
+                                      FLAGS_structure_threads,
+                                      FLAGS_goto_threshold,
+                                      FLAGS_cond_size_limit));
+    rellic::AddStagePass(ast, "DeadStmtElim",
+                         rellic::createDeadStmtElimPass(ast_ctx, gen));
+    // Functions are lowered even after a cancellation, so that every one
+    // of them has a definition
+    runner.RunOnce(ast, "ast", nullptr, 0, /*cancellable=*/false);
+    recycler->Collect();
+    WriteCheckpoint(ast_ctx, gen, checkpoints, stage_ids[0]);
+  }
+
+  // Stage `i` finished before stage `i + 1` was checkpointed. Stages that
+  // were cut short, or whose queries fell back, must not be resumed from.
+  runner.Refine({&func}, pipeline, resumed < 0 ? 0 : resumed, [&](size_t i) {
+    if (!cancellation.IsCancelled() &&
+        solver.GetNumFallbacks() == num_fallbacks) {
+      WriteCheckpoint(ast_ctx, gen, checkpoints, stage_ids[i + 1]);
+    }
+  });
+
+  // Queries that a cancellation stopped are reported with it
+  num_fallbacks = solver.GetNumFallbacks() - num_fallbacks;
+  if (num_fallbacks && !cancellation.IsCancelled()) {
+    LOG(WARNING) << num_fallbacks
+                 << " Z3 queries exceeded their resource limits; the "
+                    "affected conditions were left unrefined";
+  }
+  return num_fallbacks;
+}
+
+static bool GeneratePseudocode(llvm::Module& module, llvm::raw_ostream& output,
+                               rellic::Z3ProofCache& proofs) {
+  clang::CompilerInstance ins;
+  rellic::InitCompilerInstance(ins, module.getTargetTriple());
+
+  auto& ast_ctx{ins.getASTContext()};
+
+  rellic::IRToASTVisitor gen(ast_ctx);
+  gen.SetLazyInitElements(FLAGS_lazy_init_elements);
+  // Declarations of the module are lowered once, instead of before every
+  // function, which would walk the whole module every time
+  gen.Summarize(module);
+
+  // One solver for all functions, which is reset in between
+  rellic::Z3Solver solver(ast_ctx, &proofs);
+  ConfigureSolver(solver);
+
+  // Functions are refined one at a time, so that Z3 only ever holds the
+  // terms of one of them. Finished definitions leave the translation
+  // unit until all are done, so that later pipelines don't walk them.
+  // There is no recycler across functions here, as it would take the
+  // compounds of the definitions that are out of the translation unit.
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::FunctionDecl*> fdefns;
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    rellic::Trace::SetFunction(func.getName());
+    rellic::TraceSpan span(func.getName(), "function");
+    rellic::StatsTimer timer;
+    RunPipeline(module, ast_ctx, gen, func, solver);
+    if (rellic::Stats::IsEnabled()) {
+      rellic::Stats::Get().AddFunctionTime(func.getName(), timer.GetSeconds());
+    }
+    auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(&func))};
+    if (auto fdefn = fdecl->getDefinition()) {
+      tudecl->removeDecl(fdefn);
+      fdefns.push_back(fdefn);
+    }
+  }
+  for (auto fdefn : fdefns) {
+    tudecl->addDecl(fdefn);
+  }
+
+  rellic::PrintTranslationUnit(tudecl, output);
+  // ast_ctx.getTranslationUnitDecl()->dump(output);
+
+  return true;
+}
+
+// Printed definitions on their way from the decompiling thread to the
+// thread that writes them. Holding at most `capacity` of them bounds the
+// memory that a slow output takes.
+class OutputQueue {
+ private:
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::string> defns;
+  size_t capacity;
+  bool closed{false};
+
+ public:
+  OutputQueue(size_t capacity) : capacity(capacity) {}
+
+  // Waits until there is room for `defn`
+  void Push(std::string defn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return defns.size() < capacity; });
+    defns.push_back(std::move(defn));
+    changed.notify_all();
+  }
+
+  // Waits for the next definition. Returns `false` once the queue is
+  // closed and empty.
+  bool Pop(std::string& defn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return !defns.empty() || closed; });
+    if (defns.empty()) {
+      return false;
+    }
+    defn = std::move(defns.front());
+    defns.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+};
+
+// Prints the declarations that were added to `tudecl` after `last`, or
+// all of them if `last` is `nullptr`, except for `skip`. Moves `last` to
+// the last declaration that was printed.
+static void PrintNewDecls(clang::TranslationUnitDecl* tudecl,
+                          clang::Decl*& last, clang::Decl* skip,
+                          llvm::raw_ostream& os) {
+  auto decl{last ? last->getNextDeclInContext()
+                 : tudecl->decls_empty() ? nullptr : *tudecl->decls_begin()};
+  for (; decl; decl = decl->getNextDeclInContext()) {
+    if (decl != skip) {
+      rellic::PrintTopLevelDecl(decl, os);
+      last = decl;
+    }
+  }
+}
+
+// Decompiles the functions of `module` one at a time. Declarations are
+// printed up front and every definition as soon as its pipeline is done.
+// Types that only bodies use are declared once a body is loaded, and are
+// printed right before the first definition that follows them.
+// Unless --stream_queue is 0, definitions are written and compressed on
+// a separate thread, while the next function is being decompiled.
+// Afterwards the definition is taken out of the translation unit and the
+// IR of the function is deleted, so that later pipelines neither walk
+// nor keep finished functions. Lazily loaded bodies are read on demand.
+static bool GenerateStreamingPseudocode(llvm::Module& module,
+                                        llvm::raw_ostream& output,
+                                        rellic::Z3ProofCache& proofs) {
+  clang::CompilerInstance ins;
+  rellic::InitCompilerInstance(ins, module.getTargetTriple());
+
+  auto& ast_ctx{ins.getASTContext()};
+
+  rellic::IRToASTVisitor gen(ast_ctx);
+  gen.SetLazyInitElements(FLAGS_lazy_init_elements);
+
+  // Lets later functions reuse the statements of finished ones
+  rellic::StmtRecycler recycler(ast_ctx);
+
+  // One solver for all functions, which is reset in between
+  rellic::Z3Solver solver(ast_ctx, &proofs);
+  ConfigureSolver(solver);
+
+  // Lower and print declarations of the whole module
+  llvm::legacy::PassManager ast;
+  ast.add(rellic::createGenerateASTPass(
+      ast_ctx, gen, [](llvm::Function& func) { return false; }));
+  ast.run(module);
+
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  rellic::PrintTranslationUnit(tudecl, output);
+  clang::Decl* last{nullptr};
+  for (auto decl : tudecl->decls()) {
+    last = decl;
+  }
+
+  std::unique_ptr<OutputQueue> queue;
+  std::thread writer;
+  if (FLAGS_stream_queue) {
+    output.flush();
+    queue.reset(new OutputQueue(FLAGS_stream_queue));
+    writer = std::thread([&queue, &output] {
+      for (std::string defn; queue->Pop(defn);) {
+        output << defn;
+        output.flush();
+      }
+    });
+  }
+
+  auto prepare{GetPrepareOptions()};
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    rellic::MaterializeFunction(func);
+    rellic::PrepareFunction(func, prepare);
+
+    rellic::Trace::SetFunction(func.getName());
+    rellic::TraceSpan span(func.getName(), "function");
+    rellic::StatsTimer timer;
+    RunPipeline(module, ast_ctx, gen, func, solver);
+    if (rellic::Stats::IsEnabled()) {
+      rellic::Stats::Get().AddFunctionTime(func.getName(), timer.GetSeconds());
+    }
+
+    auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(&func))};
+    if (auto fdefn = fdecl->getDefinition()) {
+      std::string defn;
+      llvm::raw_string_ostream os(defn);
+      PrintNewDecls(tudecl, last, fdefn, os);
+      rellic::PrintDecl(fdefn, os);
+      os << '\n';
+      os.flush();
+      tudecl->removeDecl(fdefn);
+      if (queue) {
+        queue->Push(std::move(defn));
+      } else {
+        output << defn;
+        output.flush();
       }
     }
+
+    gen.ClearFunctionBody(func);
+    func.deleteBody();
   }
-  for (auto phi : work_list) {
-    DemotePHIToStack(phi);
+
+  if (queue) {
+    queue->Close();
+    writer.join();
   }
+
+  return true;
 }
 
-static void LowerSwitches(llvm::Module& module) {
-  llvm::legacy::PassManager pm;
-  pm.add(llvm::createLowerSwitchPass());
-  pm.run(module);
+// Estimates the time that decompiling `func` takes from the size of its
+// control flow. Loops multiply the work of the blocks they contain,
+// because refinement revisits them.
+static double EstimateCost(llvm::Function& func) {
+  llvm::DominatorTree dt(func);
+  llvm::LoopInfo loops(dt);
+  double cost{0};
+  for (auto& block : func) {
+    cost += (1 + loops.getLoopDepth(&block)) * (1 + block.size() / 8.0);
+  }
+  return cost;
 }
 
-static void InitOptPasses(void) {
-  auto& pr = *llvm::PassRegistry::getPassRegistry();
-  initializeCore(pr);
-  initializeAnalysis(pr);
+// Reads the time that every function took in the --stats JSON of a
+// previous run
+static std::unordered_map<std::string, double> LoadFunctionTimes(
+    const std::string& path) {
+  std::unordered_map<std::string, double> times;
+  auto buf{llvm::MemoryBuffer::getFile(path)};
+  if (!buf) {
+    LOG(WARNING) << "Failed to read " << path << ": "
+                 << buf.getError().message();
+    return times;
+  }
+  auto json{llvm::json::parse(buf.get()->getBuffer())};
+  if (!json) {
+    LOG(WARNING) << "Failed to parse " << path << ": "
+                 << llvm::toString(json.takeError());
+    return times;
+  }
+  auto obj{json->getAsObject()};
+  auto entries{obj ? obj->getObject("function_seconds") : nullptr};
+  if (entries) {
+    for (auto& entry : *entries) {
+      if (auto seconds = entry.second.getAsNumber()) {
+        times[entry.first.str()] = *seconds;
+      }
+    }
+  }
+  return times;
 }
 
-static bool GeneratePseudocode(llvm::Module& module,
-                               llvm::raw_ostream& output) {
-  InitOptPasses();
+// Name of the file that holds the definition of `func` with --split_output
+static std::string GetSplitName(llvm::Function& func) {
+  llvm::StringRef name{func.getName()};
+  if (FLAGS_split_output == "unit") {
+    name = func.getParent()->getSourceFileName();
+    if (auto sp = func.getSubprogram()) {
+      name = sp->getUnit()->getFilename();
+    }
+    name = llvm::sys::path::stem(name);
+  }
+  std::string result;
+  for (auto c : name) {
+    result += llvm::isAlnum(c) || c == '_' || c == '-' ? c : '_';
+  }
+  return result.empty() ? "unnamed" : result;
+}
+
+// Writes `decls` into `decls.h` in the directory `dir`, and the definitions
+// `defns` of the functions of `module` into files that include it. Every
+// file lists its definitions in module order.
+static bool WriteSplitOutput(const std::string& dir, llvm::Module& module,
+                             llvm::StringRef decls,
+                             const std::vector<std::string>& defns) {
+  auto ec{llvm::sys::fs::create_directories(dir)};
+  if (ec) {
+    LOG(ERROR) << "Failed to create output directory " << dir << ": "
+               << ec.message();
+    return false;
+  }
+
+  auto Write{[&dir](const std::string& name, llvm::StringRef prefix,
+                    llvm::StringRef text) {
+    llvm::SmallString<256> path(dir);
+    llvm::sys::path::append(path,
+                            name + rellic::GetOutputExtension(compression));
+    std::error_code ec;
+    rellic::OutputFile file(path, ec, compression);
+    if (ec) {
+      LOG(ERROR) << "Failed to create output file " << path << ": "
+                 << ec.message();
+      return false;
+    }
+    file << prefix << text;
+    if (!file.Close()) {
+      LOG(ERROR) << "Failed to write output file " << path;
+      return false;
+    }
+    return true;
+  }};
+
+  if (!Write("decls.h", "", decls)) {
+    return false;
+  }
+
+  // Group definitions by file, in order of first appearance
+  std::vector<std::pair<std::string, std::string>> files;
+  std::unordered_map<std::string, unsigned> file_ids;
+  auto idx{0U};
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    auto& defn{defns[idx++]};
+    if (defn.empty()) {
+      continue;
+    }
+    auto name{GetSplitName(func)};
+    auto it{file_ids.find(name)};
+    if (it == file_ids.end()) {
+      it = file_ids.emplace(name, files.size()).first;
+      files.emplace_back(name, "");
+    }
+    files[it->second].second += defn;
+  }
+
+  // Names that differ only in case or sanitized characters get a suffix
+  std::unordered_set<std::string> used{"decls"};
+  for (auto& file : files) {
+    auto name{file.first};
+    for (auto i = 1U; !used.insert(llvm::StringRef(name).lower()).second;
+         ++i) {
+      name = file.first + '_' + std::to_string(i);
+    }
+    if (!Write(name + ".c", "#include \"decls.h\"\n\n", file.second)) {
+      return false;
+    }
+  }
+  return true;
+}
 
+// Decompiles the functions of `module` on `jobs` worker threads. Every
+// worker loads its own copy of the input and owns its LLVM, clang and Z3
+// state. Workers take functions from a shared queue that starts with the
+// most costly ones, so that a big function does not start last, and
+// print every definition into a separate buffer. The buffers are then
+// emitted after the module declarations in module order, or split into
+// files in `split_dir`. Definitions found in `cache` are not decompiled
+// again. With --shard, only the functions of the shard are decompiled,
+// and the output is the shard as `rellic::PrintShardOutput` prints it.
+static bool GenerateParallelPseudocode(const Input& input,
+                                       llvm::Module& module,
+                                       llvm::raw_ostream& output,
+                                       rellic::Z3ProofCache& proofs,
+                                       unsigned jobs,
+                                       rellic::FunctionCache* cache,
+                                       const std::string* split_dir) {
+  // Lower declarations of the whole module
   clang::CompilerInstance ins;
   rellic::InitCompilerInstance(ins, module.getTargetTriple());
 
   auto& ast_ctx{ins.getASTContext()};
 
   rellic::IRToASTVisitor gen(ast_ctx);
+  gen.SetLazyInitElements(FLAGS_lazy_init_elements);
 
   llvm::legacy::PassManager ast;
-  ast.add(rellic::createGenerateASTPass(ast_ctx, gen));
-  ast.add(rellic::createDeadStmtElimPass(ast_ctx, gen));
+  ast.add(rellic::createGenerateASTPass(
+      ast_ctx, gen, [](llvm::Function& func) { return false; }));
   ast.run(module);
 
-  // Simplifier to use during condition-based refinement
-  auto cbr_simplifier{new rellic::Z3CondSimplify(ast_ctx, gen)};
-  cbr_simplifier->SetZ3Simplifier(
-      // Simplify boolean structure with AIGs
-      z3::tactic(cbr_simplifier->GetZ3Context(), "aig") &
-      // Cheap local simplifier
-      z3::tactic(cbr_simplifier->GetZ3Context(), "simplify"));
-
-  llvm::legacy::PassManager cbr;
-  if (!FLAGS_disable_z3) {
-    cbr.add(cbr_simplifier);
-    cbr.add(rellic::createNestedCondPropPass(ast_ctx, gen));
-  }
-
-  cbr.add(rellic::createNestedScopeCombinerPass(ast_ctx, gen));
-
-  if (!FLAGS_disable_z3) {
-    cbr.add(rellic::createCondBasedRefinePass(ast_ctx, gen));
-    cbr.add(rellic::createReachBasedRefinePass(ast_ctx, gen));
-  }
-
-  while (cbr.run(module))
-    ;
-
-  llvm::legacy::PassManager loop;
-  loop.add(rellic::createLoopRefinePass(ast_ctx, gen));
-  loop.add(rellic::createNestedScopeCombinerPass(ast_ctx, gen));
-  while (loop.run(module))
-    ;
-
-  // Simplifier to use during final refinement
-  auto fin_simplifier{new rellic::Z3CondSimplify(ast_ctx, gen)};
-  fin_simplifier->SetZ3Simplifier(
-      // Simplify boolean structure with AIGs
-      z3::tactic(fin_simplifier->GetZ3Context(), "aig") &
-      // Propagate bounds over bit-vectors
-      z3::tactic(fin_simplifier->GetZ3Context(), "propagate-bv-bounds") &
-      // Eliminate conjunctions using De Morgan laws
-      z3::tactic(fin_simplifier->GetZ3Context(), "elim-and") &
-      // Tseitin transformation
-      z3::tactic(fin_simplifier->GetZ3Context(), "tseitin-cnf") &
-      // Contextual simplification
-      z3::tactic(fin_simplifier->GetZ3Context(), "ctx-simplify"));
-
-  llvm::legacy::PassManager fin;
-  if (!FLAGS_disable_z3) {
-    fin.add(fin_simplifier);
-    fin.add(rellic::createNestedCondPropPass(ast_ctx, gen));
-  }
-
-  fin.add(rellic::createNestedScopeCombinerPass(ast_ctx, gen));
-  fin.add(rellic::createExprCombinePass(ast_ctx, gen));
-  fin.run(module);
-
-  ast_ctx.getTranslationUnitDecl()->print(output);
-  // ast_ctx.getTranslationUnitDecl()->dump(output);
+  std::unordered_map<std::string, double> times;
+  if (!FLAGS_schedule_stats.empty()) {
+    times = LoadFunctionTimes(FLAGS_schedule_stats);
+  }
+
+  // With --shard, functions of other shards are left out like cached ones,
+  // but keep empty definitions
+  std::vector<double> shard_costs;
+  std::vector<unsigned> shards;
+  if (shard.count) {
+    for (auto& func : module.functions()) {
+      if (!func.isDeclaration()) {
+        shard_costs.push_back(EstimateCost(func));
+      }
+    }
+    shards = rellic::AssignShards(shard_costs, shard.count);
+  }
+
+  // Reuse cached definitions and estimate the cost of the rest
+  std::vector<std::string> defns;
+  std::vector<std::string> keys;
+  // Whether Z3 queries of a function fell back, which keeps its definition
+  // out of the cache. Not a `std::vector<bool>`, as workers set elements
+  // concurrently.
+  std::vector<char> fell_back;
+  std::vector<unsigned> work;
+  std::vector<double> estimates;
+  std::vector<double> costs;
+  // Ratio of measured times and estimates of the functions that have both
+  double measured{0};
+  double estimated{0};
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    auto idx{defns.size()};
+    if (shard.count && shards[idx] != shard.index) {
+      defns.emplace_back();
+      keys.emplace_back();
+      continue;
+    }
+    std::string defn;
+    std::string key;
+    auto cached{false};
+    if (cache) {
+      key = cache->GetKey(func, ast_ctx, gen);
+      cached = cache->Lookup(key, defn);
+    }
+    if (!cached) {
+      auto estimate{shard.count ? shard_costs[idx] : EstimateCost(func)};
+      auto time{times.find(func.getName().str())};
+      if (time != times.end()) {
+        measured += time->second;
+        estimated += estimate;
+        costs.push_back(time->second);
+      } else {
+        costs.push_back(-1);
+      }
+      estimates.push_back(estimate);
+      work.push_back(idx);
+    }
+    defns.push_back(defn);
+    keys.push_back(key);
+  }
+
+  size_t num_selected{defns.size()};
+  if (shard.count) {
+    num_selected = std::count(shards.begin(), shards.end(), shard.index);
+  }
+  LOG_IF(INFO, cache) << "Reusing " << num_selected - work.size() << " of "
+                      << num_selected << " cached function definitions";
+
+  // Fill in the costs of functions without timings in the same unit
+  auto scale{estimated > 0 ? measured / estimated : 1.0};
+  for (auto i = 0U; i < costs.size(); ++i) {
+    if (costs[i] < 0) {
+      costs[i] = estimates[i] * scale;
+    }
+  }
+  // Start with the most costly functions
+  std::vector<unsigned> order(work.size());
+  for (auto i = 0U; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&costs](unsigned lhs,
+                                                        unsigned rhs) {
+    return costs[lhs] > costs[rhs];
+  });
+
+  std::atomic<unsigned> next{0};
+  fell_back.resize(defns.size());
+  auto Worker{[&input, &defns, &keys, &fell_back, &work, &order, &next,
+               &proofs, cache] {
+    llvm::LLVMContext llvm_ctx;
+    // The input was verified when `module` was loaded
+    std::unique_ptr<llvm::Module> module(
+        LoadInput(llvm_ctx, input, /*lazy=*/false, /*warn=*/false,
+                  /*allow_failure=*/false, /*verify=*/false));
+    // Switches are lowered only in the functions that a worker takes, so
+    // that lowering is spread over the workers and overlaps with the
+    // pipelines of other functions. Everything else has to happen before
+    // the module is summarized: removing PHI nodes and simplifying change
+    // where bodies first refer to types, and so how anonymous structures
+    // are named, and skipped functions must be declarations.
+    auto prepare{GetPrepareOptions()};
+    auto deferred{prepare.lower_switch && !prepare.simplify_ir};
+    if (deferred) {
+      for (auto& func : *module) {
+        if (prepare.remove_phi_nodes) {
+          rellic::RemovePHINodes(func);
+        }
+        rellic::SkipUnsupported(func, prepare, /*report=*/false);
+      }
+    } else {
+      rellic::PrepareModule(*module, prepare, /*report=*/false);
+    }
+    // Workers select the same definitions as the main thread, so that
+    // they line up with `defns`
+    std::vector<llvm::Function*> funcs;
+    for (auto& func : module->functions()) {
+      if (!func.isDeclaration()) {
+        funcs.push_back(&func);
+      }
+    }
+
+    clang::CompilerInstance ins;
+    rellic::InitCompilerInstance(ins, module->getTargetTriple());
+
+    auto& ast_ctx{ins.getASTContext()};
+
+    // Declarations of the module are lowered once, instead of before every
+    // function, and stay unchanged while bodies are lowered
+    rellic::IRToASTVisitor gen(ast_ctx);
+    gen.SetLazyInitElements(FLAGS_lazy_init_elements);
+    gen.Summarize(*module);
+
+    // Lets later functions reuse the statements of finished ones
+    rellic::StmtRecycler recycler(ast_ctx);
+
+    // One solver per worker, which is reset between functions
+    rellic::Z3Solver solver(ast_ctx, &proofs);
+    ConfigureSolver(solver);
+
+    auto tudecl{ast_ctx.getTranslationUnitDecl()};
+    for (unsigned item; (item = next++) < order.size();) {
+      auto idx{work[order[item]]};
+      auto func{funcs[idx]};
+      rellic::Trace::SetFunction(func->getName());
+      rellic::TraceSpan span(func->getName(), "function");
+      rellic::StatsTimer timer;
+      if (deferred) {
+        rellic::LowerSwitches(*func);
+      }
+      Checkpoints checkpoints{cache, func, keys[idx]};
+      fell_back[idx] =
+          RunPipeline(*module, ast_ctx, gen, *func, solver,
+                      FLAGS_checkpoints && cache ? &checkpoints : nullptr) > 0;
+
+      auto fdecl{clang::cast<clang::FunctionDecl>(gen.GetOrCreateDecl(func))};
+      if (auto fdefn = fdecl->getDefinition()) {
+        llvm::raw_string_ostream os(defns[idx]);
+        rellic::PrintDecl(fdefn, os);
+        os << '\n';
+        os.flush();
+        tudecl->removeDecl(fdefn);
+      }
+      if (rellic::Stats::IsEnabled()) {
+        rellic::Stats::Get().AddFunctionTime(func->getName(),
+                                             timer.GetSeconds());
+      }
+      // Later pipelines neither walk nor keep finished functions
+      gen.ClearFunctionBody(*func);
+      func->deleteBody();
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  for (auto id = 0U; id < std::min<size_t>(jobs, work.size()); ++id) {
+    workers.emplace_back(Worker);
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  // Definitions may be cut short once cancelled, or by resource limits
+  if (cache && !cancellation.IsCancelled()) {
+    for (auto idx : work) {
+      if (!defns[idx].empty() && !fell_back[idx]) {
+        cache->Insert(keys[idx], defns[idx]);
+      }
+    }
+  }
+
+  if (split_dir) {
+    std::string decls;
+    llvm::raw_string_ostream os(decls);
+    rellic::PrintTranslationUnit(ast_ctx.getTranslationUnitDecl(), os);
+    return WriteSplitOutput(*split_dir, module, os.str(), defns);
+  }
+
+  if (shard.count) {
+    rellic::ShardOutput result;
+    result.shard = shard;
+    llvm::raw_string_ostream os(result.decls);
+    rellic::PrintTranslationUnit(ast_ctx.getTranslationUnitDecl(), os);
+    os.flush();
+    for (auto i = 0U; i < defns.size(); ++i) {
+      if (shards[i] == shard.index) {
+        result.defns[i] = std::move(defns[i]);
+      }
+    }
+    rellic::PrintShardOutput(result, output);
+    return true;
+  }
 
+  rellic::PrintTranslationUnit(ast_ctx.getTranslationUnitDecl(), output);
+  for (auto& defn : defns) {
+    output << defn;
+  }
+
+  return true;
+}
+
+// Flags that change the decompiled definitions. Cached definitions are
+// only reused with the same values, so every such flag must be listed.
+static const char* const kOutputFlags[]{
+    "disable_z3",
+    "remove_phi_nodes",
+    "lower_switch",
+    "simplify_ir",
+    "skip_unsupported",
+    "z3_timeout",
+    "z3_rlimit",
+    "z3_function_timeout",
+    "memory_budget",
+    "max_rounds",
+    "goto_threshold",
+    "cond_size_limit",
+    "trivial_blocks",
+    "trivial_depth",
+    "lazy_init_elements",
+    "z3_abstract_atoms",
+};
+
+// Returns the salt of function cache entries, which invalidates them when
+// rellic or options that affect output change
+static std::string GetSalt() {
+  std::stringstream salt;
+  salt << rellic::Version::GetCommitHash() << ' ' << LLVM_VERSION_STRING;
+  for (auto name : kOutputFlags) {
+    std::string value;
+    CHECK(google::GetCommandLineOption(name, &value)) << "No flag " << name;
+    salt << ' ' << name << '=' << value;
+  }
+  // The stages that --passes names, which may come from a file
+  for (auto& stage : pipeline) {
+    salt << ' ' << DescribeStage(stage);
+  }
+  return salt.str();
+}
+
+// Decompiles the module of `input` into `output`, or into files in
+// `split_dir` if given, using up to `jobs` worker threads. With
+// `allow_failure`, an input that can't be loaded is reported instead of
+// aborting.
+static bool DecompileModule(const Input& input, llvm::raw_ostream& output,
+                            rellic::Z3ProofCache& proofs, unsigned jobs,
+                            bool allow_failure,
+                            const std::string* split_dir = nullptr) {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module(
+      LoadInput(llvm_ctx, input, FLAGS_stream, /*warn=*/true, allow_failure));
+  if (!module) {
+    LOG(ERROR) << "Failed to load " << input.path;
+    return false;
+  }
+
+  // Streaming prepares every function right before decompiling it
+  if (!FLAGS_stream) {
+    rellic::PrepareModule(*module, GetPrepareOptions());
+  }
+
+  // The passes that a profile skips change as it learns, so definitions
+  // of profiled runs are neither reused nor kept
+  std::unique_ptr<rellic::FunctionCache> cache;
+  if (!FLAGS_function_cache.empty() && !profile) {
+    cache.reset(new rellic::FunctionCache(FLAGS_function_cache, GetSalt()));
+  }
+
+  bool succeeded;
+  if (FLAGS_stream) {
+    succeeded = GenerateStreamingPseudocode(*module, output, proofs);
+  } else if (jobs > 1 || cache || split_dir || shard.count) {
+    succeeded = GenerateParallelPseudocode(input, *module, output, proofs,
+                                           jobs, cache.get(), split_dir);
+  } else {
+    succeeded = GeneratePseudocode(*module, output, proofs);
+  }
+  LOG_IF(WARNING, cancellation.IsCancelled())
+      << "Refinement of " << input.path << " was cancelled; functions are "
+      << "emitted as refined so far";
+  return succeeded;
+}
+
+// Decompiles `input` into the C file `output_path`, or into files in the
+// directory `output_path` with --split_output
+static bool DecompileFile(const Input& input, const std::string& output_path,
+                          rellic::Z3ProofCache& proofs, unsigned jobs,
+                          bool allow_failure) {
+  if (!FLAGS_split_output.empty()) {
+    return DecompileModule(input, llvm::nulls(), proofs, jobs, allow_failure,
+                           &output_path);
+  }
+  std::error_code ec;
+  rellic::OutputFile output(output_path, ec, compression);
+  if (ec) {
+    LOG(ERROR) << "Failed to create output file " << output_path << ": "
+               << ec.message();
+    return false;
+  }
+  if (!DecompileModule(input, output, proofs, jobs, allow_failure)) {
+    return false;
+  }
+  if (!output.Close()) {
+    LOG(ERROR) << "Failed to write output file " << output_path;
+    return false;
+  }
+  return true;
+}
+
+using FileList = std::vector<std::pair<std::string, std::string>>;
+
+// Reads the pairs of input and output files listed in the manifest
+// `path`. Empty lines and lines that start with `#` are skipped.
+static bool ReadManifest(const std::string& path, FileList& files) {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    LOG(ERROR) << "Failed to open manifest " << path;
+    return false;
+  }
+  std::string line;
+  for (unsigned num{1}; std::getline(manifest, line); ++num) {
+    std::istringstream fields(line);
+    std::string input, output, extra;
+    if (!(fields >> input) || input[0] == '#') {
+      continue;
+    }
+    if (!(fields >> output) || (fields >> extra)) {
+      LOG(ERROR) << path << ':' << num
+                 << ": Expected an input and an output file";
+      return false;
+    }
+    files.emplace_back(input, output);
+  }
+  return true;
+}
+
+// Decompiles the files listed in the manifest `path` in one process,
+// `jobs` files at a time. Every file is decompiled on a single thread and
+// files that fail don't stop the others. Files share the cancellation
+// token, so each one gets its own --deadline_ms only if `jobs` is 1.
+static bool DecompileBatch(const std::string& path,
+                           rellic::Z3ProofCache& proofs, unsigned jobs) {
+  FileList files;
+  if (!ReadManifest(path, files)) {
+    return false;
+  }
+
+  std::vector<char> succeeded(files.size(), false);
+  std::atomic<size_t> next{0};
+  auto Worker{[&files, &succeeded, &next, &proofs, jobs] {
+    for (size_t idx; (idx = next++) < files.size();) {
+      auto& file{files[idx]};
+      LOG(INFO) << "Decompiling " << file.first << " into " << file.second;
+      if (jobs == 1) {
+        cancellation.Reset();
+        cancellation.SetTimeout(FLAGS_deadline_ms);
+      }
+      succeeded[idx] = DecompileFile(file.first, file.second, proofs, 1U,
+                                     /*allow_failure=*/true);
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  for (auto id = 0U; id < std::min<size_t>(jobs, files.size()); ++id) {
+    workers.emplace_back(Worker);
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  auto num_failed{std::count(succeeded.begin(), succeeded.end(), false)};
+  LOG_IF(ERROR, num_failed) << "Failed to decompile " << num_failed << " of "
+                            << files.size() << " files";
+  return !num_failed;
+}
+
+// Longest request header that the server accepts
+static constexpr size_t kMaxRequestHeader{1 << 16};
+// Largest bitcode that the server accepts in a request
+static constexpr uint64_t kMaxRequestBitcode{uint64_t(1) << 30};
+// Milliseconds between checks whether a client is still connected
+static constexpr int kWatchInterval{100};
+
+static bool ReadAll(int fd, char* data, size_t size) {
+  while (size) {
+    auto num{::read(fd, data, size)};
+    if (num < 0 && errno == EINTR) {
+      continue;
+    } else if (num <= 0) {
+      return false;
+    }
+    data += num;
+    size -= num;
+  }
   return true;
 }
+
+static bool WriteAll(int fd, const char* data, size_t size) {
+  while (size) {
+    auto num{::write(fd, data, size)};
+    if (num < 0 && errno == EINTR) {
+      continue;
+    } else if (num <= 0) {
+      return false;
+    }
+    data += num;
+    size -= num;
+  }
+  return true;
+}
+
+// Reads a line without its newline
+static bool ReadLine(int fd, std::string& line) {
+  line.clear();
+  char chr;
+  while (line.size() < kMaxRequestHeader && ReadAll(fd, &chr, 1)) {
+    if (chr == '\n') {
+      return true;
+    }
+    line.push_back(chr);
+  }
+  return false;
+}
+
+static bool SendResponse(int fd, const std::string& status,
+                         const std::string& payload) {
+  auto header{status + ' ' + std::to_string(payload.size()) + '\n'};
+  return WriteAll(fd, header.data(), header.size()) &&
+         WriteAll(fd, payload.data(), payload.size());
+}
+
+// Decompiles the bitcode of a request into `code`, or sets `code` to an
+// error message
+static bool DecompileRequest(const std::string& bitcode, Input& input,
+                             std::string& code, rellic::Z3ProofCache& proofs,
+                             unsigned jobs) {
+  if (!input.function_regex.empty()) {
+    std::string error;
+    if (!llvm::Regex("^(" + input.function_regex + ")$").isValid(error)) {
+      code = "Invalid function_regex: " + error;
+      return false;
+    }
+  }
+  // Workers of parallel decompilation reload the module from a file
+  int bc_fd;
+  llvm::SmallString<128> bc_path;
+  if (auto ec = llvm::sys::fs::createTemporaryFile("rellic-request", "bc",
+                                                   bc_fd, bc_path)) {
+    code = "Failed to create temporary file: " + ec.message();
+    return false;
+  }
+  {
+    llvm::raw_fd_ostream bc_os(bc_fd, /*shouldClose=*/true);
+    bc_os << bitcode;
+  }
+  input.path = bc_path.str().str();
+
+  llvm::raw_string_ostream os(code);
+  auto succeeded{
+      DecompileModule(input, os, proofs, jobs, /*allow_failure=*/true)};
+  os.flush();
+  llvm::sys::fs::remove(bc_path);
+  if (!succeeded) {
+    code = "Failed to decompile the bitcode";
+  }
+  return succeeded;
+}
+
+// Cancels the current request once the client `fd` hangs up, until `done`
+static void WatchClient(int fd, const std::atomic<bool>& done) {
+  while (!done) {
+    // Hangups and errors are reported without asking for any events
+    pollfd pfd{fd, 0, 0};
+    if (::poll(&pfd, 1, kWatchInterval) > 0 &&
+        (pfd.revents & (POLLHUP | POLLERR))) {
+      LOG(INFO) << "Client disconnected, cancelling its request";
+      cancellation.Cancel();
+      return;
+    }
+  }
+}
+
+// Handles the requests of a client until it disconnects. A request is a
+// header line
+//
+//   decompile SIZE [functions=NAME,...] [function_regex=REGEX]
+//             [deadline_ms=MS]
+//
+// followed by SIZE bytes of bitcode, or `shutdown`. Every request is
+// answered with a line `ok SIZE` or `error SIZE`, followed by SIZE bytes
+// of C code or of an error message. Code that is only refined as far as
+// the deadline allowed, which defaults to --deadline_ms, is answered with
+// `partial SIZE` instead of `ok SIZE`. Requests of clients that hang up
+// are cancelled. Returns false after `shutdown`.
+static bool ServeClient(int fd, rellic::Z3ProofCache& proofs, unsigned jobs) {
+  std::string header;
+  while (ReadLine(fd, header)) {
+    std::istringstream fields(header);
+    std::string command;
+    fields >> command;
+    if (command == "shutdown") {
+      SendResponse(fd, "ok", "");
+      return false;
+    }
+
+    Input input("", "", "");
+    std::string size_field;
+    uint64_t size{0};
+    auto deadline_ms{FLAGS_deadline_ms};
+    auto valid{command == "decompile" && (fields >> size_field) &&
+               !llvm::StringRef(size_field).getAsInteger(10, size)};
+    for (std::string field; valid && (fields >> field);) {
+      llvm::StringRef option(field);
+      if (option.consume_front("functions=")) {
+        input.functions = option.str();
+      } else if (option.consume_front("function_regex=")) {
+        input.function_regex = option.str();
+      } else if (option.consume_front("deadline_ms=")) {
+        valid = !option.getAsInteger(10, deadline_ms);
+      } else {
+        valid = false;
+      }
+    }
+    // The rest of the connection can't be parsed after a bad header
+    if (!valid) {
+      SendResponse(fd, "error", "Malformed request: " + header);
+      return true;
+    }
+    // Don't allocate whatever a client asks for
+    if (size > kMaxRequestBitcode) {
+      SendResponse(fd, "error",
+                   "Bitcode is larger than " +
+                       std::to_string(kMaxRequestBitcode) + " bytes");
+      return true;
+    }
+
+    std::string bitcode(size, '\0');
+    if (!ReadAll(fd, &bitcode[0], size)) {
+      return true;
+    }
+
+    LOG(INFO) << "Decompiling " << size << " bytes of bitcode";
+    cancellation.Reset();
+    cancellation.SetTimeout(deadline_ms);
+    std::atomic<bool> done{false};
+    std::thread watcher(WatchClient, fd, std::cref(done));
+    std::string code;
+    auto succeeded{DecompileRequest(bitcode, input, code, proofs, jobs)};
+    done = true;
+    watcher.join();
+    auto status{succeeded ? "ok" : "error"};
+    if (succeeded && cancellation.IsCancelled()) {
+      status = "partial";
+    }
+    if (!SendResponse(fd, status, code)) {
+      return true;
+    }
+  }
+  return true;
+}
+
+// Serves clients on the Unix domain socket `path`, one at a time, until
+// a client requests a shutdown. LLVM passes, the Z3 proof cache and the
+// function cache stay warm between requests.
+static bool Serve(const std::string& path, rellic::Z3ProofCache& proofs,
+                  unsigned jobs) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "Socket path is too long: " << path;
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  auto server{::socket(AF_UNIX, SOCK_STREAM, 0)};
+  if (server < 0) {
+    PLOG(ERROR) << "Failed to create socket";
+    return false;
+  }
+
+  ::unlink(path.c_str());
+  if (::bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+      ::listen(server, SOMAXCONN)) {
+    PLOG(ERROR) << "Failed to listen on " << path;
+    ::close(server);
+    return false;
+  }
+
+  // Keep running when clients disconnect before reading their responses
+  std::signal(SIGPIPE, SIG_IGN);
+
+  LOG(INFO) << "Listening on " << path;
+  auto succeeded{true};
+  for (auto running{true}; running;) {
+    auto client{::accept(server, nullptr, nullptr)};
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "Failed to accept client";
+      succeeded = false;
+      break;
+    }
+    running = ServeClient(client, proofs, jobs);
+    ::close(client);
+  }
+
+  ::close(server);
+  ::unlink(path.c_str());
+  return succeeded;
+}
 }  // namespace
 
+// Parses the pipeline described by `spec`, which is read from a file if
+// it starts with `@`
+static bool LoadPipeline(const std::string& spec, rellic::PipelineDesc& desc) {
+  std::string text{spec};
+  if (!spec.empty() && spec[0] == '@') {
+    std::ifstream file(spec.substr(1));
+    if (!file) {
+      LOG(ERROR) << "Failed to open pipeline file " << spec.substr(1);
+      return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+  }
+  std::string error;
+  if (!rellic::ParsePipeline(text, desc, error)) {
+    LOG(ERROR) << "Invalid --passes: " << error;
+    return false;
+  }
+  if (FLAGS_disable_z3) {
+    rellic::RemoveZ3Passes(desc);
+  }
+  return true;
+}
+
 static void SetVersion(void) {
   std::stringstream version;
 
@@ -197,6 +1565,111 @@ int main(int argc, char* argv[]) {
         << "    --output OUTPUT_C_FILE \\" << std::endl
         << std::endl
 
+        // Decompile only some functions.
+        << "    [--functions NAME,...]" << std::endl
+        << "    [--function_regex REGEX]" << std::endl
+        << std::endl
+
+        // Select the refinement passes.
+        << "    [--passes PRESET|PIPELINE|@FILE]" << std::endl
+        << "    [--max_rounds N]" << std::endl
+        << std::endl
+
+        // Fold conditions in the IR before generating the AST.
+        << "    [--simplify_ir]" << std::endl
+        << std::endl
+
+        // Print functions as soon as they are decompiled.
+        << "    [--stream]" << std::endl
+        << "    [--stream_queue N]" << std::endl
+        << std::endl
+
+        // Write compressed output, or one file per function or unit.
+        << "    [--output_compression none|gzip|zstd]" << std::endl
+        << "    [--split_output function|unit]" << std::endl
+        << std::endl
+
+        // Decompile one of N parts of the functions, for rellic-merge.
+        << "    [--shard I/N]" << std::endl
+        << std::endl
+
+        // Decompile many files instead of --input and --output.
+        << "    [--batch MANIFEST_FILE]" << std::endl
+        << std::endl
+
+        // Serve requests instead of decompiling --input into --output.
+        << "    [--serve SOCKET_FILE]" << std::endl
+        << std::endl
+
+        // Decompile functions on multiple threads.
+        << "    [--jobs N]" << std::endl
+        << "    [--schedule_stats STATS_JSON_FILE]" << std::endl
+        << std::endl
+
+        // Collect pipeline statistics.
+        << "    [--stats STATS_JSON_FILE]" << std::endl
+        << "    [--time_passes]" << std::endl
+        << "    [--trace TRACE_JSON_FILE]" << std::endl
+        << std::endl
+
+        // Reuse function definitions of previous runs.
+        << "    [--function_cache CACHE_DIR]" << std::endl
+        << "    [--checkpoints]" << std::endl
+        << std::endl
+
+        // Reuse Z3 proof results of previous runs.
+        << "    [--z3_cache CACHE_FILE]" << std::endl
+        << std::endl
+
+        // Skip passes that never change functions of a CFG shape class.
+        << "    [--pass_profile PROFILE_FILE]" << std::endl
+        << std::endl
+
+        // Limit the resources of Z3 queries.
+        << "    [--z3_timeout MS]" << std::endl
+        << "    [--z3_rlimit N]" << std::endl
+        << "    [--z3_function_timeout MS]" << std::endl
+        << "    [--memory_budget MIB]" << std::endl
+        << std::endl
+
+        // Stop refining after a wall time limit.
+        << "    [--deadline_ms MS]" << std::endl
+        << std::endl
+
+        // Abstract opaque atoms of Z3 queries.
+        << "    [--z3_abstract_atoms]" << std::endl
+        << std::endl
+
+        // Write slow Z3 queries as reproducers.
+        << "    [--slow_query_dir DIR]" << std::endl
+        << "    [--slow_query_ms MS]" << std::endl
+        << std::endl
+
+        // Prove independent Z3 queries concurrently.
+        << "    [--z3_threads N]" << std::endl
+        << std::endl
+
+        // Analyze the loops of a function concurrently.
+        << "    [--structure_threads N]" << std::endl
+        << std::endl
+
+        // Use gotos for huge regions and irreducible cycles.
+        << "    [--goto_threshold N]" << std::endl
+        << std::endl
+
+        // Bound the size of reaching conditions.
+        << "    [--cond_size_limit N]" << std::endl
+        << std::endl
+
+        // Skip refinement of small acyclic functions.
+        << "    [--trivial_blocks N]" << std::endl
+        << "    [--trivial_depth N]" << std::endl
+        << std::endl
+
+        // Lower huge constant tables while printing them.
+        << "    [--lazy_init_elements N]" << std::endl
+        << std::endl
+
         // Print the version and exit.
         << "    [--version]" << std::endl
         << std::endl;
@@ -207,37 +1680,161 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  LOG_IF(ERROR, FLAGS_input.empty())
-      << "Must specify the path to an input LLVM bitcode file.";
+  if (!FLAGS_batch.empty() || !FLAGS_serve.empty()) {
+    if ((!FLAGS_batch.empty() && !FLAGS_serve.empty()) ||
+        !FLAGS_input.empty() || !FLAGS_output.empty()) {
+      LOG(ERROR) << "--batch and --serve can't be combined with each other "
+                    "or with --input or --output";
+      return EXIT_FAILURE;
+    }
+  } else {
+    LOG_IF(ERROR, FLAGS_input.empty())
+        << "Must specify the path to an input LLVM bitcode file.";
 
-  LOG_IF(ERROR, FLAGS_output.empty())
-      << "Must specify the path to an output C file.";
+    LOG_IF(ERROR, FLAGS_output.empty())
+        << "Must specify the path to an output C file.";
 
-  if (FLAGS_input.empty() || FLAGS_output.empty()) {
-    std::cerr << google::ProgramUsage();
+    if (FLAGS_input.empty() || FLAGS_output.empty()) {
+      std::cerr << google::ProgramUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  // With --batch, --jobs decompiles files in parallel instead of functions
+  auto parallel_functions{FLAGS_jobs > 1 && FLAGS_batch.empty()};
+  if (FLAGS_deadline_ms && FLAGS_jobs > 1 && !FLAGS_batch.empty()) {
+    LOG(ERROR) << "--deadline_ms applies to one file at a time, so it can't "
+                  "be combined with --batch and --jobs";
+    return EXIT_FAILURE;
+  }
+  if (FLAGS_stream && (parallel_functions || !FLAGS_function_cache.empty())) {
+    LOG(ERROR) << "--stream can't be combined with --jobs or --function_cache";
     return EXIT_FAILURE;
   }
 
-  std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
+  std::string error;
+  if (!FLAGS_shard.empty()) {
+    if (!rellic::ParseShardSpec(FLAGS_shard, shard, error)) {
+      LOG(ERROR) << "Invalid --shard: " << error;
+      return EXIT_FAILURE;
+    }
+    if (FLAGS_stream || !FLAGS_split_output.empty() ||
+        !FLAGS_batch.empty() || !FLAGS_serve.empty()) {
+      LOG(ERROR) << "--shard can't be combined with --stream, "
+                    "--split_output, --batch or --serve";
+      return EXIT_FAILURE;
+    }
+  }
 
-  auto module = rellic::LoadModuleFromFile(llvm_ctx.get(), FLAGS_input);
+  if (!FLAGS_split_output.empty()) {
+    if (FLAGS_split_output != "function" && FLAGS_split_output != "unit") {
+      LOG(ERROR) << "--split_output must be `function` or `unit`";
+      return EXIT_FAILURE;
+    }
+    if (FLAGS_stream || !FLAGS_serve.empty()) {
+      LOG(ERROR) << "--split_output can't be combined with --stream or "
+                    "--serve";
+      return EXIT_FAILURE;
+    }
+  }
 
-  std::error_code ec;
-  llvm::raw_fd_ostream output(FLAGS_output, ec, llvm::sys::fs::F_Text);
-  CHECK(!ec) << "Failed to create output file: " << ec.message();
+  if (!rellic::ParseOutputCompression(FLAGS_output_compression, compression,
+                                      error)) {
+    LOG(ERROR) << "Invalid --output_compression: " << error;
+    return EXIT_FAILURE;
+  }
+  if (shard.count && compression != rellic::OutputCompression::kNone) {
+    LOG(ERROR) << "rellic-merge reads only uncompressed --shard outputs";
+    return EXIT_FAILURE;
+  }
+
+  if (!FLAGS_slow_query_dir.empty()) {
+    auto ec{llvm::sys::fs::create_directories(FLAGS_slow_query_dir)};
+    if (ec) {
+      LOG(ERROR) << "Failed to create slow query directory "
+                 << FLAGS_slow_query_dir << ": " << ec.message();
+      return EXIT_FAILURE;
+    }
+  }
 
-  if (FLAGS_remove_phi_nodes) {
-    RemovePHINodes(*module);
+  if (FLAGS_checkpoints && FLAGS_function_cache.empty()) {
+    LOG(ERROR) << "--checkpoints needs --function_cache";
+    return EXIT_FAILURE;
   }
 
-  if (FLAGS_lower_switch) {
-    LowerSwitches(*module);
+  if (!LoadPipeline(FLAGS_passes, pipeline)) {
+    return EXIT_FAILURE;
   }
 
-  GeneratePseudocode(*module, output);
+  InitOptPasses();
+
+  rellic::Z3ProofCache proofs;
+  if (!FLAGS_z3_cache.empty()) {
+    LOG_IF(INFO, !proofs.Load(FLAGS_z3_cache))
+        << "Starting with an empty Z3 proof cache";
+  }
+
+  if (!FLAGS_pass_profile.empty()) {
+    profile.reset(new rellic::PassProfile);
+    LOG_IF(INFO, !profile->Load(FLAGS_pass_profile))
+        << "Starting with an empty pass profile";
+    LOG_IF(WARNING, !FLAGS_function_cache.empty())
+        << "--function_cache is not used with --pass_profile";
+  }
+
+  if (!FLAGS_stats.empty() || FLAGS_time_passes) {
+    rellic::Stats::Enable();
+  }
+
+  if (!FLAGS_trace.empty()) {
+    rellic::Trace::Enable();
+  }
+
+  cancellation.SetTimeout(FLAGS_deadline_ms);
+
+  auto jobs{std::max(FLAGS_jobs, 1U)};
+  bool succeeded;
+  if (!FLAGS_batch.empty()) {
+    succeeded = DecompileBatch(FLAGS_batch, proofs, jobs);
+  } else if (!FLAGS_serve.empty()) {
+    succeeded = Serve(FLAGS_serve, proofs, jobs);
+  } else {
+    succeeded = DecompileFile(FLAGS_input, FLAGS_output, proofs, jobs,
+                              /*allow_failure=*/false);
+  }
+
+  if (!FLAGS_z3_cache.empty()) {
+    proofs.Save(FLAGS_z3_cache);
+  }
+
+  if (profile) {
+    LOG(INFO) << "Skipped " << profile->GetNumSkipped()
+              << " pass runs; " << profile->GetNumSampleChanges() << " of "
+              << profile->GetNumSamples()
+              << " validation samples changed their function";
+    profile->Save(FLAGS_pass_profile);
+  }
+
+  if (!FLAGS_stats.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream stats(FLAGS_stats, ec, llvm::sys::fs::F_Text);
+    CHECK(!ec) << "Failed to create statistics file: " << ec.message();
+    rellic::Stats::Get().PrintJSON(stats);
+  }
+
+  if (FLAGS_time_passes) {
+    rellic::Stats::Get().PrintPassTimes(llvm::errs());
+  }
+
+  if (!FLAGS_trace.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream trace(FLAGS_trace, ec, llvm::sys::fs::F_Text);
+    CHECK(!ec) << "Failed to create trace file: " << ec.message();
+    rellic::Trace::Get().PrintJSON(trace);
+  }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
 
-  return EXIT_SUCCESS;
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
 }
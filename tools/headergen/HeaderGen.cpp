@@ -17,11 +17,24 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
 #include <streambuf>
+#include <thread>
+#include <vector>
 
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Lex/PreprocessingRecord.h>
+#include <clang/Lex/Preprocessor.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 
 #include "rellic/AST/CXXToCDecl.h"
 #include "rellic/AST/Util.h"
@@ -34,18 +47,386 @@
 
 DEFINE_string(input, "", "Input header file.");
 DEFINE_string(output, "", "Output file.");
+DEFINE_string(batch, "",
+              "Generate a C header for every input header listed in this "
+              "manifest from a single parse of all of them, instead of "
+              "--input. Every line holds an input header and an output "
+              "file, separated by whitespace.");
+DEFINE_string(input_dir, "",
+              "Generate a C header for every C++ header in this directory "
+              "and its subdirectories, instead of --input.");
+DEFINE_string(output_dir, "",
+              "Directory in which the headers of --input_dir are generated, "
+              "under the same relative paths.");
+DEFINE_uint32(jobs, 1,
+              "Number of threads that parse and lower the headers of "
+              "--input_dir in parallel.");
 
 DECLARE_bool(version);
 
 namespace {
 
-static std::string ReadFile(std::string path) {
-  auto err_or_buf = llvm::MemoryBuffer::getFile(path);
-  if (!err_or_buf) {
-    auto msg = err_or_buf.getError().message();
-    LOG(FATAL) << "Failed to read input file: " << msg;
+using FileList = std::vector<std::pair<std::string, std::string>>;
+using FileSet = std::set<llvm::sys::fs::UniqueID>;
+using IncludeMap =
+    std::map<llvm::sys::fs::UniqueID, std::vector<llvm::sys::fs::UniqueID>>;
+
+// Reads the pairs of input and output files listed in the manifest
+// `path`. Empty lines and lines that start with `#` are skipped.
+static bool ReadManifest(const std::string& path, FileList& files) {
+  std::ifstream manifest(path);
+  if (!manifest) {
+    LOG(ERROR) << "Failed to open manifest " << path;
+    return false;
+  }
+  std::string line;
+  for (unsigned num{1}; std::getline(manifest, line); ++num) {
+    std::istringstream fields(line);
+    std::string input, output, extra;
+    if (!(fields >> input) || input[0] == '#') {
+      continue;
+    }
+    if (!(fields >> output) || (fields >> extra)) {
+      LOG(ERROR) << path << ':' << num
+                 << ": Expected an input and an output file";
+      return false;
+    }
+    files.emplace_back(input, output);
+  }
+  return true;
+}
+
+// Parses `files` as one translation unit that includes every input. The
+// inputs are read by the file manager of clang, instead of being copied
+// into the source of the translation unit, and headers that several
+// inputs include are parsed once. The language is C++ if `cxx` is set,
+// and otherwise picked from the extension of the first input.
+static std::unique_ptr<clang::ASTUnit> ParseHeaders(const FileList& files,
+                                                    bool record_includes,
+                                                    bool cxx = false) {
+  std::string code;
+  for (auto& file : files) {
+    llvm::SmallString<256> path(file.first);
+    llvm::sys::fs::make_absolute(path);
+    code += "#include \"" + path.str().str() + "\"\n";
+  }
+  std::vector<std::string> args;
+  if (record_includes) {
+    // Keep every `#include`, including those skipped by include guards
+    args = {"-Xclang", "-detailed-preprocessing-record"};
+  }
+  auto name{"rellic-headergen" +
+            (cxx ? std::string(".hpp")
+                 : llvm::sys::path::extension(files.front().first).str())};
+  return clang::tooling::buildASTFromCodeWithArgs(code, args, name);
+}
+
+// Maps every file of `unit` to the files that it includes
+static IncludeMap GetIncludes(clang::ASTUnit& unit) {
+  IncludeMap includes;
+  auto record{unit.getPreprocessor().getPreprocessingRecord()};
+  if (!record) {
+    return includes;
+  }
+  auto& sm{unit.getSourceManager()};
+  for (auto entity : *record) {
+    auto incl{llvm::dyn_cast_or_null<clang::InclusionDirective>(entity)};
+    if (!incl || !incl->getFile()) {
+      continue;
+    }
+    auto loc{incl->getSourceRange().getBegin()};
+    if (auto from = sm.getFileEntryForID(sm.getFileID(loc))) {
+      includes[from->getUniqueID()].push_back(incl->getFile()->getUniqueID());
+    }
+  }
+  return includes;
+}
+
+// Returns the file that `decl` is declared in, or `nullptr` for builtins
+static const clang::FileEntry* GetDeclFile(clang::ASTUnit& unit,
+                                           clang::Decl* decl) {
+  auto& sm{unit.getSourceManager()};
+  auto loc{sm.getExpansionLoc(decl->getLocation())};
+  return sm.getFileEntryForID(sm.getFileID(loc));
+}
+
+// Returns `header` and the files it includes transitively
+static FileSet GetIncludeClosure(const std::string& header,
+                                 const IncludeMap& includes) {
+  FileSet closure;
+  llvm::sys::fs::UniqueID id;
+  if (llvm::sys::fs::getUniqueID(header, id)) {
+    return closure;
+  }
+  std::vector<llvm::sys::fs::UniqueID> work_list{id};
+  while (!work_list.empty()) {
+    auto file{work_list.back()};
+    work_list.pop_back();
+    if (!closure.insert(file).second) {
+      continue;
+    }
+    auto iter{includes.find(file)};
+    if (iter != includes.end()) {
+      work_list.insert(work_list.end(), iter->second.begin(),
+                       iter->second.end());
+    }
+  }
+  return closure;
+}
+
+// Writes the C equivalents of the declarations of `unit` to `path`. With
+// `files`, only declarations of those files and builtin ones are written.
+static bool GenerateHeader(clang::ASTUnit& unit, const FileSet* files,
+                           const std::string& path) {
+  std::error_code ec;
+  llvm::raw_fd_ostream output(path, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    LOG(ERROR) << "Failed to create output file " << path << ": "
+               << ec.message();
+    return false;
   }
-  return err_or_buf.get()->getBuffer().str();
+  clang::CompilerInstance c_ins;
+  rellic::InitCompilerInstance(c_ins);
+  auto& c_ast_ctx = c_ins.getASTContext();
+  rellic::CXXToCDeclVisitor visitor(c_ast_ctx);
+  auto tudecl{unit.getASTContext().getTranslationUnitDecl()};
+  if (!files) {
+    visitor.TraverseDecl(tudecl);
+  } else {
+    for (auto decl : tudecl->decls()) {
+      auto entry{GetDeclFile(unit, decl)};
+      if (!entry || files->count(entry->getUniqueID())) {
+        visitor.TraverseDecl(decl);
+      }
+    }
+  }
+  c_ast_ctx.getTranslationUnitDecl()->print(output);
+  return true;
+}
+
+// Generates the C headers of all inputs listed in the manifest `path`.
+// Every output gets the declarations of its input and of the headers the
+// input includes, so it matches the output of a single run on the input.
+static bool GenerateBatch(const std::string& path) {
+  FileList files;
+  if (!ReadManifest(path, files)) {
+    return false;
+  }
+  if (files.empty()) {
+    return true;
+  }
+  auto cxx_ast_unit{ParseHeaders(files, /*record_includes=*/true)};
+  if (cxx_ast_unit->getDiagnostics().hasErrorOccurred()) {
+    return false;
+  }
+  auto includes{GetIncludes(*cxx_ast_unit)};
+  auto success{true};
+  for (auto& file : files) {
+    auto closure{GetIncludeClosure(file.first, includes)};
+    success &= GenerateHeader(*cxx_ast_unit, &closure, file.second);
+  }
+  return success;
+}
+
+// Name of the header of --output_dir that holds the declarations of
+// headers outside of --input_dir
+static const char* kCommonHeader = "rellic-common.h";
+
+// A header of --input_dir and the C declarations generated from it
+struct DirHeader {
+  std::string input;
+  // Path of the output, relative to --output_dir
+  std::string output;
+  llvm::sys::fs::UniqueID id;
+  // Outputs of the headers of --input_dir that the input includes
+  std::vector<std::string> includes;
+  // Declarations of the input itself
+  std::vector<std::string> decls;
+  // Declarations of headers outside of --input_dir, and the names they
+  // are deduplicated by
+  std::vector<std::pair<std::string, std::string>> common;
+};
+
+static std::string PrintDecl(clang::Decl* decl) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  decl->print(os);
+  os << ";\n";
+  return os.str();
+}
+
+// Lowers the declarations that `header` needs and sorts the resulting C
+// declarations into those of `header` itself and the common ones. The
+// headers of `inputs` other than `header` get their own outputs.
+static void LowerDirHeader(clang::ASTUnit& unit, const IncludeMap& includes,
+                           const std::map<llvm::sys::fs::UniqueID,
+                                          std::string>& inputs,
+                           DirHeader& header) {
+  auto closure{GetIncludeClosure(header.input, includes)};
+  auto direct{includes.find(header.id)};
+  if (direct != includes.end()) {
+    for (auto& file : direct->second) {
+      auto input{inputs.find(file)};
+      if (input != inputs.end() && file != header.id) {
+        header.includes.push_back(input->second);
+      }
+    }
+  }
+
+  clang::CompilerInstance c_ins;
+  rellic::InitCompilerInstance(c_ins);
+  auto& c_ast_ctx = c_ins.getASTContext();
+  rellic::CXXToCDeclVisitor visitor(c_ast_ctx);
+  auto c_tu{c_ast_ctx.getTranslationUnitDecl()};
+  // Skip the implicit declarations of the C translation unit
+  clang::Decl* last{nullptr};
+  for (auto c_decl : c_tu->decls()) {
+    last = c_decl;
+  }
+  for (auto decl : unit.getASTContext().getTranslationUnitDecl()->decls()) {
+    auto entry{GetDeclFile(unit, decl)};
+    if (entry && !closure.count(entry->getUniqueID())) {
+      continue;
+    }
+    // Every C++ declaration is lowered, so that the C structs of the
+    // classes it uses exist, but the output only gets the C declarations
+    // of its own file and those of the common header
+    visitor.TraverseDecl(decl);
+    auto next{last ? last->getNextDeclInContext()
+                   : c_tu->decls_empty() ? nullptr : *c_tu->decls_begin()};
+    for (auto c_decl = next; c_decl; c_decl = c_decl->getNextDeclInContext()) {
+      last = c_decl;
+      if (entry && entry->getUniqueID() == header.id) {
+        header.decls.push_back(PrintDecl(c_decl));
+      } else if (!entry || !inputs.count(entry->getUniqueID())) {
+        auto text{PrintDecl(c_decl)};
+        auto named{clang::dyn_cast<clang::NamedDecl>(c_decl)};
+        auto name{named ? std::string(c_decl->getDeclKindName()) + ' ' +
+                              named->getNameAsString()
+                        : text};
+        header.common.emplace_back(name, text);
+      }
+    }
+  }
+}
+
+static bool WriteHeader(const std::string& path,
+                        const std::vector<std::string>& includes,
+                        const std::vector<std::string>& decls) {
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+  std::error_code ec;
+  llvm::raw_fd_ostream output(path, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    LOG(ERROR) << "Failed to create output file " << path << ": "
+               << ec.message();
+    return false;
+  }
+  output << "#pragma once\n";
+  for (auto& include : includes) {
+    output << "#include \"" << include << "\"\n";
+  }
+  for (auto& decl : decls) {
+    output << decl;
+  }
+  return true;
+}
+
+// Generates a C header for every header of `input_dir` on `jobs` threads.
+// Every thread parses its share of the headers as one translation unit.
+// The outputs mirror the includes between the inputs, and declarations of
+// headers outside of `input_dir` are emitted once, into a common header
+// of `output_dir`.
+static bool GenerateDir(const std::string& input_dir,
+                        const std::string& output_dir, unsigned jobs) {
+  std::vector<DirHeader> headers;
+  std::map<llvm::sys::fs::UniqueID, std::string> inputs;
+  std::error_code ec;
+  for (llvm::sys::fs::recursive_directory_iterator it(input_dir, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    auto ext{llvm::sys::path::extension(it->path())};
+    if (ext != ".h" && ext != ".hh" && ext != ".hpp" && ext != ".hxx") {
+      continue;
+    }
+    DirHeader header;
+    header.input = it->path();
+    if (llvm::sys::fs::getUniqueID(header.input, header.id)) {
+      continue;
+    }
+    llvm::SmallString<256> output(header.input);
+    llvm::sys::path::replace_path_prefix(output, input_dir, "");
+    llvm::sys::path::replace_extension(output, "h");
+    header.output = llvm::sys::path::relative_path(output).str();
+    headers.push_back(header);
+  }
+  if (ec) {
+    LOG(ERROR) << "Failed to list " << input_dir << ": " << ec.message();
+    return false;
+  }
+  std::sort(headers.begin(), headers.end(),
+            [](const DirHeader& lhs, const DirHeader& rhs) {
+              return lhs.input < rhs.input;
+            });
+  std::set<std::string> outputs{kCommonHeader};
+  for (auto& header : headers) {
+    if (!outputs.insert(header.output).second) {
+      LOG(ERROR) << "Output " << header.output << " of " << header.input
+                 << " is already used";
+      return false;
+    }
+    inputs[header.id] = header.output;
+  }
+  if (headers.empty()) {
+    return true;
+  }
+
+  std::atomic<bool> success{true};
+  auto Worker{[&](unsigned id) {
+    FileList files;
+    std::vector<DirHeader*> work;
+    for (auto i = id; i < headers.size(); i += jobs) {
+      files.emplace_back(headers[i].input, headers[i].output);
+      work.push_back(&headers[i]);
+    }
+    auto unit{ParseHeaders(files, /*record_includes=*/true, /*cxx=*/true)};
+    if (unit->getDiagnostics().hasErrorOccurred()) {
+      success = false;
+      return;
+    }
+    auto includes{GetIncludes(*unit)};
+    for (auto header : work) {
+      LowerDirHeader(*unit, includes, inputs, *header);
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  for (auto id = 0U; id < std::min<size_t>(jobs, headers.size()); ++id) {
+    workers.emplace_back(Worker, id);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (!success) {
+    return false;
+  }
+
+  // Keep the first of every common declaration, in the order of the
+  // inputs, so that the structs a declaration uses come before it
+  std::set<std::string> names;
+  std::vector<std::string> common;
+  auto ok{true};
+  for (auto& header : headers) {
+    for (auto& decl : header.common) {
+      if (names.insert(decl.first).second) {
+        common.push_back(decl.second);
+      }
+    }
+    auto includes{header.includes};
+    includes.insert(includes.begin(), kCommonHeader);
+    ok &= WriteHeader(output_dir + "/" + header.output, includes,
+                      header.decls);
+  }
+  ok &= WriteHeader(output_dir + "/" + kCommonHeader, {}, common);
+  return ok;
 }
 
 }  // namespace
@@ -86,6 +467,15 @@ int main(int argc, char* argv[]) {
         << "    --output OUTPUT_FILE \\" << std::endl
         << std::endl
 
+        // Generate the headers listed in a manifest from one parse.
+        << "    [--batch MANIFEST_FILE]" << std::endl
+        << std::endl
+
+        // Generate the headers of a directory on multiple threads.
+        << "    [--input_dir INPUT_DIR --output_dir OUTPUT_DIR]" << std::endl
+        << "    [--jobs N]" << std::endl
+        << std::endl
+
         // Print the version and exit.
         << "    [--version]" << std::endl
         << std::endl;
@@ -96,6 +486,19 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
+  if (!FLAGS_batch.empty() || !FLAGS_input_dir.empty()) {
+    LOG_IF(ERROR, !FLAGS_input_dir.empty() && FLAGS_output_dir.empty())
+        << "Must specify the path to an output directory.";
+    auto success{FLAGS_batch.empty()
+                     ? !FLAGS_output_dir.empty() &&
+                           GenerateDir(FLAGS_input_dir, FLAGS_output_dir,
+                                       std::max(FLAGS_jobs, 1U))
+                     : GenerateBatch(FLAGS_batch)};
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   LOG_IF(ERROR, FLAGS_input.empty())
       << "Must specify the path to an input header file.";
 
@@ -107,25 +510,17 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  std::error_code ec;
-  llvm::raw_fd_ostream output(FLAGS_output, ec, llvm::sys::fs::F_Text);
-  CHECK(!ec) << "Failed to create output file: " << ec.message();
   // Read a CXX AST from our input file
-  auto cxx_ast_unit =
-      clang::tooling::buildASTFromCode(ReadFile(FLAGS_input), FLAGS_input);
+  auto cxx_ast_unit{
+      ParseHeaders({{FLAGS_input, FLAGS_output}}, /*record_includes=*/false)};
   // Exit if AST generation has failed
   if (cxx_ast_unit->getDiagnostics().hasErrorOccurred()) {
     return EXIT_FAILURE;
   }
-  // Run our visitor on the CXX AST
-  clang::CompilerInstance c_ins;
-  rellic::InitCompilerInstance(c_ins);
-  auto& c_ast_ctx = c_ins.getASTContext();
-  rellic::CXXToCDeclVisitor visitor(c_ast_ctx);
-  // cxx_ast_unit->getASTContext().getTranslationUnitDecl()->dump();
-  visitor.TraverseDecl(cxx_ast_unit->getASTContext().getTranslationUnitDecl());
-  // Print output
-  c_ast_ctx.getTranslationUnitDecl()->print(output);
+  // Run our visitor on the CXX AST and print the output
+  if (!GenerateHeader(*cxx_ast_unit, nullptr, FLAGS_output)) {
+    return EXIT_FAILURE;
+  }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "rellic/AST/OutputFile.h"
+#include "rellic/AST/Shard.h"
+#include "rellic/Version/Version.h"
+
+DEFINE_string(output, "", "Output C file.");
+
+namespace {
+
+// Reads the outputs of `rellic-decomp --shard` in `paths`
+static bool ReadShards(const std::vector<std::string>& paths,
+                       std::vector<rellic::ShardOutput>& shards) {
+  for (auto& path : paths) {
+    auto buf{llvm::MemoryBuffer::getFile(path)};
+    if (!buf) {
+      LOG(ERROR) << "Failed to read " << path << ": "
+                 << buf.getError().message();
+      return false;
+    }
+    std::string error;
+    shards.emplace_back();
+    if (!rellic::ParseShardOutput(buf.get()->getBuffer(), shards.back(),
+                                  error)) {
+      LOG(ERROR) << path << " is not a shard: " << error;
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --output OUTPUT_C_FILE \\" << std::endl
+        << "    SHARD_C_FILE..." << std::endl
+        << std::endl
+        << "  Combines the outputs of all runs of rellic-decomp --shard I/N "
+           "on the same input into one C file."
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::SetVersionString(rellic::Version::GetVersionString());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(ERROR, FLAGS_output.empty())
+      << "Must specify the path to an output C file.";
+  LOG_IF(ERROR, argc < 2) << "Must specify the shards to merge.";
+  if (FLAGS_output.empty() || argc < 2) {
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::string> paths(argv + 1, argv + argc);
+  std::vector<rellic::ShardOutput> shards;
+  if (!ReadShards(paths, shards)) {
+    return EXIT_FAILURE;
+  }
+
+  std::error_code ec;
+  rellic::OutputFile output(FLAGS_output, ec);
+  if (ec) {
+    LOG(ERROR) << "Failed to create output file " << FLAGS_output << ": "
+               << ec.message();
+    return EXIT_FAILURE;
+  }
+  std::string error;
+  if (!rellic::MergeShardOutputs(shards, output, error)) {
+    LOG(ERROR) << "Failed to merge shards: " << error;
+    return EXIT_FAILURE;
+  }
+  if (!output.Close()) {
+    LOG(ERROR) << "Failed to write output file " << FLAGS_output;
+    return EXIT_FAILURE;
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}